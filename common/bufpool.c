@@ -0,0 +1,214 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "bufpool.h"
+
+typedef struct {
+	uint8_t* mem;
+	uint32_t block_size;
+	uint32_t nb_blocks;
+	/* Owner of each block, NULL if free */
+	thread_t** owner;
+	/* Number of blocks of the buffer starting at this block, 0 otherwise */
+	uint8_t* run;
+	uint32_t nb_free;
+	uint32_t min_free;
+	uint32_t nb_fail;
+} bufpool_t;
+
+static uint8_t bufpool_dma_mem[BUFPOOL_DMA_NB_BLOCK * BUFPOOL_DMA_BLOCK_SIZE] __attribute__ ((aligned (4)));
+static thread_t* bufpool_dma_owner[BUFPOOL_DMA_NB_BLOCK];
+static uint8_t bufpool_dma_run[BUFPOOL_DMA_NB_BLOCK];
+
+static uint8_t bufpool_ccm_mem[BUFPOOL_CCM_NB_BLOCK * BUFPOOL_CCM_BLOCK_SIZE] CCM_SECTION __attribute__ ((aligned (4)));
+static thread_t* bufpool_ccm_owner[BUFPOOL_CCM_NB_BLOCK];
+static uint8_t bufpool_ccm_run[BUFPOOL_CCM_NB_BLOCK];
+
+static bufpool_t bufpool[BUFPOOL_NB_REGION] = {
+	{
+		bufpool_dma_mem, BUFPOOL_DMA_BLOCK_SIZE, BUFPOOL_DMA_NB_BLOCK,
+		bufpool_dma_owner, bufpool_dma_run,
+		BUFPOOL_DMA_NB_BLOCK, BUFPOOL_DMA_NB_BLOCK, 0
+	},
+	{
+		bufpool_ccm_mem, BUFPOOL_CCM_BLOCK_SIZE, BUFPOOL_CCM_NB_BLOCK,
+		bufpool_ccm_owner, bufpool_ccm_run,
+		BUFPOOL_CCM_NB_BLOCK, BUFPOOL_CCM_NB_BLOCK, 0
+	}
+};
+
+/* One lock for both pools, held only to scan/update the block tables */
+static mutex_t bufpool_mtx;
+static condition_variable_t bufpool_cond;
+
+void bufpool_init(void)
+{
+	chMtxObjectInit(&bufpool_mtx);
+	chCondObjectInit(&bufpool_cond);
+}
+
+/* Return first block of nb free contiguous blocks or -1 */
+static int bufpool_find(bufpool_t* pool, uint32_t nb)
+{
+	uint32_t i, len;
+
+	len = 0;
+	for(i = 0; i < pool->nb_blocks; i++) {
+		if(pool->owner[i] != NULL) {
+			len = 0;
+			continue;
+		}
+		if(++len == nb)
+			return i + 1 - nb;
+	}
+	return -1;
+}
+
+/* Return pool and first block of buffer p (must be locked) */
+static bufpool_t* bufpool_lookup(const void* p, uint32_t* block)
+{
+	bufpool_t* pool;
+	uint32_t offset;
+	int i;
+
+	for(i = 0; i < BUFPOOL_NB_REGION; i++) {
+		pool = &bufpool[i];
+		offset = (const uint8_t*)p - pool->mem;
+		if(offset >= (pool->block_size * pool->nb_blocks))
+			continue;
+		if( (offset % pool->block_size) != 0 )
+			return NULL;
+		*block = offset / pool->block_size;
+		if(pool->run[*block] == 0)
+			return NULL;
+		return pool;
+	}
+	return NULL;
+}
+
+void* bufpool_alloc(bufpool_region_t region, uint32_t size, systime_t timeout)
+{
+	bufpool_t* pool;
+	uint32_t nb, i;
+	int first;
+
+	if(region >= BUFPOOL_NB_REGION)
+		return NULL;
+	pool = &bufpool[region];
+	nb = (size + pool->block_size - 1) / pool->block_size;
+	if( (nb == 0) || (nb > pool->nb_blocks) )
+		return NULL;
+
+	chMtxLock(&bufpool_mtx);
+	while((first = bufpool_find(pool, nb)) < 0) {
+		if(timeout == TIME_IMMEDIATE) {
+			pool->nb_fail++;
+			chMtxUnlock(&bufpool_mtx);
+			return NULL;
+		}
+		if(chCondWaitTimeout(&bufpool_cond, timeout) == MSG_TIMEOUT) {
+			/* Mutex is not re-acquired on timeout */
+			chMtxLock(&bufpool_mtx);
+			pool->nb_fail++;
+			chMtxUnlock(&bufpool_mtx);
+			return NULL;
+		}
+	}
+
+	for(i = first; i < (first + nb); i++)
+		pool->owner[i] = chThdGetSelfX();
+	pool->run[first] = nb;
+	pool->nb_free -= nb;
+	if(pool->nb_free < pool->min_free)
+		pool->min_free = pool->nb_free;
+	chMtxUnlock(&bufpool_mtx);
+
+	return &pool->mem[first * pool->block_size];
+}
+
+static int bufpool_set_owner(void* p, thread_t* tp)
+{
+	bufpool_t* pool;
+	uint32_t block, i, nb;
+
+	chMtxLock(&bufpool_mtx);
+	pool = bufpool_lookup(p, &block);
+	if(pool == NULL) {
+		chMtxUnlock(&bufpool_mtx);
+		return -1;
+	}
+	if(pool->owner[block] != chThdGetSelfX()) {
+		chMtxUnlock(&bufpool_mtx);
+		return -2;
+	}
+
+	nb = pool->run[block];
+	for(i = block; i < (block + nb); i++)
+		pool->owner[i] = tp;
+	if(tp == NULL) {
+		pool->run[block] = 0;
+		pool->nb_free += nb;
+		chCondBroadcast(&bufpool_cond);
+	}
+	chMtxUnlock(&bufpool_mtx);
+	return 0;
+}
+
+int bufpool_free(void* p)
+{
+	return bufpool_set_owner(p, NULL);
+}
+
+int bufpool_handoff(void* p, thread_t* tp)
+{
+	if(tp == NULL)
+		return -2;
+	return bufpool_set_owner(p, tp);
+}
+
+bool bufpool_is_buffer(const void* p)
+{
+	return (bufpool_size(p) != 0);
+}
+
+uint32_t bufpool_size(const void* p)
+{
+	bufpool_t* pool;
+	uint32_t block, size;
+
+	size = 0;
+	chMtxLock(&bufpool_mtx);
+	pool = bufpool_lookup(p, &block);
+	if(pool != NULL)
+		size = pool->run[block] * pool->block_size;
+	chMtxUnlock(&bufpool_mtx);
+	return size;
+}
+
+void bufpool_status(bufpool_region_t region, uint32_t* nb_free,
+		    uint32_t* min_free, uint32_t* nb_fail)
+{
+	bufpool_t* pool;
+
+	pool = &bufpool[region];
+	chMtxLock(&bufpool_mtx);
+	*nb_free = pool->nb_free;
+	*min_free = pool->min_free;
+	*nb_fail = pool->nb_fail;
+	chMtxUnlock(&bufpool_mtx);
+}
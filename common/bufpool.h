@@ -0,0 +1,77 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _BUFPOOL_H_
+#define _BUFPOOL_H_
+
+#include "common.h"
+
+/*
+ * Fixed-block buffer pools, one per memory region.
+ * A buffer is a run of contiguous blocks owned by one thread at a time,
+ * ownership can be handed off (producer -> consumer) and only the owner
+ * can free it. Thread context only (not usable from ISR).
+ */
+
+typedef enum {
+	/* Main SRAM, reachable by the DMA controllers (SDIO, SPI, USB OTG) */
+	BUFPOOL_DMA = 0,
+	/* CCM (core coupled 64KB), CPU only, never give it to a DMA */
+	BUFPOOL_CCM,
+	BUFPOOL_NB_REGION
+} bufpool_region_t;
+
+/* DMA pool holds one NB_SBUFFER capture buffer plus unaligned test slack */
+#define BUFPOOL_DMA_BLOCK_SIZE (4096)
+#define BUFPOOL_DMA_NB_BLOCK (17)
+
+#define BUFPOOL_CCM_BLOCK_SIZE (1024)
+#define BUFPOOL_CCM_NB_BLOCK (16)
+
+/* Largest capture buffer which can be borrowed from the DMA pool */
+#define BUFPOOL_DMA_MAX_SIZE (BUFPOOL_DMA_BLOCK_SIZE * BUFPOOL_DMA_NB_BLOCK)
+
+/* CCM is not on the DMA bus matrix */
+#define BUFPOOL_CCM_BASE (0x10000000UL)
+#define BUFPOOL_CCM_SIZE (0x10000UL)
+#define bufpool_is_dma_capable(p) \
+	( ((uint32_t)(p) - BUFPOOL_CCM_BASE) >= BUFPOOL_CCM_SIZE )
+
+void bufpool_init(void);
+
+/*
+ * Borrow size bytes (rounded up to whole blocks) from region, the calling
+ * thread becomes the owner. Wait up to timeout (each time a buffer is
+ * freed) for enough contiguous blocks.
+ * Return the buffer (4 bytes aligned) or NULL.
+ */
+void* bufpool_alloc(bufpool_region_t region, uint32_t size, systime_t timeout);
+
+/* Return 0 if freed, -1 if p is not a pool buffer, -2 if caller is not the owner */
+int bufpool_free(void* p);
+
+/* Give ownership to thread tp, same return values as bufpool_free() */
+int bufpool_handoff(void* p, thread_t* tp);
+
+/* Return TRUE if p is the start of a borrowed pool buffer */
+bool bufpool_is_buffer(const void* p);
+
+/* Size of a borrowed buffer (whole blocks) or 0 */
+uint32_t bufpool_size(const void* p);
+
+void bufpool_status(bufpool_region_t region, uint32_t* nb_free,
+		    uint32_t* min_free, uint32_t* nb_fail);
+
+#endif /* _BUFPOOL_H_ */
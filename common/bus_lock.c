@@ -0,0 +1,119 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "bus_lock.h"
+
+typedef struct {
+	mutex_t mtx;
+	const void* owner; /* NULL if free */
+	const char* name;
+} bus_lock_t;
+
+static bus_lock_t bus_lock[BUS_LOCK_NB];
+
+static const char* const bus_lock_dev_name[BUS_LOCK_NB] = {
+	"HiZ", "SPI1", "SPI2", "UART1", "UART2", "I2C1"
+};
+
+void bus_lock_init(void)
+{
+	int i;
+
+	for(i = 0; i < BUS_LOCK_NB; i++) {
+		chMtxObjectInit(&bus_lock[i].mtx);
+		bus_lock[i].owner = NULL;
+		bus_lock[i].name = NULL;
+	}
+}
+
+bool bus_lock_acquire(bus_lock_dev_t dev, const void* owner, const char* name)
+{
+	bus_lock_t* b;
+	bool res;
+
+	if( (dev == BUS_LOCK_NONE) || (dev >= BUS_LOCK_NB) )
+		return TRUE;
+
+	b = &bus_lock[dev];
+	chMtxLock(&b->mtx);
+	if( (b->owner == NULL) || (b->owner == owner) ) {
+		b->owner = owner;
+		b->name = name;
+		res = TRUE;
+	} else {
+		res = FALSE;
+	}
+	chMtxUnlock(&b->mtx);
+	return res;
+}
+
+void bus_lock_release(bus_lock_dev_t dev, const void* owner)
+{
+	bus_lock_t* b;
+
+	if( (dev == BUS_LOCK_NONE) || (dev >= BUS_LOCK_NB) )
+		return;
+
+	b = &bus_lock[dev];
+	chMtxLock(&b->mtx);
+	if(b->owner == owner) {
+		b->owner = NULL;
+		b->name = NULL;
+	}
+	chMtxUnlock(&b->mtx);
+}
+
+const char* bus_lock_owner(bus_lock_dev_t dev)
+{
+	bus_lock_t* b;
+	const char* name;
+
+	if( (dev == BUS_LOCK_NONE) || (dev >= BUS_LOCK_NB) )
+		return NULL;
+
+	b = &bus_lock[dev];
+	chMtxLock(&b->mtx);
+	name = (b->owner != NULL) ? b->name : NULL;
+	chMtxUnlock(&b->mtx);
+	return name;
+}
+
+void bus_lock_print_busy(t_hydra_console *con, bus_lock_dev_t dev)
+{
+	const char* name;
+
+	name = bus_lock_owner(dev);
+	cprintf(con, "%s busy, used by %s\r\n", bus_lock_dev_name[dev],
+		(name != NULL) ? name : "?");
+}
+
+/* bus: owner of each peripheral */
+void cmd_bus(t_hydra_console *con, int argc, const char* const* argv)
+{
+	const char* name;
+	int i;
+
+	(void)argc;
+	(void)argv;
+
+	for(i = BUS_LOCK_NONE + 1; i < BUS_LOCK_NB; i++) {
+		name = bus_lock_owner(i);
+		cprintf(con, "%s: %s\r\n", bus_lock_dev_name[i],
+			(name != NULL) ? name : "free");
+	}
+}
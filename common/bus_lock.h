@@ -0,0 +1,57 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _BUS_LOCK_H_
+#define _BUS_LOCK_H_
+
+#include "common.h"
+
+/*
+ * Ownership of the shared peripherals (bsp devices) between the consoles
+ * and the services (buslog, hydranfc).
+ * A console owns the peripheral of its mode from the mode setup to the
+ * mode cleanup, the bsp driver state of a peripheral is only used by its
+ * owner. Each peripheral owner is protected by its own mutex.
+ */
+typedef enum {
+	BUS_LOCK_NONE = 0, /* HiZ, nothing to own */
+	BUS_LOCK_SPI1,
+	BUS_LOCK_SPI2,
+	BUS_LOCK_UART1,
+	BUS_LOCK_UART2,
+	BUS_LOCK_I2C1,
+	BUS_LOCK_NB
+} bus_lock_dev_t;
+
+void bus_lock_init(void);
+
+/*
+ * Take dev for owner (any unique pointer, e.g. the console), name is used
+ * in busy messages. Return TRUE if dev is free or already owned by owner.
+ */
+bool bus_lock_acquire(bus_lock_dev_t dev, const void* owner, const char* name);
+
+/* Release dev if owned by owner */
+void bus_lock_release(bus_lock_dev_t dev, const void* owner);
+
+/* Owner name, NULL if dev is free */
+const char* bus_lock_owner(bus_lock_dev_t dev);
+
+/* "<dev> busy, used by <owner>\r\n" */
+void bus_lock_print_busy(t_hydra_console *con, bus_lock_dev_t dev);
+
+void cmd_bus(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _BUS_LOCK_H_ */
@@ -0,0 +1,447 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <string.h>
+#include <stdio.h> /* sprintf */
+#include <stdlib.h> /* strtoul */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "microsd.h"
+#include "storage.h"
+#include "bufpool.h"
+#include "buslog.h"
+#include "bsp_uart.h"
+#include "bus_lock.h"
+
+#define BUSLOG_RING_MASK (BUSLOG_RING_NB - 1)
+
+/* RX bytes per text line max */
+#define BUSLOG_LINE_BYTES (32)
+/* "ssssssssss.uuuuuu U1" + " XX" per byte + " OVR DROP" + "\r\n" */
+#define BUSLOG_LINE_MAX (20 + (BUSLOG_LINE_BYTES * 3) + 9 + 2)
+
+/* Fast interrupt above the kernel level, the RX callback only touches the ring */
+#define BUSLOG_IRQ_PRIORITY (CORTEX_MAX_KERNEL_PRIORITY - 1)
+
+/* Free running 32bits 1MHz timestamp counter (wraps every 71 minutes) */
+#define BUSLOG_TIMER STM32_TIM5
+
+#define BUSLOG_FLAG_OVERRUN (1 << 0) /* USART overrun before this byte */
+#define BUSLOG_FLAG_DROP (1 << 1) /* Ring full before this byte */
+
+typedef struct {
+	uint32_t ts_us;
+	uint8_t dev;
+	uint8_t data;
+	uint8_t flags;
+	uint8_t pad;
+} buslog_rec_t;
+
+/* Single producer (USART IRQ) single consumer (logger thread) ring */
+static buslog_rec_t buslog_ring[BUSLOG_RING_NB] CCM_SECTION;
+static volatile uint32_t buslog_head; /* Written by the IRQ only */
+static volatile uint32_t buslog_tail; /* Written by the logger thread only */
+static volatile uint32_t buslog_nb_drop;
+static volatile bool buslog_drop_pending;
+
+typedef struct {
+	uint64_t first_us;
+	uint64_t last_us;
+	uint8_t dev;
+	uint8_t flags;
+	uint32_t nb;
+	uint8_t data[BUSLOG_LINE_BYTES];
+} buslog_line_t;
+
+static thread_t* buslog_thread = NULL;
+static THD_WORKING_AREA(waBuslog, BUSLOG_WA_SIZE);
+static mode_config_proto_t buslog_proto;
+static bsp_dev_uart_t buslog_dev;
+/* Owner of the logged UART */
+static const char buslog_owner[] = "buslog";
+static uint32_t buslog_gap_us;
+static uint32_t buslog_file_max;
+
+/* Logger thread state */
+static buslog_line_t buslog_line;
+static uint32_t buslog_time_hi;
+static uint32_t buslog_last_now;
+static uint8_t* buslog_batch;
+static uint32_t buslog_batch_len;
+static systime_t buslog_batch_start;
+
+/* File names are used by the storage worker until the appends are done */
+static filename_t buslog_filename[2];
+static int buslog_file_idx;
+static uint32_t buslog_file_size;
+static uint32_t buslog_nb_files;
+
+/* Statistics */
+static uint32_t buslog_nb_rx;
+static uint32_t buslog_nb_overrun;
+static uint32_t buslog_nb_bytes;
+static uint32_t buslog_nb_batch_lost;
+static volatile uint32_t buslog_nb_write_err;
+
+static const char buslog_htoa[16] = "0123456789ABCDEF";
+
+/* Called from USART IRQ */
+static void buslog_rx_cb(bsp_dev_uart_t dev_num, uint8_t data, bool overrun)
+{
+	buslog_rec_t* rec;
+	uint32_t head;
+
+	head = buslog_head;
+	if((head - buslog_tail) >= BUSLOG_RING_NB) {
+		buslog_nb_drop++;
+		buslog_drop_pending = TRUE;
+		return;
+	}
+
+	rec = &buslog_ring[head & BUSLOG_RING_MASK];
+	rec->ts_us = BUSLOG_TIMER->CNT;
+	rec->dev = dev_num;
+	rec->data = data;
+	rec->flags = overrun ? BUSLOG_FLAG_OVERRUN : 0;
+	if(buslog_drop_pending) {
+		rec->flags |= BUSLOG_FLAG_DROP;
+		buslog_drop_pending = FALSE;
+	}
+	/* Record shall be written before it is published */
+	__DMB();
+	buslog_head = head + 1;
+}
+
+static void buslog_timer_start(void)
+{
+	rccEnableTIM5(FALSE);
+	rccResetTIM5();
+	BUSLOG_TIMER->PSC = (STM32_TIMCLK1 / 1000000) - 1;
+	BUSLOG_TIMER->ARR = 0xFFFFFFFF;
+	BUSLOG_TIMER->CNT = 0;
+	BUSLOG_TIMER->EGR = STM32_TIM_EGR_UG;
+	BUSLOG_TIMER->CR1 = STM32_TIM_CR1_CEN;
+}
+
+static void buslog_timer_stop(void)
+{
+	BUSLOG_TIMER->CR1 = 0;
+	rccDisableTIM5(FALSE);
+}
+
+/* Called by the storage worker when a batch is written */
+static void buslog_write_done(int result, void* cb_arg)
+{
+	if(result < 0)
+		buslog_nb_write_err++;
+	bufpool_free(cb_arg);
+}
+
+/* Give the current batch to the storage worker, start a new file if needed */
+static void buslog_flush(void)
+{
+	uint32_t len;
+
+	len = buslog_batch_len;
+	if( (buslog_batch == NULL) || (len == 0) )
+		return;
+	buslog_batch_len = 0;
+
+	if( (buslog_nb_files == 0) || ((buslog_file_size + len) > buslog_file_max) ) {
+		/* Previous name can still be referenced by queued appends */
+		buslog_file_idx ^= 1;
+		if(sd_next_filename("buslog", &buslog_filename[buslog_file_idx]) < 0) {
+			buslog_nb_batch_lost++;
+			return;
+		}
+		buslog_file_size = 0;
+		buslog_nb_files++;
+	}
+
+	if(storage_append_async(buslog_filename[buslog_file_idx].filename,
+				buslog_batch, len, buslog_write_done, buslog_batch) < 0) {
+		/* Not queued, batch buffer is still owned by this thread */
+		buslog_nb_batch_lost++;
+		return;
+	}
+	buslog_batch = NULL;
+	buslog_file_size += len;
+	buslog_nb_bytes += len;
+}
+
+/* Return TRUE if the current batch has room for one more line */
+static bool buslog_batch_ready(void)
+{
+	if( (buslog_batch != NULL) &&
+	    ((buslog_batch_len + BUSLOG_LINE_MAX) > BUSLOG_BATCH_SIZE) )
+		buslog_flush();
+
+	if(buslog_batch == NULL) {
+		/* Ring keeps the data until a batch is free again */
+		buslog_batch = bufpool_alloc(BUFPOOL_DMA, BUSLOG_BATCH_SIZE, TIME_IMMEDIATE);
+		if(buslog_batch == NULL)
+			return FALSE;
+		buslog_batch_len = 0;
+	}
+	return TRUE;
+}
+
+static void buslog_line_end(void)
+{
+	buslog_line_t* line;
+	char* p;
+	uint32_t i, sec, usec;
+	int len;
+
+	line = &buslog_line;
+	if(line->nb == 0)
+		return;
+
+	if(buslog_batch_len == 0)
+		buslog_batch_start = chVTGetSystemTime();
+
+	p = (char*)&buslog_batch[buslog_batch_len];
+	sec = line->first_us / 1000000;
+	usec = line->first_us % 1000000;
+	len = sprintf(p, "%lu.%06lu U%d", sec, usec, line->dev + 1);
+	for(i = 0; i < line->nb; i++) {
+		p[len++] = ' ';
+		p[len++] = buslog_htoa[line->data[i] >> 4];
+		p[len++] = buslog_htoa[line->data[i] & 0x0F];
+	}
+	if(line->flags & BUSLOG_FLAG_OVERRUN) {
+		memcpy(&p[len], " OVR", 4);
+		len += 4;
+	}
+	if(line->flags & BUSLOG_FLAG_DROP) {
+		memcpy(&p[len], " DROP", 5);
+		len += 5;
+	}
+	p[len++] = '\r';
+	p[len++] = '\n';
+	buslog_batch_len += len;
+
+	line->nb = 0;
+	line->flags = 0;
+}
+
+static void buslog_add(const buslog_rec_t* rec, uint64_t t_us)
+{
+	buslog_line_t* line;
+
+	line = &buslog_line;
+	if( (line->nb > 0) &&
+	    ((line->dev != rec->dev) || (line->nb == BUSLOG_LINE_BYTES) ||
+	     ((t_us - line->last_us) > buslog_gap_us)) )
+		buslog_line_end();
+
+	if(line->nb == 0) {
+		line->first_us = t_us;
+		line->dev = rec->dev;
+	}
+	line->data[line->nb++] = rec->data;
+	line->flags |= rec->flags;
+	line->last_us = t_us;
+
+	buslog_nb_rx++;
+	if(rec->flags & BUSLOG_FLAG_OVERRUN)
+		buslog_nb_overrun++;
+}
+
+static void buslog_drain(void)
+{
+	const buslog_rec_t* rec;
+	uint32_t head, tail, now, hi;
+	uint64_t now_us;
+
+	/* Records up to head were all timestamped before now */
+	head = buslog_head;
+	__DMB();
+	now = BUSLOG_TIMER->CNT;
+	if(now < buslog_last_now)
+		buslog_time_hi++;
+	buslog_last_now = now;
+
+	tail = buslog_tail;
+	while(tail != head) {
+		if(!buslog_batch_ready())
+			break;
+		rec = &buslog_ring[tail & BUSLOG_RING_MASK];
+		/* Timestamp after now means before the counter wrap */
+		hi = (rec->ts_us > now) ? (buslog_time_hi - 1) : buslog_time_hi;
+		buslog_add(rec, ((uint64_t)hi << 32) | rec->ts_us);
+		tail++;
+		buslog_tail = tail;
+	}
+
+	/* Line is complete when the bus is idle for more than gap */
+	now_us = ((uint64_t)buslog_time_hi << 32) | now;
+	if( (buslog_line.nb > 0) && ((now_us - buslog_line.last_us) > buslog_gap_us) &&
+	    buslog_batch_ready() )
+		buslog_line_end();
+
+	if( (buslog_batch_len > 0) &&
+	    (chVTTimeElapsedSinceX(buslog_batch_start) >= MS2ST(BUSLOG_FLUSH_MS)) )
+		buslog_flush();
+}
+
+static THD_FUNCTION(buslog_thd, arg)
+{
+	(void)arg;
+	chRegSetThreadName("buslog");
+
+	while(!chThdShouldTerminateX()) {
+		chThdSleepMilliseconds(BUSLOG_POLL_MS);
+		buslog_drain();
+	}
+
+	/* RX IRQ is stopped, write everything left */
+	buslog_drain();
+	if(buslog_batch_ready())
+		buslog_line_end();
+	buslog_flush();
+	if(buslog_batch != NULL) {
+		bufpool_free(buslog_batch);
+		buslog_batch = NULL;
+	}
+	return 0;
+}
+
+static void buslog_status(t_hydra_console *con)
+{
+	if(buslog_thread != NULL)
+		cprintf(con, "buslog running on UART%d, file %s (%ld bytes)\r\n",
+			buslog_dev + 1,
+			(buslog_nb_files > 0) ? &buslog_filename[buslog_file_idx].filename[2] : "none",
+			buslog_file_size);
+	else
+		cprintf(con, "buslog stopped\r\n");
+	cprintf(con, "rx bytes: %ld, overrun: %ld, ring drop: %ld\r\n",
+		buslog_nb_rx, buslog_nb_overrun, buslog_nb_drop);
+	cprintf(con, "files: %ld, written: %ld bytes, batch lost: %ld, write errors: %ld\r\n",
+		buslog_nb_files, buslog_nb_bytes, buslog_nb_batch_lost, buslog_nb_write_err);
+}
+
+static void buslog_stop(t_hydra_console *con)
+{
+	if(buslog_thread == NULL) {
+		cprintf(con, "buslog not running\r\n");
+		return;
+	}
+
+	bsp_uart_rx_irq_stop(buslog_dev);
+	chThdTerminate(buslog_thread);
+	chThdWait(buslog_thread);
+	buslog_thread = NULL;
+	buslog_timer_stop();
+	bsp_uart_deinit(buslog_dev);
+	bus_lock_release(BUS_LOCK_UART1 + buslog_dev, buslog_owner);
+
+	buslog_status(con);
+}
+
+static void buslog_start(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint32_t baudrate;
+	int i;
+
+	if(buslog_thread != NULL) {
+		cprintf(con, "buslog already running\r\n");
+		return;
+	}
+
+	buslog_dev = (strcmp(argv[1], "uart1") == 0) ? BSP_DEV_UART1 : BSP_DEV_UART2;
+	baudrate = 115200;
+	buslog_gap_us = BUSLOG_DEFAULT_GAP_US;
+	buslog_file_max = BUSLOG_DEFAULT_FILE_MB;
+	for(i = 2; (i + 1) < argc; i += 2) {
+		if(strcmp(argv[i], "speed") == 0)
+			baudrate = strtoul(argv[i + 1], NULL, 0);
+		else if(strcmp(argv[i], "gap") == 0)
+			buslog_gap_us = strtoul(argv[i + 1], NULL, 0);
+		else if(strcmp(argv[i], "size") == 0)
+			buslog_file_max = strtoul(argv[i + 1], NULL, 0);
+	}
+	if( (baudrate < 300) || (buslog_file_max == 0) ) {
+		cprintf(con, "Invalid speed or size\r\n");
+		return;
+	}
+	/* Min 1MB so at most 2 files are referenced by queued appends */
+	buslog_file_max *= 1024 * 1024;
+
+	/* 8N1, dev_speed above the speed table index is baudrate - 1 */
+	memset(&buslog_proto, 0, sizeof(buslog_proto));
+	buslog_proto.dev_num = buslog_dev;
+	buslog_proto.dev_speed = baudrate - 1;
+	/* Not while a console is in UART mode on it (and the reverse) */
+	if(bus_lock_acquire(BUS_LOCK_UART1 + buslog_dev, buslog_owner, buslog_owner) == FALSE) {
+		bus_lock_print_busy(con, BUS_LOCK_UART1 + buslog_dev);
+		return;
+	}
+	if(bsp_uart_init(buslog_dev, &buslog_proto) != BSP_OK) {
+		bus_lock_release(BUS_LOCK_UART1 + buslog_dev, buslog_owner);
+		cprintf(con, "bsp_uart_init() error\r\n");
+		return;
+	}
+
+	buslog_head = 0;
+	buslog_tail = 0;
+	buslog_nb_drop = 0;
+	buslog_drop_pending = FALSE;
+	memset(&buslog_line, 0, sizeof(buslog_line));
+	buslog_time_hi = 0;
+	buslog_last_now = 0;
+	buslog_batch = NULL;
+	buslog_batch_len = 0;
+	buslog_file_size = 0;
+	buslog_nb_files = 0;
+	buslog_nb_rx = 0;
+	buslog_nb_overrun = 0;
+	buslog_nb_bytes = 0;
+	buslog_nb_batch_lost = 0;
+	buslog_nb_write_err = 0;
+
+	buslog_timer_start();
+	buslog_thread = chThdCreateStatic(waBuslog, sizeof(waBuslog),
+					  NORMALPRIO + 1, buslog_thd, NULL);
+	bsp_uart_rx_irq_start(buslog_dev, buslog_rx_cb, BUSLOG_IRQ_PRIORITY);
+
+	cprintf(con, "buslog UART%d %ld bauds 8N1, gap %ld us, %ld MB per file\r\n",
+		buslog_dev + 1, baudrate, buslog_gap_us, buslog_file_max / (1024 * 1024));
+}
+
+/*
+ * buslog                                   status
+ * buslog uart1|uart2 [speed <baud>] [gap <us>] [size <MB>]   start
+ * buslog stop
+ */
+void cmd_buslog(t_hydra_console *con, int argc, const char* const* argv)
+{
+	if(argc < 2) {
+		buslog_status(con);
+		return;
+	}
+
+	if(strcmp(argv[1], "stop") == 0) {
+		buslog_stop(con);
+	} else if( (strcmp(argv[1], "uart1") == 0) || (strcmp(argv[1], "uart2") == 0) ) {
+		buslog_start(con, argc, argv);
+	} else {
+		cprintf(con, "usage: %s [uart1|uart2 [speed <baud>] [gap <us>] [size <MB>]] | [stop]\r\n",
+			argv[0]);
+	}
+}
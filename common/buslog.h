@@ -0,0 +1,45 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _BUSLOG_H_
+#define _BUSLOG_H_
+
+#include "common.h"
+
+/*
+ * Bus traffic logger, UART RX bytes are timestamped (1us) in the USART IRQ
+ * and pushed in a lock-free single producer/single consumer ring.
+ * The logger thread formats them in text lines, batches of BUSLOG_BATCH_SIZE
+ * are appended to buslog_<n>.txt by the storage worker, a new file is
+ * started when the size limit is reached.
+ */
+
+/* Ring entries (power of 2), 8 bytes each in CCM */
+#define BUSLOG_RING_NB (2048)
+/* SD write batch borrowed from the DMA pool */
+#define BUSLOG_BATCH_SIZE (16384)
+#define BUSLOG_WA_SIZE (2048)
+
+/* Ring polling period and max time before a partial batch is written */
+#define BUSLOG_POLL_MS (5)
+#define BUSLOG_FLUSH_MS (1000)
+
+/* Defaults: new line after 1ms without RX byte, 64MB per file */
+#define BUSLOG_DEFAULT_GAP_US (1000)
+#define BUSLOG_DEFAULT_FILE_MB (64)
+
+void cmd_buslog(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _BUSLOG_H_ */
@@ -12,7 +12,11 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include <string.h> /* memcpy, strcmp */
+
 #include "common.h"
+#include "bufpool.h"
+#include "memstreams.h"
 
 #include "hydrabus.h"
 #include "hydrafw_version.hdr"
@@ -26,13 +30,6 @@ limitations under the License.
 
 #define TEST_WA_SIZE    THD_WORKING_AREA_SIZE(256)
 
-uint8_t buf[512] __attribute__ ((section(".ccm")));
-/* Generic large buffer.*/
-uint8_t fbuff[2048] __attribute__ ((section(".ccm")));
-
-uint32_t g_sbuf_idx;
-uint8_t g_sbuf[NB_SBUFFER+128] __attribute__ ((aligned (4)));
-
 /* USB1: Virtual serial port over USB.*/
 SerialUSBDriver SDU1;
 /* USB2: Virtual serial port over USB.*/
@@ -73,18 +70,223 @@ void DelayUs(uint32_t delay_us)
 	osalSysPolledDelayX(US2RTC(STM32_HCLK, delay_us));
 }
 
+typedef struct {
+	const char* stage;
+	uint32_t cycles;
+} boot_mark_t;
+
+static boot_mark_t boot_timeline[BOOT_TIMELINE_MAX];
+static uint32_t boot_nb_mark;
+
+void boot_mark(const char* stage)
+{
+	uint32_t i;
+
+	chSysLock();
+	i = boot_nb_mark;
+	if(i < BOOT_TIMELINE_MAX) {
+		boot_timeline[i].stage = stage;
+		boot_timeline[i].cycles = get_cyclecounter();
+		boot_nb_mark++;
+	}
+	chSysUnlock();
+}
+
+/* boot: print the boot timeline */
+void cmd_boot(t_hydra_console *con, int argc, const char* const* argv)
+{
+	(void)argc;
+	(void)argv;
+	uint32_t i, us, prev_us;
+
+	cprintf(con, "      us    delta stage\r\n");
+	prev_us = 0;
+	for(i = 0; i < boot_nb_mark; i++) {
+		us = boot_timeline[i].cycles / (STM32_SYSCLK / 1000000);
+		cprintf(con, "%8ld %8ld %s\r\n", us, us - prev_us, boot_timeline[i].stage);
+		prev_us = us;
+	}
+}
+
+static const char* const console_policy_names[] = {
+	"block", "drop", "truncate", "defer"
+};
+
+bool console_is_aborted(t_hydra_console *con)
+{
+	if(con == NULL)
+		return USER_BUTTON;
+	if(con->abort_con != NULL)
+		con = con->abort_con;
+	if(USER_BUTTON)
+		con->abort = TRUE;
+	return con->abort;
+}
+
+bool console_is_usb(t_hydra_console *con)
+{
+	return (con->sdu == &SDU1) || (con->sdu == &SDU2);
+}
+
+uint32_t console_write(t_hydra_console *con, const uint8_t *data, uint32_t size)
+{
+	uint32_t free;
+
+	if( (con->out_policy == CONSOLE_OUT_BLOCK) || !console_is_usb(con) )
+		return chSequentialStreamWrite(con->bss, data, size);
+
+	if(con->out_policy == CONSOLE_OUT_DEFER) {
+		free = CONSOLE_OUT_DEFER_SIZE - con->out_defer_len;
+		if( (free < size) && (con->out_defer_prev == CONSOLE_OUT_BLOCK) ) {
+			/* Nothing may be lost, wait for the host this time */
+			console_flush(con);
+			if(size > CONSOLE_OUT_DEFER_SIZE)
+				return chSequentialStreamWrite(con->bss, data, size);
+			free = CONSOLE_OUT_DEFER_SIZE;
+		}
+	} else {
+		chSysLock();
+		free = chOQGetEmptyI(&con->sdu->oqueue);
+		chSysUnlock();
+	}
+
+	if(free < size) {
+		if( (con->out_policy == CONSOLE_OUT_DROP) || (free == 0) ) {
+			con->out_nb_drop++;
+			con->out_nb_lost += size;
+			return 0;
+		}
+		con->out_nb_trunc++;
+		con->out_nb_lost += size - free;
+		size = free;
+	}
+
+	if(con->out_policy == CONSOLE_OUT_DEFER) {
+		memcpy(&con->out_defer[con->out_defer_len], data, size);
+		con->out_defer_len += size;
+		return size;
+	}
+	/* Only this thread writes to the queue, size bytes fit without waiting */
+	return chnWriteTimeout(con->sdu, data, size, TIME_IMMEDIATE);
+}
+
+void console_vprintf(t_hydra_console *con, const char *fmt, va_list ap)
+{
+	MemoryStream ms;
+	uint8_t fmt_buf[CONSOLE_OUT_FMT_SIZE];
+	va_list ap_copy;
+	int len;
+
+	va_copy(ap_copy, ap);
+	msObjectInit(&ms, fmt_buf, sizeof(fmt_buf), 0);
+	len = chvprintf((BaseSequentialStream *)&ms, fmt, ap);
+	if( (uint32_t)len <= ms.eos ) {
+		console_write(con, fmt_buf, ms.eos);
+	} else if( (con->out_policy == CONSOLE_OUT_BLOCK) || !console_is_usb(con) ) {
+		/* Too long for the format buffer, formatted again straight to the stream */
+		chvprintf(con->bss, fmt, ap_copy);
+	} else if( (con->out_policy == CONSOLE_OUT_DEFER) &&
+		   (con->out_defer_prev == CONSOLE_OUT_BLOCK) ) {
+		console_flush(con);
+		chvprintf(con->bss, fmt, ap_copy);
+	} else {
+		console_write(con, fmt_buf, ms.eos);
+		con->out_nb_trunc++;
+		con->out_nb_lost += len - ms.eos;
+	}
+	va_end(ap_copy);
+}
+
+console_out_policy_t console_set_policy(t_hydra_console *con, console_out_policy_t policy)
+{
+	console_out_policy_t prev;
+	uint8_t *defer;
+
+	prev = con->out_policy;
+	if(policy == prev)
+		return prev;
+
+	if(policy == CONSOLE_OUT_DEFER) {
+		/* Nothing to defer on a redirected stream, it does not wait on USB */
+		if(!console_is_usb(con))
+			return prev;
+		/* Without buffer the output is not deferred, nothing is lost */
+		con->out_defer = bufpool_alloc(BUFPOOL_CCM, CONSOLE_OUT_DEFER_SIZE, TIME_IMMEDIATE);
+		if(con->out_defer == NULL)
+			return prev;
+		con->out_defer_len = 0;
+		con->out_defer_prev = prev;
+		con->out_policy = policy;
+		return prev;
+	}
+
+	con->out_policy = policy;
+	if(prev == CONSOLE_OUT_DEFER) {
+		defer = con->out_defer;
+		con->out_defer = NULL;
+		console_write(con, defer, con->out_defer_len);
+		con->out_defer_len = 0;
+		bufpool_free(defer);
+	}
+	return prev;
+}
+
+void console_flush(t_hydra_console *con)
+{
+	uint32_t len;
+
+	if( (con->out_policy != CONSOLE_OUT_DEFER) || (con->out_defer_len == 0) )
+		return;
+
+	len = con->out_defer_len;
+	con->out_defer_len = 0;
+	con->out_policy = con->out_defer_prev;
+	console_write(con, con->out_defer, len);
+	con->out_policy = CONSOLE_OUT_DEFER;
+}
+
+/* console [block|drop|truncate]: show output counters, set default policy */
+void cmd_console(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint32_t i;
+
+	if(argc > 1) {
+		for(i = 0; i < CONSOLE_OUT_DEFER; i++) {
+			if(strcmp(argv[1], console_policy_names[i]) == 0)
+				break;
+		}
+		if(i == CONSOLE_OUT_DEFER) {
+			cprintf(con, "usage: %s [block|drop|truncate]\r\n", argv[0]);
+			return;
+		}
+		console_set_policy(con, i);
+	}
+
+	cprintf(con, "%s: policy %s, %ld dropped, %ld truncated, %ld bytes lost\r\n",
+		con->thread_name, console_policy_names[con->out_policy],
+		con->out_nb_drop, con->out_nb_trunc, con->out_nb_lost);
+}
+
 void cmd_mem(t_hydra_console *con, int argc, const char* const* argv)
 {
 
 	(void)argc;
 	(void)argv;
 	size_t n, size;
+	uint32_t nb_free, min_free, nb_fail;
 
 	n = chHeapStatus(NULL, &size);
 	cprintf(con, "core free memory : %u bytes\r\n", chCoreStatus());
 	cprintf(con, "heap fragments   : %u\r\n", n);
 	cprintf(con, "heap free total  : %u bytes\r\n", size);
 
+	bufpool_status(BUFPOOL_DMA, &nb_free, &min_free, &nb_fail);
+	cprintf(con, "bufpool DMA      : %ld/%d blocks of %d bytes free (min %ld, %ld alloc failed)\r\n",
+		nb_free, BUFPOOL_DMA_NB_BLOCK, BUFPOOL_DMA_BLOCK_SIZE, min_free, nb_fail);
+	bufpool_status(BUFPOOL_CCM, &nb_free, &min_free, &nb_fail);
+	cprintf(con, "bufpool CCM      : %ld/%d blocks of %d bytes free (min %ld, %ld alloc failed)\r\n",
+		nb_free, BUFPOOL_CCM_NB_BLOCK, BUFPOOL_CCM_BLOCK_SIZE, min_free, nb_fail);
+
 }
 
 void cmd_threads(t_hydra_console *con, int argc, const char* const* argv)
@@ -197,12 +399,12 @@ void cmd_dbg(t_hydra_console *con, int argc, const char* const* argv)
 	cprintf(con, "50ns=%.2ld ticks\r\n", (uint32_t)ticks10MHz);
 	cprintf(con, "148ns=%.2ld ticks\r\n", (uint32_t)ticks3_39MHz);
 	cprintf(con, "500ns=%.2ld ticks\r\n", (uint32_t)tick1MHz);
-	cprintf(con, "Test dbg Out Freq Max 84Mhz(11.9ns),10MHz(100ns/2),3.39MHz(295ns/2),1MHz(1us/2)\r\nPress User Button to exit\r\n");
+	cprintf(con, "Test dbg Out Freq Max 84Mhz(11.9ns),10MHz(100ns/2),3.39MHz(295ns/2),1MHz(1us/2)\r\nCtrl-C or User Button to exit\r\n");
 	chThdSleepMilliseconds(1);
 
 	while(1) {
-		/* Exit if User Button is pressed */
-		if(USER_BUTTON) {
+		/* Exit on Ctrl-C or User Button */
+		if(console_is_aborted(con)) {
 			break;
 		}
 
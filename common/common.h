@@ -64,14 +64,19 @@ void scs_dwt_cycle_counter_enabled(void);
 void wait_nbcycles(uint32_t nbcycles);
 void DelayUs(uint32_t delay_us);
 
-extern uint8_t buf[512] __attribute__ ((section(".cmm")));
-/* Generic large buffer.*/
-extern uint8_t fbuff[2048] __attribute__ ((section(".cmm")));
+/*
+ * Boot timeline, DWT cycle counter is cleared at reset entry of main().
+ * stage shall be a static string.
+ */
+#define BOOT_TIMELINE_MAX (16)
+void boot_mark(const char* stage);
+
+/* CCM (64KB) is not reachable by DMA, only CPU buffers can be placed there */
+#define CCM_SECTION __attribute__ ((section(".ccm")))
 
+/* Large capture buffers are borrowed from the DMA pool (see bufpool.h) */
 #define NB_SBUFFER  (65536)
 #define G_SBUF_SDC_BURST_SIZE (NB_SBUFFER/MMCSD_BLOCK_SIZE) /* how many sectors reads at once */
-extern uint32_t g_sbuf_idx;
-extern uint8_t g_sbuf[NB_SBUFFER+128] __attribute__ ((aligned (4)));
 
 /* USB1: Virtual serial port over USB.*/
 extern SerialUSBDriver SDU1;
@@ -110,6 +115,37 @@ typedef struct {
 /* How much thread working area to allocate per console. */
 #define CONSOLE_WA_SIZE 2048
 
+/* Called from USB event callback when a CDC gets configured (ISR context) */
+void console_usb_configured_hookI(USBDriver *usbp);
+/*
+ * OUT endpoint callback of the CDC data endpoint (replaces sduDataReceived),
+ * a Ctrl-C sets the console abort flag before the console thread reads it.
+ */
+void console_data_received(USBDriver *usbp, usbep_t ep);
+#define CONSOLE_ABORT_CHAR (0x03) /* Ctrl-C */
+
+/*
+ * Console output policy when the USB output queue is full (host not reading).
+ * Only applies to USB consoles, redirected streams (run ... out) always block.
+ */
+typedef enum {
+	CONSOLE_OUT_BLOCK = 0, /* Wait for the host (default) */
+	CONSOLE_OUT_DROP, /* Message dropped if it does not fit */
+	CONSOLE_OUT_TRUNCATE, /* What fits is written, the rest is dropped */
+	CONSOLE_OUT_DEFER /* Kept in RAM, written when the policy is restored */
+} console_out_policy_t;
+
+/* Formatting buffer of cprintf() when the policy is not CONSOLE_OUT_BLOCK, longer output is truncated */
+#define CONSOLE_OUT_FMT_SIZE (160)
+/*
+ * CONSOLE_OUT_DEFER buffer (CCM pool), when it is full the deferred output
+ * is written with the policy to restore (CONSOLE_OUT_BLOCK waits, nothing is lost).
+ */
+#define CONSOLE_OUT_DEFER_SIZE (2048)
+
+/* TAB completion result size (command names) */
+#define CONSOLE_COMPL_MAX (64)
+
 typedef struct hydra_console {
 	char *thread_name;
 	thread_t *thread;
@@ -120,6 +156,20 @@ typedef struct hydra_console {
 	microrl_t *mrl;
 	int insert_char;
 	t_mode_config *mode;
+	uint8_t out_policy; /* console_out_policy_t */
+	uint8_t out_defer_prev; /* Policy restored when leaving CONSOLE_OUT_DEFER */
+	uint8_t *out_defer;
+	uint32_t out_defer_len;
+	/* Output backpressure counters */
+	uint32_t out_nb_drop; /* Messages fully dropped */
+	uint32_t out_nb_trunc; /* Messages partially written */
+	uint32_t out_nb_lost; /* Total bytes lost */
+	/* Ctrl-C received (USB ISR) or UBTN pressed, cleared at each command */
+	volatile bool abort;
+	/* Copy of a console with a redirected stream: abort flag of the original */
+	struct hydra_console *abort_con;
+	/* TAB completion result, NULL terminated, read by microrl of this console */
+	char* compl[CONSOLE_COMPL_MAX + 1];
 } t_hydra_console;
 
 void cmd_info(t_hydra_console *con, int argc, const char* const* argv);
@@ -127,22 +177,43 @@ void cmd_init(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_mem(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_threads(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_dbg(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_console(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_boot(t_hydra_console *con, int argc, const char* const* argv);
+
+/*
+ * TRUE if the running command shall stop (Ctrl-C or UBTN), to be checked
+ * by the long loops. con can be NULL (UBTN only).
+ */
+bool console_is_aborted(t_hydra_console *con);
+
+/* TRUE if the console is a USB CDC (not redirected to a file) */
+bool console_is_usb(t_hydra_console *con);
+/* Write size bytes according to con->out_policy, return number of bytes written */
+uint32_t console_write(t_hydra_console *con, const uint8_t *data, uint32_t size);
+void console_vprintf(t_hydra_console *con, const char *fmt, va_list ap);
+/*
+ * Set the output policy of the caller, return the previous one to be restored.
+ * Leaving CONSOLE_OUT_DEFER writes the deferred output with the new policy.
+ */
+console_out_policy_t console_set_policy(t_hydra_console *con, console_out_policy_t policy);
+/* Write the deferred output now (end of a bus transaction), deferral goes on */
+void console_flush(t_hydra_console *con);
 
 static inline void cprint(t_hydra_console *con, const char *data, const uint32_t size)
 {
-	BaseSequentialStream* chp = con->bss;
-
 	if(size > 0)
-		chSequentialStreamWrite(chp, (uint8_t *)data, size);
+		console_write(con, (const uint8_t *)data, size);
 }
 
 static inline void cprintf(t_hydra_console *con, const char *fmt, ...)
 {
-	BaseSequentialStream* chp = con->bss;
 	va_list ap;
 
 	va_start(ap, fmt);
-	chvprintf(chp, fmt, ap);
+	if(con->out_policy == CONSOLE_OUT_BLOCK)
+		chvprintf(con->bss, fmt, ap);
+	else
+		console_vprintf(con, fmt, ap);
 	va_end(ap);
 }
 
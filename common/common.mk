@@ -1,9 +1,18 @@
 # List of all the common related files.
-COMMONSRC = common/common.c \
+COMMONSRC = common/bufpool.c \
+            common/bus_lock.c \
+            common/buslog.c \
+            common/common.c \
+            common/hydra_cmd.c \
             common/microrl_common.c \
             common/microsd.c \
+            common/sd_xfer.c \
+            common/storage.c \
             common/usb1cfg.c \
             common/usb2cfg.c \
+            common/usb_msd.c \
+            common/usb_stream.c \
+            common/usb_tx.c \
             common/xatoi.c
 # Required include directories
 COMMONINC = ./common
@@ -0,0 +1,184 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <string.h>
+
+#include "common.h"
+#include "hydra_cmd.h"
+#include "microrl_common.h"
+#include "microsd.h"
+#include "usb_msd.h"
+#include "sd_xfer.h"
+#include "buslog.h"
+#include "bus_lock.h"
+#include "usb_tx.h"
+#include "usb_stream.h"
+
+#include "hydrabus_microrl.h"
+#include "hydrabus_mode.h"
+#include "hydrabus_run.h"
+
+#ifdef HYDRANFC
+#include "hydranfc.h"
+#include "hydranfc_microrl.h"
+#endif
+
+#define HYDRA_CMD(name, func, boards, help) { name, &func, boards, help },
+static const hydra_cmd_t hydra_cmd_table[] = {
+#include "hydra_cmd_list.h"
+};
+#undef HYDRA_CMD
+
+#define HYDRA_CMD_NB ((int)ARRAY_SIZE(hydra_cmd_table))
+
+/* Table index sorted by name */
+static uint8_t hydra_cmd_sorted[HYDRA_CMD_NB];
+
+static uint8_t hydra_cmd_board(void)
+{
+#ifdef HYDRANFC
+	if(hydranfc_is_detected() == TRUE)
+		return HYDRA_CMD_NFC;
+#endif
+	return HYDRA_CMD_BUS;
+}
+
+void hydra_cmd_init(void)
+{
+	int i, j;
+	uint8_t idx;
+
+	/* Insertion sort, done once */
+	for(i = 0; i < HYDRA_CMD_NB; i++) {
+		idx = i;
+		for(j = i; j > 0; j--) {
+			if(strcmp(hydra_cmd_table[hydra_cmd_sorted[j - 1]].name,
+				  hydra_cmd_table[idx].name) <= 0)
+				break;
+			hydra_cmd_sorted[j] = hydra_cmd_sorted[j - 1];
+		}
+		hydra_cmd_sorted[j] = idx;
+	}
+}
+
+/* First sorted position whose name is not lower than the len first chars of name */
+static int hydra_cmd_lower_bound(const char* name, size_t len)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = HYDRA_CMD_NB;
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		if(strncmp(hydra_cmd_table[hydra_cmd_sorted[mid]].name, name, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+const hydra_cmd_t* hydra_cmd_find(const char* name)
+{
+	const hydra_cmd_t* cmd;
+	int i;
+
+	/* Including the terminating 0 */
+	i = hydra_cmd_lower_bound(name, strlen(name) + 1);
+	if(i == HYDRA_CMD_NB)
+		return NULL;
+
+	cmd = &hydra_cmd_table[hydra_cmd_sorted[i]];
+	if( (strcmp(cmd->name, name) != 0) || !(cmd->boards & hydra_cmd_board()) )
+		return NULL;
+	return cmd;
+}
+
+//*****************************************************************************
+// execute callback for microrl library
+// do what you want here, but don't write to argv!!! read only!!
+int hydra_cmd_execute(t_hydra_console *con, int argc, const char* const* argv)
+{
+	const hydra_cmd_t* cmd;
+	int curr_arg;
+
+	/* Ctrl-C/UBTN seen before this line do not abort it */
+	con->abort = FALSE;
+	for(curr_arg = 0; (curr_arg < argc) && !console_is_aborted(con); curr_arg++) {
+		cmd = hydra_cmd_find(argv[curr_arg]);
+		if(cmd != NULL) {
+			/* The command gets the rest of the line as arguments */
+			cmd->func(con, argc-curr_arg, &argv[curr_arg]);
+			break;
+		}
+
+		/* HydraBus mode protocol interaction (e.g. "[ 0x12 r:4 ]") */
+		if( (hydra_cmd_board() & HYDRA_CMD_BUS) &&
+		    hydrabus_mode_proto_inter(con, argc-curr_arg, &argv[curr_arg]) )
+			continue;
+
+		print(con,"command: '");
+		print(con,(char*)argv[curr_arg]);
+		print(con,"' Error/Not found.\n\r");
+	}
+	return 0;
+}
+
+char** hydra_cmd_complete(t_hydra_console *con, const char* prefix)
+{
+	const hydra_cmd_t* cmd;
+	uint8_t board;
+	size_t len;
+	int i, j;
+
+	board = hydra_cmd_board();
+	if(prefix != NULL) {
+		len = strlen(prefix);
+		i = hydra_cmd_lower_bound(prefix, len);
+	} else {
+		len = 0;
+		i = 0;
+	}
+
+	j = 0;
+	for(; (i < HYDRA_CMD_NB) && (j < CONSOLE_COMPL_MAX); i++) {
+		cmd = &hydra_cmd_table[hydra_cmd_sorted[i]];
+		if(strncmp(cmd->name, prefix != NULL ? prefix : "", len) != 0)
+			break;
+		if(cmd->boards & board)
+			con->compl[j++] = (char*)cmd->name;
+	}
+	// note! last ptr in array always must be NULL!!!
+	con->compl[j] = NULL;
+	return con->compl;
+}
+
+void hydra_cmd_help(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint8_t board;
+	int i;
+
+	board = hydra_cmd_board();
+
+	print(con, "Use TAB key for completion\n\r");
+	for(i = 0; i < HYDRA_CMD_NB; i++) {
+		if( (hydra_cmd_table[i].help == NULL) || !(hydra_cmd_table[i].boards & board) )
+			continue;
+		print(con, hydra_cmd_table[i].help);
+		print(con, "\n\r");
+	}
+
+	if(board & HYDRA_CMD_BUS)
+		hydrabus_print_help(con, argc, argv);
+}
@@ -0,0 +1,52 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _HYDRA_CMD_H_
+#define _HYDRA_CMD_H_
+
+#include "common.h"
+#include "microrl_callback.h"
+
+/*
+ * Single console command registry for HydraBus and HydraNFC, the table is
+ * built from hydra_cmd_list.h and looked up by binary search on the names.
+ */
+
+/* Boards where a command is available */
+#define HYDRA_CMD_BUS (1 << 0) /* HydraBus alone */
+#define HYDRA_CMD_NFC (1 << 1) /* HydraNFC shield detected */
+#define HYDRA_CMD_ALL (HYDRA_CMD_BUS | HYDRA_CMD_NFC)
+
+typedef struct {
+	const char* name;
+	ptFunc func;
+	uint8_t boards;
+	const char* help; /* NULL: not listed by help */
+} hydra_cmd_t;
+
+/* Sort the name index, call once before the consoles are started */
+void hydra_cmd_init(void);
+
+/* Command of the current board or NULL */
+const hydra_cmd_t* hydra_cmd_find(const char* name);
+
+int hydra_cmd_execute(t_hydra_console *con, int argc, const char* const* argv);
+
+/* NULL terminated sorted names starting with prefix (all if NULL), stored in con */
+char** hydra_cmd_complete(t_hydra_console *con, const char* prefix);
+
+void hydra_cmd_help(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _HYDRA_CMD_H_ */
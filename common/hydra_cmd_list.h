@@ -0,0 +1,61 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * Console commands, expanded by hydra_cmd.c (no include guard).
+ * HYDRA_CMD(name, function, boards, help line or NULL)
+ * Names shall be unique, help is printed in this order.
+ */
+
+HYDRA_CMD("?",            hydra_cmd_help,         HYDRA_CMD_ALL, "? or h         - Help\t")
+HYDRA_CMD("h",            hydra_cmd_help,         HYDRA_CMD_ALL, NULL)
+HYDRA_CMD("clear",        print_clear,            HYDRA_CMD_ALL, "clear          - clear screen")
+HYDRA_CMD("info",         cmd_info,               HYDRA_CMD_ALL, "info           - info on FW & HW")
+HYDRA_CMD("ch_mem",       cmd_mem,                HYDRA_CMD_ALL, "ch_mem         - memory info\t")
+HYDRA_CMD("ch_threads",   cmd_threads,            HYDRA_CMD_ALL, "ch_threads     - threads")
+HYDRA_CMD("boot",         cmd_boot,               HYDRA_CMD_ALL, "boot           - boot timeline (us since reset)")
+HYDRA_CMD("mount",        cmd_sd_mount,           HYDRA_CMD_ALL, "mount          - mount sd")
+HYDRA_CMD("umount",       cmd_sd_umount,          HYDRA_CMD_ALL, "umount         - unmount sd")
+HYDRA_CMD("cd",           cmd_sd_cd,              HYDRA_CMD_ALL, "cd <dir>       - change directory in sd")
+HYDRA_CMD("pwd",          cmd_sd_pwd,             HYDRA_CMD_ALL, "pwd            - show current directory path in sd")
+HYDRA_CMD("ls",           cmd_sd_ls,              HYDRA_CMD_ALL, "ls [opt dir]   - list files in sd")
+HYDRA_CMD("cat",          cmd_sd_cat,             HYDRA_CMD_ALL, "cat <filename> [offset [length]] - display sd file (ASCII)")
+HYDRA_CMD("hd",           cmd_sd_cat,             HYDRA_CMD_ALL, "hd <filename> [offset [length]]  - hexdump sd file")
+HYDRA_CMD("sd_rperfo",    cmd_sd_read_perfo,      HYDRA_CMD_ALL, "sd_rperfo      - sd read performance test")
+HYDRA_CMD("sd_wperfo",    cmd_sd_write_perfo,     HYDRA_CMD_ALL, "sd_wperfo      - sd write performance test (raw/FatFs)")
+HYDRA_CMD("usb_msd",      cmd_usb_msd,            HYDRA_CMD_ALL, "usb_msd [on|off] - expose sd to USB2 host as mass storage")
+HYDRA_CMD("sd_get",       cmd_sd_get,             HYDRA_CMD_ALL, "sd_get <file>  - binary file download (scripts/hydra_xfer.py)")
+HYDRA_CMD("sd_put",       cmd_sd_put,             HYDRA_CMD_ALL, "sd_put <file>  - binary file upload (scripts/hydra_xfer.py)")
+HYDRA_CMD("buslog",       cmd_buslog,             HYDRA_CMD_ALL, "buslog [uart1|uart2 [speed <baud>] [gap <us>] [size <MB>]|stop] - log UART RX to sd")
+HYDRA_CMD("run",          cmd_run,                HYDRA_CMD_BUS, "run <file> [loop <n>] [out <file>] - run a mode script from sd")
+HYDRA_CMD("usb_perf",     cmd_usb_perf,           HYDRA_CMD_ALL, "usb_perf [<KB>] - USB CDC transmit throughput test")
+HYDRA_CMD("usb_stream",   cmd_usb_stream,         HYDRA_CMD_ALL, "usb_stream [test [<KB>]] - USB1 vendor bulk stream status/test (scripts/hydra_stream.py)")
+HYDRA_CMD("bus",          cmd_bus,                HYDRA_CMD_ALL, "bus            - peripherals owner (console/buslog/hydranfc)")
+HYDRA_CMD("console",      cmd_console,            HYDRA_CMD_ALL, "console [block|drop|truncate] - console output policy when host is not reading, lost output")
+HYDRA_CMD("erase",        cmd_sd_erase,           HYDRA_CMD_ALL, "erase          - erase sd")
+
+HYDRA_CMD(_HYDRABUS_MODE,      hydrabus_mode,      HYDRA_CMD_BUS, "m              - Change mode")
+HYDRA_CMD(_HYDRABUS_MODE_INFO, hydrabus_mode_info, HYDRA_CMD_BUS, "i              - Mode information")
+
+#ifdef HYDRANFC
+HYDRA_CMD("nfc_mifare",   cmd_nfc_mifare,         HYDRA_CMD_NFC, "nfc_mifare     - NFC read Mifare/ISO14443A UID")
+HYDRA_CMD("nfc_vicinity", cmd_nfc_vicinity,       HYDRA_CMD_NFC, "nfc_vicinity   - NFC read Vicinity UID")
+HYDRA_CMD("nfc_dump",     cmd_nfc_dump_regs,      HYDRA_CMD_NFC, "nfc_dump       - NFC dump registers")
+HYDRA_CMD("nfc_watch",    cmd_nfc_watch,          HYDRA_CMD_NFC, "nfc_watch [us] [nb] [reg(hex)...] - NFC watch registers (default RSSI/FIFO)")
+HYDRA_CMD("nfc_select_low", cmd_microrl_select_nfc_low_level, HYDRA_CMD_NFC, "nfc_select_low - NFC Low level API - See C# library")
+HYDRA_CMD("nfc_sniff",    cmd_nfc_sniff_14443A,   HYDRA_CMD_NFC, "nfc_sniff      - NFC start sniffer ISO14443A\n\rnfc_sniff can be started by K3 and stopped by K4 buttons")
+HYDRA_CMD("nfc_poll",     cmd_nfc_poll,           HYDRA_CMD_NFC, "nfc_poll [nb] [sd] - NFC poll ISO14443A/B & ISO15693 (nb cycles or until K4)")
+HYDRA_CMD("apdu",         cmd_nfc_apdu,           HYDRA_CMD_NFC, "apdu <hex> [nb] - Send APDU (nb times) to ISO14443-4A card")
+#endif
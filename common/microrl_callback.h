@@ -28,8 +28,8 @@ typedef struct {
 // print to stream callback
 void print(void *user_handle, const char *str);
 
-// get_char from stream
-char get_char(t_hydra_console *con);
+// get_chars from stream, wait for the first one then take all the available ones
+int get_chars(t_hydra_console *con, uint8_t *buf, int size);
 
 // execute callback
 unsigned int execute(void *user_handle, int argc, const char* const* argv);
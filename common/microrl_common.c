@@ -25,11 +25,13 @@ limitations under the License.
 #include "microrl_common.h"
 #include "microrl_callback.h"
 
+#include "hydra_cmd.h"
 #include "hydrabus_microrl.h"
 
 #ifdef HYDRANFC
 #include "hydranfc.h"
 #include "hydranfc_microrl.h"
+#include "hydranfc_low_microrl.h"
 #endif
 
 void print_clear(t_hydra_console *con, int argc, const char* const* argv)
@@ -53,19 +55,23 @@ void print(void *user_handle, const char *str)
 	con = user_handle;
 	len = strlen(str);
 	if(len > 0 && len < 1024)
-		chSequentialStreamWrite((BaseSequentialStream *)con->sdu,
-					(uint8_t *)str, len);
+		console_write(con, (const uint8_t *)str, len);
 }
 
 //*****************************************************************************
-char get_char(t_hydra_console *con)
+int get_chars(t_hydra_console *con, uint8_t *buf, int size)
 {
-	uint8_t car;
+	int nb;
 
-	if(chSequentialStreamRead(con->sdu,(uint8_t *)&car, 1) == 0)
-		car = 0;
+	/* Sleep on the input queue until the first byte */
+	nb = chnReadTimeout(con->sdu, buf, 1, TIME_INFINITE);
+	if(nb == 0)
+		return 0; /* Queue reset (USB disconnected/reconfigured) */
 
-	return car;
+	/* Then drain what is already received, pasted lines come in one call */
+	nb += chnReadTimeout(con->sdu, &buf[1], size - 1, TIME_IMMEDIATE);
+
+	return nb;
 }
 
 #ifdef _USE_COMPLETE
@@ -73,55 +79,29 @@ char get_char(t_hydra_console *con)
 // completion callback for microrl library
 char** complet(void* user_handle, int argc, const char * const * argv)
 {
-	(void)user_handle;
-	int i;
-	char** compl_world;
-	microrl_exec_t* keyworld;
-	int j = 0;
-	int _num_of_cmd;
+	t_hydra_console *con = user_handle;
 
 #ifdef HYDRANFC
-	/* HydraNFC Shield detected*/
-	if(hydranfc_is_detected() == TRUE) {
-		_num_of_cmd = hydranfc_get_num_of_cmd();
-		compl_world = hydranfc_get_compl_world(); //;
-		keyworld = hydranfc_get_keyworld();
-	} else {
-		/* HydraBus commands */
-		_num_of_cmd = HYDRABUS_NUM_OF_CMD;
-		compl_world = &hydrabus_compl_world[0];
-		keyworld = hydrabus_keyworld;
-	}
-#else
-	/* HydraBus commands */
-	_num_of_cmd = HYDRABUS_NUM_OF_CMD;
-	compl_world = &hydrabus_compl_world[0];
-	keyworld = hydrabus_keyworld;
-#endif
-
-	// if there is token in cmdline
-	if(argc == 1) {
-		// get last entered token
-		char * bit =(char*)argv[argc-1];
-		// iterate through our available token and match it
-		for(i = 0; i < _num_of_cmd; i++) {
+	if( (hydranfc_is_detected() == TRUE) && (nfc_select_low_selected == TRUE) ) {
+		int i;
+		int j = 0;
+		int num_of_cmd = hydranfc_low_get_num_of_cmd();
+		char** compl_world = hydranfc_low_get_compl_world();
+		microrl_exec_t* keyworld = hydranfc_low_get_keyworld();
+
+		for(i = 0; i < num_of_cmd; i++) {
 			// if token is matched(text is part of our token starting from 0 char)
-			if(strstr(&keyworld[i].str_cmd[0], bit) == keyworld[i].str_cmd) {
-				// add it to completion set
+			if( (argc != 1) ||
+			    (strstr(keyworld[i].str_cmd, argv[argc-1]) == keyworld[i].str_cmd) )
 				compl_world[j++] = keyworld[i].str_cmd;
-			}
-		}
-	} else {
-		// if there is no token in cmdline, just print all available token
-		for(j = 0; j < _num_of_cmd; j++) {
-			compl_world[j] = keyworld[j].str_cmd;
 		}
+		// note! last ptr in array always must be NULL!!!
+		compl_world[j] = NULL;
+		return compl_world;
 	}
-
-	// note! last ptr in array always must be NULL!!!
-	compl_world[j] = NULL;
-	// return set of variants
-	return compl_world;
+#endif
+	// complete last entered token, else all available commands
+	return hydra_cmd_complete(con, (argc == 1) ? argv[argc-1] : NULL);
 }
 #endif
 
@@ -135,13 +115,10 @@ unsigned int execute(void *user_handle, int argc, const char* const* argv)
 	con = user_handle;
 
 #ifdef HYDRANFC
-	if(hydranfc_is_detected())
-		return hydranfc_execute(con, argc, argv);
-	else
-		return hydrabus_execute(con, argc, argv);
-#else
-	return hydrabus_execute(con, argc, argv);
+	if( (hydranfc_is_detected() == TRUE) && (nfc_select_low_selected == TRUE) )
+		return hydranfc_low_execute(con, argc, argv);
 #endif
+	return hydra_cmd_execute(con, argc, argv);
 }
 
 //*****************************************************************************
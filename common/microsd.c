@@ -15,6 +15,7 @@ limitations under the License.
 
 #include <string.h>
 #include <stdio.h> /* sprintf */
+#include <stdlib.h> /* strtoul */
 #include "ch.h"
 #include "hal.h"
 
@@ -25,6 +26,8 @@ limitations under the License.
 
 #include "microsd.h"
 #include "common.h"
+#include "storage.h"
+#include "bufpool.h"
 
 #define SDC_BURST_SIZE  4 /* how many sectors reads at once */
 #define IN_OUT_BUF_SIZE (MMCSD_BLOCK_SIZE * SDC_BURST_SIZE)
@@ -38,6 +41,53 @@ static FATFS SDC_FS;
 /* FS mounted and ready.*/
 static bool fs_ready = FALSE;
 
+/*
+ * Storage service state, the volume stays mounted between commands.
+ * Card presence is checked (CMD13) at most every SD_CHECK_PERIOD_MS,
+ * on removal all cached state (handles, next file index) is dropped.
+ */
+#define SD_CHECK_PERIOD_MS (500)
+static systime_t sd_last_check;
+
+/* Card exposed to the USB host (usb_msd.c), FatFs shall not access it */
+static bool sd_host_owned = FALSE;
+
+/* Next free log file index per prefix */
+#define SD_INDEX_CACHE_SIZE (4)
+#define SD_PREFIX_SIZE (16)
+typedef struct {
+	char prefix[SD_PREFIX_SIZE];
+	uint32_t next_idx;
+} sd_index_cache_t;
+static sd_index_cache_t sd_index_cache[SD_INDEX_CACHE_SIZE];
+
+/*
+ * Cluster link map of the last file seeked by cat/hd, with fast seek a seek
+ * in a large file does not walk the FAT cluster chain. Building the map
+ * walks the whole chain so it is kept for the next seek in the same file
+ * (same first cluster and size) until a file is created, written or
+ * removed, or the volume is unmounted.
+ * Enough for files made of up to (SD_CAT_CLMT_SIZE/2 - 1) fragments,
+ * more fragmented files fall back to normal seek.
+ */
+#define SD_CAT_CLMT_SIZE (64)
+static DWORD cat_clmt[SD_CAT_CLMT_SIZE];
+static bool cat_clmt_valid;
+static DWORD cat_clmt_sclust;
+static DWORD cat_clmt_fsize;
+
+/* Files kept open for append */
+#define SD_FILE_CACHE_SIZE (2)
+#define SD_FILE_PATH_SIZE (64)
+typedef struct {
+	FIL fp;
+	bool used;
+	uint32_t last_use;
+	char path[SD_FILE_PATH_SIZE];
+} sd_file_cache_t;
+static sd_file_cache_t sd_file_cache[SD_FILE_CACHE_SIZE];
+static uint32_t sd_file_use_cnt;
+
 #define FILENAME_SIZE (255)
 char filename[FILENAME_SIZE+4] = { 0 };
 
@@ -123,35 +173,59 @@ void fillbuffers(uint8_t pattern)
 	fillbuffer(pattern, outbuf);
 }
 
-static int sd_perf_run(t_hydra_console *con, int seconds, int sectors, int offset)
+typedef struct {
+	uint8_t* sbuf;
+	int seconds;
+	int sectors;
+	int offset;
+	uint32_t n; /* sectors read */
+} sd_perf_arg_t;
+
+/* Storage worker: read the same blocks during seconds, return 0 if OK */
+static int sd_perf_call(void* arg)
 {
-	uint32_t n, startblk;
+	sd_perf_arg_t* a = arg;
+	uint32_t startblk;
 	systime_t start, end;
-	float total;
 
 	/* The test is performed in the middle of the flash area. */
 	startblk = (SDCD1.capacity / MMCSD_BLOCK_SIZE) / 2;
 
 	start = chVTGetSystemTime();
-	end = start + MS2ST(seconds * 1000);
-	n = 0;
+	end = start + MS2ST(a->seconds * 1000);
+	a->n = 0;
 	do {
-		if (blkRead(&SDCD1, startblk, g_sbuf + offset, sectors)) {
-			cprintf(con, "SD read failed.\r\n");
-			return FALSE;
-		}
-		n += sectors;
+		if (blkRead(&SDCD1, startblk, a->sbuf + a->offset, a->sectors))
+			return -1;
+		a->n += a->sectors;
 	} while (chVTIsSystemTimeWithin(start, end));
 
-	total = (float)n * MMCSD_BLOCK_SIZE / (1024 * 1024 * seconds);
-	cprintf(con, "%6D sectors/s, %5D KB/s %4.2f MB/s\r\n", n / seconds,
-		(n * MMCSD_BLOCK_SIZE) / (1024 * seconds), total);
+	return 0;
+}
+
+static int sd_perf_run(t_hydra_console *con, uint8_t* sbuf, int seconds, int sectors, int offset)
+{
+	sd_perf_arg_t a;
+	float total;
+
+	a.sbuf = sbuf;
+	a.seconds = seconds;
+	a.sectors = sectors;
+	a.offset = offset;
+	if (storage_call(sd_perf_call, &a) < 0) {
+		cprintf(con, "SD read failed.\r\n");
+		return FALSE;
+	}
+
+	total = (float)a.n * MMCSD_BLOCK_SIZE / (1024 * 1024 * seconds);
+	cprintf(con, "%6D sectors/s, %5D KB/s %4.2f MB/s\r\n", a.n / seconds,
+		(a.n * MMCSD_BLOCK_SIZE) / (1024 * seconds), total);
 
 	return TRUE;
 }
 
 #define PERFRUN_SECONDS 1
-static int sd_perf(t_hydra_console *con, int offset)
+static int sd_perf(t_hydra_console *con, uint8_t* sbuf, int offset)
 {
 	int nb_sectors;
 	int ret;
@@ -160,7 +234,7 @@ static int sd_perf(t_hydra_console *con, int offset)
 
 	/* Single block read performance. */
 	cprintf(con, "0.5KB blocks: ");
-	if (!(ret = sd_perf_run(con, PERFRUN_SECONDS, 1, offset)))
+	if (!(ret = sd_perf_run(con, sbuf, PERFRUN_SECONDS, 1, offset)))
 		return ret;
 
 	chThdSleepMilliseconds(1);
@@ -168,7 +242,7 @@ static int sd_perf(t_hydra_console *con, int offset)
 	for(nb_sectors = 2; nb_sectors <= G_SBUF_SDC_BURST_SIZE; nb_sectors=nb_sectors*2) {
 		/* Multiple sequential blocks read performance, aligned.*/
 		cprintf(con, "%3DKB blocks: ", nb_sectors/2 );
-		ret = sd_perf_run(con, PERFRUN_SECONDS, nb_sectors, offset);
+		ret = sd_perf_run(con, sbuf, PERFRUN_SECONDS, nb_sectors, offset);
 		if(ret == FALSE)
 			return ret;
 
@@ -178,9 +252,16 @@ static int sd_perf(t_hydra_console *con, int offset)
 	return ret;
 }
 
+static int sd_mount_check_call(void* arg)
+{
+	(void)arg;
+	return sd_mount_check();
+}
+
 void cmd_sd_read_perfo(t_hydra_console *con, int argc, const char* const* argv)
 {
 	static const char *mode[] = {"SDV11", "SDV20", "MMC", NULL};
+	uint8_t* sbuf;
 
 	(void)argc;
 	(void)argv;
@@ -191,9 +272,9 @@ void cmd_sd_read_perfo(t_hydra_console *con, int argc, const char* const* argv)
 		return;
 	}
 
-	/* Connection to the card.*/
+	/* Connection to the card (kept connected with the mounted volume).*/
 	cprintf(con, "Connecting... ");
-	if (sdcConnect(&SDCD1)) {
+	if (storage_call(sd_mount_check_call, NULL)) {
 		cprintf(con, "failed.\r\n");
 		return;
 	}
@@ -206,18 +287,270 @@ void cmd_sd_read_perfo(t_hydra_console *con, int argc, const char* const* argv)
 	cprintf(con, "Capacity: %DMB\r\n", SDCD1.capacity / 2048);
 	chThdSleepMilliseconds(1);
 
-	if (!sd_perf(con, 0))
-		goto exittest;
+	/* SDIO DMA buffer with room for the unaligned test */
+	sbuf = bufpool_alloc(BUFPOOL_DMA, NB_SBUFFER + 4, TIME_IMMEDIATE);
+	if (sbuf == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return;
+	}
 
+	if (sd_perf(con, sbuf, 0)) {
 #if STM32_SDC_SDIO_UNALIGNED_SUPPORT
-	sd_perf(con, 1);
+		sd_perf(con, sbuf, 1);
 #endif /* STM32_SDC_SDIO_UNALIGNED_SUPPORT */
+	}
+	bufpool_free(sbuf);
+}
 
-	/* Card disconnect and command end.*/
-exittest:
-	sdcDisconnect(&SDCD1);
+/*
+ * Write performance test.
+ * Writes are done in a pre-allocated file (see sd_capture_open()) so the
+ * card content is preserved, raw tests use sdcWrite() on the reserved
+ * sectors and FatFs tests use f_lseek()/f_write() on the same file.
+ * Each write latency is measured with DWT cycle counter (168MHz).
+ */
+#define WPERF_FILE_SIZE		(4 * 1024 * 1024)
+#define WPERF_NB_WRITES		(256) /* max writes per block size */
+
+typedef enum {
+	WPERF_SEQ_RAW = 0,
+	WPERF_RND_RAW,
+	WPERF_MIX_RAW, /* random, 1 write for 3 reads */
+	WPERF_SEQ_FATFS,
+	WPERF_RND_FATFS,
+	WPERF_NB_MODE
+} wperf_mode_t;
+
+static const char* const wperf_mode_name[WPERF_NB_MODE] = {
+	"Sequential raw writes",
+	"Random raw writes",
+	"Mixed random raw 25% writes/75% reads",
+	"Sequential FatFs writes",
+	"Random FatFs writes"
+};
+
+/* Test context, borrowed from the DMA pool (the FIL sector buffer is a DMA target) */
+typedef struct {
+	sd_capture_t cap;
+	filename_t filename;
+	uint8_t* sbuf;
+	wperf_mode_t mode;
+	uint32_t sectors;
+	/* Results of one run */
+	bool is_write; /* failed access */
+	FRESULT err; /* f_sync() error */
+	uint32_t nb_writes;
+	uint64_t total_cycles; /* 32bits wraps after ~25s at 168MHz */
+	uint32_t lat[WPERF_NB_WRITES];
+} sd_wperf_t;
+
+static void wperf_sort(uint32_t* tab, uint32_t nb)
+{
+	uint32_t i, j, val;
 
-	return;
+	for(i = 1; i < nb; i++) {
+		val = tab[i];
+		for(j = i; (j > 0) && (tab[j - 1] > val); j--)
+			tab[j] = tab[j - 1];
+		tab[j] = val;
+	}
+}
+
+static int sd_wperf_open_call(void* arg)
+{
+	sd_wperf_t* w = arg;
+	int ret;
+
+	ret = sd_capture_open(&w->cap, "sd_wperfo", WPERF_FILE_SIZE);
+	if(ret == 0)
+		write_file_get_last_filename(&w->filename);
+	return ret;
+}
+
+/* Remove the test file */
+static int sd_wperf_close_call(void* arg)
+{
+	sd_wperf_t* w = arg;
+
+	w->cap.bytes_written = 0;
+	sd_capture_close(&w->cap);
+	f_unlink(w->filename.filename);
+	sd_linkmap_invalidate();
+	return 0;
+}
+
+/*
+ * Storage worker: one run of w->mode with w->sectors blocks.
+ * Return 0 if OK, -1 if an access failed, -2 if f_sync() failed.
+ */
+static int sd_wperf_call(void* arg)
+{
+	sd_wperf_t* w = arg;
+	sd_capture_t* cap = &w->cap;
+	uint32_t i, nb, nb_blocks, blk, seed, sectors;
+	uint32_t cycles;
+	UINT bw;
+	int err;
+
+	sectors = w->sectors;
+	nb_blocks = cap->nb_sectors / sectors;
+	nb = nb_blocks;
+	if(nb > WPERF_NB_WRITES)
+		nb = WPERF_NB_WRITES;
+
+	seed = 0x12345678;
+	w->nb_writes = 0;
+	w->total_cycles = 0;
+	for(i = 0; i < nb; i++) {
+		if(w->mode == WPERF_SEQ_RAW || w->mode == WPERF_SEQ_FATFS) {
+			blk = i;
+		} else {
+			/* Numerical Recipes LCG */
+			seed = (seed * 1664525) + 1013904223;
+			blk = (seed >> 8) % nb_blocks;
+		}
+		w->is_write = (w->mode != WPERF_MIX_RAW) || ((i & 3) == 0);
+
+		cycles = get_cyclecounter();
+		switch(w->mode) {
+		case WPERF_SEQ_FATFS:
+		case WPERF_RND_FATFS:
+			err = f_lseek(&cap->fp, blk * sectors * MMCSD_BLOCK_SIZE);
+			if(err == FR_OK)
+				err = f_write(&cap->fp, w->sbuf, sectors * MMCSD_BLOCK_SIZE, &bw);
+			if( (err == FR_OK) && (bw != (sectors * MMCSD_BLOCK_SIZE)) )
+				err = FR_DISK_ERR;
+			break;
+		default:
+			blk = cap->start_sector + (blk * sectors);
+			if(w->is_write)
+				err = sdcWrite(&SDCD1, blk, w->sbuf, sectors);
+			else
+				err = sdcRead(&SDCD1, blk, w->sbuf, sectors);
+			break;
+		}
+		cycles = get_cyclecounter() - cycles;
+		if(err)
+			return -1;
+		if(!w->is_write)
+			continue;
+
+		w->lat[w->nb_writes++] = cycles;
+		w->total_cycles += cycles;
+	}
+	/* FatFs write cache flush is part of the test */
+	if(w->mode == WPERF_SEQ_FATFS || w->mode == WPERF_RND_FATFS) {
+		cycles = get_cyclecounter();
+		w->err = f_sync(&cap->fp);
+		cycles = get_cyclecounter() - cycles;
+		if(w->err != FR_OK)
+			return -2;
+		w->total_cycles += cycles;
+	}
+	return 0;
+}
+
+/* Return TRUE if OK else FALSE */
+static int sd_wperf_run(t_hydra_console *con, sd_wperf_t* w)
+{
+	uint32_t bytes, nb_writes, p99;
+
+	switch(storage_call(sd_wperf_call, w)) {
+	case -1:
+		cprintf(con, "SD %s failed.\r\n", w->is_write ? "write" : "read");
+		return FALSE;
+	case -2:
+		cprintf(con, "f_sync() error %d\r\n", w->err);
+		return FALSE;
+	default:
+		break;
+	}
+
+	nb_writes = w->nb_writes;
+	wperf_sort(w->lat, nb_writes);
+	p99 = (nb_writes * 99) / 100;
+	if(p99 >= nb_writes)
+		p99 = nb_writes - 1;
+
+	bytes = nb_writes * w->sectors * MMCSD_BLOCK_SIZE;
+	/* KB/s = bytes / (cycles / 168MHz) / 1024 */
+	cprintf(con, "%6D KB/s lat us min %6D avg %6D p99 %6D max %6D\r\n",
+		(uint32_t)(((uint64_t)bytes * 168000000ULL) / (w->total_cycles * 1024)),
+		w->lat[0] / 168,
+		(uint32_t)((w->total_cycles / nb_writes) / 168),
+		w->lat[p99] / 168,
+		w->lat[nb_writes - 1] / 168);
+
+	return TRUE;
+}
+
+void cmd_sd_write_perfo(t_hydra_console *con, int argc, const char* const* argv)
+{
+	sd_wperf_t* w;
+	uint32_t i;
+	uint8_t* sbuf;
+	int ret;
+
+	(void)argc;
+	(void)argv;
+
+	/* Card presence check.*/
+	if (!blkIsInserted(&SDCD1)) {
+		cprintf(con, "Card not inserted, aborting.\r\n");
+		return;
+	}
+
+	sbuf = bufpool_alloc(BUFPOOL_DMA, NB_SBUFFER, TIME_IMMEDIATE);
+	w = bufpool_alloc(BUFPOOL_DMA, sizeof(sd_wperf_t), TIME_IMMEDIATE);
+	if( (sbuf == NULL) || (w == NULL) ) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		bufpool_free(sbuf);
+		bufpool_free(w);
+		return;
+	}
+	w->sbuf = sbuf;
+
+	ret = storage_call(sd_wperf_open_call, w);
+	if(ret < 0) {
+		cprintf(con, "sd_capture_open() error %d\r\n", ret);
+		bufpool_free(w);
+		bufpool_free(sbuf);
+		return;
+	}
+	cprintf(con, "Test file %s %ld KB %scontiguous\r\n", &w->filename.filename[2],
+		WPERF_FILE_SIZE / 1024, w->cap.contiguous ? "" : "not ");
+
+	for(i = 0; i < NB_SBUFFER; i++)
+		sbuf[i] = i;
+
+	ret = TRUE;
+	for(w->mode = 0; (w->mode < WPERF_NB_MODE) && ret; w->mode++) {
+		/* Raw tests need the reserved sectors */
+		if( (w->mode < WPERF_SEQ_FATFS) && !w->cap.contiguous )
+			continue;
+
+		cprintf(con, "\r\n%s:\r\n", wperf_mode_name[w->mode]);
+		for(w->sectors = 1; w->sectors <= G_SBUF_SDC_BURST_SIZE; w->sectors *= 2) {
+			if(w->sectors == 1)
+				cprintf(con, "0.5KB blocks: ");
+			else
+				cprintf(con, "%3DKB blocks: ", w->sectors / 2);
+
+			ret = sd_wperf_run(con, w);
+			if(ret == FALSE)
+				break;
+
+			chThdSleepMilliseconds(1);
+			if(console_is_aborted(con)) {
+				ret = FALSE;
+				break;
+			}
+		}
+	}
+
+	storage_call(sd_wperf_close_call, w);
+	bufpool_free(w);
+	bufpool_free(sbuf);
 }
 
 void write_file_get_last_filename(filename_t* out_filename)
@@ -226,64 +559,178 @@ void write_file_get_last_filename(filename_t* out_filename)
 	sprintf(&out_filename->filename[0], "%s", filename);
 }
 
+/*
+ * Capture file writer.
+ * The whole file is allocated at open time, if the cluster chain is
+ * contiguous the data are written with raw multi-block sdcWrite() on the
+ * reserved sectors (FatFs is only used to open, allocate and close).
+ */
+
+static int sd_next_filename_exec(const char* prefix, filename_t* out_filename);
+
 /* Return 0 if OK else < 0 error code */
-int write_file(uint8_t* buffer, uint32_t size)
+int sd_capture_open(sd_capture_t* cap, const char* prefix, uint32_t size)
 {
-	uint32_t i;
+	filename_t new_filename;
 	FRESULT err;
-	FIL FileObject;
-	uint32_t bytes_written;
+	int ret;
+	DWORD clmt[SD_CAPTURE_CLMT_SIZE];
+
+	cap->contiguous = FALSE;
+	cap->start_sector = 0;
+	cap->nb_sectors = (size + MMCSD_BLOCK_SIZE - 1) / MMCSD_BLOCK_SIZE;
+	cap->bytes_written = 0;
 
 	if(size == 0) {
 		return -1;
 	}
 
-	if(fs_ready==FALSE) {
-		if(mount() != 0) {
-			return -5;
-		}
-	} else {
-		umount();
-		if(mount() != 0) {
-			return -5;
-		}
+	/* Volume stays mounted, next free index is cached per prefix */
+	ret = sd_next_filename_exec(prefix, &new_filename);
+	if(ret < 0) {
+		return ret;
 	}
+	strcpy(filename, new_filename.filename);
 
-	/* Save data in file */
-	for(i=0; i<999; i++) {
-		sprintf(filename, "0:hydrabus_%ld.txt", i);
-		err = f_open(&FileObject, filename, FA_WRITE | FA_CREATE_NEW);
-		if(err == FR_OK) {
-			break;
-		}
+	sd_linkmap_invalidate();
+	err = f_open(&cap->fp, filename, FA_WRITE | FA_CREATE_NEW);
+	if(err != FR_OK) {
+		return -2;
 	}
-	if(err == FR_OK) {
-		err = f_write(&FileObject, buffer, size, (void *)&bytes_written);
-		if(err != FR_OK) {
-			f_close(&FileObject);
-			umount();
-			return -3;
-		}
 
-		err = f_close(&FileObject);
-		if (err != FR_OK) {
-			umount();
-			return -4;
+	/* Allocate the whole file (cluster chain) */
+	err = f_lseek(&cap->fp, cap->nb_sectors * MMCSD_BLOCK_SIZE);
+	if( (err != FR_OK) || (f_tell(&cap->fp) != (cap->nb_sectors * MMCSD_BLOCK_SIZE)) ) {
+		f_close(&cap->fp);
+		f_unlink(filename);
+		return -3;
+	}
+	err = f_sync(&cap->fp);
+	if(err != FR_OK) {
+		f_close(&cap->fp);
+		f_unlink(filename);
+		return -4;
+	}
+
+	/* Check the cluster chain is only one fragment (2 + 2 items) */
+	clmt[0] = SD_CAPTURE_CLMT_SIZE;
+	cap->fp.cltbl = clmt;
+	err = f_lseek(&cap->fp, CREATE_LINKMAP);
+	cap->fp.cltbl = NULL;
+	if( (err == FR_OK) && (clmt[0] == 4) ) {
+		cap->contiguous = TRUE;
+		cap->start_sector = SDC_FS.database + ((cap->fp.sclust - 2) * SDC_FS.csize);
+
+		/* Pre-erase hint, card can prepare the whole area */
+		sdcErase(&SDCD1, cap->start_sector, cap->start_sector + cap->nb_sectors - 1);
+	}
+
+	f_lseek(&cap->fp, 0);
+	return 0;
+}
+
+/*
+ * Return 0 if OK else < 0 error code.
+ * size shall be a multiple of MMCSD_BLOCK_SIZE except for the last write.
+ * buffer is read by the SDIO DMA (directly or through FatFs), it shall not be in CCM.
+ */
+int sd_capture_write(sd_capture_t* cap, const uint8_t* buffer, uint32_t size)
+{
+	uint32_t sector, nb_sectors;
+	uint32_t bytes_written;
+	FRESULT err;
+
+	if( (cap->bytes_written + size) > (cap->nb_sectors * MMCSD_BLOCK_SIZE) ) {
+		return -1;
+	}
+	if(!bufpool_is_dma_capable(buffer)) {
+		return -3;
+	}
+
+	if(cap->contiguous) {
+		sector = cap->start_sector + (cap->bytes_written / MMCSD_BLOCK_SIZE);
+		nb_sectors = size / MMCSD_BLOCK_SIZE;
+		if(nb_sectors > 0) {
+			if(sdcWrite(&SDCD1, sector, buffer, nb_sectors)) {
+				return -2;
+			}
+		}
+		/* Last partial sector */
+		if(size % MMCSD_BLOCK_SIZE) {
+			memset(outbuf, 0, MMCSD_BLOCK_SIZE);
+			memcpy(outbuf, &buffer[nb_sectors * MMCSD_BLOCK_SIZE], size % MMCSD_BLOCK_SIZE);
+			if(sdcWrite(&SDCD1, sector + nb_sectors, outbuf, 1)) {
+				return -2;
+			}
 		}
 	} else {
-		umount();
-		return -2;
+		err = f_write(&cap->fp, buffer, size, (void *)&bytes_written);
+		if( (err != FR_OK) || (bytes_written != size) ) {
+			return -2;
+		}
 	}
+	cap->bytes_written += size;
+	return 0;
+}
 
-	umount();
+/* Set the file size to the written size, return 0 if OK else < 0 error code */
+int sd_capture_close(sd_capture_t* cap)
+{
+	FRESULT err;
+
+	err = f_lseek(&cap->fp, cap->bytes_written);
+	if(err == FR_OK) {
+		err = f_truncate(&cap->fp);
+	}
+	if(err != FR_OK) {
+		f_close(&cap->fp);
+		return -3;
+	}
+
+	err = f_close(&cap->fp);
+	if (err != FR_OK) {
+		return -4;
+	}
 	return 0;
 }
 
+/* Return 0 if OK else < 0 error code, called from the storage worker */
+static int sd_write_file_prefix(const char* prefix, uint8_t* buffer, uint32_t size)
+{
+	sd_capture_t cap;
+	int ret;
+
+	ret = sd_capture_open(&cap, prefix, size);
+	if(ret < 0) {
+		return ret;
+	}
+
+	if(sd_capture_write(&cap, buffer, size) < 0) {
+		f_close(&cap.fp);
+		return -3;
+	}
+
+	return sd_capture_close(&cap);
+}
+
+/* Return 0 if OK else < 0 error code */
+int write_file(uint8_t* buffer, uint32_t size)
+{
+	return write_file_prefix("hydrabus", buffer, size);
+}
+
 /* return 0 if success else <0 for error */
 int mount(void)
 {
 	FRESULT err;
 
+	if(fs_ready) {
+		return 0;
+	}
+	if(sd_host_owned) {
+		return -6;
+	}
+
 	/*
 	 * SDC initialization and FS mount.
 	 */
@@ -298,10 +745,30 @@ int mount(void)
 	}
 
 	fs_ready = TRUE;
+	sd_last_check = chVTGetSystemTime();
 
 	return 0;
 }
 
+void sd_linkmap_invalidate(void)
+{
+	cat_clmt_valid = FALSE;
+}
+
+/* Drop all cached state without accessing the card (card removed) */
+static void sd_invalidate(void)
+{
+	memset(sd_file_cache, 0, sizeof(sd_file_cache));
+	memset(sd_index_cache, 0, sizeof(sd_index_cache));
+	sd_linkmap_invalidate();
+
+	if(fs_ready) {
+		f_mount(NULL, "", 0);
+		sdcDisconnect(&SDCD1);
+		fs_ready = FALSE;
+	}
+}
+
 /* return 0 if success else <0 for error */
 int umount(void)
 {
@@ -309,118 +776,373 @@ int umount(void)
 		/* File System already unmounted */
 		return -1;
 	}
-	f_mount(NULL, "", 0);
-
-	/* SDC Disconnect */
-	sdcDisconnect(&SDCD1);
-	fs_ready = FALSE;
+	sd_file_close_all();
+	sd_invalidate();
 	return 0;
 }
 
-void cmd_sd_mount(t_hydra_console *con, int argc, const char* const* argv)
+/* Return TRUE if the card is still connected and answers to SEND_STATUS */
+static bool sd_card_present(void)
 {
-	(void)argc;
-	(void)argv;
-
-	FRESULT err;
-
-	if (fs_ready) {
-		cprintf(con, "File System already mounted\r\n");
-		return;
-	}
+	uint32_t resp[1];
 
-	/*
-	 * SDC initialization and FS mount.
-	 */
-	if (sdcConnect(&SDCD1)) {
-		cprintf(con, "sdcConnect(&SDCD1) error\r\n");
-		return;
+	if(!blkIsInserted(&SDCD1)) {
+		return FALSE;
 	}
-
-	err = f_mount(&SDC_FS, "", 0);
-	if (err != FR_OK) {
-		cprintf(con, "f_mount KO\r\n");
-		sdcDisconnect(&SDCD1);
-		return;
-	} else {
-		cprintf(con, "f_mount OK\r\n");
+	if(sdc_lld_send_cmd_short_crc(&SDCD1, MMCSD_CMD_SEND_STATUS, SDCD1.rca, resp) ||
+	   MMCSD_R1_ERROR(resp[0])) {
+		return FALSE;
 	}
-	fs_ready = TRUE;
+	return TRUE;
 }
 
-void cmd_sd_umount(t_hydra_console *con, int argc, const char* const* argv)
+void sd_set_host_owned(bool host_owned)
 {
-	(void)argc;
-	(void)argv;
+	sd_linkmap_invalidate();
+	sd_host_owned = host_owned;
+}
 
-	if(!fs_ready) {
-		cprintf(con, "File System already unmounted\r\n");
-		return;
-	}
+bool sd_is_host_owned(void)
+{
+	return sd_host_owned;
+}
 
-	cprintf(con, "Umount filesystem...\r\n");
-	f_mount(NULL, "", 0);
+/*
+ * Mount the volume if needed, return 0 if success else <0 for error.
+ * A card removed since the last call is detected and remounted.
+ */
+int sd_mount_check(void)
+{
+	systime_t now;
 
-	/* SDC Disconnect */
-	sdcDisconnect(&SDCD1);
-	fs_ready = FALSE;
+	if(fs_ready) {
+		now = chVTGetSystemTime();
+		if(chVTIsSystemTimeWithin(sd_last_check, sd_last_check + MS2ST(SD_CHECK_PERIOD_MS))) {
+			return 0;
+		}
+		if(sd_card_present()) {
+			sd_last_check = now;
+			return 0;
+		}
+		sd_invalidate();
+	}
+	return mount();
 }
 
-/* ls [<path>] - Directory listing */
-static FRESULT sd_dir_list(t_hydra_console *con, char *path)
+/*
+ * Find a free file name "0:<prefix>_<n>.txt" (n < 1000).
+ * Search starts at the cached index of this prefix so consecutive
+ * captures do not probe all the previous files.
+ * prefix is at most SD_PREFIX_SIZE-1 characters (cache key).
+ * Return 0 if success else <0 for error.
+ */
+static int sd_next_filename_exec(const char* prefix, filename_t* out_filename)
 {
-	FRESULT res;
-	DIR dir;
+	sd_index_cache_t* cache;
 	FILINFO fno;
-	uint32_t nb_files;
-	uint32_t nb_dirs;
-	uint64_t file_size;
-	uint32_t file_size_mb;
+	uint32_t i, idx;
 #if _USE_LFN
-	static char lfn[_MAX_LFN + 1];   /* Buffer to store the LFN */
-	fno.lfname = lfn;
-	fno.lfsize = sizeof lfn;
+	fno.lfname = NULL;
+	fno.lfsize = 0;
 #endif
 
-	res = f_opendir(&dir, path);
-	if(res) {
-		cprintf(con, "f_opendir() error %d\r\n", res);
-		return res;
+	if(strlen(prefix) >= SD_PREFIX_SIZE) {
+		return -7;
+	}
+	if(sd_mount_check() != 0) {
+		return -5;
 	}
-	nb_files = 0;
-	file_size = 0;
-	nb_dirs = 0;
 
-	while(1) {
-		res = f_readdir(&dir, &fno);
-		if ((res != FR_OK) || !fno.fname[0]) {
+	cache = NULL;
+	for(i = 0; i < SD_INDEX_CACHE_SIZE; i++) {
+		if(sd_index_cache[i].prefix[0] == 0) {
+			if(cache == NULL)
+				cache = &sd_index_cache[i];
+			continue;
+		}
+		if(strcmp(sd_index_cache[i].prefix, prefix) == 0) {
+			cache = &sd_index_cache[i];
 			break;
 		}
+	}
+	if(cache == NULL) {
+		/* Cache full, recycle first entry */
+		cache = &sd_index_cache[0];
+		cache->prefix[0] = 0;
+	}
+	if(cache->prefix[0] == 0) {
+		strcpy(cache->prefix, prefix);
+		cache->next_idx = 0;
+	}
 
-		if (fno.fname[0] == '.') {
-			continue;
+	for(i = 0; i < 1000; i++) {
+		idx = (cache->next_idx + i) % 1000;
+		snprintf(out_filename->filename, sizeof(out_filename->filename), "0:%s_%ld.txt", prefix, idx);
+		if(f_stat(out_filename->filename, &fno) == FR_NO_FILE) {
+			cache->next_idx = idx + 1;
+			return 0;
 		}
+	}
+	return -2;
+}
 
-		if (fno.fattrib & AM_DIR) {
+/* Flush and close all cached append handles */
+void sd_file_close_all(void)
+{
+	int i;
 
-			nb_dirs++;
-		} else {
-			nb_files++;
-			file_size += fno.fsize;
+	for(i = 0; i < SD_FILE_CACHE_SIZE; i++) {
+		if(sd_file_cache[i].used) {
+			f_close(&sd_file_cache[i].fp);
+			sd_file_cache[i].used = FALSE;
 		}
-		cprintf(con, "%c%c%c%c%c %u/%02u/%02u %02u:%02u %9lu  %s\r\n",
-			(fno.fattrib & AM_DIR) ? 'd' : '-',
-			(fno.fattrib & AM_RDO) ? 'r' : '-',
-			(fno.fattrib & AM_HID) ? 'h' : '-',
-			(fno.fattrib & AM_SYS) ? 's' : '-',
-			(fno.fattrib & AM_ARC) ? 'a' : '-',
-			(fno.fdate >> 9) + 1980, (fno.fdate >> 5) & 15, fno.fdate & 31,
-			(fno.ftime >> 11), (fno.ftime >> 5) & 63,
-			fno.fsize,
-#if _USE_LFN
-			*fno.lfname ? fno.lfname : fno.fname);
+	}
+}
+
+/* Flush all cached append handles, return 0 if success else <0 for error */
+static int sd_file_sync_exec(void)
+{
+	int i, ret;
+
+	ret = 0;
+	for(i = 0; i < SD_FILE_CACHE_SIZE; i++) {
+		if(sd_file_cache[i].used) {
+			if(f_sync(&sd_file_cache[i].fp) != FR_OK)
+				ret = -1;
+		}
+	}
+	return ret;
+}
+
+/*
+ * Append data to a file (created if needed), the file is kept open so
+ * consecutive appends only cost one f_write() (data stays in the FIL
+ * sector buffer until a sector is full or sd_file_sync() is called).
+ * Return 0 if success else <0 for error.
+ */
+static int sd_file_append_exec(const char* path, const uint8_t* buffer, uint32_t size)
+{
+	sd_file_cache_t* entry;
+	FRESULT err;
+	UINT bw;
+	int i;
+
+	if(strlen(path) >= SD_FILE_PATH_SIZE) {
+		return -1;
+	}
+	if(sd_mount_check() != 0) {
+		return -5;
+	}
+	sd_linkmap_invalidate();
+
+	entry = NULL;
+	for(i = 0; i < SD_FILE_CACHE_SIZE; i++) {
+		if(sd_file_cache[i].used && (strcmp(sd_file_cache[i].path, path) == 0)) {
+			entry = &sd_file_cache[i];
+			break;
+		}
+	}
+
+	if(entry == NULL) {
+		/* Take a free entry or close the least recently used one */
+		entry = &sd_file_cache[0];
+		for(i = 0; i < SD_FILE_CACHE_SIZE; i++) {
+			if(!sd_file_cache[i].used) {
+				entry = &sd_file_cache[i];
+				break;
+			}
+			if(sd_file_cache[i].last_use < entry->last_use)
+				entry = &sd_file_cache[i];
+		}
+		if(entry->used) {
+			f_close(&entry->fp);
+			entry->used = FALSE;
+		}
+
+		err = f_open(&entry->fp, path, FA_WRITE | FA_OPEN_ALWAYS);
+		if(err == FR_OK)
+			err = f_lseek(&entry->fp, f_size(&entry->fp));
+		if(err != FR_OK) {
+			f_close(&entry->fp);
+			return -2;
+		}
+		strcpy(entry->path, path);
+		entry->used = TRUE;
+	}
+	entry->last_use = ++sd_file_use_cnt;
+
+	err = f_write(&entry->fp, buffer, size, &bw);
+	if( (err != FR_OK) || (bw != size) ) {
+		/* Card probably removed, force a presence check on next access */
+		entry->used = FALSE;
+		sd_last_check = chVTGetSystemTime() - MS2ST(SD_CHECK_PERIOD_MS);
+		return -3;
+	}
+	return 0;
+}
+
+static int sd_mount_call(void* arg)
+{
+	(void)arg;
+	if(fs_ready)
+		return 1;
+	return mount();
+}
+
+static int sd_umount_call(void* arg)
+{
+	(void)arg;
+	return umount();
+}
+
+void cmd_sd_mount(t_hydra_console *con, int argc, const char* const* argv)
+{
+	(void)argc;
+	(void)argv;
+
+	switch(storage_call(sd_mount_call, NULL)) {
+	case 1:
+		cprintf(con, "File System already mounted\r\n");
+		break;
+	case -1:
+		cprintf(con, "sdcConnect(&SDCD1) error\r\n");
+		break;
+	case -2:
+		cprintf(con, "f_mount KO\r\n");
+		break;
+	case -6:
+		cprintf(con, "SD card owned by USB host (usb_msd off)\r\n");
+		break;
+	default:
+		cprintf(con, "f_mount OK\r\n");
+		break;
+	}
+}
+
+void cmd_sd_umount(t_hydra_console *con, int argc, const char* const* argv)
+{
+	(void)argc;
+	(void)argv;
+
+	if(storage_call(sd_umount_call, NULL) < 0)
+		cprintf(con, "File System already unmounted\r\n");
+	else
+		cprintf(con, "Umount filesystem...\r\n");
+}
+
+/*
+ * Storage worker calls below return <0 (sd_mount_check() error) if the
+ * volume cannot be mounted else the FRESULT of the FatFs call.
+ */
+static int sd_chdir_call(void* arg)
+{
+	int ret;
+
+	ret = sd_mount_check();
+	if(ret)
+		return ret;
+	return f_chdir((char *)arg);
+}
+
+static int sd_getcwd_call(void* arg)
+{
+	filename_t* path = arg;
+	int ret;
+
+	ret = sd_mount_check();
+	if(ret)
+		return ret;
+	return f_getcwd(path->filename, sizeof(path->filename));
+}
+
+/* ls context, CPU only (directory sectors are read in the FATFS window) */
+typedef struct {
+	filename_t path;
+	DIR dir;
+	FILINFO fno;
+#if _USE_LFN
+	char lfn[_MAX_LFN + 1];   /* Buffer to store the LFN */
+#endif
+	DWORD clusters;
+	uint32_t csize;
+} sd_ls_t;
+
+static int sd_getfree_call(void* arg)
+{
+	sd_ls_t* ls = arg;
+	FATFS *fsp;
+	FRESULT err;
+
+	err = f_getfree("/", &ls->clusters, &fsp);
+	ls->csize = SDC_FS.csize;
+	return err;
+}
+
+static int sd_opendir_call(void* arg)
+{
+	sd_ls_t* ls = arg;
+	return f_opendir(&ls->dir, ls->path.filename);
+}
+
+static int sd_readdir_call(void* arg)
+{
+	sd_ls_t* ls = arg;
+	return f_readdir(&ls->dir, &ls->fno);
+}
+
+/* ls [<path>] - Directory listing */
+static FRESULT sd_dir_list(t_hydra_console *con, sd_ls_t* ls)
+{
+	FRESULT res;
+	FILINFO* fno = &ls->fno;
+	uint32_t nb_files;
+	uint32_t nb_dirs;
+	uint64_t file_size;
+	uint32_t file_size_mb;
+#if _USE_LFN
+	fno->lfname = ls->lfn;
+	fno->lfsize = sizeof ls->lfn;
+#endif
+
+	res = storage_call(sd_opendir_call, ls);
+	if(res) {
+		cprintf(con, "f_opendir() error %d\r\n", res);
+		return res;
+	}
+	nb_files = 0;
+	file_size = 0;
+	nb_dirs = 0;
+
+	while(1) {
+		res = storage_call(sd_readdir_call, ls);
+		if ((res != FR_OK) || !fno->fname[0]) {
+			break;
+		}
+
+		if (fno->fname[0] == '.') {
+			continue;
+		}
+
+		if (fno->fattrib & AM_DIR) {
+
+			nb_dirs++;
+		} else {
+			nb_files++;
+			file_size += fno->fsize;
+		}
+		cprintf(con, "%c%c%c%c%c %u/%02u/%02u %02u:%02u %9lu  %s\r\n",
+			(fno->fattrib & AM_DIR) ? 'd' : '-',
+			(fno->fattrib & AM_RDO) ? 'r' : '-',
+			(fno->fattrib & AM_HID) ? 'h' : '-',
+			(fno->fattrib & AM_SYS) ? 's' : '-',
+			(fno->fattrib & AM_ARC) ? 'a' : '-',
+			(fno->fdate >> 9) + 1980, (fno->fdate >> 5) & 15, fno->fdate & 31,
+			(fno->ftime >> 11), (fno->ftime >> 5) & 63,
+			fno->fsize,
+#if _USE_LFN
+			*fno->lfname ? fno->lfname : fno->fname);
 #else
-			fno.fname);
+			fno->fname);
 #endif
 		chThdSleepMilliseconds(1);
 	}
@@ -436,24 +1158,19 @@ static FRESULT sd_dir_list(t_hydra_console *con, char *path)
 /* cd [<path>] - change directory */
 void cmd_sd_cd(t_hydra_console *con, int argc, const char* const* argv)
 {
-	FRESULT err;
+	filename_t path;
+	int err;
 
 	if(argc >= 2) {
-		snprintf((char *)fbuff, FILENAME_SIZE, "0:%s", argv[1]);
+		snprintf(path.filename, sizeof(path.filename), "0:%s", argv[1]);
 	} else {
-		fbuff[0] = 0;
+		path.filename[0] = 0;
 	}
 
-	if (!fs_ready) {
-		err = mount();
-		if(err) {
-			cprintf(con, "mount error:%d\r\n", err);
-			return;
-		}
-	}
-
-	err = f_chdir((char *)fbuff);
-	if(err) {
+	err = storage_call(sd_chdir_call, path.filename);
+	if(err < 0) {
+		cprintf(con, "mount error:%d\r\n", err);
+	} else if(err) {
 		cprintf(con, "f_chdir error:%d\r\n", err);
 	}
 
@@ -465,22 +1182,19 @@ void cmd_sd_pwd(t_hydra_console *con, int argc, const char* const* argv)
 {
 	(void)argc;
 	(void)argv;
-	FRESULT err;
+	filename_t path;
+	int err;
 
-	if (!fs_ready) {
-		err = mount();
-		if(err) {
-			cprintf(con, "mount error:%d\r\n", err);
-			return;
-		}
+	err = storage_call(sd_getcwd_call, &path);
+	if(err < 0) {
+		cprintf(con, "mount error:%d\r\n", err);
+		return;
 	}
-
-	err = f_getcwd((char *)fbuff, sizeof(fbuff));
 	if(err) {
 		cprintf(con, "f_getcwd error:%d\r\n", err);
 		return;
 	}
-	cprintf(con, "%s\r\n", fbuff);
+	cprintf(con, "%s\r\n", path.filename);
 
 	return;
 }
@@ -488,61 +1202,63 @@ void cmd_sd_pwd(t_hydra_console *con, int argc, const char* const* argv)
 /* ls [<path>] - list directory */
 void cmd_sd_ls(t_hydra_console *con, int argc, const char* const* argv)
 {
-	FRESULT err;
-	uint32_t clusters;
-	FATFS *fsp;
+	sd_ls_t* ls;
+	int err;
 	uint64_t free_size_bytes;
 	uint32_t free_size_kb;
 	uint32_t free_size_mb;
 
+	ls = bufpool_alloc(BUFPOOL_CCM, sizeof(sd_ls_t), TIME_IMMEDIATE);
+	if(ls == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return;
+	}
+
 	if(argc >= 2) {
-		chsnprintf((char *)fbuff, FILENAME_SIZE, "0:%s", argv[1]);
+		chsnprintf(ls->path.filename, sizeof(ls->path.filename), "0:%s", argv[1]);
 
-		if (!fs_ready) {
-			err = mount();
-			if(err) {
-				cprintf(con, "mount error:%d\r\n", err);
-				return;
-			}
+		err = storage_call(sd_mount_check_call, NULL);
+		if(err) {
+			cprintf(con, "mount error:%d\r\n", err);
+			bufpool_free(ls);
+			return;
 		}
 
 	} else {
-		if (!fs_ready) {
-			err = mount();
-			if(err) {
-				cprintf(con, "mount error:%d\r\n", err);
-				return;
-			}
+		err = storage_call(sd_getcwd_call, &ls->path);
+		if(err < 0) {
+			cprintf(con, "mount error:%d\r\n", err);
+			bufpool_free(ls);
+			return;
 		}
-
-		err = f_getcwd((char *)fbuff, sizeof(fbuff));
 		if(err) {
 			cprintf(con, "f_getcwd error:%d\r\n", err);
 		}
 	}
 
-	cprintf(con, "%s\r\n", fbuff);
+	cprintf(con, "%s\r\n", ls->path.filename);
 
-	err = f_getfree("/", &clusters, &fsp);
+	err = storage_call(sd_getfree_call, ls);
 	if (err != FR_OK) {
 		cprintf(con, "FS: f_getfree() failed\r\n");
 	} else {
-		free_size_bytes = (uint64_t)(clusters * SDC_FS.csize) * (uint64_t)MMCSD_BLOCK_SIZE;
+		free_size_bytes = (uint64_t)(ls->clusters * ls->csize) * (uint64_t)MMCSD_BLOCK_SIZE;
 		free_size_kb = (uint32_t)(free_size_bytes/(uint64_t)1024);
 		free_size_mb = (uint32_t)(free_size_kb/1024);
 		cprintf(con,
 			"FS: %lu free clusters, %lu sectors/cluster, %lu bytes/sector\r\n",
-			clusters, (uint32_t)SDC_FS.csize, (uint32_t)MMCSD_BLOCK_SIZE);
+			ls->clusters, ls->csize, (uint32_t)MMCSD_BLOCK_SIZE);
 		cprintf(con,
 			"FS: %lu KBytes free (%lu MBytes free)\r\n",
 			free_size_kb, free_size_mb);
 
-		err = sd_dir_list(con, (char *)fbuff);
+		err = sd_dir_list(con, ls);
 		if (err != FR_OK) {
-			cprintf(con, "sd_dir_list() on dir=%s failed\r\n", fbuff);
+			cprintf(con, "sd_dir_list() on dir=%s failed\r\n", ls->path.filename);
 		}
 	}
 
+	bufpool_free(ls);
 	return;
 }
 
@@ -573,44 +1289,122 @@ static void dump_hexbuf(t_hydra_console *con, uint32_t offset,
 	}
 }
 
+/* cat/hd context, borrowed from the DMA pool (f_read() DMA target) */
+typedef struct {
+	uint8_t data[IN_OUT_BUF_SIZE + 4]; /* First, pool buffers are 4 bytes aligned */
+	FIL fp;
+	filename_t path;
+	uint32_t offset;
+	UINT cnt;
+} sd_cat_t;
+
+static int sd_cat_open_call(void* arg)
+{
+	sd_cat_t* cat = arg;
+	int ret;
+
+	ret = sd_mount_check();
+	if(ret)
+		return ret;
+	return f_open(&cat->fp, cat->path.filename, FA_READ | FA_OPEN_EXISTING);
+}
+
+static int sd_cat_seek_call(void* arg)
+{
+	sd_cat_t* cat = arg;
+	FIL* fp = &cat->fp;
+	FRESULT err;
+
+	fp->cltbl = cat_clmt;
+	if( !cat_clmt_valid || (cat_clmt_sclust != fp->sclust) || (cat_clmt_fsize != fp->fsize) ) {
+		cat_clmt[0] = SD_CAT_CLMT_SIZE;
+		err = f_lseek(fp, CREATE_LINKMAP);
+		cat_clmt_valid = (err == FR_OK);
+		cat_clmt_sclust = fp->sclust;
+		cat_clmt_fsize = fp->fsize;
+		if (err != FR_OK) {
+			/* Too fragmented (FR_NOT_ENOUGH_CORE), use normal seek */
+			fp->cltbl = NULL;
+		}
+	}
+	err = f_lseek(fp, cat->offset);
+	/* Reads follow the FAT chain from the seeked cluster */
+	fp->cltbl = NULL;
+	return err;
+}
+
+static int sd_cat_read_call(void* arg)
+{
+	sd_cat_t* cat = arg;
+	return f_read(&cat->fp, cat->data, cat->cnt, &cat->cnt);
+}
+
+static int sd_cat_close_call(void* arg)
+{
+	sd_cat_t* cat = arg;
+	return f_close(&cat->fp);
+}
+
+/* cat/hd <filename> [offset [length]] */
 void cmd_sd_cat(t_hydra_console *con, int argc, const char* const* argv)
 {
-#define MAX_FILE_SIZE (524288)
+	sd_cat_t* cat;
 	bool hex;
-	int offset, filelen;
+	uint32_t offset, filelen;
 	uint32_t cnt;
-	FRESULT err;
-	FIL fp;
+	int err;
 
 	if(argc < 2) {
-		cprintf(con, "Error missing argument\r\nusage: %s <filename>\r\n", argv[0]);
+		cprintf(con, "Error missing argument\r\nusage: %s <filename> [offset [length]]\r\n", argv[0]);
 		return;
 	}
 
-	if (!fs_ready) {
-		err = mount();
-		if(err) {
-			cprintf(con, "mount error:%d\r\n", err);
-			return;
-		}
+	cat = bufpool_alloc(BUFPOOL_DMA, sizeof(sd_cat_t), TIME_IMMEDIATE);
+	if(cat == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return;
 	}
 
-	chsnprintf(filename, FILENAME_SIZE, "0:%s", argv[1]);
-	err = f_open(&fp, filename, FA_READ | FA_OPEN_EXISTING);
+	chsnprintf(cat->path.filename, sizeof(cat->path.filename), "0:%s", argv[1]);
+	err = storage_call(sd_cat_open_call, cat);
+	if(err < 0) {
+		cprintf(con, "mount error:%d\r\n", err);
+		bufpool_free(cat);
+		return;
+	}
 	if (err != FR_OK) {
-		cprintf(con, "Error to open file %s, err:%d\r\n", filename, err);
+		cprintf(con, "Error to open file %s, err:%d\r\n", cat->path.filename, err);
+		bufpool_free(cat);
 		return;
 	}
 
-	filelen = fp.fsize;
-	if(filelen > MAX_FILE_SIZE) {
-		cprintf(con, "Read file: %s, size=%d is too big shall not exceed %d\r\n", filename, filelen, MAX_FILE_SIZE);
-	} else {
-		cprintf(con, "Read file: %s, size=%d\r\n", filename, filelen);
+	offset = 0;
+	if(argc >= 3)
+		offset = strtoul(argv[2], NULL, 0);
+	if(offset > cat->fp.fsize)
+		offset = cat->fp.fsize;
+
+	filelen = cat->fp.fsize - offset;
+	if(argc >= 4) {
+		cnt = strtoul(argv[3], NULL, 0);
+		if(cnt < filelen)
+			filelen = cnt;
+	}
+	cprintf(con, "Read file: %s, size=%ld offset=%ld length=%ld\r\n",
+		cat->path.filename, cat->fp.fsize, offset, filelen);
+
+	if(offset > 0) {
+		cat->offset = offset;
+		err = storage_call(sd_cat_seek_call, cat);
+		if (err != FR_OK) {
+			cprintf(con, "Error to seek file, err:%d\r\n", err);
+			storage_call(sd_cat_close_call, cat);
+			bufpool_free(cat);
+			return;
+		}
 	}
 
 	hex = !strcmp(argv[0], "hd");
-	offset = 0;
 	while(filelen) {
 		if(filelen >= IN_OUT_BUF_SIZE) {
 			cnt = IN_OUT_BUF_SIZE;
@@ -619,318 +1413,422 @@ void cmd_sd_cat(t_hydra_console *con, int argc, const char* const* argv)
 			cnt = filelen;
 			filelen = 0;
 		}
-		err = f_read(&fp, inbuf, cnt, (void *)&cnt);
+		cat->cnt = cnt;
+		err = storage_call(sd_cat_read_call, cat);
 		if (err != FR_OK) {
 			cprintf(con, "Error to read file, err:%d\r\n", err);
 			break;
 		}
+		cnt = cat->cnt;
 		if (!cnt)
 			break;
 
 		if (hex) {
-			dump_hexbuf(con, offset, inbuf, cnt);
+			dump_hexbuf(con, offset, cat->data, cnt);
 			offset += cnt;
 		} else {
 			/* Force end of string at end of buffer */
-			inbuf[cnt] = 0;
-			cprintf(con, "%s", inbuf);
+			cat->data[cnt] = 0;
+			cprintf(con, "%s", cat->data);
+		}
+
+		if(console_is_aborted(con)) {
+			cprintf(con, "\r\nAborted\r\n");
+			break;
 		}
 	}
 	if (!hex)
 		cprintf(con, "\r\n");
+	storage_call(sd_cat_close_call, cat);
+	bufpool_free(cat);
 }
 
 /**
  * SDIO Test Destructive
+ * Each step runs in the storage worker and returns 0 if OK, an
+ * sd_erase_ko[] index (<0) or a FRESULT (>0) printed with the step format.
  */
-void cmd_sd_erase(t_hydra_console *con, int argc, const char* const* argv)
+#define SD_ERASE_READ_KO	(-1)
+#define SD_ERASE_WRITE_KO	(-2)
+#define SD_ERASE_CMP_KO		(-3)
+#define SD_ERASE_BADBLOCKS_KO	(-4)
+#define SD_ERASE_CONNECT_KO	(-5)
+#define SD_ERASE_DISCONNECT_KO	(-6)
+#define SD_ERASE_HOST_OWNED_KO	(-7)
+
+static const char* const sd_erase_ko[] = {
+	"sdcRead KO",
+	"sdcWrite KO",
+	"memcmp KO",
+	"badblocks KO",
+	"sdcConnect KO",
+	"sdcDisconnect KO",
+	"SD card owned by USB host (usb_msd off)"
+};
+
+static const uint8_t sd_erase_teststring[] = {"This is test file\r\n"};
+
+/* Borrowed from the DMA pool (FIL sector buffer) */
+typedef struct {
+	FIL fp;
+	DWORD clusters;
+	uint32_t csize;
+	storage_func_t step;
+} sd_erase_t;
+
+/* Every step, "usb_msd on" can give the card to the host between two steps */
+static int sd_erase_step_call(void* arg)
 {
-	(void)argc;
-	(void)argv;
-	uint32_t i = 0;
+	sd_erase_t* e = arg;
 
-	cprintf(con, "SDIO Destructive test will format de SD press UBTN to continue ... ");
+	if(sd_is_host_owned())
+		return SD_ERASE_HOST_OWNED_KO;
+	return e->step(e);
+}
 
-	while(1) {
-		if(USER_BUTTON) {
-			break;
-		}
-		chThdSleepMilliseconds(10);
+static int sd_erase_connect_call(void* arg)
+{
+	(void)arg;
+	/* Release the mounted volume, the card is reconnected here */
+	umount();
+	if (sdcConnect(&SDCD1))
+		return SD_ERASE_CONNECT_KO;
+	return 0;
+}
+
+static int sd_erase_read_call(void* arg)
+{
+	(void)arg;
+	if (sdcRead(&SDCD1, 0, inbuf, 1))
+		return SD_ERASE_READ_KO;
+	return 0;
+}
+
+static int sd_erase_read_unaligned_call(void* arg)
+{
+	int i;
+
+	(void)arg;
+	for (i = 1; i <= 3; i++) {
+		if (sdcRead(&SDCD1, 0, inbuf + i, 1))
+			return SD_ERASE_READ_KO;
 	}
+	return 0;
+}
 
-	cprintf(con, "Trying to connect SDIO... ");
-	chThdSleepMilliseconds(10);
+/* offset 0: aligned reads, 1: unaligned */
+static int sd_erase_multiple_reads(uint32_t offset)
+{
+	uint32_t i;
 
-	if (!sdcConnect(&SDCD1)) {
-		cprintf(con, "OK\r\n");
-		cprintf(con, "*** Card CSD content is: ");
-		cprintf(con, "%X %X %X %X \r\n", (&SDCD1)->csd[3], (&SDCD1)->csd[2],
-			(&SDCD1)->csd[1], (&SDCD1)->csd[0]);
+	fillbuffers(0x55);
+	/* fill reference buffer from SD card */
+	if (sdcRead(&SDCD1, 0, inbuf + offset, SDC_BURST_SIZE))
+		return SD_ERASE_READ_KO;
 
-		cprintf(con, "Single aligned read...");
-		chThdSleepMilliseconds(10);
-		if (sdcRead(&SDCD1, 0, inbuf, 1)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		cprintf(con, " OK\r\n");
-		chThdSleepMilliseconds(10);
+	for (i=0; i<1000; i++) {
+		if (sdcRead(&SDCD1, 0, outbuf + offset, SDC_BURST_SIZE))
+			return SD_ERASE_READ_KO;
+		if (memcmp(inbuf, outbuf, SDC_BURST_SIZE * MMCSD_BLOCK_SIZE) != 0)
+			return SD_ERASE_CMP_KO;
+	}
+	return 0;
+}
 
-		cprintf(con, "Single unaligned read...");
-		chThdSleepMilliseconds(10);
-		if (sdcRead(&SDCD1, 0, inbuf + 1, 1)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		if (sdcRead(&SDCD1, 0, inbuf + 2, 1)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		if (sdcRead(&SDCD1, 0, inbuf + 3, 1)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		cprintf(con, " OK\r\n");
-		chThdSleepMilliseconds(10);
+static int sd_erase_reads_call(void* arg)
+{
+	(void)arg;
+	return sd_erase_multiple_reads(0);
+}
 
-		cprintf(con, "Multiple aligned reads...");
-		chThdSleepMilliseconds(10);
-		fillbuffers(0x55);
+static int sd_erase_reads_unaligned_call(void* arg)
+{
+	(void)arg;
+	return sd_erase_multiple_reads(1);
+}
 
-		/* fill reference buffer from SD card */
-		if (sdcRead(&SDCD1, 0, inbuf, SDC_BURST_SIZE)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		cprintf(con, "\r\n.");
+/* offset 0: aligned write, 1: unaligned */
+static int sd_erase_write(uint8_t pattern, uint32_t offset)
+{
+	fillbuffer(pattern, inbuf);
+	if (sdcWrite(&SDCD1, 0, inbuf + offset, 1))
+		return SD_ERASE_WRITE_KO;
+	fillbuffer(0, outbuf);
+	if (sdcRead(&SDCD1, 0, outbuf + offset, 1))
+		return SD_ERASE_READ_KO;
+	if (memcmp(inbuf + offset, outbuf + offset, MMCSD_BLOCK_SIZE) != 0)
+		return SD_ERASE_CMP_KO;
+	return 0;
+}
 
-		for (i=0; i<1000; i++) {
-			if (sdcRead(&SDCD1, 0, outbuf, SDC_BURST_SIZE)) {
-				cprintf(con, "sdcRead KO\r\n");
-				umount();
-				return;
-			}
-			if (memcmp(inbuf, outbuf, SDC_BURST_SIZE * MMCSD_BLOCK_SIZE) != 0) {
-				cprintf(con, "memcmp KO\r\n");
-				umount();
-				return;
-			}
+static int sd_erase_write_call(void* arg)
+{
+	(void)arg;
+	return sd_erase_write(0xAA, 0);
+}
 
-			cprintf(con, ".");
-		}
-		cprintf(con, " OK\r\n");
-		chThdSleepMilliseconds(10);
+static int sd_erase_write_unaligned_call(void* arg)
+{
+	(void)arg;
+	return sd_erase_write(0xFF, 1);
+}
 
-		cprintf(con, "Multiple unaligned reads...");
-		chThdSleepMilliseconds(10);
-		fillbuffers(0x55);
-		/* fill reference buffer from SD card */
-		if (sdcRead(&SDCD1, 0, inbuf + 1, SDC_BURST_SIZE)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
+static int sd_erase_badblocks_call(void* arg)
+{
+	(void)arg;
+	if(badblocks(0x10000, 0x11000, SDC_BURST_SIZE, 0xAA))
+		return SD_ERASE_BADBLOCKS_KO;
+	return 0;
+}
 
-		for (i=0; i<1000; i++) {
-			if (sdcRead(&SDCD1, 0, outbuf + 1, SDC_BURST_SIZE)) {
-				cprintf(con, "sdcRead KO\r\n");
-				umount();
-				return;
-			}
-			if (memcmp(inbuf, outbuf, SDC_BURST_SIZE * MMCSD_BLOCK_SIZE) != 0) {
-				cprintf(con, "memcmp KO\r\n");
-				umount();
-				return;
-			}
-		}
-		cprintf(con, " OK\r\n");
-		chThdSleepMilliseconds(10);
+static int sd_erase_mount_call(void* arg)
+{
+	FRESULT err;
 
-		/* DESTRUCTIVE TEST START */
-		cprintf(con, "Single aligned write...");
-		chThdSleepMilliseconds(10);
-		fillbuffer(0xAA, inbuf);
-		if (sdcWrite(&SDCD1, 0, inbuf, 1)) {
-			cprintf(con, "sdcWrite KO\r\n");
-			umount();
-			return;
-		}
-		fillbuffer(0, outbuf);
-		if (sdcRead(&SDCD1, 0, outbuf, 1)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		if (memcmp(inbuf, outbuf, MMCSD_BLOCK_SIZE) != 0) {
-			cprintf(con, "memcmp KO\r\n");
-			umount();
-			return;
-		}
-		cprintf(con, " OK\r\n");
+	(void)arg;
+	err = f_mount(&SDC_FS, "", 0);
+	if (err == FR_OK)
+		fs_ready = TRUE;
+	return err;
+}
 
-		cprintf(con, "Single unaligned write...");
-		chThdSleepMilliseconds(10);
-		fillbuffer(0xFF, inbuf);
-		if (sdcWrite(&SDCD1, 0, inbuf+1, 1)) {
-			cprintf(con, "sdcWrite KO\r\n");
-			umount();
-			return;
-		}
-		fillbuffer(0, outbuf);
-		if (sdcRead(&SDCD1, 0, outbuf+1, 1)) {
-			cprintf(con, "sdcRead KO\r\n");
-			umount();
-			return;
-		}
-		if (memcmp(inbuf+1, outbuf+1, MMCSD_BLOCK_SIZE) != 0) {
-			cprintf(con, "memcmp KO\r\n");
-			umount();
-			return;
-		}
-		cprintf(con, " OK\r\n");
+static int sd_erase_mkfs_call(void* arg)
+{
+	(void)arg;
+	return f_mkfs("",0,0);
+}
 
-		cprintf(con, "Running badblocks at 0x10000 offset...");
-		chThdSleepMilliseconds(10);
-		if(badblocks(0x10000, 0x11000, SDC_BURST_SIZE, 0xAA)) {
-			cprintf(con, "badblocks KO\r\n");
-			umount();
-			return;
-		}
-		cprintf(con, " OK\r\n");
-		/* DESTRUCTIVE TEST END */
-
-		/**
-		 * Now perform some FS tests.
-		 */
-		FRESULT err;
-		uint32_t clusters;
-		FATFS *fsp;
-		FIL FileObject;
-		uint32_t bytes_written;
-		uint32_t bytes_read;
-		uint8_t teststring[] = {"This is test file\r\n"};
-
-		cprintf(con, "Register working area for filesystem... ");
-		chThdSleepMilliseconds(10);
-		err = f_mount(&SDC_FS, "", 0);
-		if (err != FR_OK) {
-			cprintf(con, "f_mount err:%d\r\n", err);
-			umount();
-			return;
-		} else {
-			fs_ready = TRUE;
-			cprintf(con, "OK\r\n");
-		}
+static int sd_erase_getfree_call(void* arg)
+{
+	sd_erase_t* e = arg;
+	FATFS *fsp;
+	FRESULT err;
 
-		/* DESTRUCTIVE TEST START */
-		cprintf(con, "Formatting... ");
-		chThdSleepMilliseconds(10);
-		err = f_mkfs("",0,0);
-		if (err != FR_OK) {
-			cprintf(con, "f_mkfs err:%d\r\n", err);
-			umount();
-			return;
-		} else {
-			cprintf(con, "OK\r\n");
-		}
-		/* DESTRUCTIVE TEST END */
+	err = f_getfree("/", &e->clusters, &fsp);
+	e->csize = SDC_FS.csize;
+	return err;
+}
 
-		cprintf(con, "Mount filesystem... ");
-		chThdSleepMilliseconds(10);
-		err = f_getfree("/", &clusters, &fsp);
-		if (err != FR_OK) {
-			cprintf(con, "f_getfree err:%d\r\n", err);
-			umount();
-			return;
-		}
-		cprintf(con, "OK\r\n");
-		cprintf(con,
-			"FS: %lu free clusters, %lu sectors per cluster, %lu bytes free\r\n",
-			clusters, (uint32_t)SDC_FS.csize,
-			clusters * (uint32_t)SDC_FS.csize * (uint32_t)MMCSD_BLOCK_SIZE);
+static int sd_erase_create_call(void* arg)
+{
+	sd_erase_t* e = arg;
+	return f_open(&e->fp, "0:chtest.txt", FA_WRITE | FA_OPEN_ALWAYS);
+}
 
+static int sd_erase_fwrite_call(void* arg)
+{
+	sd_erase_t* e = arg;
+	UINT bytes_written;
 
-		cprintf(con, "Create file \"chtest.txt\"... ");
-		chThdSleepMilliseconds(10);
-		err = f_open(&FileObject, "0:chtest.txt", FA_WRITE | FA_OPEN_ALWAYS);
-		if (err != FR_OK) {
-			cprintf(con, "f_open err:%d\r\n", err);
-			umount();
-			return;
-		}
-		cprintf(con, "OK\r\n");
-		cprintf(con, "Write some data in it... ");
-		chThdSleepMilliseconds(10);
-		err = f_write(&FileObject, teststring, sizeof(teststring), (void *)&bytes_written);
-		if (err != FR_OK) {
-			cprintf(con, "f_write err:%d\r\n", err);
-			umount();
-			return;
-		} else
-			cprintf(con, "OK\r\n");
+	return f_write(&e->fp, sd_erase_teststring, sizeof(sd_erase_teststring), &bytes_written);
+}
 
-		cprintf(con, "Close file \"chtest.txt\"... ");
-		err = f_close(&FileObject);
-		if (err != FR_OK) {
-			cprintf(con, "f_close err:%d\r\n", err);
-			umount();
-			return;
-		} else
-			cprintf(con, "OK\r\n");
+static int sd_erase_close_call(void* arg)
+{
+	sd_erase_t* e = arg;
+	return f_close(&e->fp);
+}
 
-		cprintf(con, "Check file content \"chtest.txt\"... ");
-		err = f_open(&FileObject, "0:chtest.txt", FA_READ | FA_OPEN_EXISTING);
-		chThdSleepMilliseconds(10);
-		if (err != FR_OK) {
-			cprintf(con, "f_open err:%d\r\n", err);
-			umount();
-			return;
-		}
+static int sd_erase_open_call(void* arg)
+{
+	sd_erase_t* e = arg;
+	return f_open(&e->fp, "0:chtest.txt", FA_READ | FA_OPEN_EXISTING);
+}
 
-		err = f_read(&FileObject, inbuf, sizeof(teststring), (void *)&bytes_read);
-		if (err != FR_OK) {
-			cprintf(con, "f_read KO\r\n");
-			umount();
-			return;
-		} else {
-			if (memcmp(teststring, inbuf, sizeof(teststring)) != 0) {
-				cprintf(con, "memcmp KO\r\n");
-				umount();
-				return;
-			} else {
-				cprintf(con, "OK\r\n");
-			}
-		}
+static int sd_erase_check_call(void* arg)
+{
+	sd_erase_t* e = arg;
+	UINT bytes_read;
+	FRESULT err;
 
-		cprintf(con, "Delete file \"chtest.txt\"... ");
-		err = f_unlink("0:chtest.txt");
-		if (err != FR_OK) {
-			cprintf(con, "f_unlink err:%d\r\n", err);
-			umount();
-			return;
+	err = f_read(&e->fp, inbuf, sizeof(sd_erase_teststring), &bytes_read);
+	f_close(&e->fp);
+	if (err != FR_OK)
+		return err;
+	if (memcmp(sd_erase_teststring, inbuf, sizeof(sd_erase_teststring)) != 0)
+		return SD_ERASE_CMP_KO;
+	return 0;
+}
+
+static int sd_erase_unlink_call(void* arg)
+{
+	(void)arg;
+	sd_linkmap_invalidate();
+	return f_unlink("0:chtest.txt");
+}
+
+static int sd_erase_umount_call(void* arg)
+{
+	(void)arg;
+	f_mount(NULL, "", 0);
+	return 0;
+}
+
+static int sd_erase_disconnect_call(void* arg)
+{
+	(void)arg;
+	if (sdcDisconnect(&SDCD1))
+		return SD_ERASE_DISCONNECT_KO;
+	return 0;
+}
+
+typedef struct {
+	const char* label;
+	storage_func_t func;
+	const char* ko; /* FRESULT format */
+	const char* ok;
+} sd_erase_step_t;
+
+static const sd_erase_step_t sd_erase_steps[] = {
+	{ "Trying to connect SDIO... ", sd_erase_connect_call, NULL, "OK\r\n" },
+	{ "Single aligned read...", sd_erase_read_call, NULL, " OK\r\n" },
+	{ "Single unaligned read...", sd_erase_read_unaligned_call, NULL, " OK\r\n" },
+	{ "Multiple aligned reads...", sd_erase_reads_call, NULL, " OK\r\n" },
+	{ "Multiple unaligned reads...", sd_erase_reads_unaligned_call, NULL, " OK\r\n" },
+	/* DESTRUCTIVE TEST START */
+	{ "Single aligned write...", sd_erase_write_call, NULL, " OK\r\n" },
+	{ "Single unaligned write...", sd_erase_write_unaligned_call, NULL, " OK\r\n" },
+	{ "Running badblocks at 0x10000 offset...", sd_erase_badblocks_call, NULL, " OK\r\n" },
+	/* DESTRUCTIVE TEST END */
+	/* Now perform some FS tests. */
+	{ "Register working area for filesystem... ", sd_erase_mount_call, "f_mount err:%d\r\n", "OK\r\n" },
+	/* DESTRUCTIVE TEST START */
+	{ "Formatting... ", sd_erase_mkfs_call, "f_mkfs err:%d\r\n", "OK\r\n" },
+	/* DESTRUCTIVE TEST END */
+	{ "Mount filesystem... ", sd_erase_getfree_call, "f_getfree err:%d\r\n", "OK\r\n" },
+	{ "Create file \"chtest.txt\"... ", sd_erase_create_call, "f_open err:%d\r\n", "OK\r\n" },
+	{ "Write some data in it... ", sd_erase_fwrite_call, "f_write err:%d\r\n", "OK\r\n" },
+	{ "Close file \"chtest.txt\"... ", sd_erase_close_call, "f_close err:%d\r\n", "OK\r\n" },
+	{ "Check file content \"chtest.txt\"... ", sd_erase_open_call, "f_open err:%d\r\n", "" },
+	{ "", sd_erase_check_call, "f_read err:%d\r\n", "OK\r\n" },
+	{ "Delete file \"chtest.txt\"... ", sd_erase_unlink_call, "f_unlink err:%d\r\n", "OK\r\n" },
+	{ "Umount filesystem... ", sd_erase_umount_call, NULL, "OK\r\n" },
+	{ "Disconnecting from SDIO...", sd_erase_disconnect_call, NULL, " OK\r\n" },
+};
+
+void cmd_sd_erase(t_hydra_console *con, int argc, const char* const* argv)
+{
+	(void)argc;
+	(void)argv;
+	const sd_erase_step_t* step;
+	sd_erase_t* e;
+	uint32_t i;
+	int ret;
+
+	if(sd_is_host_owned()) {
+		cprintf(con, "%s\r\n", sd_erase_ko[-SD_ERASE_HOST_OWNED_KO - 1]);
+		return;
+	}
+
+	cprintf(con, "SDIO Destructive test will format de SD press UBTN to continue ... ");
+
+	while(1) {
+		if(USER_BUTTON) {
+			break;
 		}
+		chThdSleepMilliseconds(10);
+	}
 
-		cprintf(con, "Umount filesystem... ");
-		f_mount(NULL, "", 0);
-		cprintf(con, "OK\r\n");
+	e = bufpool_alloc(BUFPOOL_DMA, sizeof(sd_erase_t), TIME_IMMEDIATE);
+	if(e == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return;
+	}
 
-		cprintf(con, "Disconnecting from SDIO...");
+	ret = 0;
+	for(i = 0; i < ARRAY_SIZE(sd_erase_steps); i++) {
+		step = &sd_erase_steps[i];
+		cprintf(con, "%s", step->label);
 		chThdSleepMilliseconds(10);
-		if (sdcDisconnect(&SDCD1)) {
-			cprintf(con, "sdcDisconnect KO\r\n");
-			umount();
-			return;
+
+		e->step = step->func;
+		ret = storage_call(sd_erase_step_call, e);
+		if(ret < 0) {
+			cprintf(con, "%s\r\n", sd_erase_ko[-ret - 1]);
+			break;
 		}
-		cprintf(con, " OK\r\n");
+		if(ret > 0) {
+			cprintf(con, step->ko, ret);
+			break;
+		}
+		cprintf(con, "%s", step->ok);
+
+		if(step->func == sd_erase_connect_call) {
+			cprintf(con, "*** Card CSD content is: ");
+			cprintf(con, "%X %X %X %X \r\n", (&SDCD1)->csd[3], (&SDCD1)->csd[2],
+				(&SDCD1)->csd[1], (&SDCD1)->csd[0]);
+		} else if(step->func == sd_erase_getfree_call) {
+			cprintf(con,
+				"FS: %lu free clusters, %lu sectors per cluster, %lu bytes free\r\n",
+				e->clusters, e->csize,
+				e->clusters * e->csize * (uint32_t)MMCSD_BLOCK_SIZE);
+		}
+	}
+	if(ret == 0) {
 		cprintf(con, "------------------------------------------------------\r\n");
 		cprintf(con, "All tests passed successfully.\r\n");
 		chThdSleepMilliseconds(10);
-
-		umount();
 	}
+
+	storage_call(sd_umount_call, NULL);
+	bufpool_free(e);
+}
+
+/*
+ * Storage service entry points, FatFs and SDCD1 are only accessed by the
+ * storage worker thread (see storage.c), callers are serialized.
+ */
+typedef struct {
+	const char* name;
+	const uint8_t* buffer;
+	uint32_t size;
+	filename_t* out_filename;
+} sd_call_arg_t;
+
+static int write_file_prefix_call(void* arg)
+{
+	sd_call_arg_t* a = arg;
+	return sd_write_file_prefix(a->name, (uint8_t*)a->buffer, a->size);
+}
+
+/* Write buffer in a new file <prefix>_<n>.txt, return 0 if OK else < 0 error code */
+int write_file_prefix(const char* prefix, uint8_t* buffer, uint32_t size)
+{
+	sd_call_arg_t a = { .name = prefix, .buffer = buffer, .size = size };
+	return storage_call(write_file_prefix_call, &a);
+}
+
+static int sd_next_filename_call(void* arg)
+{
+	sd_call_arg_t* a = arg;
+	return sd_next_filename_exec(a->name, a->out_filename);
+}
+
+int sd_next_filename(const char* prefix, filename_t* out_filename)
+{
+	sd_call_arg_t a = { .name = prefix, .out_filename = out_filename };
+	return storage_call(sd_next_filename_call, &a);
+}
+
+static int sd_file_append_call(void* arg)
+{
+	sd_call_arg_t* a = arg;
+	return sd_file_append_exec(a->name, a->buffer, a->size);
+}
+
+int sd_file_append(const char* path, const uint8_t* buffer, uint32_t size)
+{
+	sd_call_arg_t a = { .name = path, .buffer = buffer, .size = size };
+	return storage_call(sd_file_append_call, &a);
+}
+
+static int sd_file_sync_call(void* arg)
+{
+	(void)arg;
+	return sd_file_sync_exec();
+}
+
+int sd_file_sync(void)
+{
+	return storage_call(sd_file_sync_call, NULL);
 }
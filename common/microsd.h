@@ -17,19 +17,54 @@ limitations under the License.
 #define _MICROSD_H_
 
 #include "common.h"
+#include "ff.h"
 
 typedef struct {
 	char filename[255];
 } filename_t;
 
+typedef struct {
+	FIL fp;
+	bool contiguous; /* TRUE if data are written with raw sdcWrite() */
+	uint32_t start_sector;
+	uint32_t nb_sectors;
+	uint32_t bytes_written;
+} sd_capture_t;
+
+/* Cluster link map table size used to check capture file contiguity */
+#define SD_CAPTURE_CLMT_SIZE (8)
+
 bool is_fs_ready(void);
 
+int sd_capture_open(sd_capture_t* cap, const char* prefix, uint32_t size);
+int sd_capture_write(sd_capture_t* cap, const uint8_t* buffer, uint32_t size);
+int sd_capture_close(sd_capture_t* cap);
+
+int write_file_prefix(const char* prefix, uint8_t* buffer, uint32_t size);
 int write_file(uint8_t* buffer, uint32_t size);
 void write_file_get_last_filename(filename_t* out_filename);
 
 int mount(void);
 int umount(void);
 
+/*
+ * Storage service, volume stays mounted until umount() or card removal.
+ * mount()/umount()/sd_mount_check() and sd_capture_xxx() shall only be
+ * called from the storage worker thread (storage.h), other functions can be
+ * called from any thread.
+ */
+int sd_mount_check(void);
+/* Card owned by the USB host (mass storage), mount() fails with -6 */
+void sd_set_host_owned(bool host_owned);
+bool sd_is_host_owned(void);
+/* prefix is at most 15 characters, return 0 if success else <0 error code */
+int sd_next_filename(const char* prefix, filename_t* out_filename);
+int sd_file_append(const char* path, const uint8_t* buffer, uint32_t size);
+int sd_file_sync(void);
+void sd_file_close_all(void);
+/* Drop the cat/hd cluster link map, call after a file is created, written or removed */
+void sd_linkmap_invalidate(void);
+
 /* Shell commands */
 void cmd_sd_mount(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_sd_umount(t_hydra_console *con, int argc, const char* const* argv);
@@ -40,5 +75,6 @@ void cmd_sd_cat(t_hydra_console *con, int argc, const char* const* argv);
 
 void cmd_sd_erase(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_sd_read_perfo(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_sd_write_perfo(t_hydra_console *con, int argc, const char* const* argv);
 
 #endif /* _MICROSD_H_ */
@@ -76,6 +76,7 @@ typedef struct {
 typedef struct {
 	mode_config_proto_t proto;
 	mode_config_command_t cmd;
+	int bus_lock; /* bus_lock_dev_t owned by the current mode (0 none) */
 } t_mode_config;
 
 #endif /* _MODE_CONFIG_H_ */
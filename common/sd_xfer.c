@@ -0,0 +1,447 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+
+#include "ff.h"
+
+#include "common.h"
+#include "microsd.h"
+#include "storage.h"
+#include "bufpool.h"
+#include "sd_xfer.h"
+
+#define XFER_ACK_TIMEOUT_MS	(1000)
+#define XFER_MAX_RETRY		(5)
+#define XFER_SEQ_NONE		(0xFFFFFFFF)
+/* xfer_recv() bad frame (CRC, magic or length), 0 is timeout */
+#define XFER_RECV_BAD		(0xFF)
+
+/*
+ * Transfer context, borrowed from the DMA pool (f_read()/f_write() DMA
+ * straight from/to the frame payload), only the FatFs calls are done by
+ * the storage worker.
+ */
+typedef struct {
+	uint8_t frame[XFER_HEADER_SIZE + XFER_CHUNK_SIZE + XFER_CRC_SIZE]; /* First, 4 bytes aligned */
+	uint8_t rx[XFER_HEADER_SIZE + XFER_CRC_SIZE + 4];
+	FIL fp;
+	filename_t path;
+	BYTE mode;
+	uint32_t pos; /* f_lseek() position */
+	uint32_t len; /* f_read()/f_write() length */
+} xfer_ctx_t;
+
+/* CRC32 of buf with the CRC unit, buf shall be 4 bytes aligned */
+static uint32_t xfer_crc32(const uint8_t* buf, uint32_t len)
+{
+	uint32_t i, last;
+
+	CRC->CR = CRC_CR_RESET;
+	for(i = 0; (i + 4) <= len; i += 4)
+		CRC->DR = *(const uint32_t*)&buf[i];
+	if(i < len) {
+		last = 0;
+		memcpy(&last, &buf[i], len - i);
+		CRC->DR = last;
+	}
+	return CRC->DR;
+}
+
+static inline uint32_t xfer_get32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void xfer_put32(uint8_t* p, uint32_t val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+/* Build header + crc around payload already in frame[XFER_HEADER_SIZE], return frame size */
+static uint32_t xfer_build(uint8_t* frame, uint8_t type, uint32_t seq, uint32_t len)
+{
+	uint32_t crc;
+
+	frame[0] = XFER_MAGIC & 0xFF;
+	frame[1] = XFER_MAGIC >> 8;
+	frame[2] = type;
+	frame[3] = 0;
+	xfer_put32(&frame[4], seq);
+	xfer_put32(&frame[8], len);
+	/* Zero padding is part of the CRC */
+	memset(&frame[XFER_HEADER_SIZE + len], 0, (4 - (len & 3)) & 3);
+	crc = xfer_crc32(frame, XFER_HEADER_SIZE + len);
+	xfer_put32(&frame[XFER_HEADER_SIZE + len], crc);
+
+	return XFER_HEADER_SIZE + len + XFER_CRC_SIZE;
+}
+
+static bool xfer_send(t_hydra_console *con, uint8_t* frame, uint32_t size)
+{
+	return chnWriteTimeout(con->sdu, frame, size, MS2ST(XFER_ACK_TIMEOUT_MS)) == size;
+}
+
+static void xfer_send_ctrl(t_hydra_console *con, xfer_ctx_t* ctx, uint8_t type, uint32_t seq)
+{
+	uint32_t size;
+
+	size = xfer_build(ctx->rx, type, seq, 0);
+	xfer_send(con, ctx->rx, size);
+}
+
+/*
+ * Receive one frame in frame buffer (payload up to max_len).
+ * Return frame type, 0 on timeout or XFER_RECV_BAD on bad frame (stream
+ * resynchronized on magic).
+ */
+static uint8_t xfer_recv(t_hydra_console *con, uint8_t* frame, uint32_t max_len,
+			 uint32_t* seq, uint32_t* len, systime_t timeout)
+{
+	uint32_t crc;
+
+	/* Magic, byte per byte to resynchronize */
+	do {
+		if(chnReadTimeout(con->sdu, &frame[0], 1, timeout) != 1)
+			return 0;
+	} while(frame[0] != (XFER_MAGIC & 0xFF));
+	if(chnReadTimeout(con->sdu, &frame[1], XFER_HEADER_SIZE - 1, timeout) != (XFER_HEADER_SIZE - 1))
+		return XFER_RECV_BAD;
+	if(frame[1] != (XFER_MAGIC >> 8))
+		return XFER_RECV_BAD;
+
+	*seq = xfer_get32(&frame[4]);
+	*len = xfer_get32(&frame[8]);
+	if(*len > max_len)
+		return XFER_RECV_BAD;
+	if(chnReadTimeout(con->sdu, &frame[XFER_HEADER_SIZE], *len + XFER_CRC_SIZE, timeout) !=
+	   (*len + XFER_CRC_SIZE))
+		return XFER_RECV_BAD;
+
+	crc = xfer_get32(&frame[XFER_HEADER_SIZE + *len]);
+	memset(&frame[XFER_HEADER_SIZE + *len], 0, (4 - (*len & 3)) & 3);
+	if(xfer_crc32(frame, XFER_HEADER_SIZE + *len) != crc)
+		return XFER_RECV_BAD;
+
+	return frame[2];
+}
+
+static void xfer_report(t_hydra_console *con, const char* dir, uint32_t bytes,
+			systime_t elapsed, uint32_t nb_resend)
+{
+	uint32_t ms;
+
+	ms = ST2MS(elapsed);
+	cprintf(con, "\r\n%s %ld bytes in %ld ms", dir, bytes, ms);
+	if(ms > 0)
+		cprintf(con, " (%ld KB/s)", (uint32_t)(((uint64_t)bytes * 1000) / ((uint64_t)ms * 1024)));
+	cprintf(con, ", %ld frames sent again\r\n", nb_resend);
+}
+
+/* Return <0 (sd_mount_check() error) or the f_open() FRESULT */
+static int xfer_open_call(void* arg)
+{
+	xfer_ctx_t* ctx = arg;
+	int ret;
+
+	ret = sd_mount_check();
+	if(ret)
+		return ret;
+	if(ctx->mode & FA_WRITE)
+		sd_linkmap_invalidate();
+	return f_open(&ctx->fp, ctx->path.filename, ctx->mode);
+}
+
+/* Read up to ctx->len bytes at ctx->pos in the frame payload, ctx->len is updated */
+static int xfer_read_call(void* arg)
+{
+	xfer_ctx_t* ctx = arg;
+	FRESULT err;
+	UINT br;
+
+	err = f_lseek(&ctx->fp, ctx->pos);
+	if(err == FR_OK)
+		err = f_read(&ctx->fp, &ctx->frame[XFER_HEADER_SIZE], ctx->len, &br);
+	ctx->len = (err == FR_OK) ? br : 0;
+	return err;
+}
+
+static int xfer_write_call(void* arg)
+{
+	xfer_ctx_t* ctx = arg;
+	FRESULT err;
+	UINT bw;
+
+	err = f_write(&ctx->fp, &ctx->frame[XFER_HEADER_SIZE], ctx->len, &bw);
+	if( (err == FR_OK) && (bw != ctx->len) )
+		err = FR_DISK_ERR;
+	return err;
+}
+
+/* Pre-allocate the file, data are written in place */
+static int xfer_prealloc_call(void* arg)
+{
+	xfer_ctx_t* ctx = arg;
+
+	f_lseek(&ctx->fp, ctx->pos);
+	return f_lseek(&ctx->fp, 0);
+}
+
+static int xfer_close_call(void* arg)
+{
+	xfer_ctx_t* ctx = arg;
+
+	/* Truncate to the received size (pre-allocation) */
+	if(ctx->mode & FA_WRITE)
+		f_truncate(&ctx->fp);
+	return f_close(&ctx->fp);
+}
+
+/* Borrow a context and open name, return NULL on error (reported on con) */
+static xfer_ctx_t* xfer_open(t_hydra_console *con, const char* name, BYTE mode)
+{
+	xfer_ctx_t* ctx;
+	int err;
+
+	ctx = bufpool_alloc(BUFPOOL_DMA, sizeof(xfer_ctx_t), TIME_IMMEDIATE);
+	if(ctx == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return NULL;
+	}
+	ctx->mode = mode;
+	chsnprintf(ctx->path.filename, sizeof(ctx->path.filename), "0:%s", name);
+
+	err = storage_call(xfer_open_call, ctx);
+	if(err < 0) {
+		cprintf(con, "mount error\r\n");
+		bufpool_free(ctx);
+		return NULL;
+	}
+	if(err != FR_OK) {
+		cprintf(con, "Error to open file %s, err:%d\r\n", ctx->path.filename, err);
+		bufpool_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+
+/*
+ * sd_get <file>: send FILE, DATA frames (go-back-N window) and END.
+ */
+void cmd_sd_get(t_hydra_console *con, int argc, const char* const* argv)
+{
+	xfer_ctx_t* ctx;
+	uint8_t* frame;
+	FRESULT err;
+	uint32_t seq, acked, back, last_seq, nb_frames;
+	uint32_t len, size, retry, nb_resend, rx_seq, rx_len, file_size;
+	systime_t start;
+	uint8_t type;
+
+	if(argc < 2) {
+		cprintf(con, "usage: %s <file>\r\n", argv[0]);
+		return;
+	}
+	ctx = xfer_open(con, argv[1], FA_READ | FA_OPEN_EXISTING);
+	if(ctx == NULL)
+		return;
+	frame = ctx->frame;
+
+	rccEnableAHB1(RCC_AHB1ENR_CRCEN, FALSE);
+	file_size = f_size(&ctx->fp);
+	nb_frames = (file_size + XFER_CHUNK_SIZE - 1) / XFER_CHUNK_SIZE;
+	/* seq 0 FILE, 1..nb_frames DATA, nb_frames + 1 END */
+	last_seq = nb_frames + 1;
+	nb_resend = 0;
+	retry = 0;
+	start = chVTGetSystemTime();
+
+	seq = 0;
+	acked = XFER_SEQ_NONE; /* nothing acked */
+	back = XFER_SEQ_NONE; /* last seq gone back to */
+	while( (acked == XFER_SEQ_NONE) || (acked < last_seq) ) {
+		/* Fill the window */
+		while( (seq <= last_seq) && ((acked == XFER_SEQ_NONE) ? (seq == 0) : (seq <= (acked + XFER_WINDOW))) ) {
+			if(seq == 0) {
+				xfer_put32(&frame[XFER_HEADER_SIZE], file_size);
+				len = strlen(argv[1]);
+				memcpy(&frame[XFER_HEADER_SIZE + 4], argv[1], len);
+				size = xfer_build(frame, XFER_TYPE_FILE, seq, len + 4);
+			} else if(seq == last_seq) {
+				size = xfer_build(frame, XFER_TYPE_END, seq, 0);
+			} else {
+				/* Raw file data straight to the USB queue */
+				ctx->pos = (seq - 1) * XFER_CHUNK_SIZE;
+				ctx->len = XFER_CHUNK_SIZE;
+				err = storage_call(xfer_read_call, ctx);
+				if(err != FR_OK) {
+					xfer_send_ctrl(con, ctx, XFER_TYPE_ABORT, seq);
+					storage_call(xfer_close_call, ctx);
+					bufpool_free(ctx);
+					cprintf(con, "\r\nf_read error %d\r\n", err);
+					return;
+				}
+				size = xfer_build(frame, XFER_TYPE_DATA, seq, ctx->len);
+			}
+			if(!xfer_send(con, frame, size))
+				break;
+			seq++;
+		}
+
+		/* Wait ACK/NAK */
+		type = xfer_recv(con, ctx->rx, 0, &rx_seq, &rx_len, MS2ST(XFER_ACK_TIMEOUT_MS));
+		if(type == XFER_TYPE_ACK) {
+			if( (acked == XFER_SEQ_NONE) || (rx_seq > acked) ) {
+				acked = rx_seq;
+				retry = 0;
+			}
+			continue;
+		}
+		if(type == XFER_TYPE_ABORT)
+			break;
+		/* One NAK per frame received after a lost one, go back once per seq */
+		if( (type == XFER_TYPE_NAK) && (rx_seq == back) )
+			continue;
+		if( (type != 0) && (type != XFER_TYPE_NAK) )
+			continue;
+
+		/* NAK or timeout, go back to the first frame not acked */
+		if(++retry > XFER_MAX_RETRY) {
+			xfer_send_ctrl(con, ctx, XFER_TYPE_ABORT, seq);
+			break;
+		}
+		if(type == XFER_TYPE_NAK)
+			seq = rx_seq;
+		else
+			seq = (acked == XFER_SEQ_NONE) ? 0 : (acked + 1);
+		back = seq;
+		nb_resend++;
+	}
+	storage_call(xfer_close_call, ctx);
+	bufpool_free(ctx);
+
+	if( (acked != XFER_SEQ_NONE) && (acked == last_seq) )
+		xfer_report(con, "sd_get sent", file_size, chVTGetSystemTime() - start, nb_resend);
+	else
+		cprintf(con, "\r\nsd_get aborted\r\n");
+}
+
+/*
+ * sd_put <file>: receive FILE, DATA frames in order and END, each frame
+ * received in order is acked, the first bad or out of order frame is
+ * answered by a NAK of the expected seq (again after each timeout).
+ */
+void cmd_sd_put(t_hydra_console *con, int argc, const char* const* argv)
+{
+	xfer_ctx_t* ctx;
+	uint8_t* frame;
+	FRESULT err;
+	uint32_t expected, nak_seq, seq, len, size, written, retry, nb_nak;
+	systime_t start;
+	uint8_t type;
+	bool done;
+
+	if(argc < 2) {
+		cprintf(con, "usage: %s <file>\r\n", argv[0]);
+		return;
+	}
+	ctx = xfer_open(con, argv[1], FA_WRITE | FA_CREATE_ALWAYS);
+	if(ctx == NULL)
+		return;
+	frame = ctx->frame;
+
+	rccEnableAHB1(RCC_AHB1ENR_CRCEN, FALSE);
+	cprintf(con, "sd_put ready\r\n");
+
+	size = 0;
+	written = 0;
+	expected = 0;
+	nak_seq = XFER_SEQ_NONE;
+	retry = 0;
+	nb_nak = 0;
+	done = FALSE;
+	start = chVTGetSystemTime();
+	while(!done) {
+		type = xfer_recv(con, frame, XFER_CHUNK_SIZE, &seq, &len, MS2ST(XFER_ACK_TIMEOUT_MS));
+		if(type == XFER_TYPE_ABORT)
+			break;
+		if(type == 0) {
+			/* Timeout: NAK or ACK lost, ask again from expected */
+			if(++retry > XFER_MAX_RETRY) {
+				xfer_send_ctrl(con, ctx, XFER_TYPE_ABORT, expected);
+				break;
+			}
+			xfer_send_ctrl(con, ctx, XFER_TYPE_NAK, expected);
+			nak_seq = expected;
+			nb_nak++;
+			continue;
+		}
+		if( (type == XFER_RECV_BAD) || (seq > expected) ) {
+			/* Bad CRC or frame lost: ask once from expected, the window follows */
+			if(nak_seq != expected) {
+				xfer_send_ctrl(con, ctx, XFER_TYPE_NAK, expected);
+				nak_seq = expected;
+				nb_nak++;
+			}
+			continue;
+		}
+		if(seq < expected) {
+			/* Frame sent again, our ACK was lost */
+			xfer_send_ctrl(con, ctx, XFER_TYPE_ACK, expected - 1);
+			continue;
+		}
+		retry = 0;
+
+		switch(type) {
+		case XFER_TYPE_FILE:
+			size = xfer_get32(&frame[XFER_HEADER_SIZE]);
+			ctx->pos = size;
+			storage_call(xfer_prealloc_call, ctx);
+			start = chVTGetSystemTime();
+			break;
+		case XFER_TYPE_DATA:
+			ctx->len = len;
+			err = storage_call(xfer_write_call, ctx);
+			if(err != FR_OK) {
+				xfer_send_ctrl(con, ctx, XFER_TYPE_ABORT, seq);
+				expected = XFER_SEQ_NONE;
+				done = TRUE;
+				continue;
+			}
+			written += len;
+			break;
+		case XFER_TYPE_END:
+			done = TRUE;
+			break;
+		default:
+			break;
+		}
+		xfer_send_ctrl(con, ctx, XFER_TYPE_ACK, seq);
+		expected++;
+	}
+
+	storage_call(xfer_close_call, ctx);
+	bufpool_free(ctx);
+
+	if(done && (expected != XFER_SEQ_NONE) && (written == size))
+		xfer_report(con, "sd_put received", written, chVTGetSystemTime() - start, nb_nak);
+	else
+		cprintf(con, "\r\nsd_put aborted (%ld/%ld bytes)\r\n", written, size);
+}
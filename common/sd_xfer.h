@@ -0,0 +1,50 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _SD_XFER_H_
+#define _SD_XFER_H_
+
+#include "common.h"
+
+/*
+ * Binary file transfer over the CDC console (see scripts/hydra_xfer.py).
+ * Frame (little endian):
+ *   u16 magic "HX", u8 type, u8 reserved, u32 seq, u32 len, payload[len],
+ *   u32 crc
+ * crc is the STM32 CRC unit CRC32 (poly 0x04C11DB7, init 0xFFFFFFFF, no
+ * reflection/final xor) on the 32bits words of header + payload, payload
+ * is zero padded to a multiple of 4 bytes.
+ * Recovery: the receiver sends one NAK per expected seq (again after a
+ * timeout), the sender goes back once per NAK seq and ignores duplicates.
+ * After XFER_MAX_RETRY go back/timeouts on the same seq the side giving
+ * up sends ABORT.
+ */
+#define XFER_MAGIC		(0x5848)
+#define XFER_HEADER_SIZE	(12)
+#define XFER_CRC_SIZE		(4)
+#define XFER_CHUNK_SIZE		(4096)
+#define XFER_WINDOW		(8) /* DATA frames sent before waiting an ACK */
+
+#define XFER_TYPE_FILE		(0x01) /* payload u32 size + file name */
+#define XFER_TYPE_DATA		(0x02)
+#define XFER_TYPE_END		(0x03)
+#define XFER_TYPE_ACK		(0x06) /* seq = last frame received in order */
+#define XFER_TYPE_NAK		(0x15) /* seq = first frame to send again */
+#define XFER_TYPE_ABORT		(0x18)
+
+void cmd_sd_get(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_sd_put(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _SD_XFER_H_ */
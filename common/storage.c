@@ -0,0 +1,195 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "microsd.h"
+#include "storage.h"
+#include "bufpool.h"
+
+typedef enum {
+	STORAGE_REQ_CALL = 0,
+	STORAGE_REQ_WRITE,
+	STORAGE_REQ_APPEND
+} storage_req_type_t;
+
+typedef struct {
+	storage_req_type_t type;
+	/* STORAGE_REQ_CALL */
+	storage_func_t func;
+	void* arg;
+	/* STORAGE_REQ_WRITE/APPEND */
+	const char* name;
+	uint8_t* buffer;
+	uint32_t size;
+	/* Completion, done is set for synchronous requests */
+	binary_semaphore_t* done;
+	int result;
+	storage_done_cb_t cb;
+	void* cb_arg;
+} storage_req_t;
+
+/* Mailbox also holds the synchronous requests (one per waiting thread) */
+#define STORAGE_MB_SIZE (STORAGE_NB_ASYNC_REQ + 4)
+
+static storage_req_t storage_async_req[STORAGE_NB_ASYNC_REQ];
+static memory_pool_t storage_pool;
+static msg_t storage_mb_buf[STORAGE_MB_SIZE];
+static mailbox_t storage_mb;
+/* Free mailbox slots, reserved before a post so an async post never blocks */
+static semaphore_t storage_slot_sem;
+static thread_t* storage_thread = NULL;
+static THD_WORKING_AREA(waStorage, STORAGE_WA_SIZE);
+
+static THD_FUNCTION(storage_worker, arg)
+{
+	storage_req_t* req;
+	msg_t msg;
+	int ret;
+
+	(void)arg;
+	chRegSetThreadName("storage");
+
+	while(TRUE) {
+		if(chMBFetch(&storage_mb, &msg, TIME_INFINITE) != MSG_OK)
+			continue;
+		req = (storage_req_t*)msg;
+		chSemSignal(&storage_slot_sem);
+
+		switch(req->type) {
+		case STORAGE_REQ_CALL:
+			ret = req->func(req->arg);
+			break;
+		case STORAGE_REQ_WRITE:
+			ret = write_file_prefix(req->name, req->buffer, req->size);
+			break;
+		case STORAGE_REQ_APPEND:
+			ret = sd_file_append(req->name, req->buffer, req->size);
+			if(ret == 0)
+				ret = sd_file_sync();
+			break;
+		default:
+			ret = -1;
+			break;
+		}
+
+		if(req->done != NULL) {
+			req->result = ret;
+			chBSemSignal(req->done);
+		} else {
+			/* Pool buffer handed off without callback is released here */
+			if(req->cb != NULL)
+				req->cb(ret, req->cb_arg);
+			else
+				bufpool_free(req->buffer);
+			chPoolFree(&storage_pool, req);
+		}
+	}
+	return 0;
+}
+
+void storage_init(void)
+{
+	chPoolObjectInit(&storage_pool, sizeof(storage_req_t), NULL);
+	chPoolLoadArray(&storage_pool, storage_async_req, STORAGE_NB_ASYNC_REQ);
+	chMBObjectInit(&storage_mb, storage_mb_buf, STORAGE_MB_SIZE);
+	chSemObjectInit(&storage_slot_sem, STORAGE_MB_SIZE);
+
+	storage_thread = chThdCreateStatic(waStorage, sizeof(waStorage),
+					   NORMALPRIO, storage_worker, NULL);
+}
+
+bool storage_is_worker(void)
+{
+	return (chThdGetSelfX() == storage_thread);
+}
+
+int storage_call(storage_func_t func, void* arg)
+{
+	storage_req_t req;
+	binary_semaphore_t done;
+
+	/* Nested call from the worker or worker not started */
+	if( (storage_thread == NULL) || storage_is_worker() )
+		return func(arg);
+
+	chBSemObjectInit(&done, TRUE);
+	req.type = STORAGE_REQ_CALL;
+	req.func = func;
+	req.arg = arg;
+	req.done = &done;
+	req.cb = NULL;
+
+	chSemWait(&storage_slot_sem);
+	chMBPost(&storage_mb, (msg_t)&req, TIME_INFINITE);
+	chBSemWait(&done);
+
+	return req.result;
+}
+
+static int storage_post_async(storage_req_type_t type, const char* name,
+			      uint8_t* buffer, uint32_t size,
+			      storage_done_cb_t cb, void* cb_arg)
+{
+	storage_req_t* req;
+
+	if(storage_thread == NULL)
+		return -2;
+
+	/*
+	 * Only a pool buffer owned by the caller can be given to the worker
+	 * (it frees it), handoff to the caller itself checks that.
+	 */
+	if(bufpool_handoff(buffer, chThdGetSelfX()) < 0)
+		return -4;
+
+	req = chPoolAlloc(&storage_pool);
+	if(req == NULL)
+		return -1;
+
+	req->type = type;
+	req->name = name;
+	req->buffer = buffer;
+	req->size = size;
+	req->done = NULL;
+	req->cb = cb;
+	req->cb_arg = cb_arg;
+
+	/* A producer never waits for the worker, the request fails when no slot is free */
+	if(chSemWaitTimeout(&storage_slot_sem, TIME_IMMEDIATE) != MSG_OK) {
+		chPoolFree(&storage_pool, req);
+		return -3;
+	}
+
+	/* Pool buffer is owned by the worker until the request is done (owner checked above) */
+	bufpool_handoff(buffer, storage_thread);
+	/* Slot reserved, cannot fail */
+	chMBPost(&storage_mb, (msg_t)req, TIME_IMMEDIATE);
+	return 0;
+}
+
+int storage_write_async(const char* prefix, uint8_t* buffer, uint32_t size,
+			storage_done_cb_t cb, void* cb_arg)
+{
+	return storage_post_async(STORAGE_REQ_WRITE, prefix, buffer, size, cb, cb_arg);
+}
+
+int storage_append_async(const char* path, uint8_t* buffer, uint32_t size,
+			 storage_done_cb_t cb, void* cb_arg)
+{
+	return storage_post_async(STORAGE_REQ_APPEND, path, buffer, size, cb, cb_arg);
+}
@@ -0,0 +1,59 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include "common.h"
+
+/*
+ * Storage worker thread, it owns SDCD1 and FatFs (_FS_REENTRANT is 0) and
+ * serves the requests posted in its mailbox one at a time.
+ */
+
+/* Number of asynchronous requests which can be queued */
+#define STORAGE_NB_ASYNC_REQ (8)
+#define STORAGE_WA_SIZE (4096)
+
+typedef int (*storage_func_t)(void* arg);
+/* Called by the worker when an asynchronous request is done, buffer can be reused */
+typedef void (*storage_done_cb_t)(int result, void* cb_arg);
+
+void storage_init(void);
+bool storage_is_worker(void);
+
+/*
+ * Run func(arg) in the worker and return its result (called directly from the worker).
+ * func shall only do the SD/FatFs accesses, never console output (the
+ * worker would wait for the USB host while other requests are pending).
+ */
+int storage_call(storage_func_t func, void* arg);
+
+/*
+ * Asynchronous requests, buffer (and prefix/path string) ownership is
+ * given to the worker until cb is called (cb can be NULL).
+ * buffer shall be a bufpool buffer owned by the caller, it is handed off to
+ * the worker, cb (run by the worker) shall free it or hand it back, without
+ * cb the worker frees it.
+ * Return 0 if the request is queued else < 0 (queue full, never waits, or
+ * -4 if buffer is not a pool buffer owned by the caller), the caller still
+ * owns the buffer.
+ */
+int storage_write_async(const char* prefix, uint8_t* buffer, uint32_t size,
+			storage_done_cb_t cb, void* cb_arg);
+int storage_append_async(const char* path, uint8_t* buffer, uint32_t size,
+			 storage_done_cb_t cb, void* cb_arg);
+
+#endif /* _STORAGE_H_ */
@@ -17,6 +17,10 @@ limitations under the License.
 #include "ch.h"
 #include "hal.h"
 
+#include "common.h"
+#include "usb_stream.h"
+#include "usb_tx.h"
+
 /*
  * Endpoints to be used for USBD1.
  */
@@ -30,13 +34,13 @@ limitations under the License.
 static const uint8_t vcom_device_descriptor_data[18] = {
 	USB_DESC_DEVICE(
 		0x0110,        /* bcdUSB (1.1).                    */
-		0x02,          /* bDeviceClass (CDC).              */
-		0x00,          /* bDeviceSubClass.                 */
-		0x00,          /* bDeviceProtocol.                 */
+		0xEF,          /* bDeviceClass (Miscellaneous).    */
+		0x02,          /* bDeviceSubClass (Common Class).  */
+		0x01,          /* bDeviceProtocol (IAD).           */
 		0x40,          /* bMaxPacketSize.                  */
 		0x0483,        /* idVendor (ST).                   */
 		0x5740,        /* idProduct.                       */
-		0x0200,        /* bcdDevice.                       */
+		0x0201,        /* bcdDevice (USB2 0x0200, see INF).  */
 		1,             /* iManufacturer.                   */
 		2,             /* iProduct.                        */
 		3,             /* iSerialNumber.                   */
@@ -51,16 +55,24 @@ static const USBDescriptor vcom_device_descriptor = {
 	vcom_device_descriptor_data
 };
 
-/* Configuration Descriptor tree for a CDC.*/
-static const uint8_t vcom_configuration_descriptor_data[67] = {
+/* Configuration Descriptor tree for a composite CDC + vendor bulk stream.*/
+static const uint8_t vcom_configuration_descriptor_data[98] = {
 	/* Configuration Descriptor.*/
 	USB_DESC_CONFIGURATION(
-		67,            /* wTotalLength.                    */
-		0x02,          /* bNumInterfaces.                  */
+		98,            /* wTotalLength.                    */
+		0x03,          /* bNumInterfaces.                  */
 		0x01,          /* bConfigurationValue.             */
 		0,             /* iConfiguration.                  */
 		0xC0,          /* bmAttributes (self powered).     */
 		50),           /* bMaxPower (100mA).               */
+	/* Interface Association Descriptor (CDC interfaces 0 and 1).*/
+	USB_DESC_INTERFACE_ASSOCIATION(
+		0x00,          /* bFirstInterface.                 */
+		0x02,          /* bInterfaceCount.                 */
+		0x02,          /* bFunctionClass (CDC).            */
+		0x02,          /* bFunctionSubClass (ACM).         */
+		0x01,          /* bFunctionProtocol.               */
+		0),            /* iInterface.                      */
 	/* Interface Descriptor.*/
 	USB_DESC_INTERFACE(
 		0x00,          /* bInterfaceNumber.                */
@@ -131,6 +143,27 @@ static const uint8_t vcom_configuration_descriptor_data[67] = {
 		USBD1_DATA_REQUEST_EP|0x80,    /* bEndpointAddress.*/
 		0x02,          /* bmAttributes (Bulk).             */
 		0x0040,        /* wMaxPacketSize.                  */
+		0x00),         /* bInterval.                       */
+	/* Vendor Stream Interface Descriptor (libusb).*/
+	USB_DESC_INTERFACE(
+		USBD1_STREAM_INTERFACE, /* bInterfaceNumber.       */
+		0x00,          /* bAlternateSetting.               */
+		0x02,          /* bNumEndpoints.                   */
+		0xFF,          /* bInterfaceClass (Vendor).        */
+		0x00,          /* bInterfaceSubClass.              */
+		0x00,          /* bInterfaceProtocol.              */
+		0x00),         /* iInterface.                      */
+	/* Endpoint 3 OUT Descriptor.*/
+	USB_DESC_ENDPOINT(
+		USBD1_STREAM_EP,               /* bEndpointAddress.*/
+		0x02,          /* bmAttributes (Bulk).             */
+		USBD1_STREAM_EP_SIZE,          /* wMaxPacketSize.  */
+		0x00),         /* bInterval.                       */
+	/* Endpoint 3 IN Descriptor.*/
+	USB_DESC_ENDPOINT(
+		USBD1_STREAM_EP|0x80,          /* bEndpointAddress.*/
+		0x02,          /* bmAttributes (Bulk).             */
+		USBD1_STREAM_EP_SIZE,          /* wMaxPacketSize.  */
 		0x00)          /* bInterval.                       */
 };
 
@@ -234,13 +267,13 @@ static USBOutEndpointState ep1outstate;
 static const USBEndpointConfig ep1config = {
 	USB_EP_MODE_TYPE_BULK,
 	NULL,
-	sduDataTransmitted,
-	sduDataReceived,
+	usbtx_data_transmitted,
+	console_data_received,
 	0x0040,
 	0x0040,
 	&ep1instate,
 	&ep1outstate,
-	2,
+	4, /* TX FIFO of 4 packets for back-to-back IN transfers */
 	NULL
 };
 
@@ -274,6 +307,9 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 
 	switch (event) {
 	case USB_EVENT_RESET:
+		chSysLockFromISR();
+		usb_stream_reset_hookI(usbp);
+		chSysUnlockFromISR();
 		return;
 	case USB_EVENT_ADDRESS:
 		return;
@@ -289,6 +325,12 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 		/* Resetting the state of the CDC subsystem.*/
 		sduConfigureHookI(&SDU1);
 
+		/* Console spawned by main thread */
+		console_usb_configured_hookI(usbp);
+
+		/* Vendor stream endpoint */
+		usb_stream_configure_hookI(usbp);
+
 		chSysUnlockFromISR();
 		return;
 	case USB_EVENT_SUSPEND:
@@ -299,6 +341,8 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 			// Reset queues and unlock waiting threads
 			chIQResetI(&SDU1.iqueue);
 			chOQResetI(&SDU1.oqueue);
+			usbtx_reset_hookI(usbp);
+			usb_stream_reset_hookI(usbp);
 			chSysUnlockFromISR();
 		}
 		return;
@@ -17,6 +17,10 @@ limitations under the License.
 #include "ch.h"
 #include "hal.h"
 
+#include "common.h"
+#include "usb_msd.h"
+#include "usb_tx.h"
+
 /*
  * Endpoints to be used for USBD2.
  */
@@ -30,9 +34,9 @@ limitations under the License.
 static const uint8_t vcom_device_descriptor_data[18] = {
 	USB_DESC_DEVICE(
 		0x0110,        /* bcdUSB (1.1).                    */
-		0x02,          /* bDeviceClass (CDC).              */
-		0x00,          /* bDeviceSubClass.                 */
-		0x00,          /* bDeviceProtocol.                 */
+		0xEF,          /* bDeviceClass (Miscellaneous).    */
+		0x02,          /* bDeviceSubClass (Common Class).  */
+		0x01,          /* bDeviceProtocol (IAD).           */
 		0x40,          /* bMaxPacketSize.                  */
 		0x0483,        /* idVendor (ST).                   */
 		0x5740,        /* idProduct.                       */
@@ -51,16 +55,24 @@ static const USBDescriptor vcom_device_descriptor = {
 	vcom_device_descriptor_data
 };
 
-/* Configuration Descriptor tree for a CDC.*/
-static const uint8_t vcom_configuration_descriptor_data[67] = {
+/* Configuration Descriptor tree for a composite CDC + Mass Storage.*/
+static const uint8_t vcom_configuration_descriptor_data[98] = {
 	/* Configuration Descriptor.*/
 	USB_DESC_CONFIGURATION(
-		67,            /* wTotalLength.                    */
-		0x02,          /* bNumInterfaces.                  */
+		98,            /* wTotalLength.                    */
+		0x03,          /* bNumInterfaces.                  */
 		0x01,          /* bConfigurationValue.             */
 		0,             /* iConfiguration.                  */
 		0xC0,          /* bmAttributes (self powered).     */
 		50),           /* bMaxPower (100mA).               */
+	/* Interface Association Descriptor (CDC interfaces 0 and 1).*/
+	USB_DESC_INTERFACE_ASSOCIATION(
+		0x00,          /* bFirstInterface.                 */
+		0x02,          /* bInterfaceCount.                 */
+		0x02,          /* bFunctionClass (CDC).            */
+		0x02,          /* bFunctionSubClass (ACM).         */
+		0x01,          /* bFunctionProtocol.               */
+		0),            /* iInterface.                      */
 	/* Interface Descriptor.*/
 	USB_DESC_INTERFACE(
 		0x00,          /* bInterfaceNumber.                */
@@ -128,6 +140,27 @@ static const uint8_t vcom_configuration_descriptor_data[67] = {
 		USBD2_DATA_REQUEST_EP|0x80,    /* bEndpointAddress.*/
 		0x02,          /* bmAttributes (Bulk). */
 		0x0040,        /* wMaxPacketSize. */
+		0x00),         /* bInterval. */
+	/* Mass Storage Interface Descriptor.*/
+	USB_DESC_INTERFACE(
+		USBD2_MSD_INTERFACE, /* bInterfaceNumber. */
+		0x00,          /* bAlternateSetting. */
+		0x02,          /* bNumEndpoints. */
+		0x08,          /* bInterfaceClass (Mass Storage). */
+		0x06,          /* bInterfaceSubClass (SCSI transparent). */
+		0x50,          /* bInterfaceProtocol (Bulk-Only). */
+		0x00),         /* iInterface. */
+	/* Endpoint 3 OUT Descriptor.*/
+	USB_DESC_ENDPOINT(
+		USBD2_MSD_EP,  /* bEndpointAddress.*/
+		0x02,          /* bmAttributes (Bulk). */
+		USBD2_MSD_EP_SIZE, /* wMaxPacketSize. */
+		0x00),         /* bInterval. */
+	/* Endpoint 3 IN Descriptor.*/
+	USB_DESC_ENDPOINT(
+		USBD2_MSD_EP|0x80, /* bEndpointAddress.*/
+		0x02,          /* bmAttributes (Bulk). */
+		USBD2_MSD_EP_SIZE, /* wMaxPacketSize. */
 		0x00)          /* bInterval. */
 };
 
@@ -232,13 +265,13 @@ static USBOutEndpointState ep1outstate;
 static const USBEndpointConfig ep1config = {
 	USB_EP_MODE_TYPE_BULK,
 	NULL,
-	sduDataTransmitted,
-	sduDataReceived,
+	usbtx_data_transmitted,
+	console_data_received,
 	0x0040,
 	0x0040,
 	&ep1instate,
 	&ep1outstate,
-	2,
+	4, /* TX FIFO of 4 packets for back-to-back IN transfers */
 	NULL
 };
 
@@ -272,6 +305,9 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 
 	switch (event) {
 	case USB_EVENT_RESET:
+		chSysLockFromISR();
+		usb_msd_reset_hookI(usbp);
+		chSysUnlockFromISR();
 		return;
 	case USB_EVENT_ADDRESS:
 		return;
@@ -287,6 +323,12 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 		/* Resetting the state of the CDC subsystem.*/
 		sduConfigureHookI(&SDU2);
 
+		/* Console spawned by main thread */
+		console_usb_configured_hookI(usbp);
+
+		/* Mass Storage endpoint and thread */
+		usb_msd_configure_hookI(usbp);
+
 		chSysUnlockFromISR();
 		return;
 	case USB_EVENT_SUSPEND:
@@ -297,6 +339,8 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 			// Reset queues and unlock waiting threads
 			chIQResetI(&SDU2.iqueue);
 			chOQResetI(&SDU2.oqueue);
+			usbtx_reset_hookI(usbp);
+			usb_msd_reset_hookI(usbp);
 			chSysUnlockFromISR();
 		}
 		return;
@@ -308,13 +352,23 @@ static void usb_event(USBDriver *usbp, usbevent_t event)
 	return;
 }
 
+/*
+ * Handles the class requests, Mass Storage interface first then CDC.
+ */
+static bool requests_hook(USBDriver *usbp)
+{
+	if (usb_msd_requests_hook(usbp))
+		return TRUE;
+	return sduRequestsHook(usbp);
+}
+
 /*
  * USB driver configuration.
  */
 const USBConfig usb2cfg = {
 	usb_event,
 	get_descriptor,
-	sduRequestsHook,
+	requests_hook,
 	NULL
 };
 
@@ -0,0 +1,625 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <string.h>
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "microsd.h"
+#include "storage.h"
+#include "usb_msd.h"
+
+/*
+ * USB Mass Storage Bulk-Only Transport.
+ * The medium is only exposed to the host after "usb_msd on", FatFs is then
+ * locked out (sd_mount_check() fails) until "usb_msd off" or a host eject.
+ * SD reads/writes are double buffered to overlap SDIO and USB transfers.
+ */
+#define MSD_WA_SIZE		(1024)
+#define MSD_BUF_SECTORS		(8) /* 4KB per buffer */
+
+#define MSD_CBW_SIGNATURE	(0x43425355)
+#define MSD_CSW_SIGNATURE	(0x53425355)
+#define MSD_CBW_SIZE		(31)
+#define MSD_CSW_SIZE		(13)
+#define MSD_CBW_FLAGS_IN	(0x80)
+
+#define MSD_CSW_PASSED		(0x00)
+#define MSD_CSW_FAILED		(0x01)
+#define MSD_CSW_PHASE_ERROR	(0x02)
+
+/* Class requests */
+#define MSD_REQ_RESET		(0xFF)
+#define MSD_REQ_GET_MAX_LUN	(0xFE)
+
+/* SCSI commands */
+#define SCSI_TEST_UNIT_READY	(0x00)
+#define SCSI_REQUEST_SENSE	(0x03)
+#define SCSI_INQUIRY		(0x12)
+#define SCSI_MODE_SENSE6	(0x1A)
+#define SCSI_START_STOP_UNIT	(0x1B)
+#define SCSI_MEDIA_REMOVAL	(0x1E)
+#define SCSI_READ_FORMAT_CAP	(0x23)
+#define SCSI_READ_CAPACITY10	(0x25)
+#define SCSI_READ10		(0x28)
+#define SCSI_WRITE10		(0x2A)
+#define SCSI_VERIFY10		(0x2F)
+#define SCSI_SYNC_CACHE10	(0x35)
+
+/* Sense keys and additional sense codes */
+#define SCSI_SENSE_NO_SENSE		(0x00)
+#define SCSI_SENSE_NOT_READY		(0x02)
+#define SCSI_SENSE_MEDIUM_ERROR		(0x03)
+#define SCSI_SENSE_ILLEGAL_REQUEST	(0x05)
+#define SCSI_SENSE_UNIT_ATTENTION	(0x06)
+
+#define SCSI_ASC_INVALID_COMMAND	(0x20)
+#define SCSI_ASC_LBA_OUT_OF_RANGE	(0x21)
+#define SCSI_ASC_WRITE_FAULT		(0x0C)
+#define SCSI_ASC_READ_ERROR		(0x11)
+#define SCSI_ASC_MEDIUM_CHANGED		(0x28)
+#define SCSI_ASC_MEDIUM_NOT_PRESENT	(0x3A)
+
+typedef struct __attribute__((packed)) {
+	uint32_t signature;
+	uint32_t tag;
+	uint32_t data_len;
+	uint8_t flags;
+	uint8_t lun;
+	uint8_t cb_len;
+	uint8_t cb[16];
+} msd_cbw_t;
+
+typedef struct __attribute__((packed)) {
+	uint32_t signature;
+	uint32_t tag;
+	uint32_t residue;
+	uint8_t status;
+} msd_csw_t;
+
+static USBDriver* const msd_usbp = &USBD2;
+
+static binary_semaphore_t msd_in_sem;
+static binary_semaphore_t msd_out_sem;
+static volatile bool msd_configured = FALSE;
+static volatile bool msd_reset = FALSE;
+
+/* Medium exposed to the host, SDCD1 is connected and owned by this driver */
+static volatile bool msd_medium_present = FALSE;
+static mutex_t msd_medium_mtx;
+
+static uint8_t msd_sense_key;
+static uint8_t msd_sense_asc;
+
+static uint8_t msd_cbw_buf[USBD2_MSD_EP_SIZE] __attribute__ ((aligned (4)));
+static msd_csw_t msd_csw;
+static uint8_t msd_resp[36] __attribute__ ((aligned (4)));
+static uint8_t msd_buf[2][MSD_BUF_SECTORS * MMCSD_BLOCK_SIZE] __attribute__ ((aligned (4)));
+
+static uint32_t msd_nb_read_kb;
+static uint32_t msd_nb_write_kb;
+
+static THD_WORKING_AREA(waMsd, MSD_WA_SIZE);
+
+static const uint8_t msd_inquiry[36] = {
+	0x00, /* Direct access block device */
+	0x80, /* Removable */
+	0x04, /* SPC-2 */
+	0x02, /* Response data format */
+	36 - 5, /* Additional length */
+	0x00, 0x00, 0x00,
+	'H', 'y', 'd', 'r', 'a', 'B', 'u', 's', /* Vendor */
+	'S', 'D', ' ', 'c', 'a', 'r', 'd', ' ', /* Product */
+	' ', ' ', ' ', ' ', ' ', ' ', ' ', ' ',
+	'1', '.', '0', ' ' /* Revision */
+};
+
+/**
+ * @brief   IN/OUT EP3 states.
+ */
+static USBInEndpointState ep3instate;
+static USBOutEndpointState ep3outstate;
+
+static void msd_data_transmitted(USBDriver *usbp, usbep_t ep)
+{
+	(void)usbp;
+	(void)ep;
+	chSysLockFromISR();
+	chBSemSignalI(&msd_in_sem);
+	chSysUnlockFromISR();
+}
+
+static void msd_data_received(USBDriver *usbp, usbep_t ep)
+{
+	(void)usbp;
+	(void)ep;
+	chSysLockFromISR();
+	chBSemSignalI(&msd_out_sem);
+	chSysUnlockFromISR();
+}
+
+/**
+ * @brief   EP3 initialization structure (both IN and OUT).
+ */
+static const USBEndpointConfig ep3config = {
+	USB_EP_MODE_TYPE_BULK,
+	NULL,
+	msd_data_transmitted,
+	msd_data_received,
+	USBD2_MSD_EP_SIZE,
+	USBD2_MSD_EP_SIZE,
+	&ep3instate,
+	&ep3outstate,
+	2,
+	NULL
+};
+
+void usb_msd_configure_hookI(USBDriver *usbp)
+{
+	usbInitEndpointI(usbp, USBD2_MSD_EP, &ep3config);
+	msd_configured = TRUE;
+	msd_reset = TRUE;
+	chBSemSignalI(&msd_in_sem);
+	chBSemSignalI(&msd_out_sem);
+}
+
+void usb_msd_reset_hookI(USBDriver *usbp)
+{
+	(void)usbp;
+	msd_configured = FALSE;
+	msd_reset = TRUE;
+	/* Unlock the thread waiting for a transfer */
+	chBSemSignalI(&msd_in_sem);
+	chBSemSignalI(&msd_out_sem);
+}
+
+/* Bulk-Only class requests on the MSD interface, return TRUE if handled */
+bool usb_msd_requests_hook(USBDriver *usbp)
+{
+	static const uint8_t max_lun = 0;
+
+	if( ((usbp->setup[0] & USB_RTYPE_TYPE_MASK) != USB_RTYPE_TYPE_CLASS) ||
+	    ((usbp->setup[0] & USB_RTYPE_RECIPIENT_MASK) != USB_RTYPE_RECIPIENT_INTERFACE) ||
+	    (usbp->setup[4] != USBD2_MSD_INTERFACE) )
+		return FALSE;
+
+	switch(usbp->setup[1]) {
+	case MSD_REQ_RESET:
+		chSysLockFromISR();
+		msd_reset = TRUE;
+		chBSemSignalI(&msd_in_sem);
+		chBSemSignalI(&msd_out_sem);
+		chSysUnlockFromISR();
+		usbSetupTransfer(usbp, NULL, 0, NULL);
+		return TRUE;
+	case MSD_REQ_GET_MAX_LUN:
+		usbSetupTransfer(usbp, (uint8_t *)&max_lun, 1, NULL);
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+/* Start an IN transfer, return FALSE if USB was reset */
+static bool msd_start_transmit(const uint8_t* buf, uint32_t size)
+{
+	usbPrepareTransmit(msd_usbp, USBD2_MSD_EP, buf, size);
+	chSysLock();
+	if(msd_reset || (usbGetDriverStateI(msd_usbp) != USB_ACTIVE)) {
+		chSysUnlock();
+		return FALSE;
+	}
+	usbStartTransmitI(msd_usbp, USBD2_MSD_EP);
+	chSysUnlock();
+	return TRUE;
+}
+
+static bool msd_start_receive(uint8_t* buf, uint32_t size)
+{
+	usbPrepareReceive(msd_usbp, USBD2_MSD_EP, buf, size);
+	chSysLock();
+	if(msd_reset || (usbGetDriverStateI(msd_usbp) != USB_ACTIVE)) {
+		chSysUnlock();
+		return FALSE;
+	}
+	usbStartReceiveI(msd_usbp, USBD2_MSD_EP);
+	chSysUnlock();
+	return TRUE;
+}
+
+/* Wait end of transfer, return FALSE if USB was reset */
+static bool msd_wait(binary_semaphore_t* sem)
+{
+	chBSemWait(sem);
+	return !msd_reset;
+}
+
+static bool msd_transmit(const uint8_t* buf, uint32_t size)
+{
+	if(!msd_start_transmit(buf, size))
+		return FALSE;
+	return msd_wait(&msd_in_sem);
+}
+
+static void msd_set_sense(uint8_t key, uint8_t asc)
+{
+	msd_sense_key = key;
+	msd_sense_asc = asc;
+}
+
+/* Stall the data stage endpoint and wait for the host to clear it */
+static void msd_stall(bool in)
+{
+	chSysLock();
+	if(in)
+		usbStallTransmitI(msd_usbp, USBD2_MSD_EP);
+	else
+		usbStallReceiveI(msd_usbp, USBD2_MSD_EP);
+	chSysUnlock();
+
+	while(!msd_reset) {
+		if(in && (usb_lld_get_status_in(msd_usbp, USBD2_MSD_EP) != EP_STATUS_STALLED))
+			break;
+		if(!in && (usb_lld_get_status_out(msd_usbp, USBD2_MSD_EP) != EP_STATUS_STALLED))
+			break;
+		chThdSleepMilliseconds(1);
+	}
+}
+
+static inline uint32_t msd_be32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void msd_put_be32(uint8_t* p, uint32_t val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+/* Read blocks and send them, next chunk is read while the previous one is sent */
+static bool msd_read(uint32_t lba, uint32_t nb_blocks, uint32_t* done)
+{
+	uint32_t chunk, next;
+	int cur;
+
+	cur = 0;
+	chunk = MIN(nb_blocks, MSD_BUF_SECTORS);
+	if(sdcRead(&SDCD1, lba, msd_buf[cur], chunk)) {
+		msd_set_sense(SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_READ_ERROR);
+		return FALSE;
+	}
+	while(nb_blocks > 0) {
+		if(!msd_start_transmit(msd_buf[cur], chunk * MMCSD_BLOCK_SIZE))
+			return FALSE;
+		nb_blocks -= chunk;
+		lba += chunk;
+
+		next = MIN(nb_blocks, MSD_BUF_SECTORS);
+		if(next > 0) {
+			if(sdcRead(&SDCD1, lba, msd_buf[cur ^ 1], next)) {
+				msd_wait(&msd_in_sem);
+				msd_set_sense(SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_READ_ERROR);
+				return FALSE;
+			}
+		}
+		if(!msd_wait(&msd_in_sem))
+			return FALSE;
+
+		*done += chunk * MMCSD_BLOCK_SIZE;
+		msd_nb_read_kb += chunk / 2;
+		cur ^= 1;
+		chunk = next;
+	}
+	return TRUE;
+}
+
+/* Receive blocks and write them, next chunk is received while the previous one is written */
+static bool msd_write(uint32_t lba, uint32_t nb_blocks, uint32_t* done)
+{
+	uint32_t chunk, next;
+	int cur;
+
+	cur = 0;
+	chunk = MIN(nb_blocks, MSD_BUF_SECTORS);
+	if(!msd_start_receive(msd_buf[cur], chunk * MMCSD_BLOCK_SIZE))
+		return FALSE;
+	while(nb_blocks > 0) {
+		if(!msd_wait(&msd_out_sem))
+			return FALSE;
+		nb_blocks -= chunk;
+
+		next = MIN(nb_blocks, MSD_BUF_SECTORS);
+		if(next > 0) {
+			if(!msd_start_receive(msd_buf[cur ^ 1], next * MMCSD_BLOCK_SIZE))
+				return FALSE;
+		}
+		if(sdcWrite(&SDCD1, lba, msd_buf[cur], chunk)) {
+			if(next > 0)
+				msd_wait(&msd_out_sem);
+			msd_set_sense(SCSI_SENSE_MEDIUM_ERROR, SCSI_ASC_WRITE_FAULT);
+			return FALSE;
+		}
+		lba += chunk;
+
+		*done += chunk * MMCSD_BLOCK_SIZE;
+		msd_nb_write_kb += chunk / 2;
+		cur ^= 1;
+		chunk = next;
+	}
+	return TRUE;
+}
+
+/* Storage worker: flush and disconnect the card, FatFs is the owner again */
+static int msd_release_call(void* arg)
+{
+	(void)arg;
+
+	sdcSync(&SDCD1);
+	sdcDisconnect(&SDCD1);
+	sd_set_host_owned(FALSE);
+	return 0;
+}
+
+/*
+ * Host eject or "usb_msd off" with msd_medium_mtx locked, give the card
+ * back to FatFs. The worker call does not lock msd_medium_mtx.
+ */
+static void msd_release_medium(void)
+{
+	if(!msd_medium_present)
+		return;
+	msd_medium_present = FALSE;
+	storage_call(msd_release_call, NULL);
+}
+
+/*
+ * Execute one SCSI command, data stage is done here for read/write,
+ * other commands return their response in msd_resp (resp_len).
+ */
+static uint8_t msd_scsi(msd_cbw_t* cbw, uint32_t* resp_len, uint32_t* done)
+{
+	uint32_t lba, nb_blocks;
+	uint8_t opcode;
+
+	opcode = cbw->cb[0];
+	*resp_len = 0;
+
+	/* Commands which do not need the medium */
+	switch(opcode) {
+	case SCSI_INQUIRY:
+		memcpy(msd_resp, msd_inquiry, sizeof(msd_inquiry));
+		*resp_len = sizeof(msd_inquiry);
+		return MSD_CSW_PASSED;
+	case SCSI_REQUEST_SENSE:
+		memset(msd_resp, 0, 18);
+		msd_resp[0] = 0x70;
+		msd_resp[2] = msd_sense_key;
+		msd_resp[7] = 10;
+		msd_resp[12] = msd_sense_asc;
+		*resp_len = 18;
+		msd_set_sense(SCSI_SENSE_NO_SENSE, 0);
+		return MSD_CSW_PASSED;
+	case SCSI_MEDIA_REMOVAL:
+		return MSD_CSW_PASSED;
+	default:
+		break;
+	}
+
+	if(!msd_medium_present) {
+		msd_set_sense(SCSI_SENSE_NOT_READY, SCSI_ASC_MEDIUM_NOT_PRESENT);
+		return MSD_CSW_FAILED;
+	}
+	/* Medium just inserted ("usb_msd on"), report it once */
+	if(msd_sense_key == SCSI_SENSE_UNIT_ATTENTION)
+		return MSD_CSW_FAILED;
+
+	switch(opcode) {
+	case SCSI_TEST_UNIT_READY:
+	case SCSI_VERIFY10:
+		return MSD_CSW_PASSED;
+
+	case SCSI_SYNC_CACHE10:
+		sdcSync(&SDCD1);
+		return MSD_CSW_PASSED;
+
+	case SCSI_START_STOP_UNIT:
+		/* LoEj=1 Start=0: host eject */
+		if( (cbw->cb[4] & 0x03) == 0x02 )
+			msd_release_medium();
+		return MSD_CSW_PASSED;
+
+	case SCSI_MODE_SENSE6:
+		memset(msd_resp, 0, 4);
+		msd_resp[0] = 3;
+		if(blkIsWriteProtected(&SDCD1))
+			msd_resp[2] = 0x80;
+		*resp_len = 4;
+		return MSD_CSW_PASSED;
+
+	case SCSI_READ_FORMAT_CAP:
+		memset(msd_resp, 0, 12);
+		msd_resp[3] = 8;
+		msd_put_be32(&msd_resp[4], SDCD1.capacity);
+		msd_resp[8] = 0x02; /* Formatted media */
+		msd_resp[10] = MMCSD_BLOCK_SIZE >> 8;
+		*resp_len = 12;
+		return MSD_CSW_PASSED;
+
+	case SCSI_READ_CAPACITY10:
+		msd_put_be32(&msd_resp[0], SDCD1.capacity - 1);
+		msd_put_be32(&msd_resp[4], MMCSD_BLOCK_SIZE);
+		*resp_len = 8;
+		return MSD_CSW_PASSED;
+
+	case SCSI_READ10:
+	case SCSI_WRITE10:
+		lba = msd_be32(&cbw->cb[2]);
+		nb_blocks = ((uint32_t)cbw->cb[7] << 8) | cbw->cb[8];
+		if( ((lba + nb_blocks) > SDCD1.capacity) ||
+		    ((nb_blocks * MMCSD_BLOCK_SIZE) > cbw->data_len) ) {
+			msd_set_sense(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_LBA_OUT_OF_RANGE);
+			return MSD_CSW_FAILED;
+		}
+		if(opcode == SCSI_READ10) {
+			if(!msd_read(lba, nb_blocks, done))
+				return MSD_CSW_FAILED;
+		} else {
+			if(!msd_write(lba, nb_blocks, done))
+				return MSD_CSW_FAILED;
+		}
+		return MSD_CSW_PASSED;
+
+	default:
+		msd_set_sense(SCSI_SENSE_ILLEGAL_REQUEST, SCSI_ASC_INVALID_COMMAND);
+		return MSD_CSW_FAILED;
+	}
+}
+
+static THD_FUNCTION(msd_thread, arg)
+{
+	msd_cbw_t* cbw = (msd_cbw_t*)msd_cbw_buf;
+	uint32_t resp_len, done, size;
+	bool dir_in;
+	uint8_t status;
+
+	(void)arg;
+	chRegSetThreadName("usb_msd");
+
+	while(TRUE) {
+		if(!msd_configured) {
+			chThdSleepMilliseconds(10);
+			continue;
+		}
+		chSysLock();
+		msd_reset = FALSE;
+		chBSemResetI(&msd_in_sem, TRUE);
+		chBSemResetI(&msd_out_sem, TRUE);
+		chSysUnlock();
+
+		/* Command stage */
+		if(!msd_start_receive(msd_cbw_buf, sizeof(msd_cbw_buf)) ||
+		   !msd_wait(&msd_out_sem))
+			continue;
+		chSysLock();
+		size = usbGetReceiveTransactionSizeI(msd_usbp, USBD2_MSD_EP);
+		chSysUnlock();
+		if( (size != MSD_CBW_SIZE) ||
+		    (cbw->signature != MSD_CBW_SIGNATURE) ) {
+			/* Invalid CBW, wait for Reset Recovery */
+			msd_stall(TRUE);
+			msd_stall(FALSE);
+			continue;
+		}
+
+		/* Data stage */
+		dir_in = (cbw->flags & MSD_CBW_FLAGS_IN) != 0;
+		done = 0;
+		chMtxLock(&msd_medium_mtx);
+		status = msd_scsi(cbw, &resp_len, &done);
+		chMtxUnlock(&msd_medium_mtx);
+		if(msd_reset)
+			continue;
+
+		if( (resp_len > 0) && dir_in ) {
+			resp_len = MIN(resp_len, cbw->data_len);
+			if(!msd_transmit(msd_resp, resp_len))
+				continue;
+			done = resp_len;
+		}
+		if(done < cbw->data_len) {
+			/* Host expects more data than sent/received */
+			msd_stall(dir_in);
+		}
+
+		/* Status stage */
+		msd_csw.signature = MSD_CSW_SIGNATURE;
+		msd_csw.tag = cbw->tag;
+		msd_csw.residue = cbw->data_len - done;
+		msd_csw.status = status;
+		msd_transmit((uint8_t*)&msd_csw, MSD_CSW_SIZE);
+	}
+	return 0;
+}
+
+void usb_msd_init(void)
+{
+	chBSemObjectInit(&msd_in_sem, TRUE);
+	chBSemObjectInit(&msd_out_sem, TRUE);
+	chMtxObjectInit(&msd_medium_mtx);
+
+	chThdCreateStatic(waMsd, sizeof(waMsd), NORMALPRIO, msd_thread, NULL);
+}
+
+/*
+ * Storage worker: flush and release the volume, the host becomes the owner.
+ * Return 0 if OK, -1 if already on, -2 if the card does not answer.
+ */
+static int usb_msd_on_call(void* arg)
+{
+	(void)arg;
+
+	if(msd_medium_present)
+		return -1;
+	umount();
+	if(sdcConnect(&SDCD1))
+		return -2;
+	sd_set_host_owned(TRUE);
+
+	chMtxLock(&msd_medium_mtx);
+	msd_nb_read_kb = 0;
+	msd_nb_write_kb = 0;
+	msd_set_sense(SCSI_SENSE_UNIT_ATTENTION, SCSI_ASC_MEDIUM_CHANGED);
+	msd_medium_present = TRUE;
+	chMtxUnlock(&msd_medium_mtx);
+	return 0;
+}
+
+void cmd_usb_msd(t_hydra_console *con, int argc, const char* const* argv)
+{
+	if(argc < 2) {
+		cprintf(con, "USB MSD medium %s, host %sconnected\r\n",
+			msd_medium_present ? "exposed" : "not exposed",
+			msd_configured ? "" : "not ");
+		cprintf(con, "Read %ld KB, written %ld KB\r\n", msd_nb_read_kb, msd_nb_write_kb);
+		return;
+	}
+
+	if(strcmp(argv[1], "on") == 0) {
+		switch(storage_call(usb_msd_on_call, NULL)) {
+		case -1:
+			cprintf(con, "Already on\r\n");
+			break;
+		case -2:
+			cprintf(con, "sdcConnect(&SDCD1) error\r\n");
+			break;
+		default:
+			cprintf(con, "SD card exposed to USB host, eject it on the host or use \"%s off\"\r\n", argv[0]);
+			break;
+		}
+	} else if(strcmp(argv[1], "off") == 0) {
+		/* Wait end of the current SCSI command, FatFs does not use the card */
+		chMtxLock(&msd_medium_mtx);
+		msd_release_medium();
+		chMtxUnlock(&msd_medium_mtx);
+		cprintf(con, "SD card released (read %ld KB, written %ld KB)\r\n",
+			msd_nb_read_kb, msd_nb_write_kb);
+	} else {
+		cprintf(con, "usage: %s [on|off]\r\n", argv[0]);
+	}
+}
@@ -0,0 +1,38 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _USB_MSD_H_
+#define _USB_MSD_H_
+
+#include "common.h"
+
+/*
+ * USB Mass Storage (Bulk-Only Transport, SCSI transparent command set)
+ * exposing SDCD1 on USB2, composite with the CDC console.
+ */
+#define USBD2_MSD_INTERFACE	2
+#define USBD2_MSD_EP		3
+#define USBD2_MSD_EP_SIZE	0x0040
+
+void usb_msd_init(void);
+
+/* Called from usb2cfg.c USB callbacks (ISR context) */
+void usb_msd_configure_hookI(USBDriver *usbp);
+void usb_msd_reset_hookI(USBDriver *usbp);
+bool usb_msd_requests_hook(USBDriver *usbp);
+
+void cmd_usb_msd(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _USB_MSD_H_ */
@@ -0,0 +1,466 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <string.h>
+#include <stdlib.h> /* strtoul */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "bufpool.h"
+#include "usb_stream.h"
+
+/* usb_stream test frame size and default size */
+#define STREAM_TEST_FRAME_SIZE (16384)
+#define STREAM_TEST_DEFAULT_KB (1024)
+
+#define STREAM_EVT_IN		EVENT_MASK(0) /* IN transfer done */
+#define STREAM_EVT_OUT		EVENT_MASK(1) /* OUT packet received */
+#define STREAM_EVT_POST		EVENT_MASK(2) /* Frame queued */
+#define STREAM_EVT_CONFIG	EVENT_MASK(3) /* Host configured the device */
+#define STREAM_EVT_RESET	EVENT_MASK(4) /* USB reset/unplug */
+
+static USBDriver* const stream_usbp = &USBD1;
+static thread_t* stream_thread = NULL;
+static THD_WORKING_AREA(waStream, USB_STREAM_WA_SIZE);
+
+static volatile bool stream_configured = FALSE;
+
+/* Frames posted by the producers, a slot is reserved before the post */
+static mailbox_t stream_mb;
+static msg_t stream_mb_buf[USB_STREAM_NB_QUEUE];
+static semaphore_t stream_slots;
+
+static uint8_t stream_rx_buf[USBD1_STREAM_EP_SIZE] __attribute__ ((aligned (4)));
+
+/* Stream thread state */
+static uint8_t* stream_cur; /* Frame being transmitted */
+static bool stream_in_busy;
+static bool stream_zlp; /* Zero length packet needed after stream_cur */
+static uint32_t stream_seq;
+static uint32_t stream_credit;
+
+/* Statistics */
+static uint32_t stream_nb_frames;
+static uint32_t stream_nb_bytes;
+static uint32_t stream_nb_bad_rx;
+static volatile uint32_t stream_nb_lost;
+static volatile bool stream_lost_pending;
+/* Bytes of the frames queued or in flight (USB_STREAM_POOL_MAX) */
+static uint32_t stream_pool_used;
+
+/**
+ * @brief   IN/OUT EP3 states.
+ */
+static USBInEndpointState ep3instate;
+static USBOutEndpointState ep3outstate;
+
+static void stream_data_transmitted(USBDriver *usbp, usbep_t ep)
+{
+	(void)usbp;
+	(void)ep;
+	chSysLockFromISR();
+	chEvtSignalI(stream_thread, STREAM_EVT_IN);
+	chSysUnlockFromISR();
+}
+
+static void stream_data_received(USBDriver *usbp, usbep_t ep)
+{
+	(void)usbp;
+	(void)ep;
+	chSysLockFromISR();
+	chEvtSignalI(stream_thread, STREAM_EVT_OUT);
+	chSysUnlockFromISR();
+}
+
+/**
+ * @brief   EP3 initialization structure (both IN and OUT).
+ */
+static const USBEndpointConfig ep3config = {
+	USB_EP_MODE_TYPE_BULK,
+	NULL,
+	stream_data_transmitted,
+	stream_data_received,
+	USBD1_STREAM_EP_SIZE,
+	USBD1_STREAM_EP_SIZE,
+	&ep3instate,
+	&ep3outstate,
+	2,
+	NULL
+};
+
+void usb_stream_configure_hookI(USBDriver *usbp)
+{
+	usbInitEndpointI(usbp, USBD1_STREAM_EP, &ep3config);
+	stream_configured = TRUE;
+	if(stream_thread != NULL)
+		chEvtSignalI(stream_thread, STREAM_EVT_CONFIG);
+}
+
+void usb_stream_reset_hookI(USBDriver *usbp)
+{
+	(void)usbp;
+	stream_configured = FALSE;
+	if(stream_thread != NULL)
+		chEvtSignalI(stream_thread, STREAM_EVT_RESET);
+}
+
+static inline uint32_t stream_get32(const uint8_t* p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void stream_put32(uint8_t* p, uint32_t val)
+{
+	p[0] = val;
+	p[1] = val >> 8;
+	p[2] = val >> 16;
+	p[3] = val >> 24;
+}
+
+/* Start an IN transfer, return FALSE if USB was reset */
+static bool stream_start_transmit(const uint8_t* buf, uint32_t size)
+{
+	usbPrepareTransmit(stream_usbp, USBD1_STREAM_EP, buf, size);
+	chSysLock();
+	if(!stream_configured || (usbGetDriverStateI(stream_usbp) != USB_ACTIVE)) {
+		chSysUnlock();
+		return FALSE;
+	}
+	usbStartTransmitI(stream_usbp, USBD1_STREAM_EP);
+	chSysUnlock();
+	return TRUE;
+}
+
+static bool stream_start_receive(void)
+{
+	usbPrepareReceive(stream_usbp, USBD1_STREAM_EP, stream_rx_buf, sizeof(stream_rx_buf));
+	chSysLock();
+	if(!stream_configured || (usbGetDriverStateI(stream_usbp) != USB_ACTIVE)) {
+		chSysUnlock();
+		return FALSE;
+	}
+	usbStartReceiveI(stream_usbp, USBD1_STREAM_EP);
+	chSysUnlock();
+	return TRUE;
+}
+
+/* Frame sent or dropped by the stream thread, buffer goes back to the pool */
+static void stream_free(uint8_t* frame)
+{
+	uint32_t size;
+
+	size = USB_STREAM_HEADER_SIZE + stream_get32(&frame[8]);
+	chSysLock();
+	stream_pool_used -= size;
+	chSysUnlock();
+	bufpool_free(frame);
+}
+
+static void stream_lost(void)
+{
+	chSysLock();
+	stream_nb_lost++;
+	stream_lost_pending = TRUE;
+	chSysUnlock();
+}
+
+/* Drop the frame in progress, the USB reset cancelled the transfer */
+static void stream_abort(void)
+{
+	if(stream_cur != NULL) {
+		stream_free(stream_cur);
+		stream_cur = NULL;
+	}
+	stream_in_busy = FALSE;
+	stream_zlp = FALSE;
+	stream_credit = 0;
+}
+
+/* Host to device frame */
+static void stream_rx(void)
+{
+	uint32_t size, credit;
+
+	chSysLock();
+	size = usbGetReceiveTransactionSizeI(stream_usbp, USBD1_STREAM_EP);
+	chSysUnlock();
+
+	if( (size < USB_STREAM_HEADER_SIZE) ||
+	    ((stream_rx_buf[0] | (stream_rx_buf[1] << 8)) != USB_STREAM_MAGIC) ) {
+		stream_nb_bad_rx++;
+		return;
+	}
+
+	switch(stream_rx_buf[2]) {
+	case USB_STREAM_CREDIT:
+		if(size < (USB_STREAM_HEADER_SIZE + 4)) {
+			stream_nb_bad_rx++;
+			break;
+		}
+		credit = stream_get32(&stream_rx_buf[USB_STREAM_HEADER_SIZE]);
+		if( (stream_credit + credit) < stream_credit )
+			stream_credit = 0xFFFFFFFF;
+		else
+			stream_credit += credit;
+		break;
+
+	case USB_STREAM_RESET:
+		stream_seq = 0;
+		stream_credit = 0;
+		break;
+
+	default:
+		stream_nb_bad_rx++;
+		break;
+	}
+}
+
+/*
+ * Without credit the queued frames would pin their DMA pool buffers until
+ * the host reads again, the ones older than USB_STREAM_MAX_AGE_MS are
+ * dropped (oldest first, post time is in the seq field until sent).
+ */
+static void stream_expire(void)
+{
+	uint8_t* frame;
+	msg_t msg;
+	systime_t now;
+
+	if(stream_credit > 0)
+		return;
+
+	now = chVTGetSystemTime();
+	while(TRUE) {
+		chSysLock();
+		if(chMBGetUsedCountI(&stream_mb) == 0) {
+			chSysUnlock();
+			return;
+		}
+		frame = (uint8_t*)chMBPeekI(&stream_mb);
+		chSysUnlock();
+		if( (systime_t)(now - stream_get32(&frame[4])) < MS2ST(USB_STREAM_MAX_AGE_MS) )
+			return;
+
+		chMBFetch(&stream_mb, &msg, TIME_IMMEDIATE);
+		chSemSignal(&stream_slots);
+		stream_free(frame);
+		stream_lost();
+	}
+}
+
+/* Transmit the queued frames while the host gives credits */
+static void stream_send(void)
+{
+	msg_t msg;
+	uint32_t len;
+
+	while(!stream_in_busy && stream_configured && (stream_credit > 0)) {
+		if(chMBFetch(&stream_mb, &msg, TIME_IMMEDIATE) != MSG_OK)
+			return;
+		chSemSignal(&stream_slots);
+
+		stream_cur = (uint8_t*)msg;
+		stream_cur[3] = 0;
+		if(stream_lost_pending) {
+			stream_lost_pending = FALSE;
+			stream_cur[3] = USB_STREAM_FLAG_LOST;
+		}
+		stream_put32(&stream_cur[4], stream_seq);
+		len = USB_STREAM_HEADER_SIZE + stream_get32(&stream_cur[8]);
+
+		if(!stream_start_transmit(stream_cur, len)) {
+			stream_abort();
+			return;
+		}
+		/* A transfer multiple of the packet size is ended by a ZLP */
+		stream_zlp = ((len % USBD1_STREAM_EP_SIZE) == 0);
+		stream_in_busy = TRUE;
+		stream_seq++;
+		stream_credit--;
+		stream_nb_frames++;
+		stream_nb_bytes += len;
+	}
+}
+
+static THD_FUNCTION(usb_stream_thread, arg)
+{
+	eventmask_t evt;
+
+	(void)arg;
+	chRegSetThreadName("usb_stream");
+
+	while(TRUE) {
+		/* Timeout to expire the queued frames without host activity */
+		evt = chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(USB_STREAM_MAX_AGE_MS / 2));
+
+		if(evt & (STREAM_EVT_RESET | STREAM_EVT_CONFIG)) {
+			stream_abort();
+			stream_seq = 0;
+			if(evt & STREAM_EVT_CONFIG)
+				stream_start_receive();
+		}
+
+		if(evt & STREAM_EVT_OUT) {
+			stream_rx();
+			stream_start_receive();
+		}
+
+		if( (evt & STREAM_EVT_IN) && stream_in_busy ) {
+			if(stream_cur != NULL) {
+				/* Frame sent, buffer goes back to the pool */
+				stream_free(stream_cur);
+				stream_cur = NULL;
+			}
+			stream_in_busy = FALSE;
+			if(stream_zlp) {
+				stream_zlp = FALSE;
+				if(stream_start_transmit(NULL, 0))
+					stream_in_busy = TRUE;
+			}
+		}
+
+		stream_send();
+		stream_expire();
+	}
+}
+
+void usb_stream_init(void)
+{
+	chMBObjectInit(&stream_mb, stream_mb_buf, USB_STREAM_NB_QUEUE);
+	chSemObjectInit(&stream_slots, USB_STREAM_NB_QUEUE);
+
+	stream_thread = chThdCreateStatic(waStream, sizeof(waStream),
+					  NORMALPRIO + 1, usb_stream_thread, NULL);
+}
+
+uint8_t* usb_stream_alloc(uint32_t payload_size, systime_t timeout)
+{
+	if( (payload_size == 0) ||
+	    ((USB_STREAM_HEADER_SIZE + payload_size) > USB_STREAM_MAX_FRAME) )
+		return NULL;
+	return bufpool_alloc(BUFPOOL_DMA, USB_STREAM_HEADER_SIZE + payload_size, timeout);
+}
+
+int usb_stream_post(uint8_t* frame, uint32_t payload_len)
+{
+	uint32_t size;
+	bool full;
+
+	if(chSemWaitTimeout(&stream_slots, TIME_IMMEDIATE) != MSG_OK) {
+		bufpool_free(frame);
+		stream_lost();
+		return -1;
+	}
+
+	/* Pool share of the stream, released by stream_free() */
+	size = USB_STREAM_HEADER_SIZE + payload_len;
+	chSysLock();
+	full = (stream_pool_used + size) > USB_STREAM_POOL_MAX;
+	if(!full)
+		stream_pool_used += size;
+	chSysUnlock();
+	if(full) {
+		chSemSignal(&stream_slots);
+		bufpool_free(frame);
+		stream_lost();
+		return -2;
+	}
+
+	frame[0] = USB_STREAM_MAGIC & 0xFF;
+	frame[1] = USB_STREAM_MAGIC >> 8;
+	frame[2] = USB_STREAM_DATA;
+	/* Post time until the frame is sent (seq) */
+	stream_put32(&frame[4], chVTGetSystemTime());
+	stream_put32(&frame[8], payload_len);
+
+	bufpool_handoff(frame, stream_thread);
+	/* Slot reserved above, does not wait */
+	chMBPost(&stream_mb, (msg_t)frame, TIME_INFINITE);
+	chEvtSignal(stream_thread, STREAM_EVT_POST);
+	return 0;
+}
+
+/* Counter frames for host tool throughput test */
+static void stream_test(t_hydra_console *con, uint32_t size_kb)
+{
+	uint8_t* frame;
+	uint32_t* payload;
+	uint32_t total, len, i, counter, nb_frames, nb_lost;
+	systime_t start;
+	uint32_t elapsed_ms;
+
+	counter = 0;
+	nb_frames = 0;
+	nb_lost = 0;
+	start = chVTGetSystemTime();
+	for(total = 0; total < (size_kb * 1024); total += len) {
+		len = MIN(STREAM_TEST_FRAME_SIZE - USB_STREAM_HEADER_SIZE, (size_kb * 1024) - total);
+		len &= ~3;
+		if(len == 0)
+			break;
+
+		/* Buffers come back to the pool as the host drains the frames */
+		frame = usb_stream_alloc(len, MS2ST(1000));
+		if(frame == NULL) {
+			cprintf(con, "No frame buffer (host not reading?)\r\n");
+			break;
+		}
+		payload = (uint32_t*)&frame[USB_STREAM_HEADER_SIZE];
+		for(i = 0; i < (len / 4); i++)
+			payload[i] = counter++;
+
+		if(usb_stream_post(frame, len) < 0)
+			nb_lost++;
+		else
+			nb_frames++;
+
+		if(console_is_aborted(con))
+			break;
+	}
+	elapsed_ms = ST2MS(chVTGetSystemTime() - start);
+	if(elapsed_ms == 0)
+		elapsed_ms = 1;
+
+	cprintf(con, "%ld frames queued, %ld lost, %ld KB in %ld ms (%ld KB/s)\r\n",
+		nb_frames, nb_lost, total / 1024, elapsed_ms, (total / 1024) * 1000 / elapsed_ms);
+}
+
+/* usb_stream [test [<KB>]] */
+void cmd_usb_stream(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint32_t size_kb;
+
+	if(argc < 2) {
+		cprintf(con, "USB stream host %sconnected, credit %ld, seq %ld\r\n",
+			stream_configured ? "" : "not ", stream_credit, stream_seq);
+		cprintf(con, "%ld frames sent (%ld KB), %ld lost, %ld invalid host frames\r\n",
+			stream_nb_frames, stream_nb_bytes / 1024, stream_nb_lost, stream_nb_bad_rx);
+		return;
+	}
+
+	if(strcmp(argv[1], "test") == 0) {
+		size_kb = STREAM_TEST_DEFAULT_KB;
+		if(argc > 2)
+			size_kb = strtoul(argv[2], NULL, 0);
+		if(size_kb == 0) {
+			cprintf(con, "Invalid size\r\n");
+			return;
+		}
+		stream_test(con, size_kb);
+	} else {
+		cprintf(con, "usage: %s [test [<KB>]]\r\n", argv[0]);
+	}
+}
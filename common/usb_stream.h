@@ -0,0 +1,80 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _USB_STREAM_H_
+#define _USB_STREAM_H_
+
+#include "common.h"
+
+/*
+ * Vendor class bulk interface on USB1 (composite with the CDC console)
+ * carrying framed binary data (captures, samples, sniff) to a libusb host
+ * tool (scripts/hydra_stream.py), the console stays free for text.
+ *
+ * Frame (one USB transfer, little endian):
+ * magic(2) "HS", type(1), flags(1), seq(4), len(4), payload(len)
+ * IN DATA frames are only sent while the host has given credits, each
+ * frame uses one credit. Producers never wait for the host: when the
+ * queue is full or holds USB_STREAM_POOL_MAX bytes the frame is dropped,
+ * queued frames are dropped after USB_STREAM_MAX_AGE_MS without credit,
+ * the next frame sent has FLAG_LOST.
+ */
+#define USBD1_STREAM_INTERFACE	2
+#define USBD1_STREAM_EP		3
+#define USBD1_STREAM_EP_SIZE	0x0040
+
+#define USB_STREAM_MAGIC	(0x5348)
+#define USB_STREAM_HEADER_SIZE	(12)
+/* One IN transfer (OTG packet count is 10 bits) */
+#define USB_STREAM_MAX_FRAME	(32768)
+
+/* Device to host */
+#define USB_STREAM_DATA		(0x01)
+/* Host to device, CREDIT payload is the number of frames (uint32_t) */
+#define USB_STREAM_CREDIT	(0x10)
+#define USB_STREAM_RESET	(0x11) /* Restart at seq 0, credits cleared */
+
+#define USB_STREAM_FLAG_LOST	(1 << 0) /* Frame(s) dropped before this one */
+
+/* Frames queued to the stream thread */
+#define USB_STREAM_NB_QUEUE	(8)
+/* DMA pool share of the queued and in flight frames, the rest is left to the other users */
+#define USB_STREAM_POOL_MAX	(48 * 1024)
+/* Queued frame age limit while the host gives no credit */
+#define USB_STREAM_MAX_AGE_MS	(500)
+#define USB_STREAM_WA_SIZE	(1024)
+
+void usb_stream_init(void);
+
+/* Called from usb1cfg.c USB callbacks (ISR context) */
+void usb_stream_configure_hookI(USBDriver *usbp);
+void usb_stream_reset_hookI(USBDriver *usbp);
+
+/*
+ * Borrow a frame buffer from the DMA pool (NULL if none),
+ * payload starts at frame + USB_STREAM_HEADER_SIZE.
+ */
+uint8_t* usb_stream_alloc(uint32_t payload_size, systime_t timeout);
+
+/*
+ * Queue frame, ownership is given to the stream thread.
+ * Return 0 if queued else <0 (queue full or pool share reached, frame
+ * freed and counted lost).
+ */
+int usb_stream_post(uint8_t* frame, uint32_t payload_len);
+
+void cmd_usb_stream(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _USB_STREAM_H_ */
@@ -0,0 +1,233 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <stdlib.h> /* strtoul */
+
+#include "ch.h"
+#include "hal.h"
+
+#include "common.h"
+#include "bufpool.h"
+#include "usb_tx.h"
+
+/* usb_perf test buffer and default size */
+#define USBTX_PERF_BUF_SIZE (16384)
+#define USBTX_PERF_DEFAULT_KB (512)
+#define USBTX_PERF_LINE_SIZE (64)
+
+typedef struct {
+	SerialUSBDriver *sdup;
+	/* Signaled on each IN transfer end and on USB reset */
+	binary_semaphore_t sem;
+	uint32_t nb_xfer;
+	uint64_t nb_bytes;
+} usbtx_t;
+
+static usbtx_t usbtx[2];
+
+static usbtx_t* usbtx_get(USBDriver *usbp)
+{
+	return (usbp == &USBD1) ? &usbtx[0] : &usbtx[1];
+}
+
+void usbtx_init(void)
+{
+	usbtx[0].sdup = &SDU1;
+	usbtx[1].sdup = &SDU2;
+	chBSemObjectInit(&usbtx[0].sem, TRUE);
+	chBSemObjectInit(&usbtx[1].sem, TRUE);
+}
+
+void usbtx_data_transmitted(USBDriver *usbp, usbep_t ep)
+{
+	usbtx_t* tx = usbtx_get(usbp);
+
+	/* Zero length packet and queued output are managed by the SDU driver */
+	sduDataTransmitted(usbp, ep);
+
+	chSysLockFromISR();
+	chBSemSignalI(&tx->sem);
+	chSysUnlockFromISR();
+}
+
+void usbtx_reset_hookI(USBDriver *usbp)
+{
+	chBSemSignalI(&usbtx_get(usbp)->sem);
+}
+
+/*
+ * Wait (locked) until the endpoint is idle and optionally the output queue
+ * is empty, return 0 if OK else <0 (same codes as usbtx_write()).
+ */
+static int usbtx_wait_idleS(usbtx_t* tx, bool queue_empty,
+			    systime_t start, systime_t timeout)
+{
+	USBDriver *usbp = tx->sdup->config->usbp;
+	usbep_t ep = tx->sdup->config->bulk_in;
+
+	while(usbGetTransmitStatusI(usbp, ep) ||
+	      (queue_empty && !chOQIsEmptyI(&tx->sdup->oqueue))) {
+		if(usbGetDriverStateI(usbp) != USB_ACTIVE)
+			return -1;
+		if( (timeout != TIME_INFINITE) &&
+		    !chVTIsSystemTimeWithinX(start, start + timeout) )
+			return -2;
+		/* Output queue is started by the writers without notification */
+		chSysUnlock();
+		chBSemWaitTimeout(&tx->sem, MS2ST(USBTX_POLL_MS));
+		chSysLock();
+	}
+	if(usbGetDriverStateI(usbp) != USB_ACTIVE)
+		return -1;
+	return 0;
+}
+
+/* Start one IN transfer once the endpoint is idle and queued output sent */
+static int usbtx_start_xfer(usbtx_t* tx, const uint8_t *buf, uint32_t len,
+			    systime_t start, systime_t timeout)
+{
+	USBDriver *usbp = tx->sdup->config->usbp;
+	usbep_t ep = tx->sdup->config->bulk_in;
+	int err;
+
+	chSysLock();
+	err = usbtx_wait_idleS(tx, TRUE, start, timeout);
+	if(err < 0) {
+		chSysUnlock();
+		return err;
+	}
+	/*
+	 * Prepared while locked so an output queue notification cannot
+	 * take the endpoint in between, it only sets the endpoint state
+	 * and transfer size registers (no OS call).
+	 */
+	usbPrepareTransmit(usbp, ep, buf, len);
+	usbStartTransmitI(usbp, ep);
+	chSysUnlock();
+
+	tx->nb_xfer++;
+	tx->nb_bytes += len;
+	return len;
+}
+
+int usbtx_write(SerialUSBDriver *sdup, const uint8_t *buf, uint32_t size, systime_t timeout)
+{
+	usbtx_t* tx;
+	systime_t start;
+	uint32_t len, sent;
+	int err;
+
+	tx = usbtx_get(sdup->config->usbp);
+	start = chVTGetSystemTime();
+
+	sent = 0;
+	while(sent < size) {
+		len = MIN(size - sent, USBTX_MAX_XFER);
+		err = usbtx_start_xfer(tx, &buf[sent], len, start, timeout);
+		if(err < 0)
+			return err;
+		sent += len;
+	}
+
+	/* buf is read from the endpoint FIFO handler until the end of transfer */
+	chSysLock();
+	err = usbtx_wait_idleS(tx, FALSE, start, timeout);
+	chSysUnlock();
+	if(err < 0)
+		return err;
+	return sent;
+}
+
+int usbtx_start(SerialUSBDriver *sdup, const uint8_t *buf, uint32_t size, systime_t timeout)
+{
+	if(size > USBTX_MAX_XFER)
+		return -3;
+	return usbtx_start_xfer(usbtx_get(sdup->config->usbp), buf, size,
+				chVTGetSystemTime(), timeout);
+}
+
+int usbtx_wait(SerialUSBDriver *sdup, systime_t timeout)
+{
+	int err;
+
+	chSysLock();
+	err = usbtx_wait_idleS(usbtx_get(sdup->config->usbp), FALSE,
+			       chVTGetSystemTime(), timeout);
+	chSysUnlock();
+	return err;
+}
+
+/* usb_perf [<KB>]: compare output queue copy and zero-copy transmit */
+void cmd_usb_perf(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint8_t* buf;
+	uint32_t size_kb, total, len, i, j;
+	systime_t start;
+	uint32_t elapsed_ms[2];
+	int err;
+
+	size_kb = USBTX_PERF_DEFAULT_KB;
+	if(argc > 1)
+		size_kb = strtoul(argv[1], NULL, 0);
+	if(size_kb == 0) {
+		cprintf(con, "usage: %s [<KB>]\r\n", argv[0]);
+		return;
+	}
+
+	buf = bufpool_alloc(BUFPOOL_DMA, USBTX_PERF_BUF_SIZE, TIME_IMMEDIATE);
+	if(buf == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return;
+	}
+	/* Printable lines so the test can run in a terminal */
+	for(i = 0; i < USBTX_PERF_BUF_SIZE; i += USBTX_PERF_LINE_SIZE) {
+		for(j = 0; j < (USBTX_PERF_LINE_SIZE - 2); j++)
+			buf[i + j] = 'A' + ((i / USBTX_PERF_LINE_SIZE + j) % 26);
+		buf[i + j] = '\r';
+		buf[i + j + 1] = '\n';
+	}
+
+	err = 0;
+	for(i = 0; (i < 2) && (err >= 0); i++) {
+		start = chVTGetSystemTime();
+		for(total = 0; total < (size_kb * 1024); total += len) {
+			len = MIN(USBTX_PERF_BUF_SIZE, (size_kb * 1024) - total);
+			if(i == 0) {
+				/* Copy through the SDU output queue */
+				chSequentialStreamWrite(con->bss, buf, len);
+			} else {
+				err = usbtx_write(con->sdu, buf, len, S2ST(5));
+				if(err < 0)
+					break;
+			}
+		}
+		elapsed_ms[i] = ST2MS(chVTGetSystemTime() - start);
+		if(elapsed_ms[i] == 0)
+			elapsed_ms[i] = 1;
+	}
+	bufpool_free(buf);
+
+	if(err < 0) {
+		cprintf(con, "\r\nusbtx_write() error %d\r\n", err);
+		return;
+	}
+	for(i = 0; i < 2; i++) {
+		cprintf(con, "\r\n%s: %ld KB in %ld ms, %ld KB/s",
+			(i == 0) ? "queue    " : "zero-copy",
+			size_kb, elapsed_ms[i], (size_kb * 1000) / elapsed_ms[i]);
+	}
+	cprintf(con, "\r\nzero-copy total: %ld transfers, %ld KB\r\n",
+		usbtx_get(con->sdu->config->usbp)->nb_xfer,
+		(uint32_t)(usbtx_get(con->sdu->config->usbp)->nb_bytes / 1024));
+}
@@ -0,0 +1,59 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _USB_TX_H_
+#define _USB_TX_H_
+
+#include "common.h"
+
+/*
+ * Zero-copy transmit on the CDC bulk IN endpoints, the buffer is given
+ * directly to the endpoint (multi-packet transfer) instead of being copied
+ * 64 bytes at a time through the SDU output queue.
+ * Text already queued by cprintf() is sent first so the stream order is kept.
+ */
+
+/* Max bytes per IN transfer (OTG DIEPTSIZ packet count is 10 bits) */
+#define USBTX_MAX_XFER (32768)
+/* Wait granularity for endpoint/queue idle */
+#define USBTX_POLL_MS (10)
+
+void usbtx_init(void);
+
+/* IN endpoint callback of the CDC data endpoint (replaces sduDataTransmitted) */
+void usbtx_data_transmitted(USBDriver *usbp, usbep_t ep);
+/* Called from USB event callback on reset/unplug (ISR context) */
+void usbtx_reset_hookI(USBDriver *usbp);
+
+/*
+ * Send size bytes from buf, buf shall not be modified until return.
+ * Return number of bytes sent or <0 (-1 USB not active, -2 timeout).
+ */
+int usbtx_write(SerialUSBDriver *sdup, const uint8_t *buf, uint32_t size, systime_t timeout);
+
+/*
+ * Start sending size bytes (up to USBTX_MAX_XFER) from buf and return
+ * without waiting for the end, buf shall not be modified until a
+ * usbtx_wait() success. Used to prepare the next buffer while one is sent.
+ * Return size or <0 (same codes as usbtx_write(), -3 size too big).
+ */
+int usbtx_start(SerialUSBDriver *sdup, const uint8_t *buf, uint32_t size, systime_t timeout);
+
+/* Wait end of the transfer started by usbtx_start(), return 0 or <0 */
+int usbtx_wait(SerialUSBDriver *sdup, systime_t timeout);
+
+void cmd_usb_perf(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _USB_TX_H_ */
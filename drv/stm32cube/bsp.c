@@ -12,11 +12,16 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 */
+#include "ch.h"
 #include "bsp.h"
 #include "stm32f405xx.h"
 #include "stm32f4xx_hal.h"
 
 static uint32_t uwTick = 0;
+static systime_t tick_last = 0;
+static uint32_t tick_rest = 0; /* System ticks not yet counted in uwTick */
+
+#define BSP_TICK_PER_MS (CH_CFG_ST_FREQUENCY / 1000)
 
 /* Internal Cycle Counter */
 #if !defined(IOREG32) || defined(__DOXYGEN__)
@@ -46,10 +51,23 @@ void HAL_IncTick(void)
 	uwTick++;
 }
 
+/* Milliseconds from the system time (callable from ISR) */
 uint32_t HAL_GetTick(void)
 {
-	HAL_IncTick();
-	return uwTick;
+	syssts_t sts;
+	systime_t now;
+	uint32_t tick;
+
+	sts = chSysGetStatusAndLockX();
+	now = chVTGetSystemTimeX();
+	tick_rest += (uint32_t)(now - tick_last);
+	tick_last = now;
+	uwTick += tick_rest / BSP_TICK_PER_MS;
+	tick_rest %= BSP_TICK_PER_MS;
+	tick = uwTick + bsp_abort_tick_offset();
+	chSysRestoreStatusX(sts);
+
+	return tick;
 }
 
 uint32_t HAL_RCC_GetPCLK1Freq(void)
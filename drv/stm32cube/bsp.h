@@ -43,6 +43,17 @@ typedef enum {
 	BSP_TIMEOUT = 0x03
 } bsp_status_t;
 
+/* More than the largest HAL timeout */
+#define BSP_TICK_ABORT_OFFSET (0x40000000)
+
+/*
+ * Implemented by the application, added to HAL_GetTick(): 0 unless the
+ * calling thread operation shall be aborted, then alternately
+ * +/-BSP_TICK_ABORT_OFFSET so that each HAL wait expires at its next tick
+ * read, whenever its tickstart was taken.
+ */
+uint32_t bsp_abort_tick_offset(void);
+
 /* wait_nb_cycles shall be min 10 */
 bool delay_is_expired(bool start, uint32_t wait_nb_cycles);
 
@@ -29,8 +29,8 @@ const int i2c_speed[I2C_SPEED_MAX] = {
 	/* 2 */ BSP_I2C_DELAY_HC_400KHZ,
 	/* 3 */ BSP_I2C_DELAY_HC_1MHZ
 };
-int i2c_speed_delay;
-bool i2c_started;
+static int i2c_speed_delay;
+static bool i2c_started;
 
 /* Set SCL LOW = 0/GND (0/GND => Set pin = logic reversed in open drain) */
 #define set_scl_low() (gpio_set_pin(BSP_I2C1_SCL_SDA_GPIO_PORT, BSP_I2C1_SCL_PIN))
@@ -20,12 +20,13 @@ limitations under the License.
 /*
 Warning in order to use this driver all GPIOs peripherals shall be enabled.
 */
-#define UARTx_TIMEOUT_MAX (20000000) // About 10sec can be aborted by UBTN too
+#define UARTx_TIMEOUT_MAX (10000) // 10sec in ms, aborted by Ctrl-C/UBTN too
 #define NB_UART (BSP_DEV_UART_END)
 #define ARRAY_SIZE(x) (sizeof((x))/sizeof((x)[0]))
 
 static UART_HandleTypeDef uart_handle[NB_UART];
 static mode_config_proto_t* uart_mode_conf[NB_UART];
+static volatile bsp_uart_rx_cb_t uart_rx_cb[NB_UART];
 
 const uint32_t dev_param_speed[] = {
 	/* 0 */ 300,
@@ -290,3 +291,84 @@ bsp_status_t bsp_uart_write_read_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, ui
 	return status;
 }
 
+static IRQn_Type uart_irqn(bsp_dev_uart_t dev_num)
+{
+	return (dev_num == BSP_DEV_UART1) ? USART1_IRQn : USART2_IRQn;
+}
+
+/**
+  * @brief  Start RX interrupt mode, UART shall be initialized.
+  * @param  dev_num: UART dev num.
+  * @param  cb: Called from IRQ for each received byte.
+  * @param  priority: NVIC priority (not shifted).
+  * @retval status.
+  */
+bsp_status_t bsp_uart_rx_irq_start(bsp_dev_uart_t dev_num, bsp_uart_rx_cb_t cb, uint32_t priority)
+{
+	UART_HandleTypeDef* huart;
+	huart = &uart_handle[dev_num];
+
+	if(cb == NULL)
+		return BSP_ERROR;
+
+	uart_rx_cb[dev_num] = cb;
+	/* Flush pending data/errors (SR then DR read) */
+	(void)huart->Instance->SR;
+	(void)huart->Instance->DR;
+
+	NVIC_SetPriority(uart_irqn(dev_num), priority);
+	NVIC_ClearPendingIRQ(uart_irqn(dev_num));
+	NVIC_EnableIRQ(uart_irqn(dev_num));
+	__HAL_UART_ENABLE_IT(huart, UART_IT_RXNE);
+
+	return BSP_OK;
+}
+
+/**
+  * @brief  Stop RX interrupt mode.
+  * @param  dev_num: UART dev num.
+  * @retval None
+  */
+void bsp_uart_rx_irq_stop(bsp_dev_uart_t dev_num)
+{
+	UART_HandleTypeDef* huart;
+	huart = &uart_handle[dev_num];
+
+	__HAL_UART_DISABLE_IT(huart, UART_IT_RXNE);
+	NVIC_DisableIRQ(uart_irqn(dev_num));
+	uart_rx_cb[dev_num] = NULL;
+}
+
+static void uart_rx_irq(bsp_dev_uart_t dev_num)
+{
+	USART_TypeDef* usart;
+	bsp_uart_rx_cb_t cb;
+	uint32_t sr;
+	uint8_t data;
+
+	usart = uart_handle[dev_num].Instance;
+	/* Reading SR then DR clears RXNE and ORE */
+	sr = usart->SR;
+	if((sr & (USART_SR_RXNE | USART_SR_ORE)) == 0)
+		return;
+	data = usart->DR;
+
+	cb = uart_rx_cb[dev_num];
+	if(cb != NULL)
+		cb(dev_num, data, (sr & USART_SR_ORE) ? TRUE : FALSE);
+}
+
+/*
+  USART1/USART2 IRQ vectors (ChibiOS vector table names), only used in RX
+  interrupt mode (HAL_USE_SERIAL/HAL_USE_UART are disabled).
+  No RTOS API is called so no CH_IRQ_PROLOGUE()/CH_IRQ_EPILOGUE().
+*/
+void VectorD4(void)
+{
+	uart_rx_irq(BSP_DEV_UART1);
+}
+
+void VectorD8(void)
+{
+	uart_rx_irq(BSP_DEV_UART2);
+}
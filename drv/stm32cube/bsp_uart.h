@@ -31,4 +31,13 @@ bsp_status_t bsp_uart_write_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, uint8_t
 bsp_status_t bsp_uart_read_u8(bsp_dev_uart_t dev_num, uint8_t* rx_data, uint8_t nb_data);
 bsp_status_t bsp_uart_write_read_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, uint8_t* rx_data, uint8_t nb_data);
 
+/*
+ * RX interrupt mode, cb is called from the USART IRQ for each received byte
+ * (overrun is TRUE if bytes were lost before this one).
+ * With priority above the RTOS kernel level cb shall not call any RTOS API.
+ */
+typedef void (*bsp_uart_rx_cb_t)(bsp_dev_uart_t dev_num, uint8_t data, bool overrun);
+bsp_status_t bsp_uart_rx_irq_start(bsp_dev_uart_t dev_num, bsp_uart_rx_cb_t cb, uint32_t priority);
+void bsp_uart_rx_irq_stop(bsp_dev_uart_t dev_num);
+
 #endif /* _BSP_UART_H_ */
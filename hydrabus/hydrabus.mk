@@ -6,6 +6,7 @@ HYDRABUSSRC = hydrabus/hydrabus.c \
             hydrabus/hydrabus_mode_hiz.c \
             hydrabus/hydrabus_mode_spi.c \
             hydrabus/hydrabus_mode_uart.c \
-            hydrabus/hydrabus_mode_i2c.c
+            hydrabus/hydrabus_mode_i2c.c \
+            hydrabus/hydrabus_run.c
 # Required include directories
 HYDRABUSINC = ./hydrabus
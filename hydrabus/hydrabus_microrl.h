@@ -16,12 +16,8 @@ limitations under the License.
 #ifndef _HYDRABUS_MICRORL_H_
 #define _HYDRABUS_MICRORL_H_
 
-#define HYDRABUS_NUM_OF_CMD (16+1)
-extern char* hydrabus_compl_world[HYDRABUS_NUM_OF_CMD + 1];
-extern microrl_exec_t hydrabus_keyworld[HYDRABUS_NUM_OF_CMD];
-
+/* Mode protocol interaction part of the help (commands are in hydra_cmd_list.h) */
 void hydrabus_print_help(t_hydra_console *con, int argc, const char* const* argv);
-int hydrabus_execute(t_hydra_console *con, int argc, const char* const* argv);
 void hydrabus_sigint(t_hydra_console *con);
 
 #endif /* _HYDRABUS_MICRORL_H_ */
@@ -14,11 +14,14 @@ limitations under the License.
 */
 
 #include "string.h"
+#include <stddef.h> /* offsetof */
 #include "common.h"
 
 #include "microrl.h"
 #include "microrl_callback.h"
 #include "xatoi.h"
+#include "bufpool.h"
+#include "usb_tx.h"
 
 #include "hydrabus.h"
 #include "hydrabus_mode.h"
@@ -55,10 +58,12 @@ const char hydrabus_mode_str_mul_br[] = "\r\n";
 
 static const char mode_str_delay_us[] = "DELAY %dus\r\n";
 static const char mode_str_delay_ms[] = "DELAY %dms\r\n";
+static const char mode_str_aborted[] = "Aborted\r\n";
 
 static const char mode_str_write_error[] =  "WRITE error:%d\r\n";
 static const char mode_str_read_error[] = "READ error:%d\r\n";
 static const char mode_str_write_read_error[] = "WRITE/READ error:%d\r\n";
+static const char mode_str_bulk_usb_error[] = "\r\nREAD stopped after %d bytes, USB error:%d\r\n";
 
 static const char mode_not_configured[] = "Mode not configured, configure mode with 'm'\r\n";
 static const char mode_repeat_too_long[] =  "Error max size for 'arg:arg' shall be >0 & <%d\r\n";
@@ -96,10 +101,12 @@ void hydrabus_mode_help(t_hydra_console *con)
 void hydrabus_mode(t_hydra_console *con, int argc, const char* const* argv)
 {
 	bool res;
-	int32_t bus_mode;
+	long bus_mode;
 	mode_config_proto_t* p_proto = &con->mode->proto;
+	uint8_t old_param[offsetof(mode_config_proto_t, buffer_tx)];
 	long old_dev_num;
 	long new_dev_num;
+	bus_lock_dev_t new_bus;
 
 	bus_mode = 0;
 	if(argc > 1) {
@@ -109,13 +116,26 @@ void hydrabus_mode(t_hydra_console *con, int argc, const char* const* argv)
 			    (bus_mode < HYDRABUS_MODE_NB_CONF)) {
 				/* Execute mode command of the protocol */
 				old_dev_num = p_proto->dev_num;
+				/* Parameters only, to keep the current mode if its peripheral is busy */
+				memcpy(old_param, p_proto, sizeof(old_param));
 				res = hydrabus_mode_conf[bus_mode]->mode_cmd(con, (argc-2), &argv[2]);
 				if(res == TRUE) {
 					new_dev_num = p_proto->dev_num;
 
+					/* The peripheral can be owned by the other console or a service */
+					new_bus = hydrabus_mode_conf[bus_mode]->mode_bus(con);
+					if(bus_lock_acquire(new_bus, con, con->thread_name) == FALSE) {
+						bus_lock_print_busy(con, new_bus);
+						memcpy(p_proto, old_param, sizeof(old_param));
+						return;
+					}
+
 					/* Cleanup previous/old mode */
 					p_proto->dev_num = old_dev_num;
 					hydrabus_mode_conf[p_proto->bus_mode]->mode_cleanup(con);
+					if((bus_lock_dev_t)con->mode->bus_lock != new_bus)
+						bus_lock_release(con->mode->bus_lock, con);
+					con->mode->bus_lock = new_bus;
 
 					/* Update mode with new mode / dev_num */
 					p_proto->bus_mode = bus_mode;
@@ -334,26 +354,15 @@ static bool repeat_cmd(t_hydra_console *con, const char* const* argv,
 	return TRUE;
 }
 
-/* Return TRUE if success or FALSE in case of error */
-static bool hydrabus_mode_write(t_hydra_console *con, const char* const* argv, int* nb_arg_car_used)
+static void hydrabus_mode_write(t_hydra_console *con, uint8_t val, long nb_repeat)
 {
-	bool ret_repeat_cmd;
 	int i;
-	long val;
-	long nb_repeat;
 	uint32_t mode_status;
 	uint32_t bus_mode;
 	mode_config_proto_t* p_proto = &con->mode->proto;
 
 	bus_mode = p_proto->bus_mode;
 
-	ret_repeat_cmd = repeat_cmd(con, argv,
-				    0, 255, &val,
-				    1, MODE_CONFIG_PROTO_BUFFER_SIZE-1, &nb_repeat,
-				    nb_arg_car_used, TRUE);
-	if(ret_repeat_cmd == FALSE) {
-		return FALSE;
-	}
 	/* TODO manage write string (only value(s) are supported in actual version) */
 
 	if(nb_repeat == 0) {
@@ -388,14 +397,139 @@ static bool hydrabus_mode_write(t_hydra_console *con, const char* const* argv, i
 				hydrabus_mode_write_error(con, mode_status);
 		}
 	}
-	return TRUE;
 }
 
-/* Return TRUE if success or FALSE in case of error */
-static bool hydrabus_mode_read(t_hydra_console *con, const char* const* argv, int* nb_arg_car_used)
+/* "READ: 0xXX ... \r\n" line per HYDRABUS_MODE_BULK_LINE values */
+#define HYDRABUS_MODE_BULK_TXT_SIZE \
+	((HYDRABUS_MODE_BULK_CHUNK * 5) + \
+	 ((HYDRABUS_MODE_BULK_CHUNK / HYDRABUS_MODE_BULK_LINE) * 8))
+/* Max wait for the host to take one chunk */
+#define HYDRABUS_MODE_BULK_USB_TIMEOUT S2ST(5)
+
+static uint32_t hydrabus_mode_bulk_format(uint8_t* txt, const uint8_t* data, uint32_t nb)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint32_t i, len;
+
+	len = 0;
+	for(i = 0; i < nb; i++) {
+		if((i % HYDRABUS_MODE_BULK_LINE) == 0) {
+			memcpy(&txt[len], hydrabus_mode_str_mul_read, 6);
+			len += 6;
+		}
+		txt[len++] = '0';
+		txt[len++] = 'x';
+		txt[len++] = hex[data[i] >> 4];
+		txt[len++] = hex[data[i] & 0x0F];
+		txt[len++] = ' ';
+		if( ((i % HYDRABUS_MODE_BULK_LINE) == (HYDRABUS_MODE_BULK_LINE - 1)) ||
+		    (i == (nb - 1)) ) {
+			txt[len++] = '\r';
+			txt[len++] = '\n';
+		}
+	}
+	return len;
+}
+
+/*
+Bulk read 'r:x' (x >= MODE_CONFIG_PROTO_BUFFER_SIZE).
+Chunk k is read and formatted in one text buffer while the other one
+(chunk k-1) is sent by the USB endpoint, so the time is close to the
+slowest of bus and USB instead of their sum.
+Modes without mode_read_bulk() or a redirected console are read and
+written chunk after chunk.
+*/
+static uint32_t hydrabus_mode_read_bulk(t_hydra_console *con, uint32_t nb)
+{
+	const mode_exec_t* mode;
+	mode_config_proto_t* p_proto;
+	uint8_t* txt[2];
+	uint32_t mode_status;
+	uint32_t done, len, i, n, txt_len;
+	console_out_policy_t policy;
+	bool usb, pending;
+	int err, cur;
+
+	p_proto = &con->mode->proto;
+	mode = hydrabus_mode_conf[p_proto->bus_mode];
+	mode_status = HYDRABUS_MODE_STATUS_OK;
+
+	txt[0] = NULL;
+	txt[1] = NULL;
+	if(mode->mode_read_bulk != NULL) {
+		txt[0] = bufpool_alloc(BUFPOOL_DMA, HYDRABUS_MODE_BULK_TXT_SIZE, TIME_IMMEDIATE);
+		txt[1] = bufpool_alloc(BUFPOOL_DMA, HYDRABUS_MODE_BULK_TXT_SIZE, TIME_IMMEDIATE);
+	}
+	if( (txt[0] == NULL) || (txt[1] == NULL) ) {
+		/* Not pipelined, mode_read() writes each chunk */
+		for(done = 0; done < nb; done += len) {
+			len = MIN(nb - done, MODE_CONFIG_PROTO_BUFFER_SIZE-1);
+			mode_status = mode->mode_read(con, p_proto->buffer_rx, len);
+			if( (mode_status != HYDRABUS_MODE_STATUS_OK) || console_is_aborted(con) )
+				break;
+		}
+		if(txt[0] != NULL)
+			bufpool_free(txt[0]);
+		if(txt[1] != NULL)
+			bufpool_free(txt[1]);
+		return mode_status;
+	}
+
+	/* Output already deferred is sent first, the chunks are streamed */
+	policy = console_set_policy(con, CONSOLE_OUT_BLOCK);
+	usb = console_is_usb(con);
+
+	err = 0;
+	cur = 0;
+	pending = FALSE;
+	for(done = 0; done < nb; done += len) {
+		len = MIN(nb - done, HYDRABUS_MODE_BULK_CHUNK);
+
+		/* Bus read and format while the previous chunk is on USB */
+		txt_len = 0;
+		for(i = 0; i < len; i += n) {
+			n = MIN(len - i, MODE_CONFIG_PROTO_BUFFER_SIZE / 2);
+			mode_status = mode->mode_read_bulk(con, p_proto->buffer_rx, n);
+			if( (mode_status != HYDRABUS_MODE_STATUS_OK) || console_is_aborted(con) )
+				break;
+			txt_len += hydrabus_mode_bulk_format(&txt[cur][txt_len], p_proto->buffer_rx, n);
+		}
+
+		if(usb) {
+			if(pending) {
+				err = usbtx_wait(con->sdu, HYDRABUS_MODE_BULK_USB_TIMEOUT);
+				pending = FALSE;
+			}
+			if( (err >= 0) && (txt_len > 0) ) {
+				err = usbtx_start(con->sdu, txt[cur], txt_len, HYDRABUS_MODE_BULK_USB_TIMEOUT);
+				pending = (err >= 0);
+			}
+		} else {
+			console_write(con, txt[cur], txt_len);
+		}
+		cur ^= 1;
+
+		if( (err < 0) || (mode_status != HYDRABUS_MODE_STATUS_OK) )
+			break;
+		if(console_is_aborted(con)) {
+			done += len;
+			break;
+		}
+	}
+	if(pending)
+		err = usbtx_wait(con->sdu, HYDRABUS_MODE_BULK_USB_TIMEOUT);
+
+	bufpool_free(txt[0]);
+	bufpool_free(txt[1]);
+
+	if(err < 0)
+		cprintf(con, mode_str_bulk_usb_error, done, err);
+	console_set_policy(con, policy);
+	return mode_status;
+}
+
+static void hydrabus_mode_read(t_hydra_console *con, long nb_repeat)
 {
-	bool ret_repeat_cmd;
-	long nb_repeat;
 	uint32_t mode_status;
 	mode_config_proto_t* p_proto;
 	uint32_t bus_mode;
@@ -403,52 +537,199 @@ static bool hydrabus_mode_read(t_hydra_console *con, const char* const* argv, in
 	p_proto = &con->mode->proto;
 	bus_mode = p_proto->bus_mode;
 
-	ret_repeat_cmd = repeat_cmd(con, argv,
-				    0, 0, NULL,
-				    1, MODE_CONFIG_PROTO_BUFFER_SIZE-1, &nb_repeat,
-				    nb_arg_car_used, FALSE);
-	if(ret_repeat_cmd == FALSE) {
-		return FALSE;
-	}
 	if(nb_repeat == 0) {
 		/* Read 1 time */
 		mode_status = hydrabus_mode_conf[bus_mode]->mode_read(con, p_proto->buffer_rx, 1);
-	} else {
+	} else if(nb_repeat < MODE_CONFIG_PROTO_BUFFER_SIZE) {
 		/* Read multiple times */
 		mode_status = hydrabus_mode_conf[bus_mode]->mode_read(con, p_proto->buffer_rx, nb_repeat);
+	} else {
+		mode_status = hydrabus_mode_read_bulk(con, nb_repeat);
 	}
 
 	if(mode_status != HYDRABUS_MODE_STATUS_OK)
 		hydrabus_mode_read_error(con, mode_status);
-
-	return TRUE;
 }
 
-/* Return TRUE if success or FALSE in case of error */
-static bool hydrabus_mode_delay(t_hydra_console *con, const char* const* argv, int* nb_arg_car_used)
+/*
+Parse one Protocol Interaction operation at the start of str.
+nb_arg_car_used is the number of characters used (0 means 1 character).
+Return TRUE if success or FALSE in case of error (out of range or invalid value).
+*/
+bool hydrabus_mode_parse_op(t_hydra_console *con, const char* str,
+			    hydrabus_mode_op_t* op, int* nb_arg_car_used)
 {
-	bool ret_repeat_cmd;
+	const char* tmp_argv[] = { 0, 0 };
+	bool ret;
+	long val;
 	long nb_repeat;
 
-	ret_repeat_cmd = repeat_cmd(con, argv,
-				    0, 0, NULL,
-				    1, HYDRABUS_MODE_DELAY_REPEAT_MAX, &nb_repeat,
-				    nb_arg_car_used, FALSE);
-	if(ret_repeat_cmd == FALSE) {
-		return FALSE;
+	*tmp_argv = str;
+	*nb_arg_car_used = 0;
+	val = 0;
+	nb_repeat = 0;
+	op->val = 0;
+	op->nb = 0;
+	ret = TRUE;
+
+	switch(str[0]) {
+	case HYDRABUS_MODE_START:
+		op->type = HYDRABUS_OP_START;
+		break;
+
+	case HYDRABUS_MODE_STOP:
+		op->type = HYDRABUS_OP_STOP;
+		break;
+
+	case HYDRABUS_MODE_STARTR:
+		op->type = HYDRABUS_OP_STARTR;
+		break;
+
+	case HYDRABUS_MODE_STOPTR:
+		op->type = HYDRABUS_OP_STOPR;
+		break;
+
+	case HYDRABUS_MODE_READ:
+		op->type = HYDRABUS_OP_READ;
+		ret = repeat_cmd(con, tmp_argv,
+				 0, 0, NULL,
+				 1, HYDRABUS_MODE_READ_MAX, &nb_repeat,
+				 nb_arg_car_used, FALSE);
+		op->nb = nb_repeat;
+		break;
+
+	case HYDRABUS_MODE_CLK_HI:
+		op->type = HYDRABUS_OP_CLK_HI;
+		break;
+
+	case HYDRABUS_MODE_CLK_LO:
+		op->type = HYDRABUS_OP_CLK_LO;
+		break;
+
+	case HYDRABUS_MODE_CLK_TK:
+		op->type = HYDRABUS_OP_CLK_TK;
+		break;
+
+	case HYDRABUS_MODE_DAT_HI:
+		op->type = HYDRABUS_OP_DAT_HI;
+		break;
+
+	case HYDRABUS_MODE_DAT_LO:
+		op->type = HYDRABUS_OP_DAT_LO;
+		break;
+
+	case HYDRABUS_MODE_DAT_RD:
+	case HYDRABUS_MODE_BIT_RD:
+		op->type = HYDRABUS_OP_BIT_RD;
+		break;
+
+	case HYDRABUS_DELAY_MICROS:
+	case HYDRABUS_DELAY_MILLIS:
+		op->type = (str[0] == HYDRABUS_DELAY_MICROS) ? HYDRABUS_OP_DELAY_US : HYDRABUS_OP_DELAY_MS;
+		ret = repeat_cmd(con, tmp_argv,
+				 0, 0, NULL,
+				 1, HYDRABUS_MODE_DELAY_REPEAT_MAX, &nb_repeat,
+				 nb_arg_car_used, FALSE);
+		if(nb_repeat == 0)
+			nb_repeat = 1;
+		op->nb = nb_repeat;
+		break;
+
+	default: /* Check if it is a valid value to Write */
+		op->type = HYDRABUS_OP_WRITE;
+		ret = repeat_cmd(con, tmp_argv,
+				 0, 255, &val,
+				 1, MODE_CONFIG_PROTO_BUFFER_SIZE-1, &nb_repeat,
+				 nb_arg_car_used, TRUE);
+		op->val = val;
+		op->nb = nb_repeat;
+		break;
 	}
+	return ret;
+}
+
+/* Execute one parsed Protocol Interaction operation, mode shall be configured */
+void hydrabus_mode_exec_op(t_hydra_console *con, const hydrabus_mode_op_t* op)
+{
+	uint32_t bus_mode;
+	mode_config_proto_t* p_proto;
+	uint32_t i;
 
-	if(nb_repeat == 0)
-		nb_repeat = 1;
+	p_proto = &con->mode->proto;
+	bus_mode = p_proto->bus_mode;
 
-	if(argv[0][0] == HYDRABUS_DELAY_MICROS) {
-		cprintf(con, mode_str_delay_us, nb_repeat);
-		DelayUs(nb_repeat);
-	} else {
-		cprintf(con, mode_str_delay_ms, nb_repeat);
-		DelayUs((nb_repeat*1000));
+	switch(op->type) {
+	case HYDRABUS_OP_START:
+		p_proto->wwr = 0;
+		hydrabus_mode_conf[bus_mode]->mode_start(con);
+		break;
+
+	case HYDRABUS_OP_STOP:
+		p_proto->wwr = 0;
+		hydrabus_mode_conf[bus_mode]->mode_stop(con);
+		/* End of transaction, timing is no longer critical */
+		console_flush(con);
+		break;
+
+	case HYDRABUS_OP_STARTR:
+		/* Enable Write with Read */
+		p_proto->wwr = 1;
+		hydrabus_mode_conf[bus_mode]->mode_startR(con);
+		break;
+
+	case HYDRABUS_OP_STOPR:
+		p_proto->wwr = 0;
+		hydrabus_mode_conf[bus_mode]->mode_stopR(con);
+		console_flush(con);
+		break;
+
+	case HYDRABUS_OP_READ:
+		hydrabus_mode_read(con, op->nb);
+		break;
+
+	case HYDRABUS_OP_WRITE:
+		hydrabus_mode_write(con, op->val, op->nb);
+		break;
+
+	case HYDRABUS_OP_CLK_HI: /* Set CLK High (x-WIRE or other raw mode ...) */
+		hydrabus_mode_conf[bus_mode]->mode_clkh(con);
+		break;
+
+	case HYDRABUS_OP_CLK_LO: /* Set CLK Low (x-WIRE or other raw mode ...) */
+		hydrabus_mode_conf[bus_mode]->mode_clkl(con);
+		break;
+
+	case HYDRABUS_OP_CLK_TK: /* CLK Tick (x-WIRE or other raw mode ...) */
+		hydrabus_mode_conf[bus_mode]->mode_clk(con);
+		break;
+
+	case HYDRABUS_OP_DAT_HI: /* Set DAT High (x-WIRE or other raw mode ...) */
+		hydrabus_mode_conf[bus_mode]->mode_dath(con);
+		break;
+
+	case HYDRABUS_OP_DAT_LO: /* Set DAT Low (x-WIRE or other raw mode ...) */
+		hydrabus_mode_conf[bus_mode]->mode_datl(con);
+		break;
+
+	case HYDRABUS_OP_BIT_RD: /* DAT Read / Read Bit (x-WIRE or other raw mode ...) */
+		hydrabus_mode_conf[bus_mode]->mode_bitr(con);
+		break;
+
+	case HYDRABUS_OP_DELAY_US:
+		cprintf(con, mode_str_delay_us, op->nb);
+		DelayUs(op->nb);
+		break;
+
+	case HYDRABUS_OP_DELAY_MS:
+		cprintf(con, mode_str_delay_ms, op->nb);
+		/* 1ms steps to stay abortable */
+		for(i = 0; (i < op->nb) && !console_is_aborted(con); i++)
+			DelayUs(1000);
+		break;
+
+	default:
+		break;
 	}
-	return TRUE;
 }
 
 /*
@@ -458,12 +739,11 @@ Return TRUE if command found(or in case Error message already written) else retu
 bool hydrabus_mode_proto_inter(t_hydra_console *con, int argc, const char* const* argv)
 {
 	bool cmd_found;
-	uint32_t bus_mode;
 	mode_config_proto_t* p_proto;
 	int arg_pos;
 	int nb_arg_car_used;
-	char arg;
-	char* tmp_argv[] = { 0, 0 };
+	hydrabus_mode_op_t op;
+	console_out_policy_t policy;
 	cmd_found = FALSE;
 
 	if(argc < 1) {
@@ -471,95 +751,34 @@ bool hydrabus_mode_proto_inter(t_hydra_console *con, int argc, const char* const
 	}
 
 	p_proto = &con->mode->proto;
-	bus_mode = p_proto->bus_mode;
 
 	if(p_proto->valid != MODE_CONFIG_PROTO_VALID) {
 		cprintf(con, mode_not_configured);
 		return TRUE;
 	}
 
-	arg_pos = 0;
-	arg = argv[0][arg_pos];
-	*tmp_argv = (char*)&argv[0][arg_pos];
-	while(arg != 0) { /* loop until end of string */
-		cmd_found = TRUE;
-		nb_arg_car_used = 0;
-		switch(arg) {
-		case HYDRABUS_MODE_START:
-			p_proto->wwr = 0;
-			hydrabus_mode_conf[bus_mode]->mode_start(con);
-			break;
-
-		case HYDRABUS_MODE_STOP:
-			p_proto->wwr = 0;
-			hydrabus_mode_conf[bus_mode]->mode_stop(con);
-			break;
-
-		case HYDRABUS_MODE_STARTR:
-			/* Enable Write with Read */
-			p_proto->wwr = 1;
-			hydrabus_mode_conf[bus_mode]->mode_startR(con);
-			break;
-
-		case HYDRABUS_MODE_STOPTR:
-			p_proto->wwr = 0;
-			hydrabus_mode_conf[bus_mode]->mode_stopR(con);
-			break;
-
-		case HYDRABUS_MODE_READ:
-			cmd_found = hydrabus_mode_read(con, (const char* const*)tmp_argv, &nb_arg_car_used);
-			break;
-
-		case HYDRABUS_MODE_CLK_HI: /* Set CLK High (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_clkh(con);
-			break;
-
-		case HYDRABUS_MODE_CLK_LO: /* Set CLK Low (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_clkl(con);
-			break;
-
-		case HYDRABUS_MODE_CLK_TK: /* CLK Tick (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_clk(con);
-			break;
-
-		case HYDRABUS_MODE_DAT_HI: /* Set DAT High (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_dath(con);
-			break;
-
-		case HYDRABUS_MODE_DAT_LO: /* Set DAT Low (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_datl(con);
-			break;
+	/* Bus operations never wait for the host, output is written at the end */
+	policy = console_set_policy(con, CONSOLE_OUT_DEFER);
 
-		case HYDRABUS_MODE_DAT_RD: /* DAT Read (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_bitr(con);
-			break;
-
-		case HYDRABUS_MODE_BIT_RD: /* Read Bit (x-WIRE or other raw mode ...) */
-			hydrabus_mode_conf[bus_mode]->mode_bitr(con);
-			break;
-
-		case HYDRABUS_DELAY_MICROS:
-		case HYDRABUS_DELAY_MILLIS:
-			cmd_found = hydrabus_mode_delay(con, (const char* const*)tmp_argv, &nb_arg_car_used);
+	arg_pos = 0;
+	while(argv[0][arg_pos] != 0) { /* loop until end of string */
+		cmd_found = hydrabus_mode_parse_op(con, &argv[0][arg_pos], &op, &nb_arg_car_used);
+		if(cmd_found == FALSE)
 			break;
 
-		default: /* Check if it is a valid value to Write */
-			cmd_found = hydrabus_mode_write(con, (const char* const*)tmp_argv, &nb_arg_car_used);
+		hydrabus_mode_exec_op(con, &op);
+		if(console_is_aborted(con)) {
+			cprintf(con, mode_str_aborted);
 			break;
 		}
 
-		if(cmd_found == FALSE)
-			return cmd_found;
-
 		if(nb_arg_car_used > 0)
 			arg_pos += nb_arg_car_used;
 		else
 			arg_pos++;
-
-		arg = argv[0][arg_pos];
-		*tmp_argv = (char*)&argv[0][arg_pos];
 	} /* while(arg != 0) */
 
+	console_set_policy(con, policy);
 	return cmd_found;
 }
 
@@ -18,6 +18,7 @@ limitations under the License.
 #include "stdint.h"
 #include "common.h"
 #include "microrl_callback.h"
+#include "bus_lock.h"
 
 #define _HYDRABUS_MODE         "m"
 #define _HYDRABUS_MODE_INFO    "i"
@@ -27,6 +28,15 @@ limitations under the License.
 
 #define HYDRABUS_MODE_STATUS_OK (0)
 
+/*
+ * 'r:x' up to HYDRABUS_MODE_READ_MAX, above MODE_CONFIG_PROTO_BUFFER_SIZE-1
+ * it is a bulk read: the bus read of a chunk overlaps the USB transmit of
+ * the previous chunk text (lines of HYDRABUS_MODE_BULK_LINE values).
+ */
+#define HYDRABUS_MODE_READ_MAX (16*1024*1024)
+#define HYDRABUS_MODE_BULK_LINE (16)
+#define HYDRABUS_MODE_BULK_CHUNK (512) /* Bytes read per chunk */
+
 /* Common string for hydrabus mode */
 /* "/CS ENABLED\r\n" */
 extern const char hydrabus_mode_str_cs_enabled[];
@@ -66,6 +76,7 @@ typedef struct {
 	void (*mode_stopR)(t_hydra_console *con); /* Stop Read command '}' */
 	uint32_t (*mode_write)(t_hydra_console *con, uint8_t *tx_data, uint8_t nb_data); /* Write/Send x data (return status 0=OK) */
 	uint32_t (*mode_read)(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data); /* Read x data command 'r' or 'r:x' (return status 0=OK) */
+	uint32_t (*mode_read_bulk)(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data); /* Read x data without output for large 'r:x' (optional, return status 0=OK) */
 	uint32_t (*mode_write_read)(t_hydra_console *con, uint8_t *tx_data, uint8_t *rx_data, uint8_t nb_data); /* Write & Read x data (return status 0=OK) */
 	void (*mode_clkh)(t_hydra_console *con); /* Set CLK High (x-WIRE or other raw mode ...) command '/' */
 	void (*mode_clkl)(t_hydra_console *con); /* Set CLK Low (x-WIRE or other raw mode ...) command '\' */
@@ -84,6 +95,7 @@ typedef struct {
 	void (*mode_print_settings)(t_hydra_console *con); /* Settings string */
 	void (*mode_print_name)(t_hydra_console *con);  /* Print Mode name */
 	const char* (*mode_str_prompt)(t_hydra_console *con); /* Prompt name string */
+	bus_lock_dev_t (*mode_bus)(t_hydra_console *con); /* Peripheral used with the current parameters (owned by the console) */
 } mode_exec_t;
 
 typedef struct {
@@ -95,9 +107,37 @@ typedef struct {
 	const char* const* argv_help; /* argv help string (when arg is invalid/missing) */
 } mode_dev_arg_t;
 
+/* Protocol Interaction operation parsed from one command character (+ value/repeat) */
+typedef enum {
+	HYDRABUS_OP_START = 0, /* '[' */
+	HYDRABUS_OP_STOP, /* ']' */
+	HYDRABUS_OP_STARTR, /* '{' */
+	HYDRABUS_OP_STOPR, /* '}' */
+	HYDRABUS_OP_WRITE, /* value or value:repeat */
+	HYDRABUS_OP_READ, /* 'r' or 'r:repeat' */
+	HYDRABUS_OP_CLK_HI, /* '/' */
+	HYDRABUS_OP_CLK_LO, /* '\' */
+	HYDRABUS_OP_CLK_TK, /* '^' */
+	HYDRABUS_OP_DAT_HI, /* '-' */
+	HYDRABUS_OP_DAT_LO, /* '_' */
+	HYDRABUS_OP_BIT_RD, /* '.' or '!' */
+	HYDRABUS_OP_DELAY_US, /* '&' or '&:repeat' */
+	HYDRABUS_OP_DELAY_MS /* '%' or '%:repeat' */
+} hydrabus_mode_op_type_t;
+
+typedef struct {
+	uint8_t type; /* hydrabus_mode_op_type_t */
+	uint8_t val; /* Value to write */
+	uint16_t pad;
+	uint32_t nb; /* Repeat/delay (0 means 1 time for read/write) */
+} hydrabus_mode_op_t;
+
 void hydrabus_mode(t_hydra_console *con, int argc, const char* const* argv);
 void hydrabus_mode_info(t_hydra_console *con, int argc, const char* const* argv);
 bool hydrabus_mode_proto_inter(t_hydra_console *con, int argc, const char* const* argv);
+bool hydrabus_mode_parse_op(t_hydra_console *con, const char* str,
+			    hydrabus_mode_op_t* op, int* nb_arg_car_used);
+void hydrabus_mode_exec_op(t_hydra_console *con, const hydrabus_mode_op_t* op);
 long hydrabus_mode_dev_manage_arg(t_hydra_console *con, int argc, const char* const* argv,
 				  int mode_dev_nb_arg, int dev_arg_no, mode_dev_arg_t* dev_arg);
 
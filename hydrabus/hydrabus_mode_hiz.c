@@ -40,7 +40,8 @@ const mode_exec_t mode_hiz_exec = {
 	.mode_print_pins     = &mode_print_pins_hiz,     /* Print Pins used */
 	.mode_print_settings = &mode_print_settings_hiz, /* Settings string */
 	.mode_print_name     = &mode_print_name_hiz,      /* Print Mode name */
-	.mode_str_prompt   = &mode_str_prompt_hiz    /* Prompt name string */
+	.mode_str_prompt   = &mode_str_prompt_hiz,   /* Prompt name string */
+	.mode_bus          = &mode_bus_hiz    /* Peripheral owned by the console */
 };
 
 static const char* str_hiz_mode = { "HiZ mode" };
@@ -259,3 +260,9 @@ const char* mode_str_prompt_hiz(t_hydra_console *con)
 	(void)con;
 	return "> ";
 }
+
+bus_lock_dev_t mode_bus_hiz(t_hydra_console *con)
+{
+	(void)con;
+	return BUS_LOCK_NONE;
+}
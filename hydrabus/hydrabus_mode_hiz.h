@@ -77,6 +77,8 @@ void mode_print_settings_hiz(t_hydra_console *con);
 void mode_print_name_hiz(t_hydra_console *con);
 /* Mode prompt string*/
 const char* mode_str_prompt_hiz(t_hydra_console *con);
+/* Peripheral owned in this mode */
+bus_lock_dev_t mode_bus_hiz(t_hydra_console *con);
 
 #endif /* _HYDRABUS_MODE_HIZ_H_ */
 
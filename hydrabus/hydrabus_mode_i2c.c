@@ -38,6 +38,7 @@ const mode_exec_t mode_i2c_exec = {
 	.mode_stopR        = &mode_stopR_i2c,     /* Stop Read command '}' */
 	.mode_write        = &mode_write_i2c,     /* Write/Send 1 data */
 	.mode_read         = &mode_read_i2c,      /* Read 1 data command 'r' */
+	.mode_read_bulk    = &mode_read_bulk_i2c, /* Read x data without output (large 'r:x') */
 	.mode_write_read   = &mode_write_read_i2c,/* Write & Read 1 data implicitely with mode_write command */
 	.mode_clkh         = &mode_clkh_i2c,      /* Set CLK High (x-WIRE or other raw mode ...) command '/' */
 	.mode_clkl         = &mode_clkl_i2c,      /* Set CLK Low (x-WIRE or other raw mode ...) command '\' */
@@ -55,7 +56,8 @@ const mode_exec_t mode_i2c_exec = {
 	.mode_print_pins     = &mode_print_pins_i2c,     /* Print Pins used */
 	.mode_print_settings = &mode_print_settings_i2c, /* Settings string */
 	.mode_print_name     = &mode_print_name_i2c,      /* Print Mode name */
-	.mode_str_prompt   = &mode_str_prompt_i2c    /* Prompt name string */
+	.mode_str_prompt   = &mode_str_prompt_i2c,   /* Prompt name string */
+	.mode_bus          = &mode_bus_i2c    /* Peripheral owned by the console */
 };
 
 /* TODO support Slave mode (by default only Master) */
@@ -241,6 +243,27 @@ uint32_t mode_read_i2c(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
 	return status;
 }
 
+/* Read x data without output (bulk 'r:x') return status 0=BSP_OK */
+uint32_t mode_read_bulk_i2c(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
+{
+	int i;
+	uint32_t status;
+	mode_config_proto_t* proto = &con->mode->proto;
+
+	status = BSP_ERROR;
+	for(i = 0; i < nb_data; i++) {
+		if(proto->ack_pending)
+			bsp_i2c_read_ack(I2C_DEV_NUM, TRUE);
+
+		status = bsp_i2c_master_read_u8(proto->dev_num, &rx_data[i]);
+		if(status != BSP_OK)
+			break;
+
+		proto->ack_pending = 1;
+	}
+	return status;
+}
+
 /* Write & Read x data return status 0=BSP_OK */
 uint32_t mode_write_read_i2c(t_hydra_console *con, uint8_t *tx_data, uint8_t *rx_data, uint8_t nb_data)
 {
@@ -379,3 +402,9 @@ const char* mode_str_prompt_i2c(t_hydra_console *con)
 	(void)con;
 	return str_prompt_i2c1;
 }
+
+bus_lock_dev_t mode_bus_i2c(t_hydra_console *con)
+{
+	(void)con;
+	return BUS_LOCK_I2C1;
+}
@@ -31,6 +31,7 @@ const mode_exec_t mode_spi_exec = {
 	.mode_stopR        = &mode_stopR_spi,     /* Stop Read command '}' */
 	.mode_write        = &mode_write_spi,     /* Write/Send 1 data */
 	.mode_read         = &mode_read_spi,      /* Read 1 data command 'r' */
+	.mode_read_bulk    = &mode_read_bulk_spi, /* Read x data without output (large 'r:x') */
 	.mode_write_read   = &mode_write_read_spi,/* Write & Read 1 data implicitely with mode_write command */
 	.mode_clkh         = &mode_clkh_spi,      /* Set CLK High (x-WIRE or other raw mode ...) command '/' */
 	.mode_clkl         = &mode_clkl_spi,      /* Set CLK Low (x-WIRE or other raw mode ...) command '\' */
@@ -48,7 +49,8 @@ const mode_exec_t mode_spi_exec = {
 	.mode_print_pins     = &mode_print_pins_spi,     /* Print Pins used */
 	.mode_print_settings = &mode_print_settings_spi, /* Settings string */
 	.mode_print_name     = &mode_print_name_spi,      /* Print Mode name */
-	.mode_str_prompt   = &mode_str_prompt_spi    /* Prompt name string */
+	.mode_str_prompt   = &mode_str_prompt_spi,   /* Prompt name string */
+	.mode_bus          = &mode_bus_spi    /* Peripheral owned by the console */
 };
 
 static const char* str_dev_arg_num[]= {
@@ -255,6 +257,12 @@ uint32_t mode_read_spi(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
 	return status;
 }
 
+/* Read x data without output (bulk 'r:x') return status 0=OK */
+uint32_t mode_read_bulk_spi(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
+{
+	return bsp_spi_read_u8(con->mode->proto.dev_num, rx_data, nb_data);
+}
+
 /* Write & Read x data return status 0=OK */
 uint32_t mode_write_read_spi(t_hydra_console *con, uint8_t *tx_data, uint8_t *rx_data, uint8_t nb_data)
 {
@@ -420,3 +428,8 @@ const char* mode_str_prompt_spi(t_hydra_console *con)
 	} else
 		return str_prompt_spi2;
 }
+
+bus_lock_dev_t mode_bus_spi(t_hydra_console *con)
+{
+	return BUS_LOCK_SPI1 + con->mode->proto.dev_num;
+}
@@ -35,6 +35,7 @@ void mode_stopR_spi(t_hydra_console *con);
 uint32_t mode_write_spi(t_hydra_console *con, uint8_t *tx_data, uint8_t nb_data);
 /* Read x data command 'r' or 'r:x' (return status 0=OK) */
 uint32_t mode_read_spi(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data);
+uint32_t mode_read_bulk_spi(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data);
 /* Write & Read x data (return status 0=OK) */
 uint32_t mode_write_read_spi(t_hydra_console *con, uint8_t *tx_data, uint8_t *rx_data, uint8_t nb_data);
 
@@ -77,6 +78,8 @@ void mode_print_settings_spi(t_hydra_console *con);
 void mode_print_name_spi(t_hydra_console *con);
 /* Mode prompt string*/
 const char* mode_str_prompt_spi(t_hydra_console *con);
+/* Peripheral owned in this mode */
+bus_lock_dev_t mode_bus_spi(t_hydra_console *con);
 
 #endif /* _HYDRABUS_MODE_SPI_H_ */
 
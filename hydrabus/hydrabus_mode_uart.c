@@ -31,6 +31,7 @@ const mode_exec_t mode_uart_exec = {
 	.mode_stopR        = &mode_stopR_uart,     /* Stop Read command '}' */
 	.mode_write        = &mode_write_uart,     /* Write/Send 1 data */
 	.mode_read         = &mode_read_uart,      /* Read 1 data command 'r' */
+	.mode_read_bulk    = &mode_read_bulk_uart, /* Read x data without output (large 'r:x') */
 	.mode_write_read   = &mode_write_read_uart,/* Write & Read 1 data implicitely with mode_write command */
 	.mode_clkh         = &mode_clkh_uart,      /* Set CLK High (x-WIRE or other raw mode ...) command '/' */
 	.mode_clkl         = &mode_clkl_uart,      /* Set CLK Low (x-WIRE or other raw mode ...) command '\' */
@@ -48,7 +49,8 @@ const mode_exec_t mode_uart_exec = {
 	.mode_print_pins     = &mode_print_pins_uart,     /* Print Pins used */
 	.mode_print_settings = &mode_print_settings_uart, /* Settings string */
 	.mode_print_name     = &mode_print_name_uart,      /* Print Mode name */
-	.mode_str_prompt   = &mode_str_prompt_uart    /* Prompt name string */
+	.mode_str_prompt   = &mode_str_prompt_uart,   /* Prompt name string */
+	.mode_bus          = &mode_bus_uart   /* Peripheral owned by the console */
 };
 
 static const char* str_dev_arg_num[]= {
@@ -208,6 +210,12 @@ uint32_t mode_read_uart(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
 	return status;
 }
 
+/* Read x data without output (bulk 'r:x') return status 0=OK */
+uint32_t mode_read_bulk_uart(t_hydra_console *con, uint8_t *rx_data, uint8_t nb_data)
+{
+	return bsp_uart_read_u8(con->mode->proto.dev_num, rx_data, nb_data);
+}
+
 /* Write & Read x data return status 0=OK */
 uint32_t mode_write_read_uart(t_hydra_console *con, uint8_t *tx_data, uint8_t *rx_data, uint8_t nb_data)
 {
@@ -379,3 +387,8 @@ const char* mode_str_prompt_uart(t_hydra_console *con)
 	} else
 		return str_prompt_uart2;
 }
+
+bus_lock_dev_t mode_bus_uart(t_hydra_console *con)
+{
+	return BUS_LOCK_UART1 + con->mode->proto.dev_num;
+}
@@ -0,0 +1,341 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <string.h>
+#include <stdlib.h> /* strtoul */
+
+#include "ch.h"
+#include "hal.h"
+#include "chprintf.h"
+
+#include "ff.h"
+
+#include "common.h"
+#include "microsd.h"
+#include "storage.h"
+#include "bufpool.h"
+
+#include "hydrabus.h"
+#include "hydrabus_mode.h"
+#include "hydrabus_run.h"
+
+#define RUN_COMMENT '#'
+
+/*
+ * Output capture stream, everything written by the mode drivers is batched
+ * in DMA pool buffers appended to the output file by the storage worker.
+ */
+typedef struct {
+	const struct BaseSequentialStreamVMT *vmt;
+	/* Referenced by the queued appends, kept until the final sync (barrier) */
+	filename_t path;
+	uint8_t* batch;
+	uint32_t batch_len;
+	uint32_t nb_bytes;
+	uint32_t nb_lost;
+} run_out_t;
+
+typedef struct {
+	const char* path;
+	uint8_t* buf;
+	uint32_t size;
+} run_load_arg_t;
+
+/* Executed by the storage worker, return 0 if success else <0 for error */
+static int run_load_call(void* arg)
+{
+	run_load_arg_t* a = arg;
+	FIL fp;
+	FRESULT err;
+	UINT br;
+	uint32_t size;
+
+	if(sd_mount_check() != 0)
+		return -5;
+
+	err = f_open(&fp, a->path, FA_READ | FA_OPEN_EXISTING);
+	if(err != FR_OK)
+		return -2;
+
+	/* Keep one byte for the end of string */
+	size = f_size(&fp);
+	if(size >= a->size) {
+		f_close(&fp);
+		return -4;
+	}
+	err = f_read(&fp, a->buf, size, &br);
+	f_close(&fp);
+	if( (err != FR_OK) || (br != size) )
+		return -3;
+
+	a->buf[size] = 0;
+	a->size = size;
+	return 0;
+}
+
+/*
+ * Parse script (modified in place) in ops.
+ * Return number of operations or <0 in case of error (already printed).
+ */
+static int run_parse(t_hydra_console *con, char* script, hydrabus_mode_op_t* ops)
+{
+	char* line;
+	char* next;
+	char* token;
+	char* save;
+	int nb_ops, line_num, used;
+
+	nb_ops = 0;
+	line_num = 0;
+	for(line = script; line != NULL; line = next) {
+		line_num++;
+		next = strchr(line, '\n');
+		if(next != NULL)
+			*next++ = 0;
+		token = strchr(line, RUN_COMMENT);
+		if(token != NULL)
+			*token = 0;
+
+		for(token = strtok_r(line, " \t\r", &save); token != NULL;
+		    token = strtok_r(NULL, " \t\r", &save)) {
+			while(*token != 0) {
+				if(nb_ops >= RUN_OP_MAX) {
+					cprintf(con, "line %d: more than %d operations\r\n",
+						line_num, RUN_OP_MAX);
+					return -1;
+				}
+				if(hydrabus_mode_parse_op(con, token, &ops[nb_ops], &used) == FALSE) {
+					cprintf(con, "line %d: invalid '%s'\r\n", line_num, token);
+					return -1;
+				}
+				nb_ops++;
+				token += (used > 0) ? used : 1;
+			}
+		}
+	}
+	return nb_ops;
+}
+
+static void run_out_flush(run_out_t* out)
+{
+	if( (out->batch == NULL) || (out->batch_len == 0) )
+		return;
+
+	/* Without callback the worker frees the batch */
+	if(storage_append_async(out->path.filename, out->batch, out->batch_len, NULL, NULL) < 0) {
+		out->nb_lost += out->batch_len;
+		bufpool_free(out->batch);
+	} else {
+		out->nb_bytes += out->batch_len;
+	}
+	out->batch = NULL;
+	out->batch_len = 0;
+}
+
+static size_t run_out_write(void *instance, const uint8_t *bp, size_t n)
+{
+	run_out_t* out = instance;
+	uint32_t len;
+	size_t i;
+
+	i = 0;
+	while(i < n) {
+		if(out->batch == NULL) {
+			/* Wait for the worker to release a previous batch */
+			out->batch = bufpool_alloc(BUFPOOL_DMA, RUN_OUT_BATCH_SIZE, MS2ST(1000));
+			if(out->batch == NULL) {
+				out->nb_lost += n - i;
+				return n;
+			}
+			out->batch_len = 0;
+		}
+		len = MIN(n - i, RUN_OUT_BATCH_SIZE - out->batch_len);
+		memcpy(&out->batch[out->batch_len], &bp[i], len);
+		out->batch_len += len;
+		i += len;
+		if(out->batch_len == RUN_OUT_BATCH_SIZE)
+			run_out_flush(out);
+	}
+	return n;
+}
+
+static size_t run_out_read(void *instance, uint8_t *bp, size_t n)
+{
+	(void)instance;
+	(void)bp;
+	(void)n;
+	return 0;
+}
+
+static msg_t run_out_put(void *instance, uint8_t b)
+{
+	run_out_write(instance, &b, 1);
+	return MSG_OK;
+}
+
+static msg_t run_out_get(void *instance)
+{
+	(void)instance;
+	return MSG_RESET;
+}
+
+static const struct BaseSequentialStreamVMT run_out_vmt = {
+	run_out_write, run_out_read, run_out_put, run_out_get
+};
+
+/* run <file> [loop <n>] [out <file>] */
+void cmd_run(t_hydra_console *con, int argc, const char* const* argv)
+{
+	t_hydra_console* run_con;
+	t_hydra_console* exec_con;
+	console_out_policy_t policy;
+	run_out_t out;
+	run_load_arg_t load;
+	hydrabus_mode_op_t* ops;
+	char* script;
+	filename_t path;
+	uint32_t nb_loop, loop, cycles, min_cycles, max_cycles;
+	systime_t start, elapsed;
+	int nb_ops, i, err;
+	bool aborted;
+
+	if(argc < 2) {
+		cprintf(con, "usage: %s <file> [loop <n>] [out <file>]\r\n", argv[0]);
+		return;
+	}
+	if(con->mode->proto.valid != MODE_CONFIG_PROTO_VALID) {
+		cprintf(con, "Mode not configured, configure mode with 'm'\r\n");
+		return;
+	}
+
+	nb_loop = 1;
+	memset(&out, 0, sizeof(out));
+	for(i = 2; (i + 1) < argc; i += 2) {
+		if(strcmp(argv[i], "loop") == 0)
+			nb_loop = strtoul(argv[i + 1], NULL, 0);
+		else if(strcmp(argv[i], "out") == 0)
+			chsnprintf(out.path.filename, sizeof(out.path.filename), "0:%s", argv[i + 1]);
+	}
+	if(nb_loop == 0) {
+		cprintf(con, "Invalid loop\r\n");
+		return;
+	}
+
+	script = bufpool_alloc(BUFPOOL_DMA, RUN_SCRIPT_MAX_SIZE, MS2ST(100));
+	ops = bufpool_alloc(BUFPOOL_CCM, RUN_OP_MAX * sizeof(hydrabus_mode_op_t), MS2ST(100));
+	if( (script == NULL) || (ops == NULL) ) {
+		cprintf(con, "Not enough buffer memory\r\n");
+		if(script != NULL)
+			bufpool_free(script);
+		if(ops != NULL)
+			bufpool_free(ops);
+		return;
+	}
+
+	chsnprintf(path.filename, sizeof(path.filename), "0:%s", argv[1]);
+	load.path = path.filename;
+	load.buf = (uint8_t*)script;
+	load.size = RUN_SCRIPT_MAX_SIZE;
+	err = storage_call(run_load_call, &load);
+	if(err < 0) {
+		if(err == -4)
+			cprintf(con, "Script %s too large (max %d bytes)\r\n", path.filename, RUN_SCRIPT_MAX_SIZE - 1);
+		else
+			cprintf(con, "Error to read file %s, err:%d\r\n", path.filename, err);
+		bufpool_free(script);
+		bufpool_free(ops);
+		return;
+	}
+
+	nb_ops = run_parse(con, script, ops);
+	/* Script text no longer needed, leave the DMA pool to the capture */
+	bufpool_free(script);
+	if(nb_ops <= 0) {
+		if(nb_ops == 0)
+			cprintf(con, "No operation in %s\r\n", path.filename);
+		bufpool_free(ops);
+		return;
+	}
+
+	exec_con = con;
+	run_con = NULL;
+	if(out.path.filename[0] != 0) {
+		/* Output is appended to the file, console copy kept off the stack */
+		run_con = bufpool_alloc(BUFPOOL_CCM, sizeof(t_hydra_console), MS2ST(100));
+		if(run_con == NULL) {
+			cprintf(con, "Not enough buffer memory\r\n");
+			bufpool_free(ops);
+			return;
+		}
+		*run_con = *con;
+		/* Ctrl-C sets the flag of con, the copy reads it */
+		run_con->abort_con = con;
+		out.vmt = &run_out_vmt;
+		run_con->bss = (BaseSequentialStream *)&out;
+		exec_con = run_con;
+	}
+
+	cprintf(con, "%d operations, %ld loop(s), Ctrl-C or UBTN to abort\r\n", nb_ops, nb_loop);
+	aborted = FALSE;
+	min_cycles = 0xFFFFFFFF;
+	max_cycles = 0;
+	start = chVTGetSystemTime();
+	for(loop = 0; loop < nb_loop; loop++) {
+		/* Console output of a loop is written after it (no effect on out) */
+		policy = console_set_policy(exec_con, CONSOLE_OUT_DEFER);
+		cycles = get_cyclecounter();
+		for(i = 0; i < nb_ops; i++)
+			hydrabus_mode_exec_op(exec_con, &ops[i]);
+		cycles = get_cyclecounter() - cycles;
+		console_set_policy(exec_con, policy);
+		if(cycles < min_cycles)
+			min_cycles = cycles;
+		if(cycles > max_cycles)
+			max_cycles = cycles;
+
+		if(console_is_aborted(con)) {
+			aborted = TRUE;
+			loop++;
+			break;
+		}
+	}
+	elapsed = chVTGetSystemTime() - start;
+	bufpool_free(ops);
+	if(run_con != NULL)
+		bufpool_free(run_con);
+
+	if(out.path.filename[0] != 0) {
+		if(out.batch != NULL) {
+			/* Last part written synchronously then the file is synced */
+			if(sd_file_append(out.path.filename, out.batch, out.batch_len) < 0)
+				out.nb_lost += out.batch_len;
+			else
+				out.nb_bytes += out.batch_len;
+			bufpool_free(out.batch);
+			out.batch = NULL;
+		}
+		/* Requests are served in order, the queued appends are done after it */
+		if(sd_file_sync() < 0)
+			cprintf(con, "Sync error %s\r\n", out.path.filename);
+	}
+
+	if(aborted)
+		cprintf(con, "Aborted by user\r\n");
+	cprintf(con, "%ld loop(s) in %ld ms, loop min %ld us max %ld us\r\n",
+		loop, (uint32_t)ST2MS(elapsed),
+		min_cycles / (STM32_SYSCLK / 1000000), max_cycles / (STM32_SYSCLK / 1000000));
+	if(out.path.filename[0] != 0)
+		cprintf(con, "%ld bytes written to %s, %ld bytes lost\r\n",
+			out.nb_bytes, out.path.filename, out.nb_lost);
+}
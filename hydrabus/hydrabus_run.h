@@ -0,0 +1,38 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _HYDRABUS_RUN_H_
+#define _HYDRABUS_RUN_H_
+
+#include "common.h"
+
+/*
+ * run <file>: Protocol Interaction script read from sd and parsed once in
+ * an operation list, the list is then executed back-to-back (no host round
+ * trip), optionally several times and with the output captured to a file.
+ * Script syntax is the one of the console ("[ 0x55:4 r:2 ] &:100"),
+ * one or more tokens per line, '#' starts a comment.
+ */
+
+/* Script file max size (loaded in a DMA pool buffer) */
+#define RUN_SCRIPT_MAX_SIZE (16384)
+/* Max operations per script, 8 bytes each in the CCM pool */
+#define RUN_OP_MAX (1024)
+/* Output capture batch borrowed from the DMA pool */
+#define RUN_OUT_BATCH_SIZE (16384)
+
+void cmd_run(t_hydra_console *con, int argc, const char* const* argv);
+
+#endif /* _HYDRABUS_RUN_H_ */
@@ -0,0 +1,267 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include "crypto1.h"
+
+#define LF_POLY_ODD	(0x29CE5C)
+#define LF_POLY_EVEN	(0x870804)
+
+#define BIT(x, n)	( ((x) >> (n)) & 1 )
+#define BEBIT(x, n)	BIT(x, (n) ^ 24)
+
+/*
+* Filter function is fc(fa(x0..3), fb(x4..7), fb(x8..11), fa(x12..15), fb(x16..19))
+* on the 20 lower odd bits.
+* It is computed with 2 lookup tables giving directly the fc input bits,
+* 12 lower bits (3 nibbles) and 8 upper bits (2 nibbles).
+*/
+#define FILTER_FC	(0xEC57E80A)
+static uint8_t filter_lo[4096];
+static uint8_t filter_hi[256];
+static int filter_ready;
+
+static uint32_t filter_fc_index(uint32_t x)
+{
+	uint32_t f;
+
+	f  = (0xf22c0 >> (x & 0xf)) & 16;
+	f |= (0x6c9c0 >> ((x >> 4) & 0xf)) & 8;
+	f |= (0x3c8b0 >> ((x >> 8) & 0xf)) & 4;
+	f |= (0x1e458 >> ((x >> 12) & 0xf)) & 2;
+	f |= (0x0d938 >> ((x >> 16) & 0xf)) & 1;
+	return f;
+}
+
+static void filter_init(void)
+{
+	uint32_t i;
+
+	for(i = 0; i < 4096; i++)
+		filter_lo[i] = filter_fc_index(i) & (16 | 8 | 4);
+	for(i = 0; i < 256; i++)
+		filter_hi[i] = filter_fc_index(i << 12) & (2 | 1);
+	filter_ready = 1;
+}
+
+static inline uint32_t filter(uint32_t x)
+{
+	return BIT(FILTER_FC, filter_lo[x & 0xfff] | filter_hi[(x >> 12) & 0xff]);
+}
+
+static inline uint32_t parity32(uint32_t x)
+{
+	x ^= x >> 16;
+	x ^= x >> 8;
+	x ^= x >> 4;
+	return BIT(0x6996, x & 0xf);
+}
+
+uint8_t crypto1_odd_parity(uint8_t data)
+{
+	return parity32(data) ^ 1;
+}
+
+void crypto1_init(crypto1_state_t* s, uint64_t key)
+{
+	int i;
+
+	if(!filter_ready)
+		filter_init();
+
+	s->odd = 0;
+	s->even = 0;
+	for(i = 47; i > 0; i -= 2) {
+		s->odd  = (s->odd << 1) | BIT(key, (i - 1) ^ 7);
+		s->even = (s->even << 1) | BIT(key, i ^ 7);
+	}
+}
+
+uint8_t crypto1_bit(crypto1_state_t* s, uint8_t in, int is_encrypted)
+{
+	uint32_t feedin, t;
+	uint8_t ret;
+
+	ret = filter(s->odd);
+
+	feedin  = ret & !!is_encrypted;
+	feedin ^= !!in;
+	feedin ^= LF_POLY_ODD & s->odd;
+	feedin ^= LF_POLY_EVEN & s->even;
+	s->even = (s->even << 1) | parity32(feedin);
+
+	t = s->odd;
+	s->odd = s->even;
+	s->even = t;
+
+	return ret;
+}
+
+/*
+* Step nb_bits (even, up to 32), LFSR is clocked 2 bits per loop so odd/even halves
+* are never swapped (odd half is updated by the 2nd step).
+* in bit n is fed at step n (LSB first), keystream is returned the same way.
+*/
+static inline uint32_t crypto1_steps(crypto1_state_t* s, uint32_t in, int nb_bits, int is_encrypted)
+{
+	uint32_t odd, even, ks, ret, feedin;
+	uint32_t enc_mask;
+	int i;
+
+	odd = s->odd;
+	even = s->even;
+	enc_mask = is_encrypted ? 1 : 0;
+	ret = 0;
+	for(i = 0; i < nb_bits; i += 2) {
+		ks = filter(odd);
+		feedin = (ks & enc_mask) ^ BIT(in, i);
+		feedin ^= (LF_POLY_ODD & odd) ^ (LF_POLY_EVEN & even);
+		even = (even << 1) | parity32(feedin);
+		ret |= ks << i;
+
+		ks = filter(even);
+		feedin = (ks & enc_mask) ^ BIT(in, i + 1);
+		feedin ^= (LF_POLY_ODD & even) ^ (LF_POLY_EVEN & odd);
+		odd = (odd << 1) | parity32(feedin);
+		ret |= ks << (i + 1);
+	}
+	s->odd = odd;
+	s->even = even;
+
+	return ret;
+}
+
+uint8_t crypto1_byte(crypto1_state_t* s, uint8_t in, int is_encrypted)
+{
+	return crypto1_steps(s, in, 8, is_encrypted);
+}
+
+/* in and returned keystream use the on air (big endian bytes) ordering */
+uint32_t crypto1_word(crypto1_state_t* s, uint32_t in, int is_encrypted)
+{
+	uint32_t le_in, ret;
+	int i;
+
+	le_in = 0;
+	for(i = 0; i < 32; i++)
+		le_in |= BEBIT(in, i) << i;
+
+	ret = crypto1_steps(s, le_in, 32, is_encrypted);
+
+	le_in = 0;
+	for(i = 0; i < 32; i++)
+		le_in |= BIT(ret, i) << (i ^ 24);
+	return le_in;
+}
+
+void crypto1_keystream(crypto1_state_t* s, uint8_t* ks, uint32_t nb_bytes)
+{
+	uint32_t i, word;
+
+	for(i = 0; (i + 4) <= nb_bytes; i += 4) {
+		word = crypto1_steps(s, 0, 32, 0);
+		ks[i] = word;
+		ks[i + 1] = word >> 8;
+		ks[i + 2] = word >> 16;
+		ks[i + 3] = word >> 24;
+	}
+	for(; i < nb_bytes; i++)
+		ks[i] = crypto1_steps(s, 0, 8, 0);
+}
+
+void crypto1_crypt(crypto1_state_t* s, uint8_t* data, uint8_t* parity, uint32_t nb_bytes, int feed_plain)
+{
+	uint32_t i;
+	uint8_t plain;
+
+	for(i = 0; i < nb_bytes; i++) {
+		plain = data[i];
+		data[i] = plain ^ crypto1_steps(s, feed_plain ? plain : 0, 8, 0);
+		/* Parity is encrypted with the next keystream bit (not consumed) */
+		if(parity != 0)
+			parity[i] = crypto1_odd_parity(plain) ^ filter(s->odd);
+	}
+}
+
+uint32_t crypto1_prng_successor(uint32_t x, uint32_t n)
+{
+	x = (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+	while(n--)
+		x = (x >> 1) | (((x >> 16) ^ (x >> 18) ^ (x >> 19) ^ (x >> 21)) << 31);
+	return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+}
+
+/*
+* Reference authentication trace (key A FFFFFFFFFFFF):
+* uid 9c599b32, nt 82a4166c, {nr} a1e458ce, {ar} 6eea41e0, {at} 5cadf439
+*/
+#define TV_KEY		(0xFFFFFFFFFFFFULL)
+#define TV_UID		(0x9c599b32)
+#define TV_NT		(0x82a4166c)
+#define TV_NR_ENC	(0xa1e458ce)
+#define TV_AR_ENC	(0x6eea41e0)
+#define TV_AT_ENC	(0x5cadf439)
+
+int crypto1_selftest(void)
+{
+	crypto1_state_t s, s_bit;
+	uint32_t i, ks, ks_bit, nr;
+	uint8_t data[4];
+	int n;
+
+	/* Test 1: lookup tables vs reference filter */
+	crypto1_init(&s, TV_KEY);
+	for(i = 0; i < (1UL << 20); i++) {
+		if(filter(i) != BIT(FILTER_FC, filter_fc_index(i)))
+			return 1;
+	}
+
+	/* Test 2: reader answer and tag answer from reference trace */
+	crypto1_init(&s, TV_KEY);
+	crypto1_word(&s, TV_UID ^ TV_NT, 0);
+	nr = TV_NR_ENC ^ crypto1_word(&s, TV_NR_ENC, 1);
+	ks = crypto1_word(&s, 0, 0);
+	if((TV_AR_ENC ^ ks) != crypto1_prng_successor(TV_NT, 64))
+		return 2;
+	ks = crypto1_word(&s, 0, 0);
+	if((TV_AT_ENC ^ ks) != crypto1_prng_successor(TV_NT, 96))
+		return 3;
+
+	/* Test 3: byte encryption of the reader nonce (plain nonce fed in LFSR) */
+	crypto1_init(&s, TV_KEY);
+	crypto1_word(&s, TV_UID ^ TV_NT, 0);
+	for(i = 0; i < 4; i++)
+		data[i] = nr >> (24 - (i * 8));
+	crypto1_crypt(&s, data, 0, 4, 1);
+	for(i = 0; i < 4; i++) {
+		if(data[i] != (uint8_t)(TV_NR_ENC >> (24 - (i * 8))))
+			return 4;
+	}
+
+	/* Test 4: word stepping vs bit stepping */
+	crypto1_init(&s, 0xA0A1A2A3A4A5ULL);
+	crypto1_init(&s_bit, 0xA0A1A2A3A4A5ULL);
+	for(i = 0; i < 64; i++) {
+		ks = crypto1_word(&s, TV_UID + i, i & 1);
+		ks_bit = 0;
+		for(n = 0; n < 32; n++)
+			ks_bit |= (uint32_t)crypto1_bit(&s_bit, BEBIT(TV_UID + i, n), i & 1) << (n ^ 24);
+		if(ks != ks_bit)
+			return 5;
+	}
+	if( (s.odd & 0xffffff) != (s_bit.odd & 0xffffff) ||
+	    (s.even & 0xffffff) != (s_bit.even & 0xffffff) )
+		return 6;
+
+	return 0;
+}
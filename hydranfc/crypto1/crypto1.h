@@ -0,0 +1,60 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _CRYPTO1_H_
+#define _CRYPTO1_H_
+
+/*
+* MIFARE Classic Crypto1 stream cipher.
+* Only depends on the C standard library so it can be built and checked
+* on a host PC as well as on target.
+*/
+#include <stdint.h>
+
+/*
+* 48bits LFSR split in odd/even bits (24bits each),
+* filter function only uses odd bits.
+*/
+typedef struct {
+	uint32_t odd;
+	uint32_t even;
+} crypto1_state_t;
+
+void crypto1_init(crypto1_state_t* s, uint64_t key);
+
+/* Clock LFSR and return keystream, in is fed in the LFSR (xor keystream if is_encrypted) */
+uint8_t crypto1_bit(crypto1_state_t* s, uint8_t in, int is_encrypted);
+uint8_t crypto1_byte(crypto1_state_t* s, uint8_t in, int is_encrypted);
+uint32_t crypto1_word(crypto1_state_t* s, uint32_t in, int is_encrypted);
+
+/* Generate nb_bytes of keystream (no input fed in the LFSR) */
+void crypto1_keystream(crypto1_state_t* s, uint8_t* ks, uint32_t nb_bytes);
+
+/*
+* Encrypt/decrypt buffer in place and compute encrypted parity bits (1 byte per data byte, can be NULL).
+* If feed_plain is set the plain data is fed in the LFSR (reader nonce).
+*/
+void crypto1_crypt(crypto1_state_t* s, uint8_t* data, uint8_t* parity, uint32_t nb_bytes, int feed_plain);
+
+/* MIFARE Classic 16bits PRNG successor of x after n steps */
+uint32_t crypto1_prng_successor(uint32_t x, uint32_t n);
+
+/* Odd parity of a byte as sent on air by ISO14443A */
+uint8_t crypto1_odd_parity(uint8_t data);
+
+/* Return 0 if all test vectors pass else index of first failing test (>0) */
+int crypto1_selftest(void);
+
+#endif /* _CRYPTO1_H_ */
@@ -14,6 +14,7 @@ limitations under the License.
 */
 
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h> /* sprintf */
 #include "ch.h"
 #include "hal.h"
@@ -24,6 +25,8 @@ limitations under the License.
 #include "usb2cfg.h"
 
 #include "common.h"
+#include "bufpool.h"
+#include "bus_lock.h"
 
 /* HydraNFC TRF7970A library */
 #include "mcu.h"
@@ -38,6 +41,8 @@ volatile int irq;
 volatile int irq_end_rx;
 
 volatile bool hydranfc_is_detected_flag = FALSE;
+/* Owner of the shield peripherals */
+static const char hydranfc_owner[] = "hydranfc";
 
 
 /*
@@ -183,17 +188,21 @@ bool hydranfc_init(void)
 	/* Enable TRF7970A EN=1 (EN2 is already equal to GND) */
 	palClearPad(GPIOB, 11);
 	palSetPadMode(GPIOB, 11, PAL_MODE_OUTPUT_PUSHPULL | PAL_STM32_OSPEED_MID1);
-	McuDelayMillisecond(2);
+	chThdSleepMilliseconds(2);
 
 	palSetPad(GPIOB, 11);
-	/* After setting EN=1 wait at least 21ms */
-	McuDelayMillisecond(21);
+	/* After setting EN=1 wait at least 21ms (sleep, other threads run) */
+	chThdSleepMilliseconds(21);
 
 	hydranfc_is_detected_flag = hydranfc_test_shield();
 	if(hydranfc_is_detected_flag == FALSE) {
 		return FALSE;
 	}
 
+	/* TRF7970A (SPI2) and its sniffer data (SPI1 slave) for good */
+	bus_lock_acquire(BUS_LOCK_SPI1, hydranfc_owner, hydranfc_owner);
+	bus_lock_acquire(BUS_LOCK_SPI2, hydranfc_owner, hydranfc_owner);
+
 	/* Configure K1/2/3/4 Buttons as Input */
 	palSetPadMode(GPIOB, 7, PAL_MODE_INPUT);
 	palSetPadMode(GPIOB, 6, PAL_MODE_INPUT);
@@ -245,21 +254,25 @@ void cmd_nfc_vicinity(t_hydra_console *con, int argc, const char* const* argv)
 	data_buf[1] = 0x31;
 	Trf797xWriteSingle(data_buf, 2);
 
+#if TRF797X_DEBUG_VERIFY
 	data_buf[0] = MODULATOR_CONTROL;
 	Trf797xReadSingle(data_buf, 1);
 	if(data_buf[0] != 0x31) {
 		cprintf(con, "Error Modulator Control Register read=0x%.2lX (shall be 0x31)\r\n", (uint32_t)data_buf[0]);
 	}
+#endif
 	/* Configure Mode ISO Control Register (0x01) to 0x02 (ISO15693 high bit rate, one subcarrier, 1 out of 4) */
 	data_buf[0] = ISO_CONTROL;
 	data_buf[1] = 0x02;
 	Trf797xWriteSingle(data_buf, 2);
 
+#if TRF797X_DEBUG_VERIFY
 	data_buf[0] = ISO_CONTROL;
 	Trf797xReadSingle(data_buf, 1);
 	if(data_buf[0] != 0x02) {
 		cprintf(con, "Error ISO Control Register read=0x%.2lX (shall be 0x02)\r\n", (uint32_t)data_buf[0]);
 	}
+#endif
 	/* Configure Test Settings 1 to BIT6/0x40 => MOD Pin becomes receiver subcarrier output (Digital Output for RX/TX) */
 	/*
 	    data_buf[0] = TEST_SETTINGS_1;
@@ -355,20 +368,24 @@ void cmd_nfc_mifare(t_hydra_console *con, int argc, const char* const* argv)
 	data_buf[1] = 0x31;
 	Trf797xWriteSingle(data_buf, 2);
 
+#if TRF797X_DEBUG_VERIFY
 	data_buf[0] = MODULATOR_CONTROL;
 	Trf797xReadSingle(data_buf, 1);
 	cprintf(con, "Modulator Control Register read=0x%.2lX (shall be 0x31)\r\n", (uint32_t)data_buf[0]);
+#endif
 
 	/* Configure Mode ISO Control Register (0x01) to 0x88 (ISO14443A RX bit rate, 106 kbps) and no RX CRC (CRC is not present in the response)) */
 	data_buf[0] = ISO_CONTROL;
 	data_buf[1] = 0x88;
 	Trf797xWriteSingle(data_buf, 2);
 
+#if TRF797X_DEBUG_VERIFY
 	data_buf[0] = ISO_CONTROL;
 	Trf797xReadSingle(data_buf, 1);
 	if(data_buf[0] != 0x88) {
 		cprintf(con, "Error ISO Control Register read=0x%.2lX (shall be 0x88)\r\n", (uint32_t)data_buf[0]);
 	}
+#endif
 	/* Configure Test Settings 1 to BIT6/0x40 => MOD Pin becomes receiver subcarrier output (Digital Output for RX/TX) */
 	/*
 	    data_buf[0] = TEST_SETTINGS_1;
@@ -492,135 +509,227 @@ void cmd_nfc_mifare(t_hydra_console *con, int argc, const char* const* argv)
 	cprintf(con, "Test nfm ISO14443-A/Mifare end\r\n");
 }
 
+/* Registers 0x00 to 0x16 and 0x18 to 0x1E, NFCID (0x17) and FIFO (0x1F) are not dumped */
+#define DUMP_REGS_NB (TX_LENGTH_BYTE_2+1)
+static const char* const dump_regs_name[DUMP_REGS_NB] = {
+	"Chip Status",
+	"ISO Control",
+	"ISO 14443B Options",
+	"ISO 14443A Options",
+	"TX Timer HighByte",
+	"TX Timer LowByte",
+	"TX Pulse Length",
+	"RX No Response Wait Time",
+	"RX Wait Time",
+	"Modulator SYS_CLK",
+	"RX SpecialSettings",
+	"Regulator IO",
+	"IRQ Status",
+	"IRQ Mask+Collision Position1",
+	"Collision Position2",
+	"RSSI+Oscillator Status",
+	"Special Functions1",
+	"Special Functions2",
+	"RAM ADDR0",
+	"RAM ADDR1",
+	"Adjust FIFO IRQ Lev",
+	"RAM ADDR3",
+	"NFC Low Field Level",
+	NULL,
+	"NFC Target Detection Level",
+	"NFC Target Protocol",
+	"Test Settings1",
+	"Test Settings2",
+	"FIFO Status",
+	"TX Length Byte1",
+	"TX Length Byte2"
+};
+
 void cmd_nfc_dump_regs(t_hydra_console *con, int argc, const char* const* argv)
 {
 	(void)argc;
 	(void)argv;
-	static uint8_t data_buf[16];
+	static uint8_t data_buf[DUMP_REGS_NB];
+	int i;
 
 	cprintf(con, "Start Dump TRF7970A Registers\r\n");
 
+	/*
+	* Continuous read (one chip select) of 0x00-0x16 then 0x18-0x1E.
+	* Reading IRQ Status(0x0C) followed by 0x0D clears IRQ Status.
+	*/
 	data_buf[0] = CHIP_STATE_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Chip Status(0x00)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = ISO_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "ISO Control(0x01)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = ISO_14443B_OPTIONS;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "ISO 14443B Options(0x02)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = ISO_14443A_OPTIONS;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "ISO 14443A Options(0x03)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = TX_TIMER_EPC_HIGH;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "TX Timer HighByte(0x04)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = TX_TIMER_EPC_LOW;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "TX Timer LowByte(0x05)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = TX_PULSE_LENGTH_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "TX Pulse Length(0x06)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = RX_NO_RESPONSE_WAIT_TIME;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RX No Response Wait Time(0x07)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = RX_WAIT_TIME;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RX Wait Time(0x08)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = MODULATOR_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Modulator SYS_CLK(0x09)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = RX_SPECIAL_SETTINGS;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RX SpecialSettings(0x0A)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = REGULATOR_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Regulator IO(0x0B)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	/* Read/Clear IRQ Status(0x0C=>0x6C)+read dummy */
-	Trf797xReadIrqStatus(data_buf);
-	cprintf(con, "IRQ Status(0x0C)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = IRQ_MASK;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "IRQ Mask+Collision Position1(0x0D)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = COLLISION_POSITION;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Collision Position2(0x0E)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = RSSI_LEVELS;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RSSI+Oscillator Status(0x0F)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = SPECIAL_FUNCTION;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Special Functions1(0x10)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = RAM_START_ADDRESS;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Special Functions2(0x11)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = RAM_START_ADDRESS+1;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RAM ADDR0(0x12)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	Trf797xReadCont(&data_buf[0], NFCID);
+	data_buf[NFC_TARGET_LEVEL] = NFC_TARGET_LEVEL;
+	Trf797xReadCont(&data_buf[NFC_TARGET_LEVEL], DUMP_REGS_NB - NFC_TARGET_LEVEL);
+
+	for(i = 0; i < DUMP_REGS_NB; i++) {
+		if(dump_regs_name[i] == NULL)
+			continue;
+		cprintf(con, "%s(0x%.2lX)=0x%.2lX\r\n", dump_regs_name[i], (uint32_t)i, (uint32_t)data_buf[i]);
+	}
 
-	data_buf[0] = RAM_START_ADDRESS+2;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RAM ADDR1(0x13)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	cprintf(con, "End Dump TRF7970A Registers\r\n");
+}
 
-	data_buf[0] = RAM_START_ADDRESS+3;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Adjust FIFO IRQ Lev(0x14)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+/*
+* Register watch, samples up to WATCH_REG_MAX registers (default RSSI Levels
+* and FIFO Status) read with one chip select.
+* IRQ Status (0x0C) can be watched but reading it clears it, so the IRQ
+* handling of a running exchange will miss the bits sampled here.
+* Samples are paced on absolute deadlines (start + n * period) so the read
+* and statistics time does not stretch the period; the deadlines have the
+* system tick resolution (1/CH_CFG_ST_FREQUENCY s), shorter periods run back
+* to back within a tick.
+* Last samples are kept in a ring buffer (one CCM pool block), statistics
+* are computed on all samples.
+*/
+#define WATCH_DEFAULT_PERIOD_US (100)
+#define WATCH_DEFAULT_NB (10000)
+#define WATCH_REG_MAX (4)
+#define WATCH_RING_NB (BUFPOOL_CCM_BLOCK_SIZE / sizeof(watch_sample_t))
+#define WATCH_RING_PRINT (16)
 
-	data_buf[0] = RAM_START_ADDRESS+4;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "RAM ADDR3(0x15)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+typedef struct {
+	uint8_t reg[WATCH_REG_MAX];
+} watch_sample_t;
 
-	data_buf[0] = NFC_LOW_DETECTION;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "NFC Low Field Level(0x16)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
-
-	data_buf[0] = NFC_TARGET_LEVEL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "NFC Target Detection Level(0x18)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+void cmd_nfc_watch(t_hydra_console *con, int argc, const char* const* argv)
+{
+	watch_sample_t* ring;
+	uint32_t rssi_am_hist[8], rssi_pm_hist[8], bit_count[WATCH_REG_MAX][8];
+	uint32_t period_us, nb_samples, nb_regs, n, i, j, idx, val;
+	uint8_t regs[WATCH_REG_MAX], reg_min[WATCH_REG_MAX], reg_max[WATCH_REG_MAX];
+	uint8_t data_buf[WATCH_REG_MAX], am, pm;
+	int rssi_idx;
+	systime_t start, next, elapsed;
+
+	period_us = (argc >= 2) ? strtoul(argv[1], NULL, 10) : WATCH_DEFAULT_PERIOD_US;
+	nb_samples = (argc >= 3) ? strtoul(argv[2], NULL, 10) : WATCH_DEFAULT_NB;
+
+	if(argc >= 4) {
+		nb_regs = argc - 3;
+		if(nb_regs > WATCH_REG_MAX) {
+			cprintf(con, "Up to %d registers\r\n", WATCH_REG_MAX);
+			return;
+		}
+		for(i = 0; i < nb_regs; i++) {
+			val = strtoul(argv[3 + i], NULL, 16);
+			/* Reading the FIFO register would pop its data */
+			if(val >= FIFO) {
+				cprintf(con, "Invalid register 0x%.2lX (0x00 to 0x%.2X)\r\n", val, FIFO - 1);
+				return;
+			}
+			regs[i] = val;
+		}
+	} else {
+		nb_regs = 2;
+		regs[0] = RSSI_LEVELS;
+		regs[1] = FIFO_CONTROL;
+	}
 
-	data_buf[0] = NFC_TARGET_PROTOCOL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "NFC Target Protocol(0x19)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	rssi_idx = -1;
+	for(i = 0; i < nb_regs; i++) {
+		if(regs[i] == RSSI_LEVELS)
+			rssi_idx = i;
+		if(regs[i] == IRQ_STATUS)
+			cprintf(con, "Warning: reading IRQ Status (0x0C) clears it\r\n");
+	}
 
-	data_buf[0] = TEST_SETTINGS_1;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Test Settings1(0x1A)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	ring = bufpool_alloc(BUFPOOL_CCM, WATCH_RING_NB * sizeof(watch_sample_t), TIME_IMMEDIATE);
+	if(ring == NULL) {
+		cprintf(con, "bufpool_alloc() error\r\n");
+		return;
+	}
 
-	data_buf[0] = TEST_SETTINGS_2;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "Test Settings2(0x1B)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	memset(rssi_am_hist, 0, sizeof(rssi_am_hist));
+	memset(rssi_pm_hist, 0, sizeof(rssi_pm_hist));
+	memset(bit_count, 0, sizeof(bit_count));
+	memset(reg_min, 0xFF, sizeof(reg_min));
+	memset(reg_max, 0, sizeof(reg_max));
+
+	cprintf(con, "Watch");
+	for(i = 0; i < nb_regs; i++)
+		cprintf(con, " 0x%.2X", regs[i]);
+	cprintf(con, " every %ld us, %ld samples (K4 to abort)\r\n", period_us, nb_samples);
+
+	start = chVTGetSystemTime();
+	for(n = 0; n < nb_samples; n++) {
+		/* All registers read with one chip select */
+		memcpy(data_buf, regs, nb_regs);
+		Trf797xReadSingle(data_buf, nb_regs);
+
+		idx = n % WATCH_RING_NB;
+		for(i = 0; i < nb_regs; i++) {
+			ring[idx].reg[i] = data_buf[i];
+			if(data_buf[i] < reg_min[i])
+				reg_min[i] = data_buf[i];
+			if(data_buf[i] > reg_max[i])
+				reg_max[i] = data_buf[i];
+			for(j = 0; j < 8; j++) {
+				if(data_buf[i] & (1 << j))
+					bit_count[i][j]++;
+			}
+		}
+		if(rssi_idx >= 0) {
+			rssi_am_hist[data_buf[rssi_idx] & 0x07]++;
+			rssi_pm_hist[(data_buf[rssi_idx] >> 3) & 0x07]++;
+		}
 
-	data_buf[0] = FIFO_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "FIFO Status(0x1C)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+		if(K4_BUTTON) {
+			n++;
+			break;
+		}
+		if(period_us > 0) {
+			/* Absolute deadline of the next sample, no drift */
+			next = start + (systime_t)(((uint64_t)(n + 1) * period_us * CH_CFG_ST_FREQUENCY) / 1000000);
+			if(chVTIsSystemTimeWithin(start, next))
+				chThdSleepUntil(next);
+		}
+	}
+	elapsed = ST2MS(chVTGetSystemTime() - start);
+
+	cprintf(con, "%ld samples in %ld ms", n, (uint32_t)elapsed);
+	if(elapsed > 0)
+		cprintf(con, " (%ld samples/s)", (n * 1000) / (uint32_t)elapsed);
+	cprintf(con, "\r\n");
+	if(n == 0) {
+		bufpool_free(ring);
+		return;
+	}
 
-	data_buf[0] = TX_LENGTH_BYTE_1;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "TX Length Byte1(0x1D)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	if(rssi_idx >= 0) {
+		cprintf(con, "RSSI level  AM      PM\r\n");
+		for(i = 0; i < 8; i++)
+			cprintf(con, "%ld    %7ld %7ld\r\n", i, rssi_am_hist[i], rssi_pm_hist[i]);
+		am = 0;
+		pm = 0;
+		for(i = 0; i < 8; i++) {
+			if(rssi_am_hist[i])
+				am = i;
+			if(rssi_pm_hist[i])
+				pm = i;
+		}
+		cprintf(con, "RSSI max AM=%d PM=%d\r\n", am, pm);
+	}
 
-	data_buf[0] = TX_LENGTH_BYTE_2;
-	Trf797xReadSingle(data_buf, 1);
-	cprintf(con, "TX Length Byte2(0x1E)=0x%.2lX\r\n", (uint32_t)data_buf[0]);
+	for(i = 0; i < nb_regs; i++) {
+		cprintf(con, "0x%.2X min=0x%.2X max=0x%.2X bits count:", regs[i], reg_min[i], reg_max[i]);
+		for(j = 0; j < 8; j++)
+			cprintf(con, " b%ld=%ld", j, bit_count[i][j]);
+		cprintf(con, "\r\n");
+	}
 
-	cprintf(con, "End Dump TRF7970A Registers\r\n");
+	/* Last samples from the ring buffer */
+	cprintf(con, "Last samples:\r\n");
+	i = (n > WATCH_RING_PRINT) ? (n - WATCH_RING_PRINT) : 0;
+	for(; i < n; i++) {
+		idx = i % WATCH_RING_NB;
+		for(j = 0; j < nb_regs; j++)
+			cprintf(con, "0x%.2X ", ring[idx].reg[j]);
+		cprintf(con, "\r\n");
+	}
+	bufpool_free(ring);
 }
 
 
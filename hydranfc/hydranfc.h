@@ -29,7 +29,10 @@ bool hydranfc_is_detected(void);
 void cmd_nfc_vicinity(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_nfc_mifare(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_nfc_dump_regs(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_nfc_watch(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_nfc_sniff_14443A(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_nfc_poll(t_hydra_console *con, int argc, const char* const* argv);
+void cmd_nfc_apdu(t_hydra_console *con, int argc, const char* const* argv);
 void cmd_microrl_select_nfc_low_level(t_hydra_console *con, int argc, const char* const* argv);
 
 
@@ -1,5 +1,7 @@
 # List of all the hydranfc related files.
 HYDRANFCSRC = hydranfc/hydranfc.c \
+              hydranfc/hydranfc_cmd_iso14443_4.c \
+              hydranfc/hydranfc_cmd_poll.c \
               hydranfc/hydranfc_cmd_sniff.c \
               hydranfc/hydranfc_cmd_sniff_downsampling.c \
               hydranfc/hydranfc_cmd_sniff_iso14443.c \
@@ -0,0 +1,413 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <string.h>
+#include <stdlib.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "mcu.h"
+#include "trf797x.h"
+#include "types.h"
+
+#include "hydranfc.h"
+
+#include "common.h"
+
+/*
+* ISO14443-4 (T=CL) half duplex block transmission protocol for ISO14443A.
+* Frame sizes are the largest supported by both the card (FSCI from ATS)
+* and the TRF7970A FIFO (no FIFO refill during TX/RX).
+*/
+
+/* Reader max frame size (FSDI=6 => 96 bytes) fits in TRF7970A FIFO */
+#define TCL_FSDI		(6)
+#define TCL_FRAME_MAX		(TRF797X_FIFO_SIZE)
+#define TCL_APDU_MAX		(512)
+
+#define TCL_PCB_I_BLOCK		(0x02)
+#define TCL_PCB_R_ACK		(0xA2)
+#define TCL_PCB_R_NAK		(0xB2)
+#define TCL_PCB_S_DESELECT	(0xC2)
+#define TCL_PCB_S_WTX		(0xF2)
+#define TCL_PCB_CHAINING	(0x10)
+#define TCL_PCB_BLOCK_NUM	(0x01)
+#define TCL_PCB_I_MASK		(0xE2)
+#define TCL_PCB_R_MASK		(0xF6)
+#define TCL_PCB_S_MASK		(0xF6)
+
+#define TCL_RETRY_MAX		(2)
+/* FWTmax (FWI=14), also the limit of FWT*WTXM */
+#define TCL_FWT_MS_MAX		(((302UL << 14) / 1000) + 1)
+
+/* Activation frames timeout */
+#define TCL_TIMEOUT_MS		(5)
+
+static const uint16_t tcl_fs_table[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+typedef struct {
+	uint8_t uid[10];
+	uint8_t uid_size;
+	uint8_t sak;
+	uint8_t ats[32];
+	uint8_t ats_size;
+	uint16_t fsc; /* Card max frame size (PCB + INF + CRC) */
+	uint8_t fwi;
+	uint8_t block_num;
+} tcl_card_t;
+
+static tcl_card_t tcl;
+
+static uint8_t tcl_buf[TCL_FRAME_MAX];
+/* Last I-block or R(ACK) sent, kept for retransmission */
+static uint8_t tcl_last[TCL_FRAME_MAX];
+static int tcl_last_size;
+static uint8_t apdu_tx[TCL_APDU_MAX];
+static uint8_t apdu_rx[TCL_APDU_MAX];
+
+static void tcl_set_iso_control(uint8_t iso_control)
+{
+	uint8_t data_buf[2];
+
+	data_buf[0] = ISO_CONTROL;
+	data_buf[1] = iso_control;
+	Trf797xWriteSingle(data_buf, 2);
+}
+
+/* FWT = 256*16/fc * 2^FWI (~302us * 2^FWI), up to ~4.9s */
+static uint16_t tcl_fwt_ms(uint8_t wtxm)
+{
+	uint32_t fwt_ms;
+
+	fwt_ms = (((302UL << tcl.fwi) * wtxm) / 1000) + 1;
+	if(fwt_ms > TCL_FWT_MS_MAX)
+		fwt_ms = TCL_FWT_MS_MAX;
+	return fwt_ms;
+}
+
+/* ISO14443-3 activation with cascade levels, return TRUE if card selected */
+static bool tcl_select(void)
+{
+	uint8_t data_buf[8];
+	uint8_t uid_buf[5];
+	uint8_t cascade;
+	int size;
+
+	tcl.uid_size = 0;
+	tcl_set_iso_control(0x88);
+
+	/* Send WUPA(7bits) and receive ATQA(2bytes) */
+	size = Trf797x_transceive_bits(0x52, 7, data_buf, sizeof(data_buf), TCL_TIMEOUT_MS, 0);
+	if(size == 0)
+		return FALSE;
+
+	for(cascade = 0x93; cascade <= 0x97; cascade += 2) {
+		tcl_set_iso_control(0x88);
+		data_buf[0] = cascade;
+		data_buf[1] = 0x20;
+		size = Trf797x_transceive_bytes(data_buf, 2, uid_buf, sizeof(uid_buf), TCL_TIMEOUT_MS, 0);
+		if(size < 5)
+			return FALSE;
+
+		/* SAK is sent with CRC_A */
+		tcl_set_iso_control(0x08);
+		data_buf[0] = cascade;
+		data_buf[1] = 0x70;
+		memcpy(&data_buf[2], uid_buf, 5);
+		size = Trf797x_transceive_bytes(data_buf, 7, data_buf, sizeof(data_buf), TCL_TIMEOUT_MS, 1);
+		if(size == 0)
+			return FALSE;
+		tcl.sak = data_buf[0];
+
+		/* Skip Cascade Tag (0x88) */
+		if(uid_buf[0] == 0x88) {
+			memcpy(&tcl.uid[tcl.uid_size], &uid_buf[1], 3);
+			tcl.uid_size += 3;
+		} else {
+			memcpy(&tcl.uid[tcl.uid_size], uid_buf, 4);
+			tcl.uid_size += 4;
+		}
+
+		/* UID complete */
+		if((tcl.sak & 0x04) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Send RATS and parse ATS, return TRUE if card supports ISO14443-4 */
+static bool tcl_rats(void)
+{
+	uint8_t data_buf[2];
+	uint8_t t0, fsci, i;
+	int size;
+
+	tcl.fsc = 32;
+	tcl.fwi = 4;
+	tcl.block_num = 0;
+	tcl.ats_size = 0;
+
+	if((tcl.sak & 0x20) == 0)
+		return FALSE;
+
+	/* RATS with FSDI and CID 0 */
+	data_buf[0] = 0xE0;
+	data_buf[1] = (TCL_FSDI << 4);
+	size = Trf797x_transceive_bytes(data_buf, 2, tcl.ats, sizeof(tcl.ats), TCL_TIMEOUT_MS, 1);
+	if(size == 0)
+		return FALSE;
+	tcl.ats_size = size;
+
+	/* TL T0 [TA] [TB] [TC] historical bytes */
+	if(size > 1) {
+		t0 = tcl.ats[1];
+		fsci = t0 & 0x0F;
+		if(fsci >= ARRAY_SIZE(tcl_fs_table))
+			fsci = ARRAY_SIZE(tcl_fs_table) - 1;
+		tcl.fsc = tcl_fs_table[fsci];
+
+		i = 2;
+		if(t0 & 0x10)
+			i++; /* TA bit rates, 106kbps only */
+		if( (t0 & 0x20) && (i < size) ) {
+			tcl.fwi = tcl.ats[i] >> 4;
+			if(tcl.fwi > 14)
+				tcl.fwi = 4;
+		}
+	}
+
+	/* TX is limited by TRF7970A FIFO */
+	if(tcl.fsc > TCL_FRAME_MAX)
+		tcl.fsc = TCL_FRAME_MAX;
+
+	return TRUE;
+}
+
+/*
+* Exchange one I-block or R(ACK) with CRC, answer to S(WTX) requests
+* transparently (ISO14443-4 7.5.4 rules for errors):
+* - timeout: R(NAK) so the PICC resends its last block (an I-block is
+*   never sent twice), R(ACK) again when acknowledging PICC chaining
+* - R(ACK) with another block number: the PICC did not receive the
+*   I-block, it is retransmitted
+* tx and rx can be the same buffer.
+* Return received block size (PCB+INF) or 0 if error.
+*/
+static int tcl_block_exchange(uint8_t* tx, int tx_size, uint8_t* rx, int rx_max)
+{
+	uint8_t frame[2];
+	uint8_t* p_tx;
+	uint8_t wtxm;
+	int size, retry;
+
+	memcpy(tcl_last, tx, tx_size);
+	tcl_last_size = tx_size;
+	p_tx = tcl_last;
+	wtxm = 1;
+	retry = 0;
+	while(1) {
+		size = Trf797x_transceive_bytes(p_tx, tx_size, rx, rx_max, tcl_fwt_ms(wtxm), 1);
+		/* FWT*WTXM only applies to the answer of S(WTX) */
+		wtxm = 1;
+		if(size == 0) {
+			if(++retry > TCL_RETRY_MAX)
+				return 0;
+			if((tcl_last[0] & TCL_PCB_R_MASK) == TCL_PCB_R_ACK) {
+				p_tx = tcl_last;
+				tx_size = tcl_last_size;
+			} else {
+				frame[0] = TCL_PCB_R_NAK | tcl.block_num;
+				p_tx = frame;
+				tx_size = 1;
+			}
+			continue;
+		}
+
+		if((rx[0] & TCL_PCB_S_MASK) == TCL_PCB_S_WTX) {
+			/* S(WTX) request, answer with same WTXM and wait FWT*WTXM */
+			wtxm = rx[1] & 0x3F;
+			if(wtxm == 0)
+				wtxm = 1;
+			frame[0] = TCL_PCB_S_WTX;
+			frame[1] = wtxm;
+			p_tx = frame;
+			tx_size = 2;
+			continue;
+		}
+
+		if( ((rx[0] & TCL_PCB_R_MASK) == TCL_PCB_R_ACK) &&
+		    ((rx[0] & TCL_PCB_BLOCK_NUM) != tcl.block_num) &&
+		    ((tcl_last[0] & TCL_PCB_I_MASK) == TCL_PCB_I_BLOCK) ) {
+			if(++retry > TCL_RETRY_MAX)
+				return 0;
+			p_tx = tcl_last;
+			tx_size = tcl_last_size;
+			continue;
+		}
+		return size;
+	}
+}
+
+/* Return response APDU size or -1 if error */
+static int tcl_apdu(uint8_t* apdu, int apdu_size, uint8_t* resp, int resp_max)
+{
+	int inf_max, chunk, size, resp_size;
+	uint8_t pcb;
+
+	inf_max = tcl.fsc - 3; /* PCB + CRC */
+	resp_size = 0;
+
+	/* Send I-blocks with chaining */
+	do {
+		chunk = (apdu_size > inf_max) ? inf_max : apdu_size;
+		pcb = TCL_PCB_I_BLOCK | tcl.block_num;
+		if(chunk < apdu_size)
+			pcb |= TCL_PCB_CHAINING;
+		tcl_buf[0] = pcb;
+		memcpy(&tcl_buf[1], apdu, chunk);
+
+		size = tcl_block_exchange(tcl_buf, chunk + 1, tcl_buf, sizeof(tcl_buf));
+		if(size == 0)
+			return -1;
+
+		apdu += chunk;
+		apdu_size -= chunk;
+		if(pcb & TCL_PCB_CHAINING) {
+			/* R(ACK) expected with current block number */
+			if( ((tcl_buf[0] & TCL_PCB_R_MASK) != TCL_PCB_R_ACK) ||
+			    ((tcl_buf[0] & TCL_PCB_BLOCK_NUM) != tcl.block_num) )
+				return -1;
+			tcl.block_num ^= 1;
+		}
+	} while(apdu_size > 0);
+
+	/* Receive I-blocks with chaining */
+	while(1) {
+		if((tcl_buf[0] & TCL_PCB_I_MASK) != TCL_PCB_I_BLOCK)
+			return -1;
+
+		size--;
+		if((resp_size + size) > resp_max)
+			return -1;
+		memcpy(&resp[resp_size], &tcl_buf[1], size);
+		resp_size += size;
+		tcl.block_num ^= 1;
+
+		if((tcl_buf[0] & TCL_PCB_CHAINING) == 0)
+			break;
+
+		tcl_buf[0] = TCL_PCB_R_ACK | tcl.block_num;
+		size = tcl_block_exchange(tcl_buf, 1, tcl_buf, sizeof(tcl_buf));
+		if(size == 0)
+			return -1;
+	}
+	return resp_size;
+}
+
+static void tcl_deselect(void)
+{
+	tcl_buf[0] = TCL_PCB_S_DESELECT;
+	Trf797x_transceive_bytes(tcl_buf, 1, tcl_buf, sizeof(tcl_buf), tcl_fwt_ms(1), 1);
+}
+
+static int tcl_parse_hex(const char* str, uint8_t* data, int max)
+{
+	char hex[3];
+	int size;
+
+	size = 0;
+	hex[2] = 0;
+	while(str[0] && str[1] && (size < max)) {
+		hex[0] = str[0];
+		hex[1] = str[1];
+		data[size++] = strtoul(hex, NULL, 16);
+		str += 2;
+	}
+	return size;
+}
+
+/* apdu <hex> [nb] - Send APDU (nb times) to ISO14443-4A card */
+void cmd_nfc_apdu(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint8_t data_buf[2];
+	uint32_t nb_loop, loop, bytes;
+	systime_t start, elapsed;
+	int apdu_size, resp_size, i;
+
+	if(argc < 2) {
+		cprintf(con, "usage: %s <apdu hex> [nb]\r\n", argv[0]);
+		return;
+	}
+	apdu_size = tcl_parse_hex(argv[1], apdu_tx, sizeof(apdu_tx));
+	nb_loop = (argc >= 3) ? strtoul(argv[2], NULL, 10) : 1;
+	if( (apdu_size < 4) || (nb_loop == 0) ) {
+		cprintf(con, "Invalid parameter\r\n");
+		return;
+	}
+
+	Trf797xInitialSettings();
+	Trf797xReset();
+	data_buf[0] = MODULATOR_CONTROL;
+	data_buf[1] = 0x31;
+	Trf797xWriteSingle(data_buf, 2);
+	Trf797xTurnRfOn();
+
+	if(!tcl_select()) {
+		cprintf(con, "No card\r\n");
+		Trf797xTurnRfOff();
+		return;
+	}
+	if(!tcl_rats()) {
+		cprintf(con, "Card does not support ISO14443-4 (SAK 0x%02X)\r\n", tcl.sak);
+		Trf797xTurnRfOff();
+		return;
+	}
+
+	cprintf(con, "UID:");
+	for(i = 0; i < tcl.uid_size; i++)
+		cprintf(con, " %02X", tcl.uid[i]);
+	cprintf(con, "\r\nATS:");
+	for(i = 0; i < tcl.ats_size; i++)
+		cprintf(con, " %02X", tcl.ats[i]);
+	cprintf(con, "\r\nFSC %d FWI %d\r\n", tcl.fsc, tcl.fwi);
+
+	resp_size = 0;
+	bytes = 0;
+	start = chVTGetSystemTime();
+	for(loop = 0; loop < nb_loop; loop++) {
+		resp_size = tcl_apdu(apdu_tx, apdu_size, apdu_rx, sizeof(apdu_rx));
+		if(resp_size < 0)
+			break;
+		bytes += apdu_size + resp_size;
+	}
+	elapsed = ST2MS(chVTGetSystemTime() - start);
+
+	tcl_deselect();
+	Trf797xTurnRfOff();
+
+	if(resp_size < 0) {
+		cprintf(con, "APDU %ld error\r\n", loop);
+	} else {
+		cprintf(con, "Response:");
+		for(i = 0; i < resp_size; i++)
+			cprintf(con, " %02X", apdu_rx[i]);
+		cprintf(con, "\r\n");
+	}
+	cprintf(con, "%ld APDU in %ld ms", loop, (uint32_t)elapsed);
+	if(elapsed > 0)
+		cprintf(con, " (%ld APDU/s, %ld bytes/s)", (loop * 1000) / (uint32_t)elapsed,
+			(bytes * 1000) / (uint32_t)elapsed);
+	cprintf(con, "\r\n");
+}
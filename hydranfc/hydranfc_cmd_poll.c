@@ -0,0 +1,311 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+#include <stdio.h> /* sprintf */
+#include <string.h>
+#include <stdlib.h>
+
+#include "ch.h"
+#include "hal.h"
+
+#include "mcu.h"
+#include "trf797x.h"
+#include "types.h"
+
+#include "hydranfc.h"
+
+#include "common.h"
+#include "microsd.h"
+
+/*
+* Continuous NFC reader polling.
+* RF field is kept ON during the whole session and the TRF7970A is
+* initialized only once, each poll cycle only changes the registers
+* which differ between protocols (shadowed by trf797x.c).
+* A detection is reported only when the UID seen for a protocol changes
+* (new tag or tag removed).
+* ISO14443A tags are halted at the end of each cycle (WUPA, anticollision,
+* SELECT, HLTA) so the next cycle WUPA finds them in the same state.
+*/
+
+/* Guard time after a protocol switch (unmodulated RF) */
+#define POLL_GUARD_TIME_US	(500)
+
+/* TX/RX timeout for each protocol request */
+#define POLL_TIMEOUT_14443A_MS	(1)
+#define POLL_TIMEOUT_14443B_MS	(2)
+#define POLL_TIMEOUT_15693_MS	(5)
+
+#define POLL_UID_MAX		(12)
+#define POLL_LINE_MAX		(80)
+
+typedef enum {
+	POLL_ISO14443A = 0,
+	POLL_ISO14443B,
+	POLL_ISO15693,
+	POLL_NB_PROTOCOL
+} poll_protocol_t;
+
+typedef struct {
+	const char* name;
+	uint8_t iso_control;
+	uint8_t modulator_control;
+} poll_protocol_conf_t;
+
+static const poll_protocol_conf_t poll_conf[POLL_NB_PROTOCOL] = {
+	/* ISO14443A 106kbps no RX CRC, OOK 100% */
+	{ "ISO14443A", 0x88, 0x31 },
+	/* ISO14443B 106kbps RX CRC, ASK 10% */
+	{ "ISO14443B", 0x0C, 0x30 },
+	/* ISO15693 high bit rate, one subcarrier, 1 out of 4, OOK 100% */
+	{ "ISO15693",  0x02, 0x31 }
+};
+
+typedef struct {
+	uint8_t uid[POLL_UID_MAX];
+	uint8_t uid_size; /* 0 means no tag present */
+	uint32_t nb_detect;
+} poll_state_t;
+
+static poll_state_t poll_state[POLL_NB_PROTOCOL];
+
+static void poll_set_protocol(poll_protocol_t proto)
+{
+	uint8_t data_buf[4];
+
+	/* Both registers are shadowed, unchanged values cost no SPI access */
+	data_buf[0] = ISO_CONTROL;
+	data_buf[1] = poll_conf[proto].iso_control;
+	data_buf[2] = MODULATOR_CONTROL;
+	data_buf[3] = poll_conf[proto].modulator_control;
+	Trf797xWriteSingle(data_buf, 4);
+}
+
+/* Return UID size or 0 if no tag, the tag is left in HALT state */
+static int poll_14443A(uint8_t* uid)
+{
+	uint8_t data_buf[8];
+	int size;
+
+	/* Send WUPA(7bits) and receive ATQA(2bytes), WUPA also wakes up a halted tag */
+	size = Trf797x_transceive_bits(0x52, 7, data_buf, sizeof(data_buf),
+				       POLL_TIMEOUT_14443A_MS, 0);
+	if(size == 0)
+		return 0;
+
+	/* Send AntiColl(2Bytes) and receive UID+BCC(5bytes) */
+	data_buf[0] = 0x93;
+	data_buf[1] = 0x20;
+	size = Trf797x_transceive_bytes(data_buf, 2, uid, 5,
+					POLL_TIMEOUT_14443A_MS, 0);
+	if(size < 5)
+		return 0;
+	/* Collision or corrupted answer */
+	if( (uid[0] ^ uid[1] ^ uid[2] ^ uid[3]) != uid[4] )
+		return 0;
+
+	/* Send Select(UID+BCC with CRC) and receive SAK+CRC */
+	data_buf[0] = 0x93;
+	data_buf[1] = 0x70;
+	memcpy(&data_buf[2], uid, 5);
+	size = Trf797x_transceive_bytes(data_buf, 7, data_buf, sizeof(data_buf),
+					POLL_TIMEOUT_14443A_MS, 1);
+	if(size == 0)
+		return 0;
+
+	/* Send HLTA(with CRC), no answer */
+	data_buf[0] = 0x50;
+	data_buf[1] = 0x00;
+	Trf797x_transceive_bytes(data_buf, 2, data_buf, sizeof(data_buf),
+				 POLL_TIMEOUT_14443A_MS, 1);
+
+	/* Drop BCC */
+	return 4;
+}
+
+/* Return UID(PUPI) size or 0 if no tag */
+static int poll_14443B(uint8_t* uid)
+{
+	uint8_t data_buf[16];
+	int size;
+
+	/* Send REQB(AFI=0, N=1) and receive ATQB */
+	data_buf[0] = 0x05;
+	data_buf[1] = 0x00;
+	data_buf[2] = 0x00;
+	size = Trf797x_transceive_bytes(data_buf, 3, data_buf, sizeof(data_buf),
+					POLL_TIMEOUT_14443B_MS, 1);
+	if( (size < 5) || (data_buf[0] != 0x50) )
+		return 0;
+
+	memcpy(uid, &data_buf[1], 4);
+	return 4;
+}
+
+/* Return UID size or 0 if no tag */
+static int poll_15693(uint8_t* uid)
+{
+	uint8_t data_buf[16];
+	int size, i;
+
+	/* Send Inventory(1 slot) and receive Flags+DSFID+UID */
+	data_buf[0] = 0x26; /* Request Flags */
+	data_buf[1] = 0x01; /* Inventory Command */
+	data_buf[2] = 0x00; /* Mask */
+	size = Trf797x_transceive_bytes(data_buf, 3, data_buf, sizeof(data_buf),
+					POLL_TIMEOUT_15693_MS, 1);
+	if(size < 10)
+		return 0;
+
+	/* UID is sent LSB first, display it MSB first */
+	for(i = 0; i < 8; i++)
+		uid[i] = data_buf[9 - i];
+	return 8;
+}
+
+static int poll_protocol(poll_protocol_t proto, uint8_t* uid)
+{
+	switch(proto) {
+	case POLL_ISO14443A:
+		return poll_14443A(uid);
+	case POLL_ISO14443B:
+		return poll_14443B(uid);
+	case POLL_ISO15693:
+		return poll_15693(uid);
+	default:
+		return 0;
+	}
+}
+
+/* SD log file, lines are appended through the storage service file cache */
+static filename_t poll_log_filename;
+static uint32_t poll_log_size;
+
+static void poll_log_sd(const char* line)
+{
+	uint32_t len;
+
+	len = strlen(line);
+	if(sd_file_append(poll_log_filename.filename, (const uint8_t*)line, len) == 0)
+		poll_log_size += len;
+}
+
+static void poll_report(t_hydra_console *con, bool log_sd, systime_t timestamp,
+			poll_protocol_t proto, uint8_t* uid, int uid_size)
+{
+	char line[POLL_LINE_MAX];
+	int i, len;
+
+	/* Timestamp in ms with 0.1ms resolution (CH_CFG_ST_FREQUENCY 10kHz) */
+	len = sprintf(line, "%6ld.%ld ms %s ",
+		      (uint32_t)(timestamp / 10), (uint32_t)(timestamp % 10),
+		      poll_conf[proto].name);
+	if(uid_size == 0) {
+		sprintf(&line[len], "removed\r\n");
+	} else {
+		len += sprintf(&line[len], "UID:");
+		for(i = 0; i < uid_size; i++)
+			len += sprintf(&line[len], " %02X", uid[i]);
+		sprintf(&line[len], "\r\n");
+	}
+
+	cprint(con, line, strlen(line));
+	if(log_sd)
+		poll_log_sd(line);
+}
+
+void cmd_nfc_poll(t_hydra_console *con, int argc, const char* const* argv)
+{
+	uint8_t uid[POLL_UID_MAX];
+	uint32_t nb_cycles, cycle, nb_polls;
+	systime_t start, now;
+	bool log_sd;
+	int i, uid_size, init_ms;
+	poll_protocol_t proto;
+
+	nb_cycles = 0;
+	log_sd = FALSE;
+	for(i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "sd") == 0)
+			log_sd = TRUE;
+		else
+			nb_cycles = strtoul(argv[i], NULL, 10);
+	}
+
+	memset(poll_state, 0, sizeof(poll_state));
+	poll_log_size = 0;
+	if(log_sd) {
+		if(sd_next_filename("nfc_poll", &poll_log_filename) < 0) {
+			cprintf(con, "sd_next_filename() error\r\n");
+			return;
+		}
+	}
+
+	/* One time chip init, RF stays ON until the end of polling */
+	init_ms = Trf797xInitialSettings();
+	Trf797xReset();
+	poll_set_protocol(POLL_ISO14443A);
+	Trf797xTurnRfOn();
+
+	cprintf(con, "NFC polling ISO14443A/ISO14443B/ISO15693 start, init_ms=%d ms\r\n", init_ms);
+	if(nb_cycles == 0)
+		cprintf(con, "Abort/Exit by pressing K4 button\r\n");
+
+	nb_polls = 0;
+	start = chVTGetSystemTime();
+	for(cycle = 0; (nb_cycles == 0) || (cycle < nb_cycles); cycle++) {
+		for(proto = 0; proto < POLL_NB_PROTOCOL; proto++) {
+			poll_set_protocol(proto);
+			DelayUs(POLL_GUARD_TIME_US);
+
+			uid_size = poll_protocol(proto, uid);
+			nb_polls++;
+
+			/* Only report tag arrival, change or removal */
+			if( (uid_size == poll_state[proto].uid_size) &&
+			    (memcmp(uid, poll_state[proto].uid, uid_size) == 0) )
+				continue;
+
+			now = chVTGetSystemTime();
+			poll_report(con, log_sd, now - start, proto, uid, uid_size);
+
+			poll_state[proto].uid_size = uid_size;
+			memcpy(poll_state[proto].uid, uid, uid_size);
+			if(uid_size > 0)
+				poll_state[proto].nb_detect++;
+		}
+		if(K4_BUTTON)
+			break;
+	}
+	now = chVTGetSystemTime();
+
+	Trf797xTurnRfOff();
+
+	now = ST2MS(now - start);
+	cprintf(con, "NFC polling end, %ld cycles, %ld polls in %ld ms", cycle, nb_polls, (uint32_t)now);
+	if(now > 0)
+		cprintf(con, " (%ld polls/s)", (nb_polls * 1000) / (uint32_t)now);
+	cprintf(con, "\r\n");
+	for(proto = 0; proto < POLL_NB_PROTOCOL; proto++)
+		cprintf(con, "%s detections: %ld\r\n", poll_conf[proto].name, poll_state[proto].nb_detect);
+
+	if(log_sd) {
+		if(sd_file_sync() < 0) {
+			cprintf(con, "sd_file_sync() error\r\n");
+		} else {
+			cprintf(con, "write_file %s size=%ld bytes OK\r\n",
+				&poll_log_filename.filename[2], poll_log_size);
+		}
+	}
+}
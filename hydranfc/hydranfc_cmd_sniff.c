@@ -30,6 +30,7 @@ limitations under the License.
 
 #include "common.h"
 #include "microsd.h"
+#include "bufpool.h"
 #include "ff.h"
 
 filename_t write_filename;
@@ -44,6 +45,11 @@ volatile int irq_sampling = 0;
 
 static uint32_t old_u32_data, u32_data, old_data_bit;
 
+/* Sniffed data (ASCII), borrowed from the DMA pool for the sniffer session */
+#define SNIFF_BUF_SIZE (NB_SBUFFER + 128)
+static uint8_t* sniff_buf;
+static uint32_t sniff_buf_idx;
+
 /*
 * SPI1 configuration structure.
 * Speed not used in Slave mode, CPHA=0, CPOL=0, 8bits frames, MSb transmitted first.
@@ -58,7 +64,7 @@ static const SPIConfig spi1cfg = {NULL, /* spicb, */
 
 uint8_t* sniffer_get_buffer(void)
 {
-	return &g_sbuf[0];
+	return sniff_buf;
 }
 
 uint32_t sniffer_get_buffer_max_size(void)
@@ -68,7 +74,7 @@ uint32_t sniffer_get_buffer_max_size(void)
 
 uint32_t sniffer_get_size(void)
 {
-	return g_sbuf_idx;
+	return sniff_buf_idx;
 }
 
 void initSPI1(void)
@@ -170,6 +176,7 @@ static void init_sniff_nfc(void)
 	Trf797xStopDecoders(); /* Disable Receiver */
 	Trf797xRunDecoders(); /* Enable Receiver */
 
+#if TRF797X_DEBUG_VERIFY
 	tmp_buf[0] = CHIP_STATE_CONTROL;
 	Trf797xReadSingle(tmp_buf, 1);
 	tprintf("Chip Status Register(0x00) read=0x%.2lX (shall be 0x21)\r\n", (uint32_t)tmp_buf[0]);
@@ -201,6 +208,7 @@ static void init_sniff_nfc(void)
 	tmp_buf[0] = TEST_SETTINGS_1;
 	Trf797xReadSingle(tmp_buf, 1);
 	tprintf("Test Settings Register(0x1A) read=0x%.2lX (shall be 0x40)\r\n", (uint32_t)tmp_buf[0]);
+#endif
 
 	tprintf("TRF7970A chipset init end\r\n");
 
@@ -245,54 +253,7 @@ __attribute__ ((always_inline)) static inline uint32_t WaitGetDMABuffer(void)
 /* Return 0 if OK else < 0 error code */
 int sniff_write_file(uint8_t* buffer, uint32_t size)
 {
-	uint32_t i;
-	FRESULT err;
-	FIL FileObject;
-	uint32_t bytes_written;
-
-	if(size == 0) {
-		return -1;
-	}
-
-	if(is_fs_ready()==FALSE) {
-		if(mount() != 0) {
-			return -5;
-		}
-	} else {
-		umount();
-		if(mount() != 0) {
-			return -5;
-		}
-	}
-
-	/* Save data in file */
-	for(i=0; i<999; i++) {
-		sprintf(write_filename.filename, "0:nfc_sniff_%ld.txt", i);
-		err = f_open(&FileObject, write_filename.filename, FA_WRITE | FA_CREATE_NEW);
-		if(err == FR_OK) {
-			break;
-		}
-	}
-	if(err == FR_OK) {
-		err = f_write(&FileObject, buffer, size, (void *)&bytes_written);
-		if(err != FR_OK) {
-			f_close(&FileObject);
-			umount();
-			return -3;
-		}
-
-		err = f_close(&FileObject);
-		if (err != FR_OK) {
-			umount();
-			return -4;
-		}
-	} else {
-		umount();
-		return -2;
-	}
-
-	umount();
-	return 0;
+	return write_file_prefix("nfc_sniff", buffer, size);
 }
 
 /*
@@ -349,6 +310,10 @@ void sniff_log(void)
 	}
 	D4_OFF;
 	D5_OFF;
+
+	bufpool_free(sniff_buf);
+	sniff_buf = NULL;
+	sniff_buf_idx = 0;
 }
 
 /* Return TRUE if sniff stopepd by K4, else return FALSE */
@@ -380,15 +345,15 @@ void sniff_write_pcd(void)
 	  It means Reader/Writer (PCD – Proximity Coupling Device)
 	*/
 	uint32_t i;
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
-
-	g_sbuf[i+2] = ' ';
-	g_sbuf[i+3] = ' ';
-	g_sbuf[i+4] = ' ';
-	g_sbuf[i+5] = ' ';
-	g_sbuf_idx +=6;
+	i = sniff_buf_idx;
+	sniff_buf[i+0] = '\r';
+	sniff_buf[i+1] = '\n';
+
+	sniff_buf[i+2] = ' ';
+	sniff_buf[i+3] = ' ';
+	sniff_buf[i+4] = ' ';
+	sniff_buf[i+5] = ' ';
+	sniff_buf_idx +=6;
 }
 
 __attribute__ ((always_inline)) static inline
@@ -398,15 +363,15 @@ void sniff_write_picc(void)
 	  It means TAG(PICC – Proximity Integrated Circuit Card)
 	*/
 	uint32_t i;
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
-
-	g_sbuf[i+2] = 'T';
-	g_sbuf[i+3] = 'A';
-	g_sbuf[i+4] = 'G';
-	g_sbuf[i+5] = ' ';
-	g_sbuf_idx +=6;
+	i = sniff_buf_idx;
+	sniff_buf[i+0] = '\r';
+	sniff_buf[i+1] = '\n';
+
+	sniff_buf[i+2] = 'T';
+	sniff_buf[i+3] = 'A';
+	sniff_buf[i+4] = 'G';
+	sniff_buf[i+5] = ' ';
+	sniff_buf_idx +=6;
 }
 
 __attribute__ ((always_inline)) static inline
@@ -423,15 +388,15 @@ void sniff_write_unknown_protocol(uint8_t data)
 	*/
 	uint32_t i;
 
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = '\r';
-	g_sbuf[i+1] = '\n';
+	i = sniff_buf_idx;
+	sniff_buf[i+0] = '\r';
+	sniff_buf[i+1] = '\n';
 
-	g_sbuf[i+2] = 'U';
-	g_sbuf[i+3] = htoa[(data & 0xF0) >> 4];
-	g_sbuf[i+4] = htoa[(data & 0x0F)];
-	g_sbuf[i+5] = ' ';
-	g_sbuf_idx +=6;
+	sniff_buf[i+2] = 'U';
+	sniff_buf[i+3] = htoa[(data & 0xF0) >> 4];
+	sniff_buf[i+4] = htoa[(data & 0x0F)];
+	sniff_buf[i+5] = ' ';
+	sniff_buf_idx +=6;
 }
 
 __attribute__ ((always_inline)) static inline
@@ -439,14 +404,14 @@ void sniff_write_8b_ASCII_HEX(uint8_t data, bool add_space)
 {
 	uint32_t i;
 
-	i = g_sbuf_idx;
-	g_sbuf[i+0] = htoa[(data & 0xF0) >> 4];
-	g_sbuf[i+1] = htoa[(data & 0x0F)];
+	i = sniff_buf_idx;
+	sniff_buf[i+0] = htoa[(data & 0xF0) >> 4];
+	sniff_buf[i+1] = htoa[(data & 0x0F)];
 	if(add_space == TRUE) {
-		g_sbuf[i+2] = ' ';
-		g_sbuf_idx +=3;
+		sniff_buf[i+2] = ' ';
+		sniff_buf_idx +=3;
 	} else {
-		g_sbuf_idx +=2;
+		sniff_buf_idx +=2;
 	}
 }
 
@@ -463,6 +428,13 @@ void cmd_nfc_sniff_14443A(t_hydra_console *con, int argc, const char* const* arg
 	uint32_t old_data_counter;
 	uint32_t nb_data;
 
+	/* Written to SD card by SDIO DMA, so not in CCM */
+	sniff_buf = bufpool_alloc(BUFPOOL_DMA, SNIFF_BUF_SIZE, TIME_IMMEDIATE);
+	if(sniff_buf == NULL) {
+		tprintf("bufpool_alloc() error\r\n");
+		return;
+	}
+
 	tprintf("cmd_nfc_sniff_14443A start TRF7970A configuration as sniffer mode\r\n");
 	tprintf("Abort/Exit by pressing K4 button\r\n");
 	init_sniff_nfc();
@@ -473,7 +445,7 @@ void cmd_nfc_sniff_14443A(t_hydra_console *con, int argc, const char* const* arg
 
 	old_protocol_found = 0;
 	protocol_found = 0;
-	g_sbuf_idx = 0;
+	sniff_buf_idx = 0;
 
 	/* Lock Kernel for sniffer */
 	chSysLock();
@@ -662,8 +634,8 @@ void cmd_nfc_sniff_14443A(t_hydra_console *con, int argc, const char* const* arg
 					break;
 				}
 				/* For safety to avoid potential buffer overflow ... */
-				if(g_sbuf_idx >= NB_SBUFFER) {
-					g_sbuf_idx = NB_SBUFFER;
+				if(sniff_buf_idx >= NB_SBUFFER) {
+					sniff_buf_idx = NB_SBUFFER;
 				}
 			}
 
@@ -675,10 +647,10 @@ void cmd_nfc_sniff_14443A(t_hydra_console *con, int argc, const char* const* arg
 
 #if 0
 			/* Send data if data are available (at least 4bytes) */
-			if( g_sbuf_idx >= 4 ) {
+			if( sniff_buf_idx >= 4 ) {
 
 				chSysUnlock();
-				tprint_str( "%s\r\n", &g_sbuf[0]);
+				tprint_str( "%s\r\n", &sniff_buf[0]);
 				/* Wait chprintf() end */
 				chThdSleepMilliseconds(5);
 				chSysLock();
@@ -686,13 +658,13 @@ void cmd_nfc_sniff_14443A(t_hydra_console *con, int argc, const char* const* arg
 				/* Swap Current Buffer*/
 				/*
 				      // Clear Index
-				      g_sbuf_idx = 0;
+				      sniff_buf_idx = 0;
 				*/
 			}
 #endif
 			/* For safety to avoid buffer overflow ... */
-			if(g_sbuf_idx >= NB_SBUFFER) {
-				g_sbuf_idx = NB_SBUFFER;
+			if(sniff_buf_idx >= NB_SBUFFER) {
+				sniff_buf_idx = NB_SBUFFER;
 			}
 			TST_OFF;
 		}
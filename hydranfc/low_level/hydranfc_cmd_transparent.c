@@ -14,6 +14,8 @@ void low_setRF_Protocol_Off();
 // lowLevelCommand
 // Set protocol
 static struct exception hydraNfcLowLevelException;
+static uint8_t current_protocol = RF_PROTOCOL_UNKNOWN;
+
 void low_setRF_Protocol(uint8_t protocol)
 {
 	switch(protocol)	{
@@ -36,6 +38,7 @@ void low_setRF_Protocol(uint8_t protocol)
 		hydraNfcLowLevelException.errorMessage = "low_setRF_Protocol Error- Unsupported Protocol";
 		Throw hydraNfcLowLevelException;
 	}
+	current_protocol = protocol;
 }
 
 void low_setRF_Protocol_Off()
@@ -48,8 +51,11 @@ void low_setRF_Protocol_ISO14443A()
 	int init_ms;
 	uint8_t data_buf[5];
 
-	init_ms = Trf797xInitialSettings();
-	printf("low_setRF_Protocol_ISO14443A - init_ms: %ld ms\n", init_ms);
+	/* Chip init is only needed once, registers already set are not rewritten */
+	if(current_protocol == RF_PROTOCOL_UNKNOWN) {
+		init_ms = Trf797xInitialSettings();
+		printf("low_setRF_Protocol_ISO14443A - init_ms: %ld ms\n", init_ms);
+	}
 	Trf797xReset();
 
 	/* Write Modulator and SYS_CLK Control Register (0x09) (13.56Mhz SYS_CLK and default Clock 13.56Mhz)) */
@@ -57,14 +63,12 @@ void low_setRF_Protocol_ISO14443A()
 	data_buf[1] = 0x31;
 	Trf797xWriteSingle(data_buf, 2);
 
-	data_buf[0] = MODULATOR_CONTROL;
-	Trf797xReadSingle(data_buf, 1);
-
 	/* Configure Mode ISO Control Register (0x01) to 0x88 (ISO14443A RX bit rate, 106 kbps) and no RX CRC (CRC is not present in the response)) */
 	data_buf[0] = ISO_CONTROL;
 	data_buf[1] = 0x88;
 	Trf797xWriteSingle(data_buf, 2);
 
+#if TRF797X_DEBUG_VERIFY
 	data_buf[0] = ISO_CONTROL;
 	Trf797xReadSingle(data_buf, 1);
 	if(data_buf[0] != 0x88) {
@@ -72,13 +76,15 @@ void low_setRF_Protocol_ISO14443A()
 		hydraNfcLowLevelException.errorMessage = "low_setRF_Protocol_ISO14443A Error- ISO_CONTROL Error";
 		Throw hydraNfcLowLevelException;
 	}
+#endif
 
 	/* Turn RF ON (Chip Status Control Register (0x00)) */
 	Trf797xTurnRfOn();
 
+#if TRF797X_DEBUG_VERIFY
 	/* Read back (Chip Status Control Register (0x00) shall be set to RF ON */
 	data_buf[0] = CHIP_STATE_CONTROL;
 	Trf797xReadSingle(data_buf, 1);
 	//printf("Chip Status Control Register (0x00): 0x%08lX\n", (uint32_t)data_buf[0]);
-
+#endif
 }
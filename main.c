@@ -30,9 +30,17 @@ limitations under the License.
 
 #include "microrl.h"
 #include "microrl_callback.h"
+#include "hydra_cmd.h"
 
 #include "microsd.h"
+#include "storage.h"
+#include "bufpool.h"
+#include "bus_lock.h"
+#include "usb_msd.h"
+#include "usb_stream.h"
+#include "usb_tx.h"
 #include "hydrabus.h"
+#include "bsp.h"
 
 #ifdef HYDRANFC
 #include "hydranfc.h"
@@ -97,9 +105,14 @@ THD_FUNCTION(ThreadHydraNFC, arg)
 }
 #endif
 
+/* Console input bytes fed to microrl per wakeup */
+#define CONSOLE_RX_BATCH (64)
+
 THD_FUNCTION(console, arg)
 {
 	int insert_char;
+	int nb, i;
+	uint8_t rx_buf[CONSOLE_RX_BATCH];
 	t_hydra_console *con;
 
 	con = arg;
@@ -112,12 +125,102 @@ THD_FUNCTION(console, arg)
 	microrl_set_sigint_callback(con->mrl, sigint);
 
 	while (1) {
-		chThdSleepMilliseconds(1);
-		microrl_insert_char(con->mrl, get_char(con));
-		if(con->insert_char != 0) {
-			insert_char = con->insert_char;
-			con->insert_char = 0;
-			microrl_insert_char(con->mrl, insert_char);
+		nb = get_chars(con, rx_buf, sizeof(rx_buf));
+		if(nb == 0) {
+			/* Avoid spinning while the USB link is being reset */
+			chThdSleepMilliseconds(10);
+			continue;
+		}
+
+		for(i = 0; i < nb; i++) {
+			microrl_insert_char(con->mrl, rx_buf[i]);
+			if(con->insert_char != 0) {
+				insert_char = con->insert_char;
+				con->insert_char = 0;
+				microrl_insert_char(con->mrl, insert_char);
+			}
+		}
+	}
+}
+
+/* Main thread, woken up by USB configuration to spawn the consoles */
+static thread_t *main_thread;
+#define MAIN_EVT_USB_CONFIGURED EVENT_MASK(0)
+
+void console_usb_configured_hookI(USBDriver *usbp)
+{
+	(void)usbp;
+
+	if(main_thread != NULL)
+		chEvtSignalI(main_thread, MAIN_EVT_USB_CONFIGURED);
+}
+
+void console_data_received(USBDriver *usbp, usbep_t ep)
+{
+	t_hydra_console *con;
+	input_queue_t *iqp;
+	uint8_t *p;
+	size_t n;
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		con = &consoles[i];
+		if(con->sdu->config->usbp != usbp)
+			continue;
+
+		/* Bytes of this transfer are the last ones written to the queue */
+		iqp = &con->sdu->iqueue;
+		n = usbGetReceiveTransactionSizeI(usbp, ep);
+		p = iqp->q_wrptr;
+		while(n-- > 0) {
+			if(p == iqp->q_buffer)
+				p = iqp->q_top;
+			p--;
+			if(*p == CONSOLE_ABORT_CHAR) {
+				con->abort = TRUE;
+				break;
+			}
+		}
+	}
+	sduDataReceived(usbp, ep);
+}
+
+/* bsp.h: HAL waits of a console thread stop on Ctrl-C/UBTN */
+uint32_t bsp_abort_tick_offset(void)
+{
+	/* Per console, two reads of the same console differ by 2 x offset */
+	static uint32_t abort_offset[2] = { BSP_TICK_ABORT_OFFSET, BSP_TICK_ABORT_OFFSET };
+	thread_t *tp;
+	int i;
+
+	tp = chThdGetSelfX();
+	for(i = 0; i < 2; i++) {
+		if(consoles[i].thread == tp) {
+			if(!console_is_aborted(&consoles[i]))
+				return 0;
+			abort_offset[i] = -abort_offset[i];
+			return abort_offset[i];
+		}
+	}
+	return 0;
+}
+
+static void console_spawn(void)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!consoles[i].thread) {
+			if (consoles[i].sdu->config->usbp->state != USB_ACTIVE)
+				continue;
+			/* Spawn new console thread.*/
+			consoles[i].thread = chThdCreateFromHeap(NULL,
+					     CONSOLE_WA_SIZE, NORMALPRIO, console, &consoles[i]);
+			boot_mark(consoles[i].thread_name);
+		} else {
+			if (chThdTerminatedX(consoles[i].thread))
+				/* This console thread terminated. */
+				consoles[i].thread = NULL;
 		}
 	}
 }
@@ -128,9 +231,21 @@ THD_FUNCTION(console, arg)
 #define BLINK_FAST   50
 #define BLINK_SLOW   250
 
+/*
+ * USB D+ pull-up kept off so the host sees a disconnect after a reset with
+ * the cable plugged, the initializations below run during this time.
+ */
+#define USB_DISCONNECT_MS 500
+
 int main(void)
 {
-	int sleep_ms, i;
+	int sleep_ms;
+	bool cold_boot;
+	systime_t usb_disconnect_time, usb_connect_time;
+
+	/* Boot timeline origin (see boot_mark()) */
+	scs_dwt_cycle_counter_enabled();
+	clear_cyclecounter();
 
 	/* clean semi hosting output */
 	printf("\f");
@@ -144,36 +259,71 @@ int main(void)
 	 */
 	halInit();
 	chSysInit();
+	boot_mark("hal/kernel");
 
-	scs_dwt_cycle_counter_enabled();
+	/* Power-on: the host had no connection, no disconnect time needed */
+	cold_boot = (RCC->CSR & RCC_CSR_PORRSTF) != 0;
+	RCC->CSR |= RCC_CSR_RMVF;
 
-	hydrabus_init();
+	main_thread = chThdGetSelfX();
 
-#ifdef HYDRANFC
-	if(hydranfc_init() == FALSE)
-		/* Reinit HydraBus */
-		hydrabus_init();
-#endif
+	/* Capture/DMA buffers borrowed by the threads below */
+	bufpool_init();
+
+	/* SD card/FatFs are owned by the storage thread */
+	storage_init();
+
+	/* Peripherals ownership, before hydranfc_init() */
+	bus_lock_init();
+
+	/* Console commands lookup index */
+	hydra_cmd_init();
 
 	/*
 	 * Initializes a serial-over-USB CDC driver.
 	 */
+	usbtx_init();
+
 	sduObjectInit(&SDU1);
 	sduStart(&SDU1, &serusb1cfg);
 
 	sduObjectInit(&SDU2);
 	sduStart(&SDU2, &serusb2cfg);
 
+	/* Mass Storage on USB2 (composite with CDC) */
+	usb_msd_init();
+
+	/* Vendor bulk stream on USB1 (composite with CDC) */
+	usb_stream_init();
+
 	/*
-	 * Activates the USB1 & 2 driver and then the USB bus pull-up on D+.
-	 * Note, a delay is inserted in order to not have to disconnect the cable
-	 * after a reset.
+	 * Start of the USB disconnect time (after a reset), the board
+	 * initializations overlap with it.
 	 */
 	usbDisconnectBus(serusb1cfg.usbp);
 	usbDisconnectBus(serusb2cfg.usbp);
+	usb_disconnect_time = chVTGetSystemTime();
+	usb_connect_time = usb_disconnect_time;
+	if(!cold_boot)
+		usb_connect_time += MS2ST(USB_DISCONNECT_MS);
+	boot_mark("usb drivers");
 
-	chThdSleepMilliseconds(500);
+	/* hydranfc_init() does not change the HydraBus pins (ULED/UBTN/SDIO) */
+	hydrabus_init();
+	boot_mark("hydrabus");
 
+#ifdef HYDRANFC
+	hydranfc_init();
+	boot_mark("hydranfc");
+#endif
+
+	/* Remaining disconnect time */
+	if(chVTIsSystemTimeWithinX(usb_disconnect_time, usb_connect_time))
+		chThdSleepUntil(usb_connect_time);
+
+	/*
+	 * Activates the USB1 & 2 driver and then the USB bus pull-up on D+.
+	 */
 	usbStart(serusb1cfg.usbp, &usb1cfg);
 	/*
 	 * Disable VBUS sensing on USB1 (GPIOA9) is not connected to VUSB
@@ -187,9 +337,7 @@ int main(void)
 
 	usbStart(serusb2cfg.usbp, &usb2cfg);
 	usbConnectBus(serusb2cfg.usbp);
-
-	/* Wait for USB Enumeration. */
-	chThdSleepMilliseconds(100);
+	boot_mark("usb connect");
 
 	/*
 	 * Creates HydraNFC Sniffer thread.
@@ -201,38 +349,21 @@ int main(void)
 #endif
 	/*
 	* Normal main() thread activity.
+	* Consoles are spawned as soon as their USB device is configured,
+	* the ULED blinks in between.
 	*/
 	chRegSetThreadName("main");
 	while (TRUE) {
-		for (i = 0; i < 2; i++) {
-			if (!consoles[i].thread) {
-				if (consoles[i].sdu->config->usbp->state != USB_ACTIVE)
-					continue;
-				/* Spawn new console thread.*/
-				consoles[i].thread = chThdCreateFromHeap(NULL,
-						     CONSOLE_WA_SIZE, NORMALPRIO, console, &consoles[i]);
-			} else {
-				if (chThdTerminatedX(consoles[i].thread))
-					/* This console thread terminated. */
-					consoles[i].thread = NULL;
-			}
-		}
+		console_spawn();
 
 		/* For test purpose HydraBus ULED blink */
 		if(USER_BUTTON)
 			sleep_ms = BLINK_FAST;
 		else
 			sleep_ms = BLINK_SLOW;
-		ULED_ON;
-
-		chThdSleepMilliseconds(sleep_ms);
-
-		if(USER_BUTTON)
-			sleep_ms = BLINK_FAST;
-		else
-			sleep_ms = BLINK_SLOW;
-		ULED_OFF;
+		if(chEvtWaitAnyTimeout(MAIN_EVT_USB_CONFIGURED, MS2ST(sleep_ms)) != 0)
+			continue;
 
-		chThdSleepMilliseconds(sleep_ms);
+		palTogglePad(GPIOA, 4);
 	}
 }
@@ -0,0 +1,109 @@
+#!/usr/bin/env python
+#
+# HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Drain the USB1 vendor bulk stream interface (frame format in
+# common/usb_stream.h) to a file, requires pyusb (libusb).
+# On Windows install driver_usb_cdc/hydrabus_usb_stream.inf (WinUSB) first.
+# Start a producer on the console, e.g. "usb_stream test 4096".
+#
+import struct
+import sys
+import time
+from optparse import OptionParser
+
+import usb.core
+import usb.util
+
+VID = 0x0483
+PID = 0x5740
+# USB2 has the same VID/PID (mass storage on interface 2)
+BCD_DEVICE = 0x0201
+INTERFACE = 2
+EP_OUT = 0x03
+EP_IN = 0x83
+
+MAGIC = 0x5348
+HEADER = struct.Struct("<HBBII")
+T_DATA, T_CREDIT, T_RESET = 0x01, 0x10, 0x11
+FLAG_LOST = 0x01
+MAX_FRAME = 32768
+CREDITS = 16
+
+def send(dev, ftype, payload=b""):
+  dev.write(EP_OUT, HEADER.pack(MAGIC, ftype, 0, 0, len(payload)) + payload)
+
+def drain(dev, out, seconds, check_counter):
+  send(dev, T_RESET)
+  send(dev, T_CREDIT, struct.pack("<I", CREDITS))
+  credits = CREDITS
+  expected = 0
+  counter = 0
+  nb_bytes = 0
+  nb_lost = 0
+  nb_gap = 0
+  start = time.time()
+  while time.time() - start < seconds:
+    try:
+      data = dev.read(EP_IN, MAX_FRAME, timeout=1000).tobytes()
+    except usb.core.USBTimeoutError:
+      continue
+    if len(data) < HEADER.size:
+      continue
+    magic, ftype, flags, seq, length = HEADER.unpack_from(data)
+    if magic != MAGIC or ftype != T_DATA or len(data) != HEADER.size + length:
+      print("Invalid frame (%d bytes)" % len(data))
+      continue
+    if seq != expected:
+      nb_gap += 1
+    expected = seq + 1
+    if flags & FLAG_LOST:
+      nb_lost += 1
+    payload = data[HEADER.size:]
+    if check_counter:
+      first = struct.unpack_from("<I", payload)[0]
+      if first != counter:
+        print("Counter gap at frame %d: %d instead of %d" % (seq, first, counter))
+      counter = first + length // 4
+    if out:
+      out.write(payload)
+    nb_bytes += length
+    # Give the credit back every half window
+    credits -= 1
+    if credits <= CREDITS // 2:
+      send(dev, T_CREDIT, struct.pack("<I", CREDITS - credits))
+      credits = CREDITS
+  elapsed = time.time() - start
+  print("%d bytes in %.2fs (%.1f KB/s), %d seq gap(s), %d frame(s) with lost data"
+        % (nb_bytes, elapsed, nb_bytes / 1024.0 / max(elapsed, 1e-6), nb_gap, nb_lost))
+
+if __name__ == "__main__":
+  usage = "%prog [options] [output file]"
+  parser = OptionParser(usage=usage)
+  parser.add_option("-t", "--time", type="float", default=10.0,
+                    help="capture duration in seconds (default 10)")
+  parser.add_option("-c", "--check", action="store_true", default=False,
+                    help="check the 32bits counter of 'usb_stream test'")
+  (options, args) = parser.parse_args()
+  dev = usb.core.find(idVendor=VID, idProduct=PID, bcdDevice=BCD_DEVICE)
+  if dev is None:
+    sys.exit("HydraBus not found")
+  usb.util.claim_interface(dev, INTERFACE)
+  out = open(args[0], "wb") if args else None
+  try:
+    drain(dev, out, options.time, options.check)
+  finally:
+    if out:
+      out.close()
+    usb.util.release_interface(dev, INTERFACE)
@@ -0,0 +1,182 @@
+#!/usr/bin/env python
+#
+# HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+# http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+# Binary file transfer with the sd_get/sd_put console commands
+# (frame format in common/sd_xfer.h), requires pyserial.
+#
+import struct
+import sys
+import time
+from optparse import OptionParser
+
+import serial
+
+MAGIC = 0x5848
+HEADER = struct.Struct("<HBBII")
+T_FILE, T_DATA, T_END, T_ACK, T_NAK, T_ABORT = 0x01, 0x02, 0x03, 0x06, 0x15, 0x18
+# read_frame() bad frame (CRC, magic or length), None is timeout
+T_BAD = 0xFF
+CHUNK = 4096
+WINDOW = 8
+# Go back/timeouts on the same seq before giving up (XFER_MAX_RETRY)
+MAX_RETRY = 5
+
+def crc32_stm32(data):
+  """CRC unit of STM32: poly 0x04C11DB7, init 0xFFFFFFFF, 32bits LE words"""
+  data = data + b"\0" * ((4 - len(data) % 4) % 4)
+  crc = 0xFFFFFFFF
+  for i in range(0, len(data), 4):
+    crc ^= struct.unpack_from("<I", data, i)[0]
+    for _ in range(32):
+      if crc & 0x80000000:
+        crc = ((crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+      else:
+        crc = (crc << 1) & 0xFFFFFFFF
+  return crc
+
+def frame(ftype, seq, payload=b""):
+  data = HEADER.pack(MAGIC, ftype, 0, seq, len(payload)) + payload
+  return data + struct.pack("<I", crc32_stm32(data))
+
+def read_frame(port):
+  """Return (type, seq, payload), (T_BAD, 0, b"") on bad frame or None on timeout"""
+  while True:
+    c = port.read(1)
+    if not c:
+      return None
+    if c == b"\x48":
+      break
+  bad = (T_BAD, 0, b"")
+  hdr = c + port.read(HEADER.size - 1)
+  if len(hdr) != HEADER.size:
+    return bad
+  magic, ftype, _, seq, length = HEADER.unpack(hdr)
+  if magic != MAGIC or length > CHUNK:
+    return bad
+  rest = port.read(length + 4)
+  if len(rest) != length + 4:
+    return bad
+  payload = rest[:length]
+  if crc32_stm32(hdr + payload) != struct.unpack("<I", rest[length:])[0]:
+    return bad
+  return ftype, seq, payload
+
+def give_up(port, seq):
+  port.write(frame(T_ABORT, seq))
+  sys.exit("Transfer aborted, no progress after %d retries" % MAX_RETRY)
+
+def start_cmd(port, cmd):
+  port.reset_input_buffer()
+  port.write((cmd + "\r\n").encode())
+  # Skip the command echo
+  port.readline()
+
+def get(port, remote, local):
+  start_cmd(port, "sd_get " + remote)
+  expected = 0
+  nak_seq = None
+  retry = 0
+  size = 0
+  start = time.time()
+  with open(local, "wb") as out:
+    while True:
+      f = read_frame(port)
+      if f is None:
+        # Timeout: NAK or ACK lost, ask again from expected
+        retry += 1
+        if retry > MAX_RETRY:
+          give_up(port, expected)
+        port.write(frame(T_NAK, expected))
+        nak_seq = expected
+        continue
+      ftype, seq, payload = f
+      if ftype == T_ABORT:
+        sys.exit("Transfer aborted by device")
+      if ftype == T_BAD or seq > expected:
+        # Ask once from expected, the rest of the window follows
+        if nak_seq != expected:
+          port.write(frame(T_NAK, expected))
+          nak_seq = expected
+        continue
+      if seq < expected:
+        continue
+      retry = 0
+      if ftype == T_FILE:
+        size = struct.unpack_from("<I", payload)[0]
+      elif ftype == T_DATA:
+        out.write(payload)
+      port.write(frame(T_ACK, seq))
+      expected += 1
+      if ftype == T_END:
+        break
+  elapsed = time.time() - start
+  print("%d bytes in %.2fs (%.1f KB/s)" % (size, elapsed, size / 1024.0 / max(elapsed, 1e-6)))
+  print(port.read_until(b"\n\r").decode(errors="replace").strip())
+
+def put(port, local, remote):
+  with open(local, "rb") as f:
+    data = f.read()
+  start_cmd(port, "sd_put " + remote)
+  port.readline() # sd_put ready
+  frames = [frame(T_FILE, 0, struct.pack("<I", len(data)) + remote.encode())]
+  for i in range(0, len(data), CHUNK):
+    frames.append(frame(T_DATA, len(frames), data[i:i + CHUNK]))
+  frames.append(frame(T_END, len(frames)))
+  start = time.time()
+  acked = -1
+  back = None
+  retry = 0
+  seq = 0
+  while acked < len(frames) - 1:
+    while seq < len(frames) and seq <= acked + WINDOW:
+      port.write(frames[seq])
+      seq += 1
+    f = read_frame(port)
+    if f is not None:
+      ftype, rseq, _ = f
+      if ftype == T_ACK:
+        if rseq > acked:
+          acked = rseq
+          retry = 0
+        continue
+      if ftype == T_ABORT:
+        sys.exit("Transfer aborted by device")
+      # One NAK per frame received after a lost one, go back once per seq
+      if ftype != T_NAK or rseq == back:
+        continue
+    # NAK or timeout, go back to the first frame not acked
+    retry += 1
+    if retry > MAX_RETRY:
+      give_up(port, seq)
+    seq = rseq if f is not None else acked + 1
+    back = seq
+  elapsed = time.time() - start
+  print("%d bytes in %.2fs (%.1f KB/s)" % (len(data), elapsed, len(data) / 1024.0 / max(elapsed, 1e-6)))
+  print(port.read_until(b"\n\r").decode(errors="replace").strip())
+
+if __name__ == "__main__":
+  usage = """
+%prog <port> get <sd file> <local file>
+%prog <port> put <local file> <sd file>"""
+  parser = OptionParser(usage=usage)
+  (options, args) = parser.parse_args()
+  if len(args) != 4 or args[1] not in ("get", "put"):
+    parser.print_help()
+    sys.exit(1)
+  port = serial.Serial(args[0], 115200, timeout=1)
+  if args[1] == "get":
+    get(port, args[2], args[3])
+  else:
+    put(port, args[2], args[3])
@@ -0,0 +1,260 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+* Host check of hydranfc/crypto1 (make -C sim check).
+* crypto1.c is compared with a bit level model written from the cipher
+* description (48 LFSR cells, fa/fb/fc boolean filter functions), and the
+* keystream/nonce suffixes of a known authentication trace are checked.
+*/
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crypto1.h"
+
+/* Reference authentication trace (key A FFFFFFFFFFFF) */
+#define TV_KEY		(0xFFFFFFFFFFFFULL)
+#define TV_UID		(0x9c599b32)
+#define TV_NT		(0x82a4166c)
+#define TV_NR_ENC	(0xa1e458ce)
+#define TV_AR_ENC	(0x6eea41e0)
+#define TV_AT_ENC	(0x5cadf439)
+/* Expected keystream and suffixes of this trace */
+#define TV_KS2		(0xe38f32ab) /* {aR} keystream */
+#define TV_KS3		(0xc6ef8f19) /* {aT} keystream */
+#define TV_SUC64	(0x8d65734b) /* aR = suc64(nT) */
+#define TV_SUC96	(0x9a427b20) /* aT = suc96(nT) */
+
+#define NB_RANDOM	(1000)
+/* Keystream benchmark, 4KB x 4096 */
+#define BENCH_SIZE	(4096)
+#define BENCH_LOOP	(4096)
+
+typedef struct {
+	uint8_t x[48];
+} ref_state_t;
+
+static int ref_fa(int y0, int y1, int y2, int y3)
+{
+	return ((y0 | y1) ^ (y0 & y3)) ^ (y2 & ((y0 ^ y1) | y3));
+}
+
+static int ref_fb(int y0, int y1, int y2, int y3)
+{
+	return ((y0 & y1) | y2) ^ ((y0 ^ y1) & (y2 | y3));
+}
+
+static int ref_fc(int y0, int y1, int y2, int y3, int y4)
+{
+	return (y0 | ((y1 | y4) & (y3 ^ y4))) ^ ((y0 ^ (y1 & y3)) & ((y2 ^ y3) | (y1 & y4)));
+}
+
+/* Key bits in on air order (bytes MSB first, bits LSB first) */
+static void ref_init(ref_state_t* s, uint64_t key)
+{
+	int i;
+
+	for(i = 0; i < 48; i++)
+		s->x[i] = (key >> ((47 - i) ^ 7)) & 1;
+}
+
+static int ref_filter(const ref_state_t* s)
+{
+	const uint8_t* x = s->x;
+
+	return ref_fc(ref_fa(x[9], x[11], x[13], x[15]),
+		      ref_fb(x[17], x[19], x[21], x[23]),
+		      ref_fb(x[25], x[27], x[29], x[31]),
+		      ref_fa(x[33], x[35], x[37], x[39]),
+		      ref_fb(x[41], x[43], x[45], x[47]));
+}
+
+static int ref_bit(ref_state_t* s, int in, int is_encrypted)
+{
+	uint8_t* x = s->x;
+	int ks, l, i;
+
+	ks = ref_filter(s);
+	l = x[0] ^ x[5] ^ x[9] ^ x[10] ^ x[12] ^ x[14] ^ x[15] ^ x[17] ^ x[19] ^
+	    x[24] ^ x[25] ^ x[27] ^ x[29] ^ x[35] ^ x[39] ^ x[41] ^ x[42] ^ x[43];
+	for(i = 0; i < 47; i++)
+		x[i] = x[i + 1];
+	x[47] = l ^ in ^ (is_encrypted ? ks : 0);
+	return ks;
+}
+
+static uint32_t ref_word(ref_state_t* s, uint32_t in, int is_encrypted)
+{
+	uint32_t ks;
+	int n;
+
+	ks = 0;
+	for(n = 0; n < 32; n++)
+		ks |= (uint32_t)ref_bit(s, (in >> (n ^ 24)) & 1, is_encrypted) << (n ^ 24);
+	return ks;
+}
+
+/* 16bits nonce LFSR x^16 + x^14 + x^13 + x^11 + 1, b[i] is bit i of the byte swapped nonce */
+static uint32_t ref_prng_successor(uint32_t nt, uint32_t n)
+{
+	uint8_t b[32 + 96];
+	uint32_t i, ret;
+
+	for(i = 0; i < 32; i++)
+		b[i] = (nt >> (i ^ 24)) & 1;
+	for(i = 32; i < 32 + n; i++)
+		b[i] = b[i - 16] ^ b[i - 14] ^ b[i - 13] ^ b[i - 11];
+	ret = 0;
+	for(i = 0; i < 32; i++)
+		ret |= (uint32_t)b[n + i] << (i ^ 24);
+	return ret;
+}
+
+static uint64_t rand48(void)
+{
+	return ((uint64_t)(rand() & 0xffffff) << 24) | (rand() & 0xffffff);
+}
+
+static int nb_fail;
+
+static void check(int ok, const char* name, uint32_t got, uint32_t expected)
+{
+	if(ok)
+		return;
+	printf("FAIL %s: %08x expected %08x\n", name, got, expected);
+	nb_fail++;
+}
+
+static void check_trace(void)
+{
+	crypto1_state_t s;
+	uint32_t ks;
+	uint8_t data[4];
+	int i, err;
+
+	err = crypto1_selftest();
+	check(err == 0, "crypto1_selftest()", err, 0);
+
+	check(crypto1_prng_successor(TV_NT, 64) == TV_SUC64, "suc64(nT)",
+	      crypto1_prng_successor(TV_NT, 64), TV_SUC64);
+	check(crypto1_prng_successor(TV_NT, 96) == TV_SUC96, "suc96(nT)",
+	      crypto1_prng_successor(TV_NT, 96), TV_SUC96);
+
+	crypto1_init(&s, TV_KEY);
+	crypto1_word(&s, TV_UID ^ TV_NT, 0);
+	crypto1_word(&s, TV_NR_ENC, 1);
+	ks = crypto1_word(&s, 0, 0);
+	check(ks == TV_KS2, "ks2", ks, TV_KS2);
+	check((TV_AR_ENC ^ ks) == TV_SUC64, "{aR}", TV_AR_ENC ^ ks, TV_SUC64);
+	ks = crypto1_word(&s, 0, 0);
+	check(ks == TV_KS3, "ks3", ks, TV_KS3);
+	check((TV_AT_ENC ^ ks) == TV_SUC96, "{aT}", TV_AT_ENC ^ ks, TV_SUC96);
+
+	/* Tag answer decrypted by crypto1_crypt() */
+	crypto1_init(&s, TV_KEY);
+	crypto1_word(&s, TV_UID ^ TV_NT, 0);
+	crypto1_word(&s, TV_NR_ENC, 1);
+	crypto1_word(&s, 0, 0);
+	for(i = 0; i < 4; i++)
+		data[i] = TV_AT_ENC >> (24 - (i * 8));
+	crypto1_crypt(&s, data, 0, 4, 0);
+	ks = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+	check(ks == TV_SUC96, "crypt {aT}", ks, TV_SUC96);
+}
+
+/* crypto1.c against the bit level model on random keys and inputs */
+static void check_random(void)
+{
+	crypto1_state_t s;
+	ref_state_t r;
+	uint8_t data[8], parity[8], ref_data[8], ref_par;
+	uint32_t in, ks, ref_ks, nt;
+	uint64_t key;
+	int i, j, n, feed;
+
+	for(i = 0; i < NB_RANDOM; i++) {
+		key = rand48();
+		crypto1_init(&s, key);
+		ref_init(&r, key);
+
+		in = rand();
+		ks = crypto1_word(&s, in, 0);
+		ref_ks = ref_word(&r, in, 0);
+		check(ks == ref_ks, "word plain", ks, ref_ks);
+
+		in = rand();
+		ks = crypto1_word(&s, in, 1);
+		ref_ks = ref_word(&r, in, 1);
+		check(ks == ref_ks, "word encrypted", ks, ref_ks);
+
+		/* Buffer encryption with the plain data fed, and parity bits */
+		feed = i & 1;
+		for(j = 0; j < 8; j++)
+			data[j] = ref_data[j] = rand();
+		crypto1_crypt(&s, data, parity, 8, feed);
+		for(j = 0; j < 8; j++) {
+			ks = 0;
+			for(n = 0; n < 8; n++)
+				ks |= ref_bit(&r, feed ? (ref_data[j] >> n) & 1 : 0, 0) << n;
+			ref_par = crypto1_odd_parity(ref_data[j]) ^ ref_filter(&r);
+			ref_data[j] ^= ks;
+			check(data[j] == ref_data[j], "crypt data", data[j], ref_data[j]);
+			check(parity[j] == ref_par, "crypt parity", parity[j], ref_par);
+		}
+
+		nt = rand();
+		n = 1 + (rand() % 96);
+		check(crypto1_prng_successor(nt, n) == ref_prng_successor(nt, n), "prng_successor",
+		      crypto1_prng_successor(nt, n), ref_prng_successor(nt, n));
+	}
+}
+
+/* Keystream bytes per second of crypto1_keystream() on the host */
+static void bench_keystream(void)
+{
+	static uint8_t ks[BENCH_SIZE];
+	crypto1_state_t s;
+	struct timespec start, end;
+	uint64_t ns;
+	int i;
+
+	crypto1_init(&s, TV_KEY);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < BENCH_LOOP; i++)
+		crypto1_keystream(&s, ks, BENCH_SIZE);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+	if(ns == 0)
+		ns = 1;
+	printf("crypto1: keystream %lu KB/s\n",
+	       (unsigned long)(((uint64_t)BENCH_SIZE * BENCH_LOOP * 1000000000ULL) / (ns * 1024)));
+}
+
+int main(void)
+{
+	srand(1);
+	check_trace();
+	check_random();
+	if(nb_fail) {
+		printf("crypto1: %d check(s) failed\n", nb_fail);
+		return 1;
+	}
+	printf("crypto1: OK\n");
+	bench_keystream();
+	return 0;
+}
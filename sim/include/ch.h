@@ -0,0 +1,77 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * Host simulation: minimal ChibiOS/RT kernel API used by the mode layer,
+ * single thread, time from the host monotonic clock (see sim_os.c).
+ */
+#ifndef _SIM_CH_H_
+#define _SIM_CH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef FALSE
+#define FALSE false
+#endif
+#ifndef TRUE
+#define TRUE true
+#endif
+
+/* System tick 10KHz as the firmware (chconf.h) */
+#define CH_CFG_ST_FREQUENCY	10000
+
+typedef uint32_t systime_t;
+typedef uint32_t eventmask_t;
+typedef int32_t msg_t;
+
+typedef struct thread {
+	const char *p_name;
+} thread_t;
+
+#define TIME_IMMEDIATE	((systime_t)0)
+#define TIME_INFINITE	((systime_t)-1)
+
+#define S2ST(sec)	((systime_t)((uint32_t)(sec) * CH_CFG_ST_FREQUENCY))
+#define MS2ST(msec)	((systime_t)(((uint32_t)(msec) * CH_CFG_ST_FREQUENCY + 999) / 1000))
+#define US2ST(usec)	((systime_t)(((uint32_t)(usec) * CH_CFG_ST_FREQUENCY + 999999) / 1000000))
+#define ST2MS(n)	(((uint32_t)(n) * 1000 + CH_CFG_ST_FREQUENCY - 1) / CH_CFG_ST_FREQUENCY)
+
+#define EVENT_MASK(eid)	((eventmask_t)(1 << (eid)))
+
+#define chSysLock()
+#define chSysUnlock()
+#define chSysLockFromISR()
+#define chSysUnlockFromISR()
+
+/* One console thread, mutexes are never contended */
+typedef struct {
+	int dummy;
+} mutex_t;
+#define chMtxObjectInit(mp) ((void)(mp))
+#define chMtxLock(mp) ((void)(mp))
+#define chMtxUnlock(mp) ((void)(mp))
+
+systime_t chVTGetSystemTime(void);
+#define chVTGetSystemTimeX() chVTGetSystemTime()
+bool chVTIsSystemTimeWithinX(systime_t start, systime_t end);
+void chThdSleep(systime_t time);
+#define chThdSleepMilliseconds(msec) chThdSleep(MS2ST(msec))
+#define chThdSleepMicroseconds(usec) chThdSleep(US2ST(usec))
+thread_t *chThdGetSelfX(void);
+void chRegSetThreadName(const char *name);
+
+#endif /* _SIM_CH_H_ */
@@ -0,0 +1,26 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* Host simulation: ChibiOS chprintf subset (see sim_os.c) */
+#ifndef _SIM_CHPRINTF_H_
+#define _SIM_CHPRINTF_H_
+
+#include <stdarg.h>
+#include "hal.h"
+
+int chvprintf(BaseSequentialStream *chp, const char *fmt, va_list ap);
+int chsnprintf(char *str, size_t size, const char *fmt, ...);
+
+#endif /* _SIM_CHPRINTF_H_ */
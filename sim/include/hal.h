@@ -0,0 +1,74 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * Host simulation: streams, serial-over-USB console on stdio and the GPIO
+ * used by the mode layer (see sim_os.c).
+ */
+#ifndef _SIM_HAL_H_
+#define _SIM_HAL_H_
+
+#include "ch.h"
+
+#define STM32_SYSCLK	168000000
+#define STM32_HCLK	STM32_SYSCLK
+#define MMCSD_BLOCK_SIZE 512
+
+struct BaseSequentialStreamVMT {
+	size_t (*write)(void *instance, const uint8_t *bp, size_t n);
+	size_t (*read)(void *instance, uint8_t *bp, size_t n);
+	msg_t (*put)(void *instance, uint8_t b);
+	msg_t (*get)(void *instance);
+};
+
+typedef struct {
+	const struct BaseSequentialStreamVMT *vmt;
+} BaseSequentialStream;
+
+#define chSequentialStreamWrite(ip, bp, n) ((ip)->vmt->write(ip, bp, n))
+#define chSequentialStreamRead(ip, bp, n) ((ip)->vmt->read(ip, bp, n))
+#define chSequentialStreamPut(ip, b) ((ip)->vmt->put(ip, b))
+#define chSequentialStreamGet(ip) ((ip)->vmt->get(ip))
+
+typedef struct {
+	int dummy;
+} USBDriver;
+typedef uint8_t usbep_t;
+
+/* Console stream, output to stdout (or discarded for benchmarks) */
+typedef struct {
+	const struct BaseSequentialStreamVMT *vmt;
+	bool mute;
+} SerialUSBDriver;
+
+void sduObjectInit(SerialUSBDriver *sdup);
+
+/* GPIO, UBTN (PA0) reads as released */
+typedef struct {
+	uint32_t IDR;
+	uint32_t ODR;
+} GPIO_TypeDef;
+
+extern GPIO_TypeDef sim_gpio[3];
+#define GPIOA (&sim_gpio[0])
+#define GPIOB (&sim_gpio[1])
+#define GPIOC (&sim_gpio[2])
+
+#define palReadPad(port, pad) (((port)->IDR >> (pad)) & 1)
+#define palSetPad(port, pad) ((port)->ODR |= (1U << (pad)))
+#define palClearPad(port, pad) ((port)->ODR &= ~(1U << (pad)))
+#define palTogglePad(port, pad) ((port)->ODR ^= (1U << (pad)))
+
+#endif /* _SIM_HAL_H_ */
@@ -0,0 +1,26 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* Host simulation: microrl is replaced by the line loop of sim_main.c */
+#ifndef _SIM_MICRORL_H_
+#define _SIM_MICRORL_H_
+
+typedef struct {
+	const char *prompt_str;
+} microrl_t;
+
+void microrl_set_prompt(microrl_t *pThis, const char *prompt_str);
+
+#endif /* _SIM_MICRORL_H_ */
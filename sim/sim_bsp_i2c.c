@@ -0,0 +1,131 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+/*
+ * Simulated I2C bus behind the bsp_i2c API:
+ * 24C02 like EEPROM (256 bytes, 8 bytes pages) at address 0x50,
+ * other addresses are not acknowledged.
+ */
+#include <string.h>
+
+#include "bsp_i2c.h"
+
+#define EEPROM_ADDR	(0x50)
+#define EEPROM_SIZE	(256)
+#define EEPROM_PAGE_SIZE (8)
+
+typedef enum {
+	EEPROM_IDLE = 0,
+	EEPROM_DEV_ADDR, /* After start */
+	EEPROM_WORD_ADDR,
+	EEPROM_WRITE,
+	EEPROM_READ
+} eeprom_state_t;
+
+static struct {
+	uint8_t mem[EEPROM_SIZE];
+	eeprom_state_t state;
+	uint8_t ptr;
+} eeprom;
+
+bsp_status_t bsp_i2c_init(bsp_dev_i2c_t dev_num, mode_config_proto_t* mode_conf)
+{
+	static bool eeprom_init = FALSE;
+
+	(void)dev_num;
+	(void)mode_conf;
+	if(!eeprom_init) {
+		memset(eeprom.mem, 0xFF, EEPROM_SIZE);
+		eeprom_init = TRUE;
+	}
+	eeprom.state = EEPROM_IDLE;
+	return BSP_OK;
+}
+
+bsp_status_t bsp_i2c_deinit(bsp_dev_i2c_t dev_num)
+{
+	(void)dev_num;
+	eeprom.state = EEPROM_IDLE;
+	return BSP_OK;
+}
+
+bsp_status_t bsp_i2c_start(bsp_dev_i2c_t dev_num)
+{
+	(void)dev_num;
+	/* Also repeated start, the word address is kept */
+	eeprom.state = EEPROM_DEV_ADDR;
+	return BSP_OK;
+}
+
+bsp_status_t bsp_i2c_stop(bsp_dev_i2c_t dev_num)
+{
+	(void)dev_num;
+	eeprom.state = EEPROM_IDLE;
+	return BSP_OK;
+}
+
+bsp_status_t bsp_i2c_master_write_u8(bsp_dev_i2c_t dev_num, uint8_t tx_data, bool* tx_ack_flag)
+{
+	(void)dev_num;
+	*tx_ack_flag = TRUE;
+
+	switch(eeprom.state) {
+	case EEPROM_DEV_ADDR:
+		if((tx_data >> 1) != EEPROM_ADDR) {
+			eeprom.state = EEPROM_IDLE;
+			*tx_ack_flag = FALSE;
+		} else if(tx_data & 1) {
+			eeprom.state = EEPROM_READ;
+		} else {
+			eeprom.state = EEPROM_WORD_ADDR;
+		}
+		break;
+	case EEPROM_WORD_ADDR:
+		eeprom.ptr = tx_data;
+		eeprom.state = EEPROM_WRITE;
+		break;
+	case EEPROM_WRITE:
+		/* Address wraps in the page */
+		eeprom.mem[eeprom.ptr] = tx_data;
+		eeprom.ptr = (eeprom.ptr & ~(EEPROM_PAGE_SIZE - 1)) |
+			     ((eeprom.ptr + 1) & (EEPROM_PAGE_SIZE - 1));
+		break;
+	default:
+		/* Nobody on the bus */
+		*tx_ack_flag = FALSE;
+		break;
+	}
+	return BSP_OK;
+}
+
+bsp_status_t bsp_i2c_master_read_u8(bsp_dev_i2c_t dev_num, uint8_t* rx_data)
+{
+	(void)dev_num;
+
+	if(eeprom.state != EEPROM_READ) {
+		/* SDA released */
+		*rx_data = 0xFF;
+		return BSP_OK;
+	}
+	*rx_data = eeprom.mem[eeprom.ptr++];
+	return BSP_OK;
+}
+
+void bsp_i2c_read_ack(bsp_dev_i2c_t dev_num, bool enable_ack)
+{
+	(void)dev_num;
+	/* NACK ends the sequential read */
+	if(!enable_ack && (eeprom.state == EEPROM_READ))
+		eeprom.state = EEPROM_IDLE;
+}
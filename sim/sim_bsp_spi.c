@@ -0,0 +1,252 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+/*
+ * Simulated SPI devices behind the bsp_spi API:
+ * SPI1: serial NOR flash (W25Q80 like, 1MB, JEDEC ID EF 40 14)
+ * SPI2: loopback (MISO = MOSI)
+ * Both devices need the board as bus master: in slave mode nothing clocks
+ * the bus and transfers time out as the HAL does on the board.
+ */
+#include <string.h>
+
+#include "bsp_spi.h"
+
+#define FLASH_SIZE	(1024 * 1024)
+#define FLASH_PAGE_SIZE	(256)
+#define FLASH_SECTOR_SIZE (4096)
+#define FLASH_BLOCK_SIZE (65536)
+
+#define FLASH_CMD_WREN	0x06
+#define FLASH_CMD_WRDI	0x04
+#define FLASH_CMD_RDSR	0x05
+#define FLASH_CMD_READ	0x03
+#define FLASH_CMD_PP	0x02
+#define FLASH_CMD_SE	0x20
+#define FLASH_CMD_BE	0xD8
+#define FLASH_CMD_CE	0xC7
+#define FLASH_CMD_CE2	0x60
+#define FLASH_CMD_JEDEC	0x9F
+
+/* mode_conf->dev_mode "1=Slave" (SPI_MODE_SLAVE in bsp_spi.c) */
+#define SIM_SPI_DEV_MODE_SLAVE	(0)
+
+typedef enum {
+	FLASH_IDLE = 0,
+	FLASH_OPCODE,
+	FLASH_ADDR,
+	FLASH_DATA,
+} flash_phase_t;
+
+typedef struct {
+	uint8_t mem[FLASH_SIZE];
+	bool selected;
+	bool wel; /* Write enable latch */
+	flash_phase_t phase;
+	uint8_t opcode;
+	int nb_addr;
+	uint32_t addr;
+	uint32_t idx;
+} sim_flash_t;
+
+static sim_flash_t flash;
+static bool spi_selected[BSP_DEV_SPI_END];
+static bool spi_master[BSP_DEV_SPI_END];
+
+static void flash_erase(uint32_t addr, uint32_t size)
+{
+	addr &= ~(size - 1) & (FLASH_SIZE - 1);
+	memset(&flash.mem[addr], 0xFF, size);
+}
+
+static void flash_select(void)
+{
+	flash.selected = TRUE;
+	flash.phase = FLASH_OPCODE;
+}
+
+/* Erase and program are executed when the chip select goes high */
+static void flash_unselect(void)
+{
+	if(flash.selected && flash.wel && (flash.phase == FLASH_DATA)) {
+		switch(flash.opcode) {
+		case FLASH_CMD_SE:
+			flash_erase(flash.addr, FLASH_SECTOR_SIZE);
+			flash.wel = FALSE;
+			break;
+		case FLASH_CMD_BE:
+			flash_erase(flash.addr, FLASH_BLOCK_SIZE);
+			flash.wel = FALSE;
+			break;
+		case FLASH_CMD_PP:
+			flash.wel = FALSE;
+			break;
+		}
+	} else if(flash.selected && flash.wel && (flash.phase == FLASH_IDLE) &&
+		  ( (flash.opcode == FLASH_CMD_CE) || (flash.opcode == FLASH_CMD_CE2) )) {
+		memset(flash.mem, 0xFF, FLASH_SIZE);
+		flash.wel = FALSE;
+	}
+	flash.selected = FALSE;
+	flash.phase = FLASH_IDLE;
+}
+
+static uint8_t flash_xfer(uint8_t tx)
+{
+	static const uint8_t jedec_id[] = { 0xEF, 0x40, 0x14 };
+	uint8_t rx = 0xFF;
+	uint32_t page;
+
+	if(!flash.selected)
+		return rx;
+
+	switch(flash.phase) {
+	case FLASH_OPCODE:
+		flash.opcode = tx;
+		flash.phase = FLASH_IDLE;
+		flash.nb_addr = 0;
+		flash.addr = 0;
+		flash.idx = 0;
+		switch(tx) {
+		case FLASH_CMD_WREN:
+			flash.wel = TRUE;
+			break;
+		case FLASH_CMD_WRDI:
+			flash.wel = FALSE;
+			break;
+		case FLASH_CMD_RDSR:
+		case FLASH_CMD_JEDEC:
+			flash.phase = FLASH_DATA;
+			break;
+		case FLASH_CMD_READ:
+		case FLASH_CMD_PP:
+		case FLASH_CMD_SE:
+		case FLASH_CMD_BE:
+			flash.phase = FLASH_ADDR;
+			break;
+		}
+		break;
+
+	case FLASH_ADDR:
+		flash.addr = (flash.addr << 8) | tx;
+		if(++flash.nb_addr == 3) {
+			flash.addr &= (FLASH_SIZE - 1);
+			flash.phase = FLASH_DATA;
+		}
+		break;
+
+	case FLASH_DATA:
+		switch(flash.opcode) {
+		case FLASH_CMD_RDSR:
+			rx = flash.wel ? 0x02 : 0x00; /* Never busy */
+			break;
+		case FLASH_CMD_JEDEC:
+			rx = jedec_id[flash.idx++ % sizeof(jedec_id)];
+			break;
+		case FLASH_CMD_READ:
+			rx = flash.mem[flash.addr];
+			flash.addr = (flash.addr + 1) & (FLASH_SIZE - 1);
+			break;
+		case FLASH_CMD_PP:
+			/* Bits can only be cleared, address wraps in the page */
+			if(flash.wel) {
+				page = flash.addr & ~(FLASH_PAGE_SIZE - 1);
+				flash.mem[page + ((flash.addr + flash.idx) % FLASH_PAGE_SIZE)] &= tx;
+				flash.idx++;
+			}
+			break;
+		}
+		break;
+
+	case FLASH_IDLE:
+		break;
+	}
+	return rx;
+}
+
+static uint8_t spi_xfer(bsp_dev_spi_t dev_num, uint8_t tx)
+{
+	if(dev_num == BSP_DEV_SPI1)
+		return flash_xfer(tx);
+	/* SPI2 loopback, only while selected */
+	return spi_selected[BSP_DEV_SPI2] ? tx : 0xFF;
+}
+
+bsp_status_t bsp_spi_init(bsp_dev_spi_t dev_num, mode_config_proto_t* mode_conf)
+{
+	static bool flash_init = FALSE;
+
+	if(dev_num >= BSP_DEV_SPI_END)
+		return BSP_ERROR;
+	spi_master[dev_num] = (mode_conf->dev_mode != SIM_SPI_DEV_MODE_SLAVE);
+	/* Flash content is kept across mode changes as a real chip */
+	if(!flash_init) {
+		memset(flash.mem, 0xFF, FLASH_SIZE);
+		flash_init = TRUE;
+	}
+	return BSP_OK;
+}
+
+bsp_status_t bsp_spi_deinit(bsp_dev_spi_t dev_num)
+{
+	bsp_spi_unselect(dev_num);
+	return BSP_OK;
+}
+
+void bsp_spi_select(bsp_dev_spi_t dev_num)
+{
+	spi_selected[dev_num] = TRUE;
+	if(dev_num == BSP_DEV_SPI1)
+		flash_select();
+}
+
+void bsp_spi_unselect(bsp_dev_spi_t dev_num)
+{
+	spi_selected[dev_num] = FALSE;
+	if(dev_num == BSP_DEV_SPI1)
+		flash_unselect();
+}
+
+bsp_status_t bsp_spi_write_u8(bsp_dev_spi_t dev_num, uint8_t* tx_data, uint8_t nb_data)
+{
+	int i;
+
+	if(!spi_master[dev_num])
+		return BSP_TIMEOUT;
+	for(i = 0; i < nb_data; i++)
+		spi_xfer(dev_num, tx_data[i]);
+	return BSP_OK;
+}
+
+bsp_status_t bsp_spi_read_u8(bsp_dev_spi_t dev_num, uint8_t* rx_data, uint8_t nb_data)
+{
+	int i;
+
+	if(!spi_master[dev_num])
+		return BSP_TIMEOUT;
+	for(i = 0; i < nb_data; i++)
+		rx_data[i] = spi_xfer(dev_num, 0xFF);
+	return BSP_OK;
+}
+
+bsp_status_t bsp_spi_write_read_u8(bsp_dev_spi_t dev_num, uint8_t* tx_data, uint8_t* rx_data, uint8_t nb_data)
+{
+	int i;
+
+	if(!spi_master[dev_num])
+		return BSP_TIMEOUT;
+	for(i = 0; i < nb_data; i++)
+		rx_data[i] = spi_xfer(dev_num, tx_data[i]);
+	return BSP_OK;
+}
@@ -0,0 +1,101 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+/*
+ * Simulated UARTs behind the bsp_uart API: TX looped back to RX.
+ */
+#include <stddef.h>
+
+#include "bsp_uart.h"
+
+#define UART_RX_SIZE (256)
+
+typedef struct {
+	uint8_t rx[UART_RX_SIZE];
+	uint32_t rd;
+	uint32_t wr;
+	bsp_uart_rx_cb_t cb;
+} sim_uart_t;
+
+static sim_uart_t uart[BSP_DEV_UART_END];
+
+bsp_status_t bsp_uart_init(bsp_dev_uart_t dev_num, mode_config_proto_t* mode_conf)
+{
+	(void)mode_conf;
+	if(dev_num >= BSP_DEV_UART_END)
+		return BSP_ERROR;
+	uart[dev_num].rd = 0;
+	uart[dev_num].wr = 0;
+	return BSP_OK;
+}
+
+bsp_status_t bsp_uart_deinit(bsp_dev_uart_t dev_num)
+{
+	uart[dev_num].cb = NULL;
+	return BSP_OK;
+}
+
+bsp_status_t bsp_uart_write_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, uint8_t nb_data)
+{
+	sim_uart_t *u = &uart[dev_num];
+	int i;
+	bool overrun;
+
+	for(i = 0; i < nb_data; i++) {
+		overrun = (u->wr - u->rd) >= UART_RX_SIZE;
+		if(u->cb != NULL) {
+			u->cb(dev_num, tx_data[i], FALSE);
+		} else if(!overrun) {
+			u->rx[u->wr % UART_RX_SIZE] = tx_data[i];
+			u->wr++;
+		}
+	}
+	return BSP_OK;
+}
+
+bsp_status_t bsp_uart_read_u8(bsp_dev_uart_t dev_num, uint8_t* rx_data, uint8_t nb_data)
+{
+	sim_uart_t *u = &uart[dev_num];
+	int i;
+
+	for(i = 0; i < nb_data; i++) {
+		if(u->rd == u->wr)
+			return BSP_TIMEOUT;
+		rx_data[i] = u->rx[u->rd % UART_RX_SIZE];
+		u->rd++;
+	}
+	return BSP_OK;
+}
+
+bsp_status_t bsp_uart_write_read_u8(bsp_dev_uart_t dev_num, uint8_t* tx_data, uint8_t* rx_data, uint8_t nb_data)
+{
+	bsp_status_t status;
+
+	status = bsp_uart_write_u8(dev_num, tx_data, nb_data);
+	if(status != BSP_OK)
+		return status;
+	return bsp_uart_read_u8(dev_num, rx_data, nb_data);
+}
+
+bsp_status_t bsp_uart_rx_irq_start(bsp_dev_uart_t dev_num, bsp_uart_rx_cb_t cb, uint32_t priority)
+{
+	(void)priority;
+	uart[dev_num].cb = cb;
+	return BSP_OK;
+}
+
+void bsp_uart_rx_irq_stop(bsp_dev_uart_t dev_num)
+{
+	uart[dev_num].cb = NULL;
+}
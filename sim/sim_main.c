@@ -0,0 +1,182 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+/*
+ * HydraBus host simulation: one console on stdin/stdout running the mode
+ * layer (hydrabus_mode*.c) over the simulated bsp_* devices
+ * (sim_bsp_spi.c, sim_bsp_i2c.c, sim_bsp_uart.c).
+ * Input not from a terminal is echoed after the prompt so a script and its
+ * output read as a console session (regression tests diff this output).
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "common.h"
+#include "microrl_config.h"
+#include "microrl_callback.h"
+#include "hydrabus_mode.h"
+#include "bus_lock.h"
+
+static microrl_t rl_con1;
+static t_mode_config mode_con1 = { .proto={ .valid=MODE_CONFIG_PROTO_VALID, .bus_mode=MODE_CONFIG_PROTO_DEV_DEF_VAL }, .cmd={ 0 } };
+
+static t_hydra_console con1 = {
+	.thread_name="console stdio", .thread=NULL, .sdu=&SDU1, .mrl=&rl_con1, .insert_char = 0, .mode = &mode_con1
+};
+
+static bool sim_exit;
+
+void print(void *user_handle, const char *str)
+{
+	t_hydra_console *con = user_handle;
+
+	cprint(con, str, strlen(str));
+}
+
+static void sim_execute(t_hydra_console *con, int argc, const char* const* argv);
+
+static void sim_help(t_hydra_console *con, int argc, const char* const* argv)
+{
+	(void)argc;
+	(void)argv;
+
+	cprintf(con, "HydraBus host simulation\r\n");
+	cprintf(con, "SPI1: NOR flash (JEDEC ID EF 40 14, 1MB), SPI2: loopback\r\n");
+	cprintf(con, "I2C1: EEPROM 256 bytes at 0x50, UART1/2: TX looped to RX\r\n");
+	cprintf(con, "m [<mode> ...]  - Change mode\r\n");
+	cprintf(con, "i               - Mode information\r\n");
+	cprintf(con, "bus             - Peripherals owner\r\n");
+	cprintf(con, "bench <n> <ops> - Run protocol operations n times without output\r\n");
+	cprintf(con, "quit            - Exit\r\n");
+}
+
+/* bench <n> <operations ...>: mode layer throughput without console output */
+static void sim_bench(t_hydra_console *con, int argc, const char* const* argv)
+{
+	struct timespec start, end;
+	uint32_t i, nb;
+	uint64_t ns;
+
+	if(argc < 3) {
+		cprintf(con, "usage: %s <n> <operations ...>\r\n", argv[0]);
+		return;
+	}
+	nb = strtoul(argv[1], NULL, 0);
+
+	SDU1.mute = TRUE;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < nb; i++)
+		sim_execute(con, argc - 2, &argv[2]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	SDU1.mute = FALSE;
+
+	ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+	if(ns == 0)
+		ns = 1;
+	cprintf(con, "%ld loops in %ld us, %ld loops/s\r\n",
+		nb, (uint32_t)(ns / 1000), (uint32_t)(((uint64_t)nb * 1000000000) / ns));
+}
+
+static void sim_quit(t_hydra_console *con, int argc, const char* const* argv)
+{
+	(void)con;
+	(void)argc;
+	(void)argv;
+	sim_exit = TRUE;
+}
+
+static const microrl_exec_t sim_keyworld[] = {
+	{ "?",             &sim_help },
+	{ "h",             &sim_help },
+	{ _HYDRABUS_MODE,  &hydrabus_mode },
+	{ _HYDRABUS_MODE_INFO, &hydrabus_mode_info },
+	{ "bus",           &cmd_bus },
+	{ "bench",         &sim_bench },
+	{ "quit",          &sim_quit },
+	{ "exit",          &sim_quit },
+};
+
+/* Ctrl-C aborts the running command as on the USB console */
+static void sim_sigint(int sig)
+{
+	(void)sig;
+	con1.abort = TRUE;
+}
+
+/* Same dispatch as hydra_cmd_execute() */
+static void sim_execute(t_hydra_console *con, int argc, const char* const* argv)
+{
+	int curr_arg;
+	unsigned int i;
+
+	con->abort = FALSE;
+	for(curr_arg = 0; (curr_arg < argc) && !console_is_aborted(con); curr_arg++) {
+		for(i = 0; i < ARRAY_SIZE(sim_keyworld); i++) {
+			if(strcmp(argv[curr_arg], sim_keyworld[i].str_cmd) == 0)
+				break;
+		}
+		if(i < ARRAY_SIZE(sim_keyworld)) {
+			sim_keyworld[i].ptFunc_exe_cmd(con, argc-curr_arg, &argv[curr_arg]);
+			break;
+		}
+
+		if(hydrabus_mode_proto_inter(con, argc-curr_arg, &argv[curr_arg]) == FALSE) {
+			print(con,"command: '");
+			print(con,(char*)argv[curr_arg]);
+			print(con,"' Error/Not found.\n\r");
+		}
+	}
+}
+
+int main(void)
+{
+	char line[_COMMAND_LINE_LEN];
+	const char* argv[_MAX_COMMAND_TOKENS];
+	char *tok, *save;
+	int argc;
+	bool echo;
+
+	sduObjectInit(&SDU1);
+	sduObjectInit(&SDU2);
+	bus_lock_init();
+	signal(SIGINT, sim_sigint);
+	chRegSetThreadName(con1.thread_name);
+	microrl_set_prompt(con1.mrl, _PROMPT_DEFAULT);
+
+	echo = !isatty(STDIN_FILENO);
+	while(!sim_exit) {
+		cprintf(&con1, "%s", rl_con1.prompt_str);
+		fflush(stdout);
+		if(fgets(line, sizeof(line), stdin) == NULL)
+			break;
+		line[strcspn(line, "\r\n")] = 0;
+		if(echo)
+			cprintf(&con1, "%s\r\n", line);
+
+		/* Tokens split on spaces as microrl */
+		argc = 0;
+		for(tok = strtok_r(line, " \t", &save); (tok != NULL) && (argc < _MAX_COMMAND_TOKENS);
+		    tok = strtok_r(NULL, " \t", &save))
+			argv[argc++] = tok;
+		if(argc > 0)
+			sim_execute(&con1, argc, argv);
+	}
+	cprintf(&con1, "\r\n");
+	return 0;
+}
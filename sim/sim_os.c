@@ -0,0 +1,299 @@
+/*
+HydraBus/HydraNFC - Copyright (C) 2012-2014 Benjamin VERNOUX
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+/*
+ * Host simulation of the kernel/HAL services used by the mode layer:
+ * time, sleep, chvprintf and the console stream on stdout.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "bufpool.h"
+#include "usb_tx.h"
+
+GPIO_TypeDef sim_gpio[3];
+
+SerialUSBDriver SDU1;
+SerialUSBDriver SDU2;
+
+static thread_t sim_main_thread = { "main" };
+
+systime_t chVTGetSystemTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (systime_t)((uint64_t)ts.tv_sec * CH_CFG_ST_FREQUENCY +
+			   (uint64_t)ts.tv_nsec / (1000000000 / CH_CFG_ST_FREQUENCY));
+}
+
+bool chVTIsSystemTimeWithinX(systime_t start, systime_t end)
+{
+	systime_t time = chVTGetSystemTime();
+
+	return (systime_t)(time - start) < (systime_t)(end - start);
+}
+
+static void sim_sleep_ns(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+void chThdSleep(systime_t time)
+{
+	sim_sleep_ns((uint64_t)time * (1000000000 / CH_CFG_ST_FREQUENCY));
+}
+
+thread_t *chThdGetSelfX(void)
+{
+	return &sim_main_thread;
+}
+
+void chRegSetThreadName(const char *name)
+{
+	sim_main_thread.p_name = name;
+}
+
+void DelayUs(uint32_t delay_us)
+{
+	sim_sleep_ns((uint64_t)delay_us * 1000);
+}
+
+/*
+ * chprintf subset, integers are 32 bits as on the target: arguments given
+ * for %l are read as long then truncated, as uint32_t are passed for %ld.
+ */
+static int sim_vformat(char *out, size_t size, const char *fmt, va_list ap)
+{
+	char spec[16];
+	char tmp[64];
+	size_t n, len;
+	int i, c;
+	bool is_long;
+	uint32_t val;
+
+	n = 0;
+	while(*fmt != 0) {
+		if(*fmt != '%') {
+			if(n + 1 < size)
+				out[n] = *fmt;
+			n++;
+			fmt++;
+			continue;
+		}
+
+		/* Flags, width and precision are given to snprintf */
+		i = 0;
+		spec[i++] = *fmt++;
+		while( (*fmt != 0) && (strchr("-+ #0123456789.", *fmt) != NULL) &&
+		       (i < (int)sizeof(spec) - 4) )
+			spec[i++] = *fmt++;
+		is_long = FALSE;
+		if(*fmt == 'l') {
+			is_long = TRUE;
+			fmt++;
+		}
+		c = *fmt;
+		if(c == 0)
+			break;
+		fmt++;
+
+		spec[i++] = c;
+		spec[i] = 0;
+		switch(c) {
+		case 'd':
+		case 'i':
+			val = is_long ? (uint32_t)va_arg(ap, long) : (uint32_t)va_arg(ap, int);
+			len = snprintf(tmp, sizeof(tmp), spec, (int32_t)val);
+			break;
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+			val = is_long ? (uint32_t)va_arg(ap, long) : (uint32_t)va_arg(ap, unsigned int);
+			len = snprintf(tmp, sizeof(tmp), spec, val);
+			break;
+		case 'c':
+			len = snprintf(tmp, sizeof(tmp), spec, va_arg(ap, int));
+			break;
+		case 's':
+			/* Strings can be longer than tmp */
+			len = snprintf((n < size) ? &out[n] : NULL, (n < size) ? size - n : 0,
+				       spec, va_arg(ap, const char *));
+			n += len;
+			continue;
+		case 'p':
+			len = snprintf(tmp, sizeof(tmp), spec, va_arg(ap, void *));
+			break;
+		default:
+			tmp[0] = c;
+			len = 1;
+			break;
+		}
+		if(len >= sizeof(tmp))
+			len = sizeof(tmp) - 1;
+		if(n < size)
+			memcpy(&out[n], tmp, (n + len < size) ? len : size - n);
+		n += len;
+	}
+	if(size > 0)
+		out[(n < size) ? n : size - 1] = 0;
+	return n;
+}
+
+int chvprintf(BaseSequentialStream *chp, const char *fmt, va_list ap)
+{
+	char buf[1024];
+	int n;
+
+	n = sim_vformat(buf, sizeof(buf), fmt, ap);
+	if(n > (int)sizeof(buf) - 1)
+		n = sizeof(buf) - 1;
+	chSequentialStreamWrite(chp, (const uint8_t *)buf, n);
+	return n;
+}
+
+int chsnprintf(char *str, size_t size, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = sim_vformat(str, size, fmt, ap);
+	va_end(ap);
+	return n;
+}
+
+/* Console stream on stdout */
+static size_t sim_sdu_write(void *instance, const uint8_t *bp, size_t n)
+{
+	SerialUSBDriver *sdup = instance;
+
+	if(!sdup->mute)
+		fwrite(bp, 1, n, stdout);
+	return n;
+}
+
+static size_t sim_sdu_read(void *instance, uint8_t *bp, size_t n)
+{
+	(void)instance;
+	return fread(bp, 1, n, stdin);
+}
+
+static msg_t sim_sdu_put(void *instance, uint8_t b)
+{
+	sim_sdu_write(instance, &b, 1);
+	return 0;
+}
+
+static msg_t sim_sdu_get(void *instance)
+{
+	(void)instance;
+	return getchar();
+}
+
+static const struct BaseSequentialStreamVMT sim_sdu_vmt = {
+	sim_sdu_write, sim_sdu_read, sim_sdu_put, sim_sdu_get
+};
+
+void sduObjectInit(SerialUSBDriver *sdup)
+{
+	sdup->vmt = &sim_sdu_vmt;
+	sdup->mute = FALSE;
+}
+
+/* abort is set by the SIGINT handler of sim_main.c */
+bool console_is_aborted(t_hydra_console *con)
+{
+	if(con == NULL)
+		return FALSE;
+	if(con->abort_con != NULL)
+		con = con->abort_con;
+	return con->abort;
+}
+
+/* stdio console, never a USB CDC: usbtx_*() are not called */
+bool console_is_usb(t_hydra_console *con)
+{
+	(void)con;
+	return FALSE;
+}
+
+int usbtx_start(SerialUSBDriver *sdup, const uint8_t *buf, uint32_t size, systime_t timeout)
+{
+	(void)sdup;
+	(void)buf;
+	(void)size;
+	(void)timeout;
+	return -1;
+}
+
+int usbtx_wait(SerialUSBDriver *sdup, systime_t timeout)
+{
+	(void)sdup;
+	(void)timeout;
+	return -1;
+}
+
+/* Pool buffers from the host heap */
+void* bufpool_alloc(bufpool_region_t region, uint32_t size, systime_t timeout)
+{
+	(void)region;
+	(void)timeout;
+	return malloc(size);
+}
+
+int bufpool_free(void* p)
+{
+	free(p);
+	return 0;
+}
+
+/* Console output, the host never applies backpressure */
+uint32_t console_write(t_hydra_console *con, const uint8_t *data, uint32_t size)
+{
+	return chSequentialStreamWrite(con->bss, data, size);
+}
+
+void console_vprintf(t_hydra_console *con, const char *fmt, va_list ap)
+{
+	chvprintf(con->bss, fmt, ap);
+}
+
+console_out_policy_t console_set_policy(t_hydra_console *con, console_out_policy_t policy)
+{
+	console_out_policy_t prev = con->out_policy;
+
+	/* Nothing is deferred, output is never blocked */
+	(void)policy;
+	return prev;
+}
+
+void console_flush(t_hydra_console *con)
+{
+	(void)con;
+}
+
+void microrl_set_prompt(microrl_t *pThis, const char *prompt_str)
+{
+	pThis->prompt_str = prompt_str;
+}
@@ -14,10 +14,12 @@
 //===============================================================
 
 #define DBG	0						// if DBG 1 interrupts are display
+#define TRF797X_DEBUG_VERIFY	0				// if 1 registers are read back after each write
 
 //==== TRF796x definitions ======================================
 
 #define TRF7970A_INIT_TIMEOUT 11
+#define TRF797X_FIFO_SIZE	127	// TX/RX FIFO size in bytes
 
 //---- Direct commands ------------------------------------------
 
@@ -75,8 +77,6 @@
 void Trf797xCommunicationSetup(void);
 void Trf797xDirectCommand(u08_t *pbuf);
 //void Trf797xDirectMode(void);
-void Trf797xDisableSlotCounter(void);
-void Trf797xEnableSlotCounter(void);
 int Trf797xInitialSettings(void);
 void Trf797xRawWrite(u08_t *pbuf, u08_t length);
 void Trf797xReadCont(u08_t *pbuf, u08_t length);
@@ -84,6 +84,7 @@ void Trf797xReadIrqStatus(u08_t *pbuf);
 void Trf797xReadSingle(u08_t *pbuf, u08_t length);
 void Trf797xReset(void);
 void Trf797xResetIrqStatus(void);
+void Trf797xShadowInvalidate(void);
 void Trf797xRunDecoders(void);
 void Trf797xStopDecoders(void);
 void Trf797xTransmitNextSlot(void);
@@ -95,12 +96,12 @@ void Trf797xWriteSingle(u08_t *pbuf, u08_t length);
 
 uint8_t Trf797x_transceive_bits(uint8_t tx_databuf, uint8_t tx_databuf_nb_bits,
 				uint8_t* rx_databuf, uint8_t rx_databuf_nb_bytes,
-				uint8_t timeout_ms,
+				uint16_t timeout_ms,
 				uint8_t flag_crc);
 
 int Trf797x_transceive_bytes(uint8_t* tx_databuf, uint8_t tx_databuf_nb_bytes,
 			     uint8_t* rx_databuf, uint8_t rx_databuf_nb_bytes,
-			     uint8_t timeout_ms,
+			     uint16_t timeout_ms,
 			     uint8_t flag_crc);
 
 //===============================================================
@@ -27,7 +27,6 @@
 //===============================================================
 
 u08_t	command[2];
-extern uint8_t buf[512] __attribute__ ((section(".cmm")));
 extern u08_t	tag_flag;
 extern u08_t	i_reg;
 #ifdef ENABLE14443A
@@ -48,6 +47,46 @@ extern volatile int irq;
 u08_t   sampling[SAMPLING_NB_BYTES];
 
 //===============================================================
+// Shadow registers
+//
+// Last known content of the configuration registers (0x00 to 0x1B).
+// Writes of a value already present in the chip are skipped and
+// reads of a known register are served without SPI transfer.
+// Status registers (IRQ, collision, RSSI, FIFO...) are never cached.
+// The whole shadow is invalidated on SOFT_INIT.
+//===============================================================
+
+#define TRF797X_SHADOW_NB_REG	(TEST_SETTINGS_2+1)
+#define TRF797X_SHADOW_CACHEABLE ( \
+	(1UL<<CHIP_STATE_CONTROL) | (1UL<<ISO_CONTROL) | \
+	(1UL<<ISO_14443B_OPTIONS) | (1UL<<ISO_14443A_OPTIONS) | \
+	(1UL<<TX_TIMER_EPC_HIGH) | (1UL<<TX_TIMER_EPC_LOW) | \
+	(1UL<<TX_PULSE_LENGTH_CONTROL) | (1UL<<RX_NO_RESPONSE_WAIT_TIME) | \
+	(1UL<<RX_WAIT_TIME) | (1UL<<MODULATOR_CONTROL) | \
+	(1UL<<RX_SPECIAL_SETTINGS) | (1UL<<REGULATOR_CONTROL) | \
+	(1UL<<SPECIAL_FUNCTION) | (0x1FUL<<RAM_START_ADDRESS) | \
+	(1UL<<NFC_LOW_DETECTION) | (1UL<<NFC_TARGET_LEVEL) | \
+	(1UL<<TEST_SETTINGS_1) | (1UL<<TEST_SETTINGS_2) )
+
+static u08_t trf797x_shadow[TRF797X_SHADOW_NB_REG];
+static u32_t trf797x_shadow_valid;
+
+#define SHADOW_IS_CACHEABLE(reg) ( ((reg) < TRF797X_SHADOW_NB_REG) && \
+				   ((TRF797X_SHADOW_CACHEABLE >> (reg)) & 1) )
+#define SHADOW_IS_VALID(reg) ( (trf797x_shadow_valid >> (reg)) & 1 )
+
+static void Trf797xShadowUpdate(u08_t reg, u08_t value)
+{
+	if(SHADOW_IS_CACHEABLE(reg)) {
+		trf797x_shadow[reg] = value;
+		trf797x_shadow_valid |= (1UL << reg);
+	}
+}
+
+void Trf797xShadowInvalidate(void)
+{
+	trf797x_shadow_valid = 0;
+}
 
 //===============================================================
 //                                                              ;
@@ -78,33 +117,11 @@ void Trf797xCommunicationSetup(void)
 
 void Trf797xDirectCommand(u08_t *pbuf)
 {
-	SpiDirectCommand(pbuf);
-}
-
-//===============================================================
-// 02DEC2010	RP	Original Code
-//===============================================================
+	/* SOFT_INIT restores all registers to their default value */
+	if((*pbuf & 0x1F) == SOFT_INIT)
+		Trf797xShadowInvalidate();
 
-void Trf797xDisableSlotCounter(void)
-{
-	buf[40] = IRQ_MASK;
-	buf[41] = IRQ_MASK;				// next slot counter
-	Trf797xReadSingle(&buf[41], 1);
-	buf[41] &= 0xFE;				// clear BIT0 in register 0x01
-	Trf797xWriteSingle(&buf[40], 2);
-}
-
-//===============================================================
-// 02DEC2010	RP	Original Code
-//===============================================================
-
-void Trf797xEnableSlotCounter(void)
-{
-	buf[40] = IRQ_MASK;
-	buf[41] = IRQ_MASK;				// next slot counter
-	Trf797xReadSingle (&buf[41], 1);
-	buf[41] |= BIT0;				// set BIT0 in register 0x01
-	Trf797xWriteSingle(&buf[40], 2);
+	SpiDirectCommand(pbuf);
 }
 
 //===============================================================
@@ -192,7 +209,13 @@ void Trf797xRawWrite(u08_t *pbuf, u08_t length)
 void
 Trf797xReadCont(u08_t *pbuf, u08_t length)
 {
+	u08_t reg, i;
+
+	reg = *pbuf & 0x1F;
 	SpiReadCont(pbuf, length);
+
+	for(i = 0; i < length; i++)
+		Trf797xShadowUpdate(reg + i, pbuf[i]);
 }
 
 //===============================================================
@@ -231,7 +254,34 @@ Trf797xReadIrqStatus(u08_t *pbuf)
 void
 Trf797xReadSingle(u08_t *pbuf, u08_t number)
 {
+	u08_t reg[TRF797X_SHADOW_NB_REG];
+	u08_t i;
+
+	if(number > TRF797X_SHADOW_NB_REG) {
+		SpiReadSingle(pbuf, number);
+		return;
+	}
+
+	for(i = 0; i < number; i++)
+		reg[i] = pbuf[i] & 0x1F;
+
+#if !TRF797X_DEBUG_VERIFY
+	/* Serve the read from shadow registers when all are known */
+	for(i = 0; i < number; i++) {
+		if(!SHADOW_IS_CACHEABLE(reg[i]) || !SHADOW_IS_VALID(reg[i]))
+			break;
+	}
+	if(i == number) {
+		for(i = 0; i < number; i++)
+			pbuf[i] = trf797x_shadow[reg[i]];
+		return;
+	}
+#endif
+
 	SpiReadSingle(pbuf, number);
+
+	for(i = 0; i < number; i++)
+		Trf797xShadowUpdate(reg[i], pbuf[i]);
 }
 
 //===============================================================
@@ -314,11 +364,17 @@ void Trf797xTurnRfOff(void)
 
 void Trf797xTurnRfOn(void)
 {
+	u08_t old_state;
+
 	command[0] = CHIP_STATE_CONTROL;
 	command[1] = CHIP_STATE_CONTROL;
 	Trf797xReadSingle(&command[1], 1);
+	old_state = command[1];
 	command[1] &= 0x3F;
 	command[1] |= 0x20;
+	if(command[1] == old_state)
+		return; /* RF already ON, no need to wait again */
+
 	Trf797xWriteSingle(command, 2);
 
 	/* After RF ON wait at least 5ms (set to 6ms for safety) */
@@ -346,6 +402,12 @@ void Trf797xTurnRfOn(void)
 
 void Trf797xWriteCont(u08_t *pbuf, u08_t length)
 {
+	u08_t reg, i;
+
+	reg = *pbuf & 0x1F;
+	for(i = 1; i < length; i++)
+		Trf797xShadowUpdate(reg + i - 1, pbuf[i]);
+
 	SpiWriteCont(pbuf, length);
 }
 
@@ -479,7 +541,42 @@ void Trf797xWriteIsoControl(u08_t iso_control)
 
 void Trf797xWriteSingle(u08_t *pbuf, u08_t length)
 {
-	SpiWriteSingle(pbuf, length);
+	u08_t write[TRF797X_SHADOW_NB_REG * 2];
+	u08_t reg, i, nb;
+
+	if(length > sizeof(write)) {
+		for(i = 0; (i + 1) < length; i += 2)
+			Trf797xShadowUpdate(pbuf[i] & 0x1F, pbuf[i + 1]);
+		SpiWriteSingle(pbuf, length);
+		return;
+	}
+
+	/* Only send registers which differ from the known chip state */
+	nb = 0;
+	for(i = 0; (i + 1) < length; i += 2) {
+		reg = pbuf[i] & 0x1F;
+		if(SHADOW_IS_CACHEABLE(reg) && SHADOW_IS_VALID(reg) &&
+		    (trf797x_shadow[reg] == pbuf[i + 1]))
+			continue;
+
+		write[nb++] = pbuf[i];
+		write[nb++] = pbuf[i + 1];
+		Trf797xShadowUpdate(reg, pbuf[i + 1]);
+	}
+	if(nb == 0)
+		return;
+
+	SpiWriteSingle(write, nb);
+
+#if TRF797X_DEBUG_VERIFY
+	/* Read back written registers to keep shadow in sync with the chip */
+	for(i = 0; i < nb; i += 2) {
+		reg = write[i] & 0x1F;
+		write[i + 1] = reg;
+		SpiReadSingle(&write[i + 1], 1);
+		Trf797xShadowUpdate(reg, write[i + 1]);
+	}
+#endif
 }
 
 /*
@@ -489,7 +586,7 @@ void Trf797xWriteSingle(u08_t *pbuf, u08_t length)
 * */
 uint8_t Trf797x_transceive_bits(uint8_t tx_databuf, uint8_t tx_databuf_nb_bits,
 				uint8_t* rx_databuf, uint8_t rx_databuf_nb_bytes,
-				uint8_t timeout_ms,
+				uint16_t timeout_ms,
 				uint8_t flag_crc)
 {
 	int i;
@@ -561,17 +658,17 @@ uint8_t Trf797x_transceive_bits(uint8_t tx_databuf, uint8_t tx_databuf_nb_bits,
 }
 
 /*
-* Send Nb Bytes (Max TX 32bytes) and receive the data.
+* Send Nb Bytes (Max TX TRF797X_FIFO_SIZE bytes) and receive the data.
 * timeout_ms is the max timeout to wait in ms (it is the timeout for whole transfer TX+RX).
-* Return 0 if timeout, no data received, or tx_databuf_nb_bytes>32 else return number of bytes received.
+* Return 0 if timeout, no data received, or tx_databuf_nb_bytes>TRF797X_FIFO_SIZE else return number of bytes received.
 *  */
 int Trf797x_transceive_bytes(uint8_t* tx_databuf, uint8_t tx_databuf_nb_bytes,
 			     uint8_t* rx_databuf, uint8_t rx_databuf_nb_bytes,
-			     uint8_t timeout_ms,
+			     uint16_t timeout_ms,
 			     uint8_t flag_crc)
 {
 #undef DATA_MAX
-#define DATA_MAX (32+6)
+#define DATA_MAX (TRF797X_FIFO_SIZE+6)
 	static uint8_t data_buf[DATA_MAX];
 
 	int i;
@@ -588,7 +685,7 @@ int Trf797x_transceive_bytes(uint8_t* tx_databuf, uint8_t tx_databuf_nb_bytes,
 	data_buf[3] = ((tx_databuf_nb_bytes&0xF0)>>4); /* Number of Bytes to be sent MSB 0x00 @0x1D */
 	data_buf[4] = ((tx_databuf_nb_bytes<<4)&0xF0); /* Number of Byte to be sent LSB 0x00 @0x1E = Max 7bits */
 
-	if(tx_databuf_nb_bytes>32)
+	if(tx_databuf_nb_bytes>TRF797X_FIFO_SIZE)
 		return 0;
 
 	for(i=0; i<tx_databuf_nb_bytes; i++) {